@@ -32,7 +32,9 @@
 //Metering logic
 #include "Circuit/circuit.h"
 #include "Circuit/calibration.h"
+#include "PowerFail/powerfail.h"
 
+#include "Cmd/cmd.h"
 #include "interactive.h"
 #include "telduino.h"
 #include "cfg.h"
@@ -48,7 +50,7 @@ int _testChannel = 1;
 
 //Hacked up test
 int32_t switchSec = 0;
-int32_t testIdx = 0;//Present index into RARAASAVE counts down to 0
+int32_t testIdx = 0;//Experiments left to run, counts down to 0
 int32_t switchings = 0;
 
 
@@ -57,17 +59,16 @@ char buff[32] = {0};
 
 void testCircuitPrint() 
 {
-    int32_t records = 0;
     int32_t RARAA[2] = {0};
-    //Get number of records from first block
-    eeprom_read_block(&records,&nRARAASave,sizeof(records));
 
-    //Iterate over these records and print in CSV format
+    //Iterate over the journal from the oldest record and print in CSV format
     dbg.println();
     dbg.print("ON: RAENERGY,OFF:RAENERGY");
     dbg.println();
-    for (int i = records-1; i >0 ; i--) {
-        eeprom_read_block(RARAA,&RARAASave[i],sizeof(RARAA));
+    for (int i = testLog.count-1; i >= 0; i--) {
+        ifnsuccess(ELread(&testLog,i,RARAA)) {
+            continue;
+        }
         dbg.print(RARAA[0]);
         dbg.print(",");
         dbg.print(RARAA[1]);
@@ -82,6 +83,477 @@ int32_t sampleZXWait(void *context)
     return millis() - waitTime;
 }
 
+/** A: Write to ADE register */
+static void writeRegister(CmdArgs *args)
+{
+    int32_t regData = 0;
+    dbg.print("Register to write $");
+    CLgetString(&dbg,buff,sizeof(buff));
+    dbg.println();
+
+    for (int i=0; i < regListSize/sizeof(regList[0]); i++) {
+        if (strcmp(regList[i]->name,buff) == 0){
+            RCreset();
+            CSselectDevice(_testChannel);
+            dbg.print("Current regData:");
+            ADEgetRegister(*regList[i],&regData);
+            dbg.print(RCstr(_retCode));
+            dbg.print(":0x");
+            dbg.print(regData,HEX);
+            dbg.print(":");
+            dbg.println(regData,BIN);
+
+            dbg.print("Enter new regData:");
+            if(CLgetInt(&dbg,&regData) == CANCELED) break;
+            dbg.println();
+            ADEsetRegister(*regList[i],&regData);
+            dbg.print(RCstr(_retCode));
+            dbg.print(":0x");
+            dbg.print(regData,HEX);
+            dbg.print(":");
+            dbg.println(regData,DEC);
+            CSselectDevice(DEVDISABLE);
+            break;
+        }
+    }
+}
+
+/** a: Read ADE reg */
+static void readRegister(CmdArgs *args)
+{
+    int32_t regData = 0;
+    dbg.print("Enter name of register to read:");
+    CLgetString(&dbg,buff,sizeof(buff));
+    dbg.println();
+
+    for (int i=0; i < regListSize/sizeof(regList[0]); i++) {
+        if (strcmp(regList[i]->name,buff) == 0){
+            RCreset();
+            CSselectDevice(_testChannel);
+            ADEgetRegister(*regList[i],&regData);
+            dbg.print("regData:");
+            dbg.print(RCstr(_retCode));
+            dbg.print(":0x");
+            dbg.print(regData,HEX);
+            dbg.print(":");
+            dbg.println(regData,DEC);
+            CSselectDevice(DEVDISABLE);
+            break;
+        }
+    }
+}
+
+/** B: Test ZX10 */
+static void testZX(CmdArgs *args)
+{
+    RCreset();
+    CSselectDevice(_testChannel);
+    int32_t avgWaitTime = 0;
+    int32_t varWaitTime = 0;
+    //For 10 seconds measure time between ZX detections
+    avgWaitTime = avg(600,sampleZXWait,NULL,&varWaitTime);
+    dbg.print("avgWait:");
+    dbg.println(avgWaitTime);
+    dbg.print("varWait:");
+    dbg.println(varWaitTime);
+    CSselectDevice(DEVDISABLE);
+}
+
+static void resetChannel(CmdArgs *args)
+{
+    if (_testChannel < NCIRCUITS) {
+        Creset(&ckts[_testChannel]);
+    } else {
+        CSreset(_testChannel);
+    }
+}
+
+/** C: Change active channel for ADE, switching, and metering */
+static void changeChannel(CmdArgs *args)
+{
+    _testChannel = getChannelID();
+}
+
+static void setParameter(CmdArgs *args)
+{
+    setCircuitParameter();
+}
+
+/** D: Initialize ckts[] to safe defaults */
+static void setDefaults(CmdArgs *args)
+{
+    for (int i = 0; i < NCIRCUITS; i++) {
+        CsetDefaults(&ckts[i],i);
+    }
+    dbg.println("Defaults set. Don't forget to program! ('P')");
+}
+
+/** E: Save data in ckts[] to EEPROM */
+static void saveCircuits(CmdArgs *args)
+{
+    dbg.println("Saving to EEPROM.");
+    for (int i =0; i < NCIRCUITS; i++) {
+        Csave(&ckts[i],cktsSave[i],&cktsDividerSave[i]);
+    }
+    dbg.println(COMPLETESTR);
+}
+
+/** e: Load circuit data from EEPROM */
+static void loadCircuits(CmdArgs *args)
+{
+    dbg.println("Loading from EEPROM.");
+    for (int i =0; i < NCIRCUITS; i++) {
+        Cload(&ckts[i],cktsSave[i],&cktsDividerSave[i]);
+    }
+    dbg.println(COMPLETESTR);
+}
+
+/** F: Test switch aggresively */
+static void testSwitchAggressively(CmdArgs *args)
+{
+    testSwitch(_testChannel);
+}
+
+/** f: Quick diagnostic test of basic functionality */
+static void testSwitchingQuick(CmdArgs *args)
+{
+    testSwitching();
+}
+
+/** L: Run calibration routine on channel */
+static void calibrate(CmdArgs *args)
+{
+    calibrateCircuit(&ckts[_testChannel]);
+}
+
+/** l: Read SD card info, quick sd card test */
+static void sdCardInfo(CmdArgs *args)
+{
+    printSDCardInfo();
+}
+
+/** P: Program values in ckts[] to ADE */
+static void programCircuits(CmdArgs *args)
+{
+    const char * codes[NCIRCUITS] = {};
+    for (int i = 0; i < NCIRCUITS; i++) {
+        Circuit *c = &ckts[i];
+        //Cprobe programs an ADE which has just been plugged in
+        if (c->connected) {
+            Cprogram(c);
+        } else {
+            Cprobe(c);
+        }
+        codes[i] = c->connected ? RCstr(_retCode) : "ABSENT";
+    }
+    printTableStrings(codes,NCIRCUITS);
+}
+
+/** p: Print Circuit values */
+static void printCircuit(CmdArgs *args)
+{
+    Cprint(&dbg,&ckts[_testChannel]);
+    dbg.println();
+}
+
+/** R: Hard Reset using watchdog timer */
+static void hardReset(CmdArgs *args)
+{
+   wdt_enable((WDTO_4S));
+   dbg.println(" #resetting in 4s.");
+}
+
+/** r: Restore communicaions on channel */
+static void restoreComms(CmdArgs *args)
+{
+    int32_t regData = 0;
+    RCreset();
+    CSselectDevice(_testChannel);
+    delay(10);
+    CSselectDevice(DEVDISABLE);
+    delay(10);
+    CSselectDevice(_testChannel);
+    delay(10);
+    CSselectDevice(DEVDISABLE);
+    CSselectDevice(_testChannel);
+    ADEgetRegister(DIEREV,&regData);
+    ifsuccess(_retCode) {
+        dbg.println("Restored");
+        return;
+    } else {
+        dbg.println("Reprogramming");
+    }
+    Creset(&ckts[(_testChannel/2)*2]);
+    Cprogram(&ckts[(_testChannel/2)*2]);
+    Cprogram(&ckts[(_testChannel/2)*2+1]);
+    ADEgetRegister(DIEREV,&regData);
+    ifsuccess(_retCode) {
+        dbg.println("Restored");
+    }
+}
+
+/** S: Toggle channel switch */
+static void toggleSwitch(CmdArgs *args)
+{
+    int8_t ID = getChannelID();
+    SWset(ID,!SWisOn(ID));
+}
+
+/** s: Display switch state */
+static void printSwitches(CmdArgs *args)
+{
+    displayEnabled(SWgetSwitchState());
+}
+
+/** T: Change reporting interval */
+static void setReportInterval(CmdArgs *args)
+{
+    int32_t retVal = 0;
+    dbg.print(" #New Reporting Interval:");
+    ifsuccess(CLgetInt(&dbg,&retVal)) {
+        reportInterval = retVal;
+    }
+}
+
+/** t: Print reporting interval */
+static void printReportInterval(CmdArgs *args)
+{
+    dbg.print(" #Reporting Interval:");
+    dbg.println(reportInterval);
+}
+
+/** M: Change Interaction Mode */
+static void changeMode(CmdArgs *args)
+{
+    int32_t retVal = 0;
+    dbg.print(" #2 for meter mode, 4 for binary meter mode, 5 for delta meter mode, 1 for interactive mode:");
+    ifsuccess(CLgetInt(&dbg,&retVal)) {
+        if ( retVal == INTERACTIVEMODE || retVal == METERMODE || retVal == METERBINMODE
+                || retVal == METERDELTAMODE) {
+            mode = retVal;
+            dbg.println();
+            return;
+        }
+    }
+    dbg.println();
+    dbg.println("Bad Input.");
+}
+
+/** m: Meter but do not print */
+static void meterQuiet(CmdArgs *args)
+{
+    RCreset();
+    Cmeasure(&ckts[_testChannel]);
+    ifsuccess(_retCode) {
+        dbg.print("#Meter Completely Successful:");
+    } else {
+        dbg.print("#Meter unsuccessful:");
+    }
+    dbg.println(RCstr(_retCode));
+    RCreset();
+}
+
+/** o: Wait for zero-crossing and print IRMS and VRMS */
+static void printZX(CmdArgs *args)
+{
+    printIRMSVRMSZX(_testChannel);
+}
+
+/** O: Take long running averages of IRMS and VRMS */
+static void averageRMS(CmdArgs *args)
+{
+    int8_t zero;
+    int32_t vrmsavr,vrmsvar,irmsav,irmsvar,wfmVavr,wfmVvar,wfmIavr,wfmIvar,waitTime;
+    vrmsavr = vrmsvar = irmsav = vrmsvar = wfmVavr = wfmVvar = wfmIavr = wfmIvar= zero =0;
+    waitTime = millis();
+    RCreset();
+    CSselectDevice(ckts[_testChannel].circuitID);
+    ADEsetRegister(IRMSOS,&vrmsavr);
+    ADEgetRegister(IRMSOS,&vrmsavr);
+    dbg.print(vrmsavr);
+    ADEgetRegister(VRMSOS,&vrmsavr);
+    dbg.print(vrmsavr);
+    CSselectDevice(DEVDISABLE);
+    vrmsavr = avg(1000,Cvrms,&ckts[_testChannel],&vrmsvar);
+    irmsav = avg(1000,Cirms,&ckts[_testChannel],&irmsvar);
+    dbg.print(millis()-waitTime); dbg.println(":TotalTime");
+    dbg.print("VRMS_AVG:"); dbg.print(vrmsavr); dbg.print(", VRMS_VAR:"); dbg.println(vrmsvar);
+    dbg.print("IRMS_AVG:"); dbg.print(irmsav); dbg.print(", IRMS_VAR:"); dbg.println(irmsvar);
+
+    _retCode = FAILURE;
+    while(nsuccess(_retCode)) {
+        RCreset();
+        CSselectDevice(ckts[_testChannel].circuitID);
+        dbg.println("Configuring to read raw voltage.");
+        vrmsavr = 0;
+        ADEsetCHXOS(2,&zero,&zero);
+        ADEsetIrqEnBit(WSMP,true);  ifnsuccess(_retCode) continue; //The WAVEFORM register will not work without this.
+        ADEsetModeBit(WAVESEL_0,true); ifnsuccess(_retCode) continue;
+        ADEsetModeBit(WAVESEL1_,true); ifnsuccess(_retCode) continue;
+        ADEsetIrqEnBit(CYCEND,true);/*Just in case */ ifnsuccess(_retCode) continue;
+        CSselectDevice(DEVDISABLE);
+    }
+    wfmVavr = avg(1000,Cwaveform,&ckts[_testChannel],&wfmVvar);
+    dbg.print("WAVEFORMV_AVG:"); dbg.print(wfmVavr); dbg.print(", WAVEFORMV_VAR:"); dbg.println(wfmVvar);
+
+    _retCode = FAILURE;
+    while(nsuccess(_retCode)) {
+        RCreset();
+        dbg.println("Configuring to read raw current.");
+        CSselectDevice(ckts[_testChannel].circuitID);
+        vrmsavr = 0;
+        ADEsetCHXOS(1,&zero,&zero);
+        ADEsetModeBit(WAVESEL_0,false); ifnsuccess(_retCode) continue;
+        CSselectDevice(DEVDISABLE);
+    }
+    wfmIavr = avg(1000,Cwaveform,&ckts[_testChannel],&wfmIvar);
+    dbg.print("WAVEFORMI_AVG:"); dbg.print(wfmIavr); dbg.print(", WAVEFORMI_VAR:"); dbg.println(wfmIvar);
+}
+
+/** x: Wait for interrupt specified by interrupt mask */
+static void waitForInterrupt(CmdArgs *args)
+{
+    int32_t regData = 0;
+    int32_t mask = 0;
+    dbg.println();
+    dbg.println("Available interrupt masks:");
+    for (int i =0; i < intListLen; i++){
+        dbg.print( intList[i]);
+        dbg.print(" ");
+    }
+    dbg.println();
+    dbg.print("Enter interrupt mask name or \"mask\" "
+            "to enter a mask manually. "
+            "Will wait for 4sec for interrupt to fire. $");
+    CLgetString(&dbg,buff,sizeof(buff));
+    if (!strcmp(buff, "mask")) {
+        dbg.print("Enter interrupt mask as a number. $");
+        CLgetInt(&dbg,&mask);
+    } else {
+        mask=1;
+        for (int i =0; i < intListLen; i++){
+            if (!strcmp(buff, intList[i])) {
+                break;
+            }
+            mask <<= 1;
+        }
+    }
+    dbg.println();
+    RCreset();
+    CSselectDevice(_testChannel);
+    RCreset();
+    ADEgetRegister(RSTSTATUS,&regData);
+    ADEwaitForInterrupt((int16_t)mask,4000);
+    dbg.println(RCstr(_retCode));
+    CSselectDevice(DEVDISABLE);
+}
+
+/** X: Read WAVEFORM Data need to configure registers first! */
+static void readWaveform(CmdArgs *args)
+{
+    int32_t regData = 0;
+    CSselectDevice(_testChannel);
+    dbg.println(" Note: Did you configure the MODE and Interrupt registers properly?");
+    for (int i =0; i < 80; i++) {
+        ADEgetRegister(WAVEFORM,&regData);
+        dbg.print(regData);
+    }
+    CSselectDevice(DEVDISABLE);
+}
+
+/** z: Print long-run test results */
+static void printTestResults(CmdArgs *args)
+{
+    testCircuitPrint();
+}
+
+/**
+ *  Z: Long-run test with metering at regular intervals
+ *  and constant switching inbetween
+ */
+static void startTest(CmdArgs *args)
+{
+    int32_t runMin = 0;
+    if (testIdx) {
+        dbg.print("Test Canceled");
+        testIdx = 0;
+        return;
+    }
+
+    dbg.println();
+    dbg.print("Minutes to run test $");
+    CLgetInt(&dbg,&runMin);
+    dbg.println();
+    dbg.print("Seconds delay between each experiment. $");
+    CLgetInt(&dbg,&switchSec);
+    if (switchSec < 0) {
+        switchSec = 0;
+    }
+    switchSec += 120/60;
+    testIdx = runMin*60/switchSec;
+
+    dbg.println();
+    dbg.print("Total number of experiments is: ");
+    dbg.print(testIdx);
+    dbg.println();
+    if (testIdx > testLog.slots) {
+        dbg.print("Only the last ");
+        dbg.print(testLog.slots);
+        dbg.print(" results are kept.");
+        dbg.println();
+    }
+
+    //Select it
+    CSselectDevice(_testChannel);
+
+    //Configure meter
+    //ADEsetRegister(LINECYC,&linecycVal);
+    //ADEsetRegister(GAIN,&gain);
+    //ADEsetRegister(PHCAL,&phcal);
+    //ADEsetModeBit(CYCMODE,1);
+
+    //Drop the results of the last test
+    ELclear(&testLog);
+    switchings = 0;
+    dbg.print("Test started.");
+}
+
+/**
+ *  Single character commands of the interactive mode, see docs/Cmds.txt.
+ *  The handlers prompt for their arguments.
+ */
+static const CmdEntry berkeleyCmds[] PROGMEM = {
+    {"A", "", writeRegister},
+    {"a", "", readRegister},
+    {"B", "", testZX},
+    {"b", "", resetChannel},
+    {"C", "", changeChannel},
+    {"c", "", setParameter},
+    {"D", "", setDefaults},
+    {"E", "", saveCircuits},
+    {"e", "", loadCircuits},
+    {"F", "", testSwitchAggressively},
+    {"f", "", testSwitchingQuick},
+    {"L", "", calibrate},
+    {"l", "", sdCardInfo},
+    {"P", "", programCircuits},
+    {"p", "", printCircuit},
+    {"R", "", hardReset},
+    {"r", "", restoreComms},
+    {"S", "", toggleSwitch},
+    {"s", "", printSwitches},
+    {"T", "", setReportInterval},
+    {"t", "", printReportInterval},
+    {"M", "", changeMode},
+    {"m", "", meterQuiet},
+    {"o", "", printZX},
+    {"O", "", averageRMS},
+    {"x", "", waitForInterrupt},
+    {"X", "", readWaveform},
+    {"z", "", printTestResults},
+    {"Z", "", startTest},
+};
+
 /**
  *  Single character serial interface for interaction with telduino
  *  Capital letters are usually writes and lower case letters are usually reads
@@ -92,6 +564,9 @@ void parseBerkeley()
     dbg.print(_testChannel,DEC);
     dbg.print(" $");
     while (dbg.available() == 0 && testIdx == 0) {
+        CdrainAll(ckts,NCIRCUITS);
+        CprobeAbsent(ckts,NCIRCUITS);
+        PFpoll();
         DbgLeds(GPAT);
         for (int i=0; i < 100; i++) {
             if (dbg.available() != 0) {
@@ -112,9 +587,10 @@ void parseBerkeley()
         uint32_t startTime = millis();
         uint32_t val = 0;
         int32_t RARAA[2] = {0};
+        int32_t startEnergy = 0;
 
-        //Clear AEnergy
-        ADEgetRegister(RAENERGY,&RARAA[1]);
+        //AENERGY is not reset, the metering drains it, see Circuit
+        ADEgetRegister(AENERGY,&startEnergy);
         RCreset();
 
         //Switch the channel On
@@ -144,10 +620,12 @@ void parseBerkeley()
         switchings += 1;
         //Meter it 
         ADEwaitForInterrupt(CYCEND,1050);
-        ADEgetRegister(RAENERGY,&RARAA[1]);
+        ADEgetRegister(AENERGY,&RARAA[1]);
         ifnsuccess(_retCode){
             RCreset();
             RARAA[1] = -1000;
+        } else {
+            RARAA[1] = (int32_t)((uint32_t)(RARAA[1] - startEnergy) << 8) >> 8;
         }
         
         dbg.print(RARAA[0]);
@@ -155,7 +633,7 @@ void parseBerkeley()
         dbg.print(RARAA[1]);
 
         //Write to EEPROM
-        eeprom_update_block(RARAA,&RARAASave[testIdx],sizeof(RARAA));
+        ELappend(&testLog,RARAA);
 
         //Switch during delay between tests so interval is switchSec seconds
         uint32_t time = millis()-startTime;
@@ -196,362 +674,11 @@ void parseBerkeley()
     // Look for incoming single character command on dbg line
     // Capital letters denote write operations and lower case letters are reads
     if (dbg.available() > 0) {
-        char incoming = dbg.read(); 
-        // TODO Make functions for each case instead of dumping code
-        int32_t regData = 0;
-        const char * codes[NCIRCUITS] = {};
-        Circuit *c;
-        int8_t ID;
-        int32_t secs = 0;
-        int32_t retVal = 0;
-        int32_t mask = 0;
-        int32_t zeros[2] = {0};
-        int32_t runMin = 0;
-        dbg.println(incoming);
-        switch (incoming) {
-            case 'A':                       //Write to ADE Register
-                dbg.print("Register to write $");
-                CLgetString(&dbg,buff,sizeof(buff));
-                dbg.println();
-
-                for (int i=0; i < regListSize/sizeof(regList[0]); i++) {
-                    if (strcmp(regList[i]->name,buff) == 0){
-                        RCreset();
-                        CSselectDevice(_testChannel);
-                        dbg.print("Current regData:");
-                        ADEgetRegister(*regList[i],&regData);
-                        dbg.print(RCstr(_retCode));
-                        dbg.print(":0x");
-                        dbg.print(regData,HEX);
-                        dbg.print(":");
-                        dbg.println(regData,BIN);
-
-                        dbg.print("Enter new regData:");
-                        if(CLgetInt(&dbg,&regData) == CANCELED) break;
-                        dbg.println();
-                        ADEsetRegister(*regList[i],&regData);
-                        dbg.print(RCstr(_retCode));
-                        dbg.print(":0x");
-                        dbg.print(regData,HEX);
-                        dbg.print(":");
-                        dbg.println(regData,DEC);
-                        CSselectDevice(DEVDISABLE);
-                        break;
-                    }
-                }
-                break;
-            case 'a':                       //Read ADE reg
-                dbg.print("Enter name of register to read:");
-                CLgetString(&dbg,buff,sizeof(buff));
-                dbg.println();
-
-                for (int i=0; i < regListSize/sizeof(regList[0]); i++) {
-                    if (strcmp(regList[i]->name,buff) == 0){
-                        RCreset();
-                        CSselectDevice(_testChannel);
-                        ADEgetRegister(*regList[i],&regData);
-                        dbg.print("regData:");
-                        dbg.print(RCstr(_retCode));
-                        dbg.print(":0x");
-                        dbg.print(regData,HEX);
-                        dbg.print(":");
-                        dbg.println(regData,DEC);
-                        CSselectDevice(DEVDISABLE);
-                        break;
-                    } 
-                }
-                break;
-            case 'B':                       //Test ZX10
-                {
-                    int waitTime = millis();
-                    RCreset();
-                    CSselectDevice(_testChannel);
-                    int32_t avgWaitTime = 0;
-                    int32_t varWaitTime = 0;
-                    //For 10 seconds measure time between ZX detections
-                    avgWaitTime = avg(600,sampleZXWait,NULL,&varWaitTime);
-                    dbg.print("avgWait:");
-                    dbg.println(avgWaitTime);
-                    dbg.print("varWait:");
-                    dbg.println(varWaitTime);
-                    CSselectDevice(DEVDISABLE);
-                }
-                break;
-            case 'b':
-                CSreset(_testChannel);
-                break;
-            case 'C':                       //Change active channel for ADE, switching, and metering
-                _testChannel = getChannelID();    
-                break;
-            case 'c':
-                setCircuitParameter();
-                break;
-            case 'D':                       //Initialize ckts[] to safe defaults
-                for (int i = 0; i < NCIRCUITS; i++) {
-                    c = &ckts[i];
-                    CsetDefaults(c,i);
-                }
-                dbg.println("Defaults set. Don't forget to program! ('P')");
-                break;
-            case 'E':                       //Save data in ckts[] to EEPROM
-                dbg.println("Saving to EEPROM.");
-                for (int i =0; i < NCIRCUITS; i++) {
-                    Csave(&ckts[i],&cktsSave[i]);
-                }
-                dbg.println(COMPLETESTR);
-                break;
-            case 'e':                       //Load circuit data from EEPROM
-                dbg.println("Loading from EEPROM.");
-                for (int i =0; i < NCIRCUITS; i++) {
-                    Cload(&ckts[i],&cktsSave[i]);
-                }
-                dbg.println(COMPLETESTR);
-                break;
-            case 'F':                       //Test switch aggresively
-                testSwitch(_testChannel);
-                break;
-            case 'f':                       //Quick diagnostic test of basic functionality
-                testSwitching();
-                break;
-            case 'L':                       //Run calibration routine on channel
-                c = &(ckts[_testChannel]);
-                calibrateCircuit(c);
-                break;
-            case 'l':                       //Read SD card info, quick sd card test
-                printSDCardInfo();
-                break;
-            case 'P':                       //Program values in ckts[] to ADE
-                for (int i = 0; i < NCIRCUITS; i++) {
-                    c = &ckts[i];
-                    Cprogram(c);
-                    codes[i] = RCstr(_retCode);
-                }
-                printTableStrings(codes,NCIRCUITS);
-                break;
-            case 'p':                       //Print Circuit values
-                c = &(ckts[_testChannel]);
-                Cprint(&dbg,c);
-                dbg.println();
-                break;
-            case 'R':                       //Hard Reset using watchdog timer
-               wdt_enable((WDTO_4S));            
-               dbg.println(" #resetting in 4s.");
-               break;
-            case 'r':                       //Restore communicaions on channel
-                RCreset();
-                CSselectDevice(_testChannel);
-                delay(10);
-                CSselectDevice(DEVDISABLE);
-                delay(10);
-                CSselectDevice(_testChannel);
-                delay(10);
-                CSselectDevice(DEVDISABLE);
-                CSselectDevice(_testChannel);
-                ADEgetRegister(DIEREV,&regData);
-                ifsuccess(_retCode) {
-                    dbg.println("Restored");
-                    break;
-                } else {
-                    dbg.println("Reprogramming");
-                }
-                CSreset(_testChannel);
-                Cprogram(&ckts[(_testChannel/2)*2]);
-                Cprogram(&ckts[(_testChannel/2)*2+1]);
-                ADEgetRegister(DIEREV,&regData);
-                ifsuccess(_retCode) {
-                    dbg.println("Restored");
-                    break;
-                } 
-                break;
-            case 'S':                       //Toggle channel switch
-                ID = getChannelID();        
-                SWset(ID,!SWisOn(ID));
-                break;
-            case 's':                       //Display switch state
-                displayEnabled(SWgetSwitchState());
-                break;
-            case'T':                        //Change reporting interval
-                dbg.print(" #New Reporting Interval:");
-                ifsuccess(CLgetInt(&dbg,&retVal)) {
-                    reportInterval = retVal;
-                }
-                break;
-            case 't':                       //Print reporting interval
-                dbg.print(" #Reporting Interval:");
-                dbg.println(reportInterval);
-                break;
-            case 'M':                       //Change Interaction Mode
-                dbg.print(" #2 for meter mode, 1 for interactive mode:"); 
-                ifsuccess(CLgetInt(&dbg,&retVal)) {
-                    if ( retVal == INTERACTIVEMODE || retVal == METERMODE) {
-                        mode = retVal;
-                        dbg.println();
-                        return;
-                    }
-                }
-                dbg.println();
-                dbg.println("Bad Input.");
-                break;
-            case 'm':                       //Meter but do not print
-                RCreset();
-                Cmeasure(&ckts[_testChannel]);
-                ifsuccess(_retCode) {
-                    dbg.print("#Meter Completely Successful:");
-                } else {
-                    dbg.print("#Meter unsuccessful:");
-                }
-                dbg.println(RCstr(_retCode));
-                RCreset();
-                break;
-            case 'o':                       //Wait for zero-crossing and print IRMS and VRMS
-                printIRMSVRMSZX(_testChannel);
-                break;
-            case 'O':                       //Take long running averages of IRMS and VRMS
-                int8_t zero;
-                int32_t vrmsavr,vrmsvar,irmsav,irmsvar,wfmVavr,wfmVvar,wfmIavr,wfmIvar,waitTime;
-                vrmsavr = vrmsvar = irmsav = vrmsvar = wfmVavr = wfmVvar = wfmIavr = wfmIvar= zero =0;
-                waitTime = millis();
-                RCreset();
-                CSselectDevice(ckts[_testChannel].circuitID);
-                ADEsetRegister(IRMSOS,&vrmsavr);
-                ADEgetRegister(IRMSOS,&vrmsavr);
-                dbg.print(vrmsavr);
-                ADEgetRegister(VRMSOS,&vrmsavr);
-                dbg.print(vrmsavr);
-                CSselectDevice(DEVDISABLE);
-                vrmsavr = avg(1000,Cvrms,&ckts[_testChannel],&vrmsvar);
-                irmsav = avg(1000,Cirms,&ckts[_testChannel],&irmsvar);
-                dbg.print(millis()-waitTime); dbg.println(":TotalTime");
-                dbg.print("VRMS_AVG:"); dbg.print(vrmsavr); dbg.print(", VRMS_VAR:"); dbg.println(vrmsvar);
-                dbg.print("IRMS_AVG:"); dbg.print(irmsav); dbg.print(", IRMS_VAR:"); dbg.println(irmsvar);
-
-                _retCode = FAILURE;
-                while(nsuccess(_retCode)) {
-                    RCreset();
-                    CSselectDevice(ckts[_testChannel].circuitID);
-                    dbg.println("Configuring to read raw voltage.");
-                    vrmsavr = 0;
-                    ADEsetCHXOS(2,&zero,&zero);
-                    ADEsetIrqEnBit(WSMP,true);  ifnsuccess(_retCode) continue; //The WAVEFORM register will not work without this.
-                    ADEsetModeBit(WAVESEL_0,true); ifnsuccess(_retCode) continue;
-                    ADEsetModeBit(WAVESEL1_,true); ifnsuccess(_retCode) continue;
-                    ADEsetIrqEnBit(CYCEND,true);/*Just in case */ ifnsuccess(_retCode) continue;
-                    CSselectDevice(DEVDISABLE);
-                }
-                wfmVavr = avg(1000,Cwaveform,&ckts[_testChannel],&wfmVvar);
-                dbg.print("WAVEFORMV_AVG:"); dbg.print(wfmVavr); dbg.print(", WAVEFORMV_VAR:"); dbg.println(wfmVvar);
-
-                _retCode = FAILURE;
-                while(nsuccess(_retCode)) {
-                    RCreset();
-                    dbg.println("Configuring to read raw current.");
-                    CSselectDevice(ckts[_testChannel].circuitID);
-                    vrmsavr = 0;
-                    ADEsetCHXOS(1,&zero,&zero);
-                    ADEsetModeBit(WAVESEL_0,false); ifnsuccess(_retCode) continue;
-                    CSselectDevice(DEVDISABLE);
-                }
-                wfmIavr = avg(1000,Cwaveform,&ckts[_testChannel],&wfmIvar);
-                dbg.print("WAVEFORMI_AVG:"); dbg.print(wfmIavr); dbg.print(", WAVEFORMI_VAR:"); dbg.println(wfmIvar);
-                break;
-            case 'x':                       //Wait for interrupt specified by interrupt mask
-                dbg.println();
-                dbg.println("Available interrupt masks:");
-                for (int i =0; i < intListLen; i++){
-                    dbg.print( intList[i]);
-                    dbg.print(" ");
-                }
-                dbg.println();
-                dbg.print("Enter interrupt mask name or \"mask\" "
-                        "to enter a mask manually. " 
-                        "Will wait for 4sec for interrupt to fire. $");
-                CLgetString(&dbg,buff,sizeof(buff));
-                if (!strcmp(buff, "mask")) {
-                    dbg.print("Enter interrupt mask as a number. $");
-                    CLgetInt(&dbg,&mask);
-                } else {
-                    mask=1;
-                    for (int i =0; i < intListLen; i++){
-                        if (!strcmp(buff, intList[i])) {
-                            break;
-                        }
-                        mask <<= 1;
-                    }
-                }
-                dbg.println();
-                RCreset();
-                CSselectDevice(_testChannel);
-                RCreset();
-                ADEgetRegister(RSTSTATUS,&regData);
-                ADEwaitForInterrupt((int16_t)mask,4000);
-                dbg.println(RCstr(_retCode));
-                CSselectDevice(DEVDISABLE);
-                break;
-            case 'X':                       // Read WAVEFORM Data need to configure registers first!
-                CSselectDevice(_testChannel);
-                dbg.println(" Note: Did you configure the MODE and Interrupt registers properly?");
-                for (int i =0; i < 80; i++) {
-                    ADEgetRegister(WAVEFORM,&regData);
-                    dbg.print(regData);
-                }
-                CSselectDevice(DEVDISABLE);
-                break;
-            case 'z':                       // Print long-run test results
-                testCircuitPrint();
-                break;
-            case 'Z':                       // Long-run test with metering 
-                                            // at regular intervals 
-                                            // and constant switching inbetween
-                if (testIdx) {
-                    dbg.print("Test Canceled");
-                    testIdx = 0;
-                    return;
-                }
-
-                dbg.println();
-                dbg.print("Minutes to run test $");
-                CLgetInt(&dbg,&runMin);
-                dbg.println();
-                dbg.print("Seconds delay between each experiment. $");
-                CLgetInt(&dbg,&switchSec);
-                if (switchSec < 0) {
-                    switchSec = 0;
-                }
-                switchSec += 120/60;
-                testIdx = runMin*60/switchSec;
-
-                dbg.println();
-                dbg.print("Total number of experiments is: ");
-                dbg.print(testIdx);
-                dbg.println();
-                if (testIdx > RARAASIZE) {
-                    dbg.print("Too many experiments to run. Make test shorter or test with a longer period between experiments.");
-                    dbg.println();
-                    testIdx = 0;
-                    return;
-                }
-
-                //Select it
-                CSselectDevice(_testChannel);
-
-                //Configure meter
-                //ADEsetRegister(LINECYC,&linecycVal);
-                //ADEsetRegister(GAIN,&gain);
-                //ADEsetRegister(PHCAL,&phcal);
-                //ADEsetModeBit(CYCMODE,1);
-
-                //Initialize storage area for results
-                eeprom_update_block(&testIdx,&nRARAASave,sizeof(testIdx));
-                for (int i=testIdx; i>0; i--) {
-                    zeros[1] = i;
-                    eeprom_update_block(zeros,RARAASave,sizeof(RARAASave[0]));
-                }
-                switchings = 0;
-                dbg.print("Test started.");
-                break;
-            default:                        //Indicate received character
-                badInput(incoming,&dbg);
-                break;
+        char incoming[2] = {(char)dbg.read(), '\0'};
+        CmdArgs args;
+        dbg.println(incoming[0]);
+        ifnsuccess(CMDexec(berkeleyCmds,CMDCOUNT(berkeleyCmds),incoming,NULL,&args)) {
+            badInput(incoming[0],&dbg);
         }
     }
 
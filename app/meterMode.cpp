@@ -1,9 +1,18 @@
 #include <stdint.h>
+#include <string.h>
 #include "meterMode.h"
 #include "cfg.h"
 #include "Circuit/circuit.h"
+#include "Switches/switches.h"
 #include "arduino/wiring.h"
 #include "ReturnCode/returncode.h"
+#include "Frame/frame.h"
+#include "Frame/records.h"
+#include "Frame/delta.h"
+#include "Cmd/cmd.h"
+#include "Ring/Ring.h"
+#include "Format/Line.h"
+#include "SDLog/sdlog.h"
 
 
 /** 
@@ -19,25 +28,103 @@
  *       COMMANDCHAR is a single character which determines the action.
  *       CIRCUIT is an integer from -1 through 19, 
  *        -1 applies the command to all circuits when relevant.
+ *        Commands about circuits answer -1 as NUMBER for any other CIRCUIT.
  *       NUMBER is an integer for now
  *      
  *       The response is in the same format if only to echo what was given.
  *       A command error returns: "! -1 -1"
+ *       An optional fourth field, a tag from 0 to 65534, is echoed at the 
+ *       end of the response so it can be matched to its command.
+ *
+ *  \section Command Queue
+ *       Lines are assembled whenever meter mode is idle and while a sweep 
+ *       waits for the ADEs. The read only commands, the lower case ones 
+ *       but w, are answered as soon as their line is complete, the others 
+ *       are queued and run in order between sweeps. If the queue is full, or
+ *       the line is longer than SERBUFFSIZE-1, the response is "! 21 -1".
  *
  *  \section Commands
+ *      See docs/Cmds.txt for the details.
+ *
  *      SET
  *      (S)witch set
  *      (M)ode
- *      (R)eport Interval in seconds
+ *      (T) report interval in seconds, of the circuits that follow it
+ *      (G) time between relay pulses in ms
  *      (W)atts meter ALL circuits
+ *      (w)atts meter circuit, all of them for -1
+ *      (C) report on change on or off
+ *      (D), (I), (V) W, IRMS and VRMS deadband of a circuit
+ *      (H) longest a circuit goes unreported with report on change
+ *      (K) time between keyframes in seconds
+ *      (F)ields a circuit reports
+ *      (R)eport interval of a circuit in seconds, see Subscriptions
+ *      (L)og to the SD card open or closed
+ *      (B) replay the SD card log of a circuit
  *
  *      GET
- *      (s)witch status
+ *      (s)witch status, all switches as a bit mask for -1
  *      (m)ode status 
- *      (r)eport Interval in seconds
- *      (w)atts meter circuit
+ *      (t) report interval in seconds
+ *      (g) time between relay pulses in ms
+ *      (q) last measurements of a circuit, see Snapshots
+ *      (c), (d), (i), (v), (h), (k), (f), (r) what the upper case ones set
+ *      (l)og sector being filled, -1 if it is closed
+ *      (b) records the running replay has sent
  *      ! do nothing NOP
  *
+ *  \section Snapshots
+ *      Every sweep publishes the measurements of each circuit it reads, see 
+ *      Csnapshot. "q CIRCUIT 0" prints the latest ones right away in the 
+ *      report format with the sweep number as seq, followed by "q CIRCUIT AGE" 
+ *      where AGE is how old the oldest of them is in ms.
+ *
+ *  \section Subscriptions
+ *      Each circuit reports the fields selected with F (CF flags of 
+ *      Circuit/circuit.h, CFDEFAULT initially) every R seconds, or every T 
+ *      seconds while R is METERFOLLOW (-2). R -1 stops its reports. Intervals
+ *      are counted from power up, so a circuit reporting every 60 s does so 
+ *      in the same sweep as one reporting every second, and circuits due 
+ *      within METERMERGEMS join a sweep that is taken anyway. A sweep meters 
+ *      every circuit at once, the ones that are not due are not sent.
+ *
+ *  \section Report on Change
+ *      With "C 0 1" the reports every reportInterval only include the 
+ *      circuits that changed since they were last reported: W, IRMS or VRMS
+ *      moved beyond the circuit's deadband (D, I and V), the switch or a 
+ *      fault flag changed, or nothing was sent for maxSilence seconds (H).
+ *      Every keyframeInterval seconds (K) all circuits are reported with a 
+ *      header so the host can resynchronize. W and w always report every circuit they meter.
+ *
+ *  \section Binary Reports
+ *      In mode METERBINMODE (M 0 4) reports and command results are sent as 
+ *      COBS framed binary records instead of text, see Frame/records.h. 
+ *      tools/meterdecode turns them back into text.
+ *      Mode METERDELTAMODE (M 0 5) is the same except that the reports of
+ *      a sweep are sent together as one RECDELTA record, each as the 
+ *      difference to the previous report of its circuit, see Frame/delta.h.
+ *
+ *  \section SD Card Log
+ *      While the log of SDLog/sdlog.h is open, every circuit metered by any 
+ *      sweep is logged as a RECFIELDS record of METERLOGFIELDS with the sweep 
+ *      number as seq, whatever is reported. It is opened at power up if a 
+ *      card is inserted. "L 0 1" opens it, "L 0 0" writes out what is 
+ *      buffered and closes it, e.g. before the card is pulled. "l 0 0" 
+ *      answers the sector being filled, -1 if the log is closed.
+ *      Logged records carry the log's clock, SLclock, which goes on across 
+ *      resets.
+ *
+ *  \section Replay
+ *      "B CIRCUIT SECONDS" sends again what the log holds of a circuit (-1 
+ *      for all) from the last SECONDS of the log's clock, e.g. after the link 
+ *      to the host was down. The sector to start at is found by binary 
+ *      search over the log's sector headers, see SLreplay, so the wait does 
+ *      not grow with the log. The answer is the sector, -1 if the log is 
+ *      closed. The records are then sent as reports between sweeps, 
+ *      METERREPLAYBATCH at a time, with their logged time and the sweep as 
+ *      seq, and "b CIRCUIT COUNT" follows the last one. "b 0 0" answers how 
+ *      many were sent so far, -1 if no replay runs.
+ *
  *  \section TODO
  *      parseMeterMode: TODO (X)Reset and reprogram Meter x
  *      parseMeterMode: TODO Sanitize input
@@ -56,139 +143,770 @@ char serBuff[SERBUFFSIZE];
 int8_t buffCursor = 0;
 float sampleTime_ms = 1000;
 
-/**Last time a metering occured. Used to determine when next time will occur.*/
-uint64_t lastMeterTime_ms = 0;
+/** 
+ *  What each circuit is subscribed to, by circuitID. See \section Subscriptions.
+ *  interval is in seconds, METERFOLLOW for reportInterval and negative for none.
+ *  slot_ms is the start of the interval the last report was sent for.
+ */
+struct MeterSub {
+    uint16_t fields;
+    int16_t interval;
+    uint32_t slot_ms;
+};
+static MeterSub subs[NCIRCUITS];
+/** Circuits reported by the sweep in progress. */
+static uint8_t sweepDue[NCIRCUITS];
+
+/** Last report of each circuit in METERDELTAMODE, by circuitID. */
+static DLencoder deltaState[NCIRCUITS];
+/** The RECDELTA record being filled by the sweep in progress. */
+static uint8_t deltaRecord[FRMAXRECORD];
+static uint8_t deltaLen = 0;
+/** Counts RECDELTA records so lost ones can be told. */
+static uint8_t deltaFrames = 0;
 /** This will roll over after 2^32-1*/
 uint32_t sequenceNum = 0;
-/**Command format string.*/
-const char *FMTSTRINGI = "%c %hd %ld";
+/** Reports since the energy totals of a circuit were sent in binary mode, by circuitID. */
+static uint8_t energyReports[NCIRCUITS];
+
+/** Report on change is on, see \section Report on Change. */
+static uint8_t reportOnChange = false;
+/** Deadbands by circuitID and DBW, DBIRMS or DBVRMS, in report units. */
+static int32_t deadband[NCIRCUITS][3];
+#define DBW 0
+#define DBIRMS 1
+#define DBVRMS 2
+/** Longest a circuit goes unreported and time between keyframes, in seconds. */
+static int16_t maxSilence = METERMAXSILENCE;
+static int16_t keyframeInterval = METERKEYFRAME;
+/** What hasChanged compares a circuit with, from its last report. */
+typedef struct {
+    uint32_t time;
+    int32_t W;
+    int32_t IRMS;
+    int32_t VRMS;
+    uint8_t on;
+    uint8_t faults;     // COMM and TIME bits of the status, shifted down
+    uint8_t reported;
+} MeterLast;
+#define METERFAULTS(status) ((uint8_t)(((status) & (COMM | TIME)) >> 16))
+static MeterLast lastReport[NCIRCUITS];
+/** millis() of the last keyframe. */
+static uint32_t lastKeyframe_ms = 0;
+/** The sweep in progress reports every circuit. */
+static uint8_t reportAll = true;
+
+/** Arguments of every meter mode command: the circuit and a number. */
+#define METERARGS "ii"
+
+/** A line waiting in commandQueue. */
+struct MeterLine {
+    char line[SERBUFFSIZE];
+};
+/** Commands received but not run yet, see \section Command Queue. */
+static Ring<MeterLine,METERQUEUESIZE> commandQueue;
+/** The line being received did not fit serBuff and is dropped. */
+static uint8_t lineOverflow = false;
+/** The previous character received ended a line. */
+static uint8_t lineEnded = false;
+
+/** Replay of the log, see \section Replay. */
+static uint8_t replaying = false;
+static int8_t replayCkt;
+static uint32_t replayWindow_ms;
+/** SLclock when the replay started. */
+static uint32_t replayEnd;
+static int32_t replayed;
+
+static void setSwitch(CmdArgs *args);
+static void setMode(CmdArgs *args);
+static void setReportInterval(CmdArgs *args);
+static void meterAllCmd(CmdArgs *args);
+static void meterCmd(CmdArgs *args);
+static void getSwitch(CmdArgs *args);
+static void getMode(CmdArgs *args);
+static void getReportInterval(CmdArgs *args);
+static void setStagger(CmdArgs *args);
+static void getStagger(CmdArgs *args);
+static void getSnapshots(CmdArgs *args);
+static void setReportOnChange(CmdArgs *args);
+static void getReportOnChange(CmdArgs *args);
+static void setDeadband(CmdArgs *args);
+static void getDeadband(CmdArgs *args);
+static void setMaxSilence(CmdArgs *args);
+static void getMaxSilence(CmdArgs *args);
+static void setKeyframeInterval(CmdArgs *args);
+static void getKeyframeInterval(CmdArgs *args);
+static void setFields(CmdArgs *args);
+static void getFields(CmdArgs *args);
+static void setSubInterval(CmdArgs *args);
+static void getSubInterval(CmdArgs *args);
+static void setLog(CmdArgs *args);
+static void getLog(CmdArgs *args);
+static void setReplay(CmdArgs *args);
+static void getReplay(CmdArgs *args);
+static void replayPoll();
+static uint8_t fieldsRecord(const Csnapshot *snap, uint16_t seq, uint16_t fields, uint8_t *rec);
+
+/** 
+ *  Meter mode commands. A handler may replace arg[1] with the value to 
+ *  report back. Unknown commands, e.g. the NOP '!', are echoed as '!'.
+ */
+static const CmdEntry meterCmds[] PROGMEM = {
+    {"S", METERARGS, setSwitch},
+    {"M", METERARGS, setMode},
+    {"T", METERARGS, setReportInterval},
+    {"W", METERARGS, meterAllCmd},
+    {"w", METERARGS, meterCmd},
+    {"G", METERARGS, setStagger},
+    {"C", METERARGS, setReportOnChange},
+    {"D", METERARGS, setDeadband},
+    {"I", METERARGS, setDeadband},
+    {"V", METERARGS, setDeadband},
+    {"H", METERARGS, setMaxSilence},
+    {"K", METERARGS, setKeyframeInterval},
+    {"F", METERARGS, setFields},
+    {"R", METERARGS, setSubInterval},
+    {"L", METERARGS, setLog},
+    {"B", METERARGS, setReplay},
+};
+
+/** Read only commands, answered even while a sweep is in progress. */
+static const CmdEntry meterQueries[] PROGMEM = {
+    {"s", METERARGS, getSwitch},
+    {"m", METERARGS, getMode},
+    {"t", METERARGS, getReportInterval},
+    {"g", METERARGS, getStagger},
+    {"q", METERARGS, getSnapshots},
+    {"c", METERARGS, getReportOnChange},
+    {"d", METERARGS, getDeadband},
+    {"i", METERARGS, getDeadband},
+    {"v", METERARGS, getDeadband},
+    {"h", METERARGS, getMaxSilence},
+    {"k", METERARGS, getKeyframeInterval},
+    {"f", METERARGS, getFields},
+    {"r", METERARGS, getSubInterval},
+    {"l", METERARGS, getLog},
+    {"b", METERARGS, getReplay},
+};
+
+/** @return true in the meter modes that send binary records. */
+static uint8_t binaryMode()
+{
+    return mode == METERBINMODE || mode == METERDELTAMODE;
+}
+
+/**
+ * Sets the report on change defaults and services the port during sweeps.
+ * */
+void meterInit()
+{
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        deadband[id][DBW] = METERDEADBANDW;
+        deadband[id][DBIRMS] = METERDEADBANDIRMS;
+        deadband[id][DBVRMS] = METERDEADBANDVRMS;
+        subs[id].fields = CFDEFAULT;
+        subs[id].interval = METERFOLLOW;
+        subs[id].slot_ms = 0;
+    }
+    CsetIdle(meterPoll);
+}
 
 /**
-* Entry point for meter mode. Handles input from CPU Serial line while in metermode.
+* Entry point for meter mode. Runs the queued commands and the reports.
 */
 void meterMode() 
 {
-    if (cpu.available()) {
+    MeterLine cmd;
+    meterPoll();
+    if (commandQueue.pop(cmd)) {
+        parseMeterMode(cmd.line);
+    }
+    replayPoll();
+    /*If there are no actions to take. See if metering is needed.*/
+    CdrainAll(ckts,NCIRCUITS);
+    CprobeAbsent(ckts,NCIRCUITS);
+    meterAuto();
+}
+
+/**
+ * Runs a command line and prints the result.
+ * @param queriesOnly only run the line if it is a read only command.
+ * @return FAILURE if queriesOnly is set and the line is not a read only 
+ *  command. Nothing is printed then.
+ * */
+static int8_t runCommand(char *cmd, uint8_t queriesOnly)
+{
+    CmdArgs args;
+    int32_t tag = RECNOTAG;
+    int8_t rc = CMDdispatch(meterQueries,CMDCOUNT(meterQueries),cmd,&args);
+
+    if (rc == FAILURE && args.name != NULL) {
+        if (queriesOnly) return FAILURE;
+        rc = CMDexec(meterCmds,CMDCOUNT(meterCmds),args.name,args.rest,&args);
+    }
+    if (rc == FAILURE && CMDparseArgs(METERARGS,args.rest,&args) == SUCCESS) {
+        // Echo unknown commands with their arguments
+        args.name = "!";
+        rc = SUCCESS;
+    }
+    ifnsuccess(rc) {
+        printResults('!',21,-1,RECNOTAG);
+        return rc;
+    }
+    if (CMDparseInt(&args.rest,&tag) != SUCCESS || tag < 0 || tag >= RECNOTAG) {
+        tag = RECNOTAG;
+    }
+    printResults(args.name[0],args.arg[0].i,args.arg[1].i,tag);
+    return SUCCESS;
+}
+
+/**
+ * Runs a meter mode command line and prints the result.
+ * */
+void parseMeterMode(char *cmd) 
+{
+    runCommand(cmd,false);
+}
+
+/**
+ * A line has been received into serBuff. Answers it if it is read only, 
+ * queues it otherwise.
+ * */
+static void lineReceived()
+{
+    MeterLine line;
+
+    strcpy(line.line,serBuff);
+    if (runCommand(line.line,true) != FAILURE) return;
+    strcpy(line.line,serBuff);
+    if (!commandQueue.push(line)) {
+        printResults('!',21,-1,RECNOTAG);
+    }
+}
+
+/**
+ * Assembles command lines from the cpu port, see \section Command Queue, 
+ * and writes the SD card log. Also runs while CmeasureAll waits, so it 
+ * must not measure itself.
+ * */
+void meterPoll()
+{
+    SLpoll();
+    if (mode != METERMODE && !binaryMode()) return;
+    while (cpu.available()) {
         char c = cpu.read();
-        if (buffCursor < (SERBUFFSIZE-1)) {
-            serBuff[buffCursor] = c;
-           if (c == '\r' || c == '\n') {
-                serBuff[buffCursor] = '\0';
-                buffCursor = 0;
-                if (cpu.peek() == '\n' || cpu.peek() == '\r') {
-                    cpu.read();
-                }   
-                parseMeterMode(serBuff);
+        if (c == '\r' || c == '\n') {
+            // "\r\n" ends a single line
+            if (lineEnded) continue;
+            lineEnded = true;
+            serBuff[buffCursor] = '\0';
+            buffCursor = 0;
+            if (lineOverflow) {
+                lineOverflow = false;
+                printResults('!',21,-1,RECNOTAG);
             } else {
-                buffCursor += 1;
+                lineReceived();
             }
+            continue;
+        }
+        lineEnded = false;
+        if (buffCursor < (SERBUFFSIZE-1)) {
+            serBuff[buffCursor++] = c;
         } else {
-            buffCursor = 0;
-            serBuff[0] = '\0';
+            lineOverflow = true;
+        }
+    }
+}
+
+/**
+ * @return true if the command's CIRCUIT is a circuitID or -1. Otherwise 
+ * the command answers -1 and must not be run.
+ * */
+static uint8_t circuitArg(CmdArgs *args)
+{
+    if (-1 <= args->arg[0].i && args->arg[0].i < NCIRCUITS) return true;
+    args->arg[1].i = -1;
+    return false;
+}
+
+static void setSwitch(CmdArgs *args)
+{
+    int8_t cktID;
+    if (!circuitArg(args)) return;
+    cktID = args->arg[0].i;
+    if (cktID == -1) {
+        for (int8_t id = 0; id<NCIRCUITS;id++) {
+            if (id == MAINS) continue;
+            CsetOn(&ckts[id],args->arg[1].i);
+        }
+    } else {
+        CsetOn(&ckts[cktID],args->arg[1].i);
+    }
+}
+
+static void setMode(CmdArgs *args)
+{
+    uint8_t wasBinary = binaryMode();
+    mode = args->arg[1].i;
+    if (binaryMode() && !wasBinary) {
+        // Ends whatever text came before so the first frame decodes
+        cpu.write((uint8_t)0);
+    }
+    if (mode == METERDELTAMODE) {
+        // The decoder starts from keyframes
+        for (int8_t id = 0; id < NCIRCUITS; id++) {
+            DLreset(&deltaState[id]);
         }
     }
-    /*If there are no actions to take. See if metering is needed.*/
-    meterAuto();
 }
 
+static void setReportInterval(CmdArgs *args)
+{
+    reportInterval = args->arg[1].i;
+}
+
+static void meterAllCmd(CmdArgs *args)
+{
+    meterAll();
+}
+
+/** w meters the circuit, or every circuit for -1. */
+static void meterCmd(CmdArgs *args)
+{
+    if (!circuitArg(args)) return;
+    if (args->arg[0].i == -1) {
+        meterAll();
+    } else {
+        meter(&ckts[args->arg[0].i]);
+    }
+}
+
+/** s answers whether the switch is on, or every switch as a bit mask for -1. */
+static void getSwitch(CmdArgs *args)
+{
+    if (!circuitArg(args)) return;
+    if (args->arg[0].i == -1) {
+        int32_t on = 0;
+        for (int8_t id = 0; id < NCIRCUITS; id++) {
+            if (CisOn(&ckts[id])) on |= (int32_t)1 << id;
+        }
+        args->arg[1].i = on;
+    } else {
+        args->arg[1].i = CisOn(&ckts[args->arg[0].i]);
+    }
+}
+
+static void getMode(CmdArgs *args)
+{
+    args->arg[1].i = mode;
+}
+
+static void getReportInterval(CmdArgs *args)
+{
+    args->arg[1].i = reportInterval;
+}
+
+static void setStagger(CmdArgs *args)
+{
+    SWsetStagger(args->arg[1].i);
+}
+
+static void getStagger(CmdArgs *args)
+{
+    args->arg[1].i = SWgetStagger();
+}
 
 /**
- * Handles the meterMode command after it has been successfully scanned.
+ * Prints the latest snapshot of the circuit, or of every circuit for -1, 
+ * with the sweep it was taken in as seq. Reports the age of the oldest 
+ * snapshot printed in ms, -1 if there was none.
  * */
-void parseMeterMode(char *cmd) 
+static void getSnapshots(CmdArgs *args)
+{
+    int8_t cktID = args->arg[0].i;
+    int32_t age = -1;
+    Csnapshot snap;
+
+    if (!circuitArg(args)) return;
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        if (cktID != -1 && id != cktID) continue;
+        ifnsuccess(CgetSnapshot(id,&snap)) continue;
+        printSnapshot(&snap,snap.sweep,subs[id].fields,true);
+        if ((int32_t)(millis() - snap.time) > age) {
+            age = millis() - snap.time;
+        }
+    }
+    args->arg[1].i = age;
+}
+
+static void setReportOnChange(CmdArgs *args)
+{
+    reportOnChange = (args->arg[1].i != 0);
+    // Start with a keyframe
+    lastKeyframe_ms = millis() - (uint32_t)keyframeInterval*1000;
+}
+
+static void getReportOnChange(CmdArgs *args)
 {
-    char action = '!';
-    int8_t cktID = NCIRCUITS + 1;
-    int32_t arg = 0;
+    args->arg[1].i = reportOnChange;
+}
 
+/** @return the deadband a D, I or V command is about. */
+static uint8_t deadbandIndex(const char *name)
+{
+    switch (name[0]) {
+        case 'D': case 'd': return DBW;
+        case 'I': case 'i': return DBIRMS;
+        default: return DBVRMS;
+    }
+}
+
+/** Sets a deadband of the circuit, or of every circuit for -1. */
+static void setDeadband(CmdArgs *args)
+{
+    int8_t cktID = args->arg[0].i;
+    uint8_t which = deadbandIndex(args->name);
+    if (!circuitArg(args)) return;
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        if (cktID == -1 || id == cktID) {
+            deadband[id][which] = args->arg[1].i;
+        }
+    }
+}
 
-    if ( sscanf(cmd,FMTSTRINGI,&action, &cktID, &arg) != 3) {
-        printResults('!',21,-1);
+static void getDeadband(CmdArgs *args)
+{
+    int8_t cktID = args->arg[0].i;
+    if (!circuitArg(args) || cktID == -1) {
+        args->arg[1].i = -1;
         return;
     }
-    
-    switch (action) {
-        case 'S':
-            if (cktID == -1) {
-                for (int8_t id = 0; id<NCIRCUITS;id++) {
-                    if (id == MAINS) continue;
-                    CsetOn(&ckts[id],arg);
-                }
-            } else {
-                CsetOn(&ckts[cktID],arg);
-            }
-            break;
-        case 'M':
-            mode = arg;
-            break;
-        case 'T':
-            reportInterval = arg;
-            break;
-        case 'W':
-            meterAll();
-            break;
-        case 'w':
-            meter(&ckts[cktID]);
-            break;
-        case 's':
-            arg = CisOn(&ckts[cktID]);
-            break;
-        case 'm':
-            arg = mode;
-            break;
-        case 't':
-            arg = reportInterval;
-            break;
-        default:
-            action = '!';
-            break;
-    }
-    printResults(action,cktID,arg);
-
-}
-
-/**
- * If enough time has passed printout all meter data.
+    args->arg[1].i = deadband[cktID][deadbandIndex(args->name)];
+}
+
+static void setMaxSilence(CmdArgs *args)
+{
+    maxSilence = args->arg[1].i;
+}
+
+static void getMaxSilence(CmdArgs *args)
+{
+    args->arg[1].i = maxSilence;
+}
+
+static void setKeyframeInterval(CmdArgs *args)
+{
+    keyframeInterval = args->arg[1].i;
+}
+
+static void getKeyframeInterval(CmdArgs *args)
+{
+    args->arg[1].i = keyframeInterval;
+}
+
+/** Subscribes the circuit, or every circuit for -1, to the CF fields in arg. */
+static void setFields(CmdArgs *args)
+{
+    int8_t cktID = args->arg[0].i;
+    if (!circuitArg(args)) return;
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        if (cktID == -1 || id == cktID) {
+            subs[id].fields = args->arg[1].i & CFALL;
+        }
+    }
+}
+
+static void getFields(CmdArgs *args)
+{
+    int8_t cktID = args->arg[0].i;
+    args->arg[1].i = (circuitArg(args) && cktID != -1) ? subs[cktID].fields : -1;
+}
+
+/** Sets the report interval of the circuit, or of every circuit for -1. */
+static void setSubInterval(CmdArgs *args)
+{
+    int8_t cktID = args->arg[0].i;
+    if (!circuitArg(args)) return;
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        if (cktID == -1 || id == cktID) {
+            subs[id].interval = args->arg[1].i;
+        }
+    }
+}
+
+static void getSubInterval(CmdArgs *args)
+{
+    int8_t cktID = args->arg[0].i;
+    args->arg[1].i = (circuitArg(args) && cktID != -1) ? subs[cktID].interval : -1;
+}
+
+/** 
+ *  L 1 opens the SD card log, L 0 syncs and closes it. Answers with 
+ *  whether it is open. 
+ *  */
+static void setLog(CmdArgs *args)
+{
+    if (args->arg[1].i) {
+        SLopen();
+    } else {
+        SLclose();
+    }
+    args->arg[1].i = SLisOpen();
+}
+
+static void getLog(CmdArgs *args)
+{
+    args->arg[1].i = SLhead();
+}
+
+/** B CKT SECONDS starts a replay of the log, see \section Replay. */
+static void setReplay(CmdArgs *args)
+{
+    int32_t seconds = args->arg[1].i;
+
+    if (!circuitArg(args) || seconds < 0) {
+        args->arg[1].i = -1;
+        return;
+    }
+    replayCkt = args->arg[0].i;
+    // Beyond 49 days the log's clock wraps, take the whole log then
+    replayWindow_ms = (seconds >= 4000000L) ? 0xFFFFFFFFUL : (uint32_t)seconds*1000;
+    replayEnd = SLclock(millis());
+    replayed = 0;
+    args->arg[1].i = SLreplay(replayWindow_ms);
+    replaying = (args->arg[1].i >= 0);
+}
+
+static void getReplay(CmdArgs *args)
+{
+    args->arg[1].i = replaying ? replayed : -1;
+}
+
+/**
+ * Unpacks a RECFIELDS record built by fieldsRecord, the fields it does not 
+ * hold are 0.
+ * @return false if it is not one.
+ * */
+static uint8_t recordSnapshot(const uint8_t *rec, uint8_t len, Csnapshot *snap, 
+        uint16_t *seq, uint16_t *fields)
+{
+    uint8_t n = RECFIELDSMIN;
+
+    if (len < RECFIELDSMIN || rec[0] != RECFIELDS) return false;
+    memset(snap,0,sizeof(*snap));
+    snap->circuitID = rec[1];
+    snap->on = (rec[2] & RECSWON) != 0;
+    if (rec[2] & RECCOMM) snap->status |= COMM;
+    if (rec[2] & RECTIME) snap->status |= TIME;
+    *seq = FRgetU16(&rec[3]);
+    snap->sweep = *seq;
+    snap->time = FRgetU32(&rec[5]);
+    *fields = FRgetU16(&rec[9]);
+    if (*fields & CFVRMS)    { snap->VRMS = FRgetU32(&rec[n]); n += 4; }
+    if (*fields & CFIRMS)    { snap->IRMS = FRgetU32(&rec[n]); n += 4; }
+    if (*fields & CFVPEAK)   { snap->vpeak = FRgetU32(&rec[n]); n += 4; }
+    if (*fields & CFIPEAK)   { snap->ipeak = FRgetU32(&rec[n]); n += 4; }
+    if (*fields & CFPERIOD)  { snap->periodus = FRgetU16(&rec[n]); n += 2; }
+    if (*fields & CFVA)      { snap->VA = FRgetU32(&rec[n]); n += 4; }
+    if (*fields & CFW)       { snap->W = FRgetU32(&rec[n]); n += 4; }
+    if (*fields & CFVAE)     { snap->VAEnergy = FRgetU32(&rec[n]); n += 4; }
+    if (*fields & CFWE)      { snap->WEnergy = FRgetU32(&rec[n]); n += 4; }
+    if (*fields & CFPF)      { snap->PF = FRgetU16(&rec[n]); n += 2; }
+    if (*fields & CFWH)      { snap->WhImport = FRgetU64(&rec[n]); n += 8; }
+    if (*fields & CFWHX)     { snap->WhExport = FRgetU64(&rec[n]); n += 8; }
+    if (*fields & CFVAH)     { snap->VAh = FRgetU64(&rec[n]); n += 8; }
+    if (*fields & CFSTATUS)  { snap->status = FRgetU16(&rec[n]); n += 2; }
+    return n == len;
+}
+
+/**
+ * Sends the next METERREPLAYBATCH logged records of the replay, the ones 
+ * of its circuit and window, then "b CKT COUNT" once they are all sent.
+ * */
+static void replayPoll()
+{
+    uint8_t rec[FRMAXRECORD];
+    Csnapshot snap;
+    uint16_t seq;
+    uint16_t fields;
+    uint8_t n;
+
+    for (uint8_t i = 0; replaying && i < METERREPLAYBATCH; i++) {
+        n = SLreplayNext(rec);
+        if (n == 0) {
+            replaying = false;
+            printResults('b',replayCkt,replayed,RECNOTAG);
+            return;
+        }
+        if (!recordSnapshot(rec,n,&snap,&seq,&fields)
+                || (replayCkt >= 0 && snap.circuitID != replayCkt)
+                || replayEnd - snap.time > replayWindow_ms) {
+            continue;
+        }
+        printSnapshot(&snap,seq,fields,false);
+        replayed++;
+    }
+}
+
+/** @return the report interval of a circuit in seconds, negative for none. */
+static int16_t subInterval(int8_t id)
+{
+    return (subs[id].interval == METERFOLLOW) ? reportInterval : subs[id].interval;
+}
+
+/**
+ * Intervals are counted from millis() 0, so the reports of circuits whose 
+ * intervals are multiples of each other fall on the same sweep.
+ * @return true if a new interval of the circuit has started by time t, 
+ *  which is then taken as reported.
+ * */
+static uint8_t takeDue(int8_t id, uint32_t t)
+{
+    int16_t interval = subInterval(id);
+    uint32_t interval_ms = (uint32_t)interval*1000;
+
+    if (interval < 0) return false;
+    if (interval_ms == 0) return true;
+    if (t/interval_ms == subs[id].slot_ms/interval_ms) return false;
+    subs[id].slot_ms = t - t%interval_ms;
+    return true;
+}
+
+/**
+ * Reports the circuits whose interval has come. Circuits that would be due 
+ * within METERMERGEMS join the sweep, so a sweep is not followed by another 
+ * one just for them.
  * */
 void meterAuto() 
 {   
+    uint32_t now = millis();
+    uint8_t due = false;
 
-    uint32_t timeNow = millis();
-    uint32_t diff = timeNow - lastMeterTime_ms;
-    if (timeNow < lastMeterTime_ms) { //overflow
-        diff = ((uint32_t(-1))-lastMeterTime_ms)+timeNow; 
-    } 
-    if (reportInterval > 0 && (diff/1000 < reportInterval)) {
-        return;
-    } 
-    lastMeterTime_ms = millis();
-    if (reportInterval < 0) {
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        sweepDue[id] = takeDue(id,now);
+        due |= sweepDue[id];
+    }
+    if (!due) {
         return;
     }
-    meterAll();
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        if (!sweepDue[id]) sweepDue[id] = takeDue(id,now + METERMERGEMS);
+    }
+    if (reportOnChange) {
+        meterChanged();
+    } else {
+        meterDue();
+    }
 }
 
-/**Meters and prints the results of the metering operation.*/
+/**
+ * Meters and prints the results of the metering operation. Like meterAll 
+ * the port is serviced during the LINECYC window and absent circuits are skipped.
+ */
 void meter(Circuit *ckt)
 {
     RCreset();
-    Cmeasure(ckt);
-    CsetSampleTime(ckt,sampleTime_ms);
-    printMeter(ckt);
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        sweepDue[id] = (id == ckt->circuitID);
+    }
+    reportAll = true;
+    CmeasureAll(ckt,1,meterReady);
+    writeDeltas();
 }
 
 /**
- *  Pulls data form all of the meters by first clearing their LINECYC interrupts.
+ *  Pulls data from all of the meters concurrently. Each circuit is printed 
+ *  as soon as its LINECYC window ends.
  */
 void meterAll() 
 {
-    //Prepare all ckts for reading. If the code starts to rely on LINCYC, this can become counterproductive.
-    dbg.println("ts,seq,#ID,S,V,I,Vp,Ip,per,VA,W,VAE,WE,PF,0,0,StatusCode");
-    for (int i=0; i < NCIRCUITS; i++) {
-        Cclear(&ckts[i]);
+    for (int8_t id = 0; id < NCIRCUITS; id++) {
+        sweepDue[id] = true;
     }
-    for (int i=0; i < NCIRCUITS; i++) {
-        meter(&ckts[i]);
+    meterDue();
+}
+
+/**
+ *  Meters every circuit and prints the ones in sweepDue. This is a keyframe
+ *  for report on change.
+ */
+void meterDue()
+{
+    if (!binaryMode()) {
+        dbg.println("ts,seq,#ID,S,V,I,Vp,Ip,per,VA,W,VAE,WE,PF,Wh,Whx,VAh,StatusCode");
+    }
+    reportAll = true;
+    lastKeyframe_ms = millis();
+    CmeasureAll(ckts,NCIRCUITS,meterReady);
+    writeDeltas();
+}
+
+/**
+ *  Report on change counterpart of meterDue. Only circuits which changed 
+ *  are printed unless a keyframe is due, which reports every subscribed circuit.
+ */
+void meterChanged()
+{
+    if (millis() - lastKeyframe_ms >= (uint32_t)keyframeInterval*1000) {
+        for (int8_t id = 0; id < NCIRCUITS; id++) {
+            sweepDue[id] = (subInterval(id) >= 0);
+        }
+        meterDue();
+        return;
+    }
+    reportAll = false;
+    CmeasureAll(ckts,NCIRCUITS,meterReady);
+    writeDeltas();
+}
+
+/** @return true if a and b are further apart than band. */
+static uint8_t outside(int32_t a, int32_t b, int32_t band)
+{
+    return (a > b) ? (a - b > band) : (b - a > band);
+}
+
+/**
+ *  @return true if the circuit has to be reported in a report on change 
+ *  sweep: it moved beyond a deadband, it was switched, a fault flag changed 
+ *  or it has not been reported for maxSilence seconds.
+ */
+static uint8_t hasChanged(Circuit *ckt)
+{
+    int8_t id = ckt->circuitID;
+    if (id < 0 || NCIRCUITS <= id || !lastReport[id].reported) return true;
+    MeterLast *last = &lastReport[id];
+    return millis() - last->time >= (uint32_t)maxSilence*1000
+        || CisOn(ckt) != last->on
+        || METERFAULTS(ckt->status) != last->faults
+        || outside(ckt->W,last->W,deadband[id][DBW])
+        || outside(ckt->IRMS,last->IRMS,deadband[id][DBIRMS])
+        || outside(ckt->VRMS,last->VRMS,deadband[id][DBVRMS]);
+}
+
+/** Adds the measurements of a circuit to the SD card log. */
+static void logMeter(Circuit *ckt)
+{
+    Csnapshot snap;
+    uint8_t rec[RECFIELDSMAX];
+    CtakeSnapshot(ckt,&snap);
+    snap.time = SLclock(snap.time);
+    SLappend(rec,fieldsRecord(&snap,snap.sweep,METERLOGFIELDS,rec));
+}
+
+/** Finishes the metering of a circuit in a sweep started by meterDue, meterChanged or meter. */
+void meterReady(Circuit *ckt)
+{
+    int8_t id = ckt->circuitID;
+    CsetSampleTime(ckt,sampleTime_ms);
+    if (SLisOpen()) {
+        logMeter(ckt);
+    }
+    if (0 <= id && id < NCIRCUITS && !sweepDue[id]) {
+        return;
+    }
+    if (reportAll || hasChanged(ckt)) {
+        printMeter(ckt);
     }
 }
 
@@ -196,25 +914,221 @@ void meterAll()
  *  Outputs all of the metering data when requested by a command or polled.
  */
 void printMeter(Circuit *ckt) {
-    cpu.print(millis());
-    cpu.print(",");
-    cpu.print(sequenceNum++);
-    cpu.print(",");
-    CprintMeas(&cpu,ckt);
-    cpu.print(",");
-    cpu.print(ckt->status,HEX);
-    cpu.println();
+    Csnapshot snap;
+    int8_t id = ckt->circuitID;
+    uint16_t fields = (0 <= id && id < NCIRCUITS) ? subs[id].fields : CFDEFAULT;
+    CtakeSnapshot(ckt,&snap);
+    if (mode == METERDELTAMODE && 0 <= id && id < NCIRCUITS) {
+        addDelta(&snap,sequenceNum++,fields);
+    } else {
+        printSnapshot(&snap,sequenceNum++,fields,false);
+    }
+    if (0 <= id && id < NCIRCUITS) {
+        MeterLast *last = &lastReport[id];
+        last->time = snap.time;
+        last->W = snap.W;
+        last->IRMS = snap.IRMS;
+        last->VRMS = snap.VRMS;
+        last->on = snap.on;
+        last->faults = METERFAULTS(snap.status);
+        last->reported = true;
+    }
+}
+
+/**
+ *  Prints the CF fields of a snapshot as a report line with its own time 
+ *  and seq. withEnergy is passed on to writeMeterRecords in binary mode.
+ */
+void printSnapshot(const Csnapshot *snap, uint32_t seq, uint16_t fields, uint8_t withEnergy) {
+    if (binaryMode()) {
+        writeMeterRecords(snap,seq,fields,withEnergy);
+        return;
+    }
+    // Assembled so the report goes to the UART in one write
+    Line<METERLINESIZE> line(&cpu);
+    line.print(snap->time);
+    line.print(",");
+    line.print(seq);
+    line.print(",");
+    CprintFields(&line,snap,fields);
+    if (fields & CFSTATUS) {
+        line.print(",");
+        line.print(snap->status,HEX);
+    }
+    line.println();
 }
 
 /**
  * Prints the result of a command. Which is the same syntax 
- * as the given command.
+ * as the given command. tag is RECNOTAG if the command had none.
  * */
-void printResults(char action, int8_t cktID, int32_t arg) {
-    cpu.print(action);
-    cpu.print(" ");
-    cpu.print(cktID);
-    cpu.print(" ");
-    cpu.println(arg);
+void printResults(char action, int8_t cktID, int32_t arg, uint16_t tag) {
+    if (binaryMode()) {
+        uint8_t rec[RECRESULTSIZE];
+        rec[0] = RECRESULT;
+        rec[1] = action;
+        rec[2] = cktID;
+        FRputU32(&rec[3],arg);
+        FRputU16(&rec[7],tag);
+        writeRecord(rec,RECRESULTSIZE);
+        return;
+    }
+    Line<METERLINESIZE> line(&cpu);
+    line.print(action);
+    line.print(" ");
+    line.print(cktID);
+    line.print(" ");
+    line.print(arg);
+    if (tag != RECNOTAG) {
+        line.print(" ");
+        line.print(tag);
+    }
+    line.println();
+}
+
+
+/** Frames a binary record and sends it. */
+void writeRecord(const uint8_t *record, uint8_t n)
+{
+    uint8_t frame[FRSIZE(FRMAXRECORD)];
+    cpu.write(frame,FRencode(record,n,frame));
+}
+
+/** 
+ *  Builds the RECFIELDS record of a snapshot, see Frame/records.h. 
+ *  @param rec has to hold RECFIELDSMAX bytes.
+ *  @return its length.
+ *  */
+static uint8_t fieldsRecord(const Csnapshot *snap, uint16_t seq, uint16_t fields, uint8_t *rec)
+{
+    uint8_t n = RECFIELDSMIN;
+    uint8_t flags = 0;
+
+    if (snap->on) flags |= RECSWON;
+    if (snap->status & COMM) flags |= RECCOMM;
+    if (snap->status & TIME) flags |= RECTIME;
+    rec[0] = RECFIELDS;
+    rec[1] = snap->circuitID;
+    rec[2] = flags;
+    FRputU16(&rec[3],seq);
+    FRputU32(&rec[5],snap->time);
+    FRputU16(&rec[9],fields);
+    if (fields & CFVRMS)    { FRputU32(&rec[n],snap->VRMS); n += 4; }
+    if (fields & CFIRMS)    { FRputU32(&rec[n],snap->IRMS); n += 4; }
+    if (fields & CFVPEAK)   { FRputU32(&rec[n],snap->vpeak); n += 4; }
+    if (fields & CFIPEAK)   { FRputU32(&rec[n],snap->ipeak); n += 4; }
+    if (fields & CFPERIOD)  {
+        FRputU16(&rec[n],(snap->periodus > 0xFFFF) ? 0xFFFF : snap->periodus);
+        n += 2;
+    }
+    if (fields & CFVA)      { FRputU32(&rec[n],snap->VA); n += 4; }
+    if (fields & CFW)       { FRputU32(&rec[n],snap->W); n += 4; }
+    if (fields & CFVAE)     { FRputU32(&rec[n],snap->VAEnergy); n += 4; }
+    if (fields & CFWE)      { FRputU32(&rec[n],snap->WEnergy); n += 4; }
+    if (fields & CFPF)      { FRputU16(&rec[n],snap->PF); n += 2; }
+    if (fields & CFWH)      { FRputU64(&rec[n],snap->WhImport); n += 8; }
+    if (fields & CFWHX)     { FRputU64(&rec[n],snap->WhExport); n += 8; }
+    if (fields & CFVAH)     { FRputU64(&rec[n],snap->VAh); n += 8; }
+    if (fields & CFSTATUS)  { FRputU16(&rec[n],snap->status); n += 2; }
+    return n;
+}
+
+/** Sends the RECFIELDS record of a snapshot. */
+static void writeFieldsRecord(const Csnapshot *snap, uint16_t seq, uint16_t fields)
+{
+    uint8_t rec[RECFIELDSMAX];
+    writeRecord(rec,fieldsRecord(snap,seq,fields,rec));
+}
+
+/** 
+ *  Binary counterpart of printSnapshot. For CFDEFAULT sends a RECMEAS record 
+ *  and, every RECENERGYEVERY reports of the circuit or if withEnergy is set, 
+ *  a RECENERGY record. Other fields are sent as a RECFIELDS record.
+ */
+void writeMeterRecords(const Csnapshot *snap, uint16_t seq, uint16_t fields, uint8_t withEnergy)
+{
+    uint8_t rec[RECENERGYSIZE];
+    uint8_t flags = 0;
+    int8_t id = snap->circuitID;
+
+    if (fields != CFDEFAULT) {
+        writeFieldsRecord(snap,seq,fields);
+        return;
+    }
+    if (snap->on) flags |= RECSWON;
+    if (snap->status & COMM) flags |= RECCOMM;
+    if (snap->status & TIME) flags |= RECTIME;
+    rec[0] = RECMEAS;
+    rec[1] = id;
+    rec[2] = flags;
+    FRputU16(&rec[3],seq);
+    FRputU32(&rec[5],snap->time);
+    FRputU32(&rec[9],snap->VRMS);
+    FRputU32(&rec[13],snap->IRMS);
+    FRputU32(&rec[17],snap->W);
+    FRputU16(&rec[21],(snap->periodus > 0xFFFF) ? 0xFFFF : snap->periodus);
+    FRputU16(&rec[23],snap->status);
+    writeRecord(rec,RECMEASSIZE);
+
+    if (!withEnergy && (!(0 <= id && id < NCIRCUITS) || energyReports[id]++ % RECENERGYEVERY != 0)) {
+        return;
+    }
+    rec[0] = RECENERGY;
+    rec[1] = id;
+    FRputU16(&rec[2],seq);
+    FRputU64(&rec[4],snap->WhImport);
+    FRputU64(&rec[12],snap->WhExport);
+    FRputU64(&rec[20],snap->VAh);
+    writeRecord(rec,RECENERGYSIZE);
+}
+
+/** 
+ *  Adds the delta coded report of a snapshot to the RECDELTA record of the 
+ *  sweep, which is sent first if it might not fit.
+ */
+void addDelta(const Csnapshot *snap, uint32_t seq, uint16_t fields)
+{
+    uint8_t entry[DLMAXENTRY];
+    uint8_t n;
+    DLreport r;
+    r.circuitID = snap->circuitID;
+    r.on = snap->on;
+    r.fields = fields;
+    r.seq = seq;
+    r.time = snap->time;
+    r.v[0] = snap->VRMS;
+    r.v[1] = snap->IRMS;
+    r.v[2] = snap->vpeak;
+    r.v[3] = snap->ipeak;
+    r.v[4] = snap->periodus;
+    r.v[5] = snap->VA;
+    r.v[6] = snap->W;
+    r.v[7] = snap->VAEnergy;
+    r.v[8] = snap->WEnergy;
+    r.v[9] = snap->PF;
+    r.v[10] = snap->WhImport;
+    r.v[11] = snap->WhExport;
+    r.v[12] = snap->VAh;
+    r.v[13] = snap->status;
+
+    n = DLencode(&deltaState[snap->circuitID],&r,entry);
+    if (deltaLen + n > FRMAXRECORD) {
+        writeDeltas();
+    }
+    if (deltaLen == 0) {
+        deltaRecord[0] = RECDELTA;
+        deltaRecord[1] = deltaFrames;
+        deltaLen = RECDELTAMIN;
+    }
+    memcpy(&deltaRecord[deltaLen],entry,n);
+    deltaLen += n;
 }
 
+/** Sends the RECDELTA record of the sweep, if it holds any reports. */
+void writeDeltas()
+{
+    if (deltaLen == 0) return;
+    writeRecord(deltaRecord,deltaLen);
+    deltaFrames++;
+    deltaLen = 0;
+}
@@ -4,14 +4,42 @@
 #include "Circuit/circuit.h"
  
 #define SERBUFFSIZE 64
+/** Reports are assembled in a buffer of this size and then sent, see Format/Line.h. */
+#define METERLINESIZE 128
+/** Lines that can wait in the command queue plus one, a power of two. */
+#define METERQUEUESIZE 4
+/** Report on change defaults, deadbands in report units and intervals in seconds. */
+#define METERDEADBANDW 5
+#define METERDEADBANDIRMS 50
+#define METERDEADBANDVRMS 2000
+#define METERMAXSILENCE 300
+#define METERKEYFRAME 900
+/** Subscription interval that follows reportInterval. */
+#define METERFOLLOW -2
+/** Circuits due this soon are reported with a sweep that is taken anyway. */
+#define METERMERGEMS 500
+/** Fields of the records in the SD card log. */
+#define METERLOGFIELDS CFDEFAULT
+/** Logged records read and sent per pass of meterMode while a replay runs. */
+#define METERREPLAYBATCH 4
 extern float sampleTime_ms;
 
+void meterInit();
 void meterMode();
+void meterPoll();
 void parseMeterMode(char *cmd);
 void printMeter(Circuit* ckt);
 void meter(Circuit* ckt);
 void meterAll();
+void meterDue();
+void meterChanged();
+void meterReady(Circuit* ckt);
 void meterAuto();
-void printResults(char action, int8_t circuitID, int32_t arg);
+void printResults(char action, int8_t circuitID, int32_t arg, uint16_t tag);
+void writeRecord(const uint8_t *record, uint8_t n);
+void printSnapshot(const Csnapshot *snap, uint32_t seq, uint16_t fields, uint8_t withEnergy);
+void writeMeterRecords(const Csnapshot *snap, uint16_t seq, uint16_t fields, uint8_t withEnergy);
+void addDelta(const Csnapshot *snap, uint32_t seq, uint16_t fields);
+void writeDeltas();
 
 #endif
@@ -21,16 +21,20 @@
 // Helper functions
 #include "prescaler.h"
 #include "arduino/wiring.h"
+#include "ReturnCode/returncode.h"
 
 // Metering Hardware
 #include "SPI/SPI.h"
 #include "DbgTel/DbgTel.h"
 #include "Select/select.h"
 #include "sd-reader/sd_raw.h"
+#include "SDLog/sdlog.h"
 #include "Switches/switches.h"
 
 // Metering logic
+#include "ADE7753/ADE7753.h"
 #include "Circuit/circuit.h"
+#include "PowerFail/powerfail.h"
 
 // Meter modes
 #include "cfg.h"
@@ -60,17 +64,35 @@ void setup()
 
     DbgTelInit();				// Blink leds
     initSelect();				// Select Circuit done in sd_raw_init
-    //sd_raw_init();			//SDCard
     SPI.begin();				// SPI
     SWinit();                   // Switches
+    ADEinitIrq();               // ADE IRQ lines
 
     // Load circuit data from EEPROM
     for (int i=0; i < NCIRCUITS; i++) {
-        Cload(&ckts[i],&cktsSave[i]);
+        Cload(&ckts[i],cktsSave[i],&cktsDividerSave[i]);
     }
+    // Energy totals as they were when the power went
+    if (PFinit(NCIRCUITS)) {
+        dbg.println("Energy totals restored after power loss");
+    }
+    ELopen(&testLog,testLogSave,sizeof(testLogSave),TESTLOGRECORD);
+    // Program the ADEs that are plugged in, sweeps skip the others
+    CprobeAll(ckts,NCIRCUITS);
+    meterInit();
+    // SD card log, see meterMode
+    if (sd_raw_available()) {
+        dbg.print("SD log: ");
+        dbg.println(RCstr(SLopen()));
+    }
+    dbg.print("ADEs present:");
     for (int i=0; i < NCIRCUITS; i++) {
-        Cprogram(&ckts[i]);
+        if (ckts[i].connected) {
+            dbg.print(" ");
+            dbg.print(i);
+        }
     }
+    dbg.println();
 }
 
 /**
@@ -78,8 +100,11 @@ void setup()
  * */
 void loop()
 {   
+    PFpoll();
     switch (mode) {
         case METERMODE:
+        case METERBINMODE:
+        case METERDELTAMODE:
             meterMode();
             break;
         case INTERACTIVEMODE:
@@ -5,6 +5,10 @@
 
 void setup();
 void loop();
+#ifdef __AVR__
 void wdt_init(void) __attribute__((naked)) __attribute__((section(".init3")));
+#else
+void wdt_init(void);
+#endif
 
 #endif
@@ -1,7 +1,9 @@
+#include <avr/sleep.h>
 #include "arduino/WProgram.h"
 #include "arduino/wiring.h"
 #include "SPI/SPI.h"
 #include "ReturnCode/returncode.h"
+#include "Select/select.h"
 
 #include "ADE7753.h"
 
@@ -56,20 +58,103 @@ const int intListLen = sizeof(intList)/sizeof(intList[0]);
 const ADEReg *regList[] = { &WAVEFORM, &AENERGY, &RAENERGY, &LAENERGY, &VAENERGY, &RVAENERGY, &LVAENERGY, &LVARENERGY, &MODE, &IRQEN, &STATUS, &RSTSTATUS, &CH1OS, &CH2OS, &GAIN, &PHCAL, &APOS, &WGAIN, &WDIV, &CFNUM, &CFDEN, &IRMS, &VRMS, &IRMSOS, &VRMSOS, &VAGAIN, &VADIV, &LINECYC, &ZXTOUT, &SAGCYC, &SAGLVL, &IPKLVL, &VPKLVL, &IPEAK, &RSTIPEAK, &VPEAK, &TEMP, &PERIOD, &TMODE, &CHKSUM, &DIEREV };
 const int regListSize = sizeof(regList);
 
+/** SPI dividers the ADEs may run at from fastest to slowest. */
+static const uint8_t ADESPILADDER[] = {SPI_CLOCK_DIV2, SPI_CLOCK_DIV4, SPI_CLOCK_DIV8, 
+    SPI_CLOCK_DIV16, SPI_CLOCK_DIV32, SPI_CLOCK_DIV64, SPI_CLOCK_DIV128};
+#define ADESPINRATES ((int8_t)sizeof(ADESPILADDER))
+
+/** Index into ADESPILADDER of each device. */
+static int8_t _ADErate[NCIRCUITS] = {0};
+/** Checksums verified and failed on each device in the current window.*/
+static uint8_t _ADEchecks[NCIRCUITS] = {0};
+static uint8_t _ADEerrors[NCIRCUITS] = {0};
+
 /**
-* returns BYTES from the ADE in a uint32_t value
-* MSB of ADE output is the MSB of the data output
-* Low level read and write for ADE. ALL reads and writes to the ADE use this 
-* function, change it if you want to use some other protocol than SPI.
-* @warning SPI mode is changed after calling this funciton
-*/
-void ADEreadData(ADEReg reg, uint32_t *data)
+ * Sets the SPI clock divider used to talk to device. 
+ * Dividers that are not in ADESPILADDER select the fastest one.
+ * */
+void ADEsetClockDivider(int8_t device, uint8_t divider)
 {
-    uint8_t nBytes = (reg.nBits+7)/8;
+    if (!(0 <= device && device < NCIRCUITS)) return;
+    _ADErate[device] = 0;
+    for (int8_t i=0; i < ADESPINRATES; i++) {
+        if (ADESPILADDER[i] == divider) {
+            _ADErate[device] = i;
+        }
+    }
+    _ADEchecks[device] = 0;
+    _ADEerrors[device] = 0;
+}
+
+/**
+ * @return the SPI clock divider currently used for device.
+ * */
+uint8_t ADEgetClockDivider(int8_t device)
+{
+    if (!(0 <= device && device < NCIRCUITS)) return SPI_CLOCK_DIV128;
+    return ADESPILADDER[_ADErate[device]];
+}
 
+/**
+ * Moves device to the next slower SPI clock.
+ * @return true if there was a slower clock to move to.
+ * */
+int8_t ADEslowDown(int8_t device)
+{
+    if (!(0 <= device && device < NCIRCUITS)) return false;
+    _ADEchecks[device] = 0;
+    _ADEerrors[device] = 0;
+    if (_ADErate[device] < ADESPINRATES-1) {
+        _ADErate[device]++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Records the outcome of a checksum or write verification on the selected device.
+ * After ADESPIMAXERRS failures within ADESPIWINDOW checks the device is moved 
+ * to the next slower SPI clock.
+ * */
+static void _ADEtrackComms(int8_t ok)
+{
+    int device = CSgetDevice();
+    if (!(0 <= device && device < NCIRCUITS)) return;
+
+    _ADEchecks[device]++;
+    if (!ok) {
+        _ADEerrors[device]++;
+    }
+    if (_ADEerrors[device] >= ADESPIMAXERRS) {
+        ADEslowDown(device);
+    } else if (_ADEchecks[device] >= ADESPIWINDOW) {
+        _ADEchecks[device] = 0;
+        _ADEerrors[device] = 0;
+    }
+}
+
+/**
+ * Sets the SPI mode and speed for the selected ADE. Only needs to be done once per 
+ * chip select session as long as no other device uses the bus in between.
+ * */
+static void _ADEconfigureSPI()
+{
+	int device = CSgetDevice();
+	uint8_t divider = SPI_CLOCK_DIV128;
+	if (0 <= device && device < NCIRCUITS) {
+		divider = ADESPILADDER[_ADErate[device]];
+	}
 	SPI.setDataMode(SPI_MODE1);
-    //SPI speed is f_osc/128
-    SPI.setClockDivider(SPI_CLOCK_DIV128);
+    SPI.setClockDivider(divider);
+}
+
+/**
+ * Reads reg assuming the bus is already configured. 
+ * The MSB of the ADE output is the MSB of data.
+ * */
+static void _ADEtransferRead(const ADEReg &reg, uint32_t *data)
+{
+    uint8_t nBytes = (reg.nBits+7)/8;
 
 	//now transfer the readInstuction/registerAddress: i.e. 00xxxxxx -AM
 	SPI.transfer(reg.addr);
@@ -77,10 +162,53 @@ void ADEreadData(ADEReg reg, uint32_t *data)
 	uint8_t msb = sizeof(*data)-1;
 	*data = 0;
 	for (int i=0; i<nBytes; i++) {
+		// The gap is idle SCK time, so a slow clock does not cover it
+		delayMicroseconds(ADEBYTEGAPUS);
 		((byte*)data)[msb-i] = SPI.transfer(0x00);
 	}
 }
 
+/**
+ * Converts the raw MSB aligned data of reg into a right aligned signed or unsigned value.
+ * Sets _retCode to FAILURE for sign types that can't be converted.
+ * */
+static void _ADErawToValue(const ADEReg &reg, uint32_t rawData, int32_t *regValue)
+{
+	uint8_t nBytes = (reg.nBits+7)/8;
+
+	//Push bits into MSB for irregular sizes
+	rawData <<= (nBytes*8-reg.nBits);
+	if (reg.signType == TWOS) {
+		//Make signed
+		*regValue = rawData;
+		//Use signed shift for 8 byte alignment, then to move LSB to 0 byte
+		(*regValue) >>= (nBytes*8-reg.nBits);
+		(*regValue) >>= ((sizeof(*regValue)-nBytes)*8);
+
+	} else if (reg.signType == UNSIGN) {
+		//Use unsigned shift for 8 byte alignment, then to move LSB to 0 byte
+		rawData >>= (nBytes*8-reg.nBits);
+		rawData >>= ((sizeof(rawData)-nBytes)*8);
+		*regValue = rawData;
+	} else {
+		//Was for CH1OS/CH2OS not used
+		_retCode = FAILURE;
+	}
+}
+
+/**
+* returns BYTES from the ADE in a uint32_t value
+* MSB of ADE output is the MSB of the data output
+* Low level read and write for ADE. ALL reads and writes to the ADE use this 
+* function, change it if you want to use some other protocol than SPI.
+* @warning SPI mode is changed after calling this funciton
+*/
+void ADEreadData(ADEReg reg, uint32_t *data)
+{
+	_ADEconfigureSPI();
+	_ADEtransferRead(reg,data);
+}
+
 /**
  * Low level read and write for ADE. ALL reads and writes to the ADE use this 
  * function, change it if you want to use some other protocol than SPI.
@@ -89,16 +217,15 @@ void ADEwriteData(ADEReg reg, uint32_t *data)
 {
 	uint8_t nBytes = (reg.nBits+7)/8;
 
-    //SPI speed is f_osc/128
-	SPI.setDataMode(SPI_MODE1);
-    SPI.setClockDivider(SPI_CLOCK_DIV128);
+	_ADEconfigureSPI();
 
 	//now transfer the write Instuction/registerAddress: i.e. 10xxxxxx -JR
 	SPI.transfer(reg.addr | 0x80);
 	//now write the data on the SPI data register byte-by-byte with the MSB first - AM
 	const uint8_t msb = sizeof(*data)-1;
 	for (uint8_t i=0; i<nBytes; i++) {
-		 SPI.transfer( ((byte*)data)[msb-i] );
+		delayMicroseconds(ADEBYTEGAPUS);
+		SPI.transfer( ((byte*)data)[msb-i] );
 	}
 }
 
@@ -111,7 +238,6 @@ void ADEgetRegister(ADEReg reg, int32_t *regValue)
 	//get raw data, MSB of data is MSB from ADE irrespective of byte length
 	_retCode = SUCCESS;
 	uint32_t rawData = 0;
-	uint8_t nBytes = (reg.nBits+7)/8;
 	uint32_t chksum = 0;
 
 	ADEreadData(reg, &rawData);
@@ -121,37 +247,60 @@ void ADEgetRegister(ADEReg reg, int32_t *regValue)
 	} else {
 		_retCode = SUCCESS;
 	}
+	_ADEtrackComms(_retCode == SUCCESS);
+	_ADErawToValue(reg,rawData,regValue);
+}
 
-	//Push bits into MSB for irregular sizes
-	rawData <<= (nBytes*8-reg.nBits);
-	if (reg.signType == TWOS) {
-		//Make signed
-		*regValue = rawData;
-		//Use signed shift for 8 byte alignment, then to move LSB to 0 byte
-		(*regValue) >>= (nBytes*8-reg.nBits);
-		(*regValue) >>= ((sizeof(*regValue)-nBytes)*8);
-
-	} else if (reg.signType == UNSIGN) {
-		//Use unsigned shift for 8 byte alignment, then to move LSB to 0 byte
-		rawData >>= (nBytes*8-reg.nBits);
-		rawData >>= ((sizeof(rawData)-nBytes)*8);
-		*regValue = rawData;
-	} else {
-		//Was for CH1OS/CH2OS not used
-		/* if(reg.signType == SIGNMAG) {
-		bool sign = rawData&(1<<(sizeof(uint32_t)-1));
-		rawData &= ~(1<<(sizeof(uint32_t)-1));
-		if (sign) { //MSB is one
-			*regValue = -rawData;
-		} else {
-			*regValue = rawData;
-		}*/
-		_retCode = FAILURE;
+/**
+ * @return true if the read of reg should be followed by a CHKSUM read under chkPolicy.
+ * */
+static int8_t _ADEshouldCheck(const ADEReg *reg, uint8_t chkPolicy)
+{
+	static uint8_t sample = 0;
+	switch (chkPolicy) {
+		case ADECHK_SAMPLED:
+			sample = (sample+1)%ADECHKSAMPLE;
+			return sample == 0;
+		case ADECHK_ENERGY:
+			return AENERGY.addr <= reg->addr && reg->addr <= LVARENERGY.addr;
+		default:
+			return true;
 	}
-	
-	
+}
+
+/**
+ * Reads n registers from the selected ADE in one chip select session.
+ * The bus is configured once and the reads are streamed back to back.
+ * Whether a read is followed by a CHKSUM read is decided by chkPolicy:
+ * - ADECHK_ALL every register as ADEgetRegister does,
+ * - ADECHK_SAMPLED one in ADECHKSAMPLE reads. The count carries over between calls
+ *   so every position in a block is eventually verified,
+ * - ADECHK_ENERGY only the energy registers (AENERGY through LVARENERGY).
+ *
+ * Stops at the first failed checksum with _retCode set to COMMERR, leaving the 
+ * remaining out[] untouched and their read-and-reset registers unread.
+ * */
+void ADEreadBlock(const ADEReg *regs[], int32_t out[], uint8_t n, uint8_t chkPolicy)
+{
+	uint32_t rawData;
+	uint32_t chksum;
 
-	/*Serial.println("ADEgetRegister EXIT");*/
+	_retCode = SUCCESS;
+	_ADEconfigureSPI();
+	for (uint8_t i=0; i < n; i++) {
+		_ADEtransferRead(*regs[i],&rawData);
+		if (_ADEshouldCheck(regs[i],chkPolicy)) {
+			_ADEtransferRead(CHKSUM,&chksum);
+			int8_t ok = (ADEchksum(rawData) == ((uint8_t*)&chksum)[3]);
+			_ADEtrackComms(ok);
+			if (!ok) {
+				_retCode = COMMERR;
+				return;
+			}
+		}
+		_ADErawToValue(*regs[i],rawData,&out[i]);
+		ifnsuccess(_retCode) return;
+	}
 }
 
 /**
@@ -184,6 +333,7 @@ void ADEsetRegister(ADEReg reg, int32_t *value)
 	if ((writeData<<shiftBits) != (readData<<shiftBits)) {
 		_retCode = COMMERR;
 	}
+	_ADEtrackComms(_retCode != COMMERR);
 	
 }
 
@@ -258,6 +408,98 @@ void ADEsetCHXOS(const uint8_t X,const int8_t *enableInt,const int8_t *val)
 	}
 }
 
+/** Set by the pin change ISR when the IRQ line of a circuit falls. */
+static volatile uint8_t _ADEirqFlags[NCIRCUITS] = {0};
+/** micros() when the IRQ line of a circuit last fell. */
+static volatile uint32_t _ADEirqTime[NCIRCUITS];
+/** micros() at the start of the read in which ADEreadInterrupt last saw its event. */
+static uint32_t _ADEeventTime;
+
+/**
+  * Pin change ISR of the routed IRQ lines. A falling line marks every 
+  * circuit on that pin as pending since with wired-OR lines the ISR cannot 
+  * tell which ADE pulled it low.
+  */
+static void _ADEirqISR()
+{
+	uint32_t now = micros();
+	for (int8_t i=0; i < NCIRCUITS; i++) {
+		int8_t pin = CSgetIrqPin(i);
+		if (pin != NOIRQPIN && digitalRead(pin) == LOW) {
+			if (!_ADEirqFlags[i]) _ADEirqTime[i] = now;
+			_ADEirqFlags[i] = true;
+		}
+	}
+}
+
+/**
+  * Attaches the pin change interrupt of every circuit whose IRQ line is 
+  * routed to the MCU. The line is open drain so the pull up is enabled.
+  */
+void ADEinitIrq()
+{
+	for (int8_t i=0; i < NCIRCUITS; i++) {
+		int8_t pin = CSgetIrqPin(i);
+		if (pin == NOIRQPIN) continue;
+		pinMode(pin,INPUT);
+		digitalWrite(pin,HIGH);
+		attachPinChangeInterrupt(pin,_ADEirqISR);
+	}
+}
+
+/**
+  * Checks, without any SPI traffic, whether the IRQ line of a device has 
+  * been asserted since the last call. Clears the pending flag.
+  * The IRQ line stays low until RSTSTATUS is read, so that read has to follow 
+  * a true return or the next event will not produce an edge.
+  * @return true if the line fell or is still low, and always true if the 
+  * line is not routed so callers fall back to polling.
+  */
+int8_t ADEirqPending(int8_t device)
+{
+	int8_t pin = CSgetIrqPin(device);
+	if (pin == NOIRQPIN) return true;
+	if (_ADEirqFlags[device]) {
+		_ADEirqFlags[device] = false;
+		return true;
+	}
+	return digitalRead(pin) == LOW;
+}
+
+/**
+  * @return micros() when the IRQ line of a device last fell, which is 
+  * when its event happened as long as the line was high before.
+  */
+uint32_t ADEirqTime(int8_t device)
+{
+	uint8_t oldSREG = SREG;
+	uint32_t t;
+	cli();
+	t = _ADEirqTime[device];
+	SREG = oldSREG;
+	return t;
+}
+
+/**
+  * @return micros() at the start of the RSTSTATUS read in which 
+  * ADEreadInterrupt last returned true. When it is polled back to back the 
+  * event happened at most one read before.
+  */
+uint32_t ADEeventTime()
+{
+	return _ADEeventTime;
+}
+
+/**
+  * Sleeps until the next interrupt. That is at the latest the next millis() 
+  * tick, an IRQ edge or a received byte.
+  */
+void ADEidle()
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_mode();
+}
+
 /** 
   * @return 1 if interrupt is fired. Returns 0 otherwise or if a failure occurs.
   * @ warning The proper flag in the Enable interrupt register must also be set.
@@ -266,20 +508,47 @@ void ADEsetCHXOS(const uint8_t X,const int8_t *enableInt,const int8_t *val)
 int8_t ADEreadInterrupt(uint16_t regMask)
 {
 	int32_t status;
+	uint32_t t = micros();
 	ADEgetRegister(RSTSTATUS,&status);
 	ifsuccess(_retCode) {
 		if (regMask == ZX0) {
 			status = ~status;
 			regMask = ZX;
 		}
-		return ((status & regMask) != 0);
+		if ((status & regMask) == 0) return 0;
+		_ADEeventTime = t;
+		return 1;
 	} else {
 		return 0;
 	}
 }
 
+/**
+  * ADEwaitForInterrupt for events which drive the IRQ line. RSTSTATUS is only 
+  * read after the line fell and the CPU sleeps in between.
+  */
+static void _ADEwaitForIrq(uint16_t regMask, uint16_t waitTimems)
+{
+	int8_t device = CSgetDevice();
+	unsigned long start = millis();
+	do {
+		if (ADEirqPending(device)) {
+			if (ADEreadInterrupt(regMask)) return;
+			ifnsuccess(_retCode) return;
+		} else {
+			ADEidle();
+		}
+	} while (millis() - start <= waitTimems);
+	// One last look in case the edge was missed
+	if (ADEreadInterrupt(regMask)) return;
+	ifnsuccess(_retCode) return;
+	_retCode = TIMEOUT;
+}
+
 /** Will wait at least waitTimems milliseconds before exiting.
   _retCode is SUCCESS if interrupt was fired, TIMEOUT otherwise.
+  If the device's IRQ line is routed and every bit of regMask is enabled in 
+  IRQEN the wait sleeps on the IRQ line instead of polling RSTSTATUS.
   @warning does not reset register, that is the users responsibility
 
   */
@@ -289,6 +558,15 @@ void ADEwaitForInterrupt(uint16_t regMask, uint16_t waitTimems)
 	unsigned long time = millis();
 	unsigned long endTime = time + waitTimems;
     RCreset();
+	// ZX0 waits for the absence of ZX which cannot raise an interrupt
+	if (regMask != ZX0 && CSgetIrqPin(CSgetDevice()) != NOIRQPIN) {
+		ADEgetRegister(IRQEN,&status);
+		ifnsuccess(_retCode) return;
+		if ((status & regMask) == regMask) {
+			_ADEwaitForIrq(regMask,waitTimems);
+			return;
+		}
+	}
 	if (time > endTime) {
 		//wait for rollover
 		do {
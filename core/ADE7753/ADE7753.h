@@ -117,6 +117,21 @@ static const uint8_t ZO=0b01;
 static const uint8_t OZ=0b10;
 static const uint8_t OO=0b11;
 
+/**
+	Checksum policies for ADEreadBlock
+*/
+enum {ADECHK_ALL=0, ADECHK_SAMPLED=1, ADECHK_ENERGY=2};
+#define ADECHKSAMPLE 3
+
+/**
+	Adaptive SPI clock. A device is moved to the next slower clock after 
+	ADESPIMAXERRS communication errors within ADESPIWINDOW checks.
+*/
+#define ADESPIWINDOW 64
+#define ADESPIMAXERRS 2
+/** Minimum time between bytes in a transfer (t7, t9 of the datasheet) at any SCK */
+#define ADEBYTEGAPUS 4
+
 extern const ADEReg *regList[];// = { &WAVEFORM, &AENERGY, &RAENERGY, &LAENERGY, &VAENERGY, &RVAENERGY, &LVAENERGY, &LVARENERGY, &MODE, &IRQEN, &STATUS, &RSTSTATUS, &CH1OS, &CH2OS, &GAIN, &PHCAL, &APOS, &WGAIN, &WDIV, &CFNUM, &CFDEN, &IRMS, &VRMS, &IRMSOS, &VRMSOS, &VAGAIN, &VADIV, &LINECYC, &ZXTOUT, &SAGCYC, &SAGLVL, &IPKLVL, &VPKLVL, &IPEAK, &RSTIPEAK, &VPEAK, &TEMP, &PERIOD, &TMODE, &CHKSUM, &DIEREV };
 extern const int regListSize;
 
@@ -127,10 +142,19 @@ extern const int regListSize;
 void ADEreadData(ADEReg, uint32_t*);
 void ADEwriteData(ADEReg, uint32_t*);
 void ADEgetRegister(ADEReg, int32_t*);
+void ADEreadBlock(const ADEReg *regs[], int32_t out[], uint8_t n, uint8_t chkPolicy);
+void ADEsetClockDivider(int8_t device, uint8_t divider);
+uint8_t ADEgetClockDivider(int8_t device);
+int8_t ADEslowDown(int8_t device);
 void ADEsetRegister(ADEReg, int32_t*);
 uint8_t ADEchksum(uint32_t);
 void ADEgetCHXOS(const uint8_t X,int8_t *enableBit,int8_t *val);
 void ADEsetCHXOS(const uint8_t X,const int8_t *enableInt,const int8_t *val);
+void ADEinitIrq();
+int8_t ADEirqPending(int8_t device);
+uint32_t ADEirqTime(int8_t device);
+uint32_t ADEeventTime();
+void ADEidle();
 int8_t ADEreadInterrupt(uint16_t regMask);
 void ADEwaitForInterrupt(uint16_t regMask, uint16_t waitTimems);
 void ADEsetModeBit(uint16_t regMask, uint8_t bit);
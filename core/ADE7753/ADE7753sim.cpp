@@ -0,0 +1,506 @@
+/** @file ADE7753sim.cpp
+ *
+ *  The model is evaluated lazily. Every SPI byte first advances the selected
+ *  chip from the time of its last access to micros(), walking over each zero
+ *  crossing in between so that LINECYC windows, peaks and ZX flags land on
+ *  the right half cycle.
+ */
+#include <math.h>
+#include <string.h>
+
+#include "Select/select.h"
+#include "ADE7753.h"
+#include "ADE7753sim.h"
+
+extern "C" unsigned long micros(void);
+
+#define CLKIN 3579545.0
+#define NREGS 0x40
+#define MASK(bits) ((bits) >= 32 ? 0xFFFFFFFF : ((1UL<<(bits))-1))
+
+/** Transaction state of the serial interface. */
+enum {ADESIM_CMD=0, ADESIM_READ=1, ADESIM_WRITE=2};
+
+typedef struct {
+    int8_t present;
+    float vrms;
+    float irms;
+    float phase;            // Current lag in radians
+    float freq;
+    float bitErrorRate;
+    uint16_t flips;
+    uint32_t maxSck;        // Fastest clock the cable to the chip carries, 0 for no limit
+
+    uint32_t reg[NREGS];
+
+    uint8_t state;
+    uint8_t addr;
+    uint8_t nBytes;
+    uint8_t byteIdx;
+    uint32_t shift;
+
+    unsigned long t_us;     // Time the chip was last advanced to
+    double halfCycles;      // Line phase in half cycles
+    double aFrac;           // Fractional energy counts
+    double vaFrac;
+    double varFrac;
+    int32_t lineA;
+    uint32_t lineVA;
+    int32_t lineVAR;
+    uint16_t lineCount;
+    double idle;            // Seconds without a zero crossing
+    double wsmp;            // Fractional waveform samples
+} ADESIMchip;
+
+ADESIMstats ADESIMstat;
+
+static ADESIMchip _chips[NCIRCUITS];
+static int _selected = DEVDISABLE;
+static uint8_t _nBits[NREGS];
+static uint8_t (*_isOn)(int8_t chip) = 0;
+static uint32_t _rand = 0x2545F491;
+static uint32_t _sck = 0;
+
+/** Power on values from the ADE7753 datasheet. */
+static void _powerOn(ADESIMchip *c)
+{
+    memset(c->reg,0,sizeof(c->reg));
+    c->reg[MODE.addr] = 0x000C;
+    c->reg[IRQEN.addr] = RESET;
+    c->reg[STATUS.addr] = RESET;
+    c->reg[PHCAL.addr] = 0x0D;
+    c->reg[CFNUM.addr] = 0x3F;
+    c->reg[CFDEN.addr] = 0x3F;
+    c->reg[LINECYC.addr] = 0xFFFF;
+    c->reg[ZXTOUT.addr] = 0xFFF;
+    c->reg[SAGCYC.addr] = 0xFF;
+    c->reg[IPKLVL.addr] = 0xFF;
+    c->reg[VPKLVL.addr] = 0xFF;
+    c->reg[TEMP.addr] = 0x19;
+    c->reg[DIEREV.addr] = 0x02;
+    c->state = ADESIM_CMD;
+    c->aFrac = c->vaFrac = c->varFrac = 0;
+    c->lineA = c->lineVA = c->lineVAR = 0;
+    c->lineCount = 0;
+    c->idle = 0;
+    c->wsmp = 0;
+}
+
+/** Sign extends an nBits wide two's complement value. */
+static int32_t _signed(uint32_t v, uint8_t nBits)
+{
+    if (v & (1UL<<(nBits-1))) {
+        return (int32_t)(v | ~MASK(nBits));
+    }
+    return (int32_t)v;
+}
+
+/** Gain of the WGAIN/VAGAIN style 12-bit registers divided by the 8-bit WDIV/VADIV registers. */
+static double _gain(ADESIMchip *c, const ADEReg &gain, const ADEReg &div)
+{
+    double g = 1.0 + _signed(c->reg[gain.addr],12)/4096.0;
+    if (c->reg[div.addr] > 1) {
+        g /= c->reg[div.addr];
+    }
+    return g;
+}
+
+static double _current(ADESIMchip *c)
+{
+    if (_isOn && !_isOn((int8_t)(c-_chips))) {
+        return 0;
+    }
+    return c->irms;
+}
+
+static void _flag(ADESIMchip *c, uint16_t mask)
+{
+    c->reg[STATUS.addr] |= mask;
+}
+
+/** Adds whole energy counts to a 24-bit energy register setting its half-full and overflow flags.*/
+static void _addActive(ADESIMchip *c, int32_t counts)
+{
+    int32_t old = _signed(c->reg[AENERGY.addr],24);
+    int32_t now = old + counts;
+    if (now > 0x7FFFFF || now < -0x800000) {
+        _flag(c,AEOF);
+    }
+    if ((old < 0x400000 && now >= 0x400000) || (old > -0x400000 && now <= -0x400000)) {
+        _flag(c,AEHF);
+    }
+    c->reg[AENERGY.addr] = (uint32_t)now & MASK(24);
+}
+
+static void _addApparent(ADESIMchip *c, uint32_t counts)
+{
+    uint32_t old = c->reg[VAENERGY.addr];
+    uint32_t now = old + counts;
+    if (now > 0xFFFFFF) {
+        _flag(c,VAEOF);
+    }
+    if (old < 0x800000 && now >= 0x800000) {
+        _flag(c,VAEHF);
+    }
+    c->reg[VAENERGY.addr] = now & MASK(24);
+}
+
+/** Integrates power over seconds into the energy and line cycle accumulators.*/
+static void _accumulate(ADESIMchip *c, double seconds)
+{
+    double i = _current(c);
+    double s = c->vrms*i*ADESIM_ECOUNTS*seconds;
+    int32_t counts;
+
+    c->aFrac += s*cos(c->phase)*_gain(c,WGAIN,WDIV);
+    counts = (int32_t)c->aFrac;
+    c->aFrac -= counts;
+    _addActive(c,counts);
+    c->lineA += counts;
+
+    c->vaFrac += s*_gain(c,VAGAIN,VADIV);
+    counts = (int32_t)c->vaFrac;
+    c->vaFrac -= counts;
+    _addApparent(c,counts);
+    c->lineVA += counts;
+
+    c->varFrac += s*sin(c->phase);
+    counts = (int32_t)c->varFrac;
+    c->varFrac -= counts;
+    c->lineVAR += counts;
+
+    if (c->reg[IRQEN.addr] & WSMP) {
+        c->wsmp += seconds*CLKIN/128/(1 << ((c->reg[MODE.addr] >> 11) & 0x03));
+        if (c->wsmp >= 1) {
+            c->wsmp -= floor(c->wsmp);
+            _flag(c,WSMP);
+        }
+    }
+}
+
+/** Peak registers hold the largest sample seen since they were last reset.*/
+static void _peaks(ADESIMchip *c)
+{
+    uint32_t ipk = (uint32_t)(_current(c)*M_SQRT2*ADESIM_ICOUNTS);
+    uint32_t vpk = (uint32_t)(c->vrms*M_SQRT2*ADESIM_VCOUNTS);
+    if (ipk > c->reg[IPEAK.addr]) c->reg[IPEAK.addr] = ipk & MASK(24);
+    if (vpk > c->reg[VPEAK.addr]) c->reg[VPEAK.addr] = vpk & MASK(24);
+    if ((ipk >> 16) > c->reg[IPKLVL.addr]) _flag(c,PKI);
+    if ((vpk >> 16) > c->reg[VPKLVL.addr]) _flag(c,PKV);
+}
+
+/** LINECYC counts half line cycles i.e. every zero crossing.*/
+static void _zeroCrossing(ADESIMchip *c)
+{
+    _flag(c,ZX);
+    c->idle = 0;
+    _peaks(c);
+    if (!(c->reg[MODE.addr] & CYCMODE)) {
+        return;
+    }
+    c->lineCount++;
+    if (c->lineCount >= c->reg[LINECYC.addr]) {
+        c->reg[LAENERGY.addr] = (uint32_t)c->lineA & MASK(24);
+        c->reg[LVAENERGY.addr] = c->lineVA & MASK(24);
+        c->reg[LVARENERGY.addr] = (uint32_t)c->lineVAR & MASK(24);
+        c->lineA = c->lineVA = c->lineVAR = 0;
+        c->lineCount = 0;
+        _flag(c,CYCEND);
+    }
+}
+
+/** Advances a chip to now.*/
+static void _update(ADESIMchip *c, unsigned long now)
+{
+    // A pin change ISR run from micros() may already have moved the chip past now
+    if ((long)(now - c->t_us) <= 0) return;
+    double dt = (now - c->t_us)*1e-6;
+    c->t_us = now;
+
+    if (c->freq > 0 && c->vrms > 0) {
+        double h = c->halfCycles;
+        double end = h + dt*2*c->freq;
+        double next = floor(h) + 1;
+        while (next <= end) {
+            _accumulate(c,(next-h)/(2*c->freq));
+            h = next;
+            _zeroCrossing(c);
+            next += 1;
+        }
+        _accumulate(c,(end-h)/(2*c->freq));
+        c->halfCycles = end - 2*floor(end/2);
+        c->reg[PERIOD.addr] = (uint32_t)(1e6/c->freq/2.2) & MASK(16);
+    } else {
+        double before = c->idle;
+        _accumulate(c,dt);
+        c->idle += dt;
+        // ZXTOUT is in units of 128/CLKIN
+        double zxto = c->reg[ZXTOUT.addr]*128/CLKIN;
+        if (before < zxto && c->idle >= zxto) {
+            _flag(c,ZXTO);
+        }
+        // SAGCYC is in half cycles of the nominal 50Hz line
+        if (!(c->reg[MODE.addr] & DISSAG) && before < c->reg[SAGCYC.addr]*0.01
+                && c->idle >= c->reg[SAGCYC.addr]*0.01) {
+            _flag(c,SAG);
+        }
+    }
+}
+
+/** Instantaneous WAVEFORM sample of the signal selected by WAVESEL.*/
+static uint32_t _waveform(ADESIMchip *c)
+{
+    double angle = c->halfCycles*M_PI;
+    double v = c->vrms*M_SQRT2*ADESIM_VCOUNTS*sin(angle);
+    double i = _current(c)*M_SQRT2*ADESIM_ICOUNTS*sin(angle - c->phase);
+    double sample;
+    switch ((c->reg[MODE.addr] >> 13) & 0x03) {
+        case OO: sample = v; break;
+        case OZ: sample = i; break;
+        default: sample = v*i/(1L<<23); break;
+    }
+    return (uint32_t)(int32_t)sample & MASK(24);
+}
+
+/** Returns the value of a register and performs the read side effects.*/
+static uint32_t _read(ADESIMchip *c, uint8_t addr)
+{
+    uint32_t value;
+    double rms;
+
+    if (addr == WAVEFORM.addr) {
+        value = (c->reg[IRQEN.addr] & WSMP) ? _waveform(c) : 0;
+    } else if (addr == RAENERGY.addr) {
+        value = c->reg[AENERGY.addr];
+        c->reg[AENERGY.addr] = 0;
+    } else if (addr == RVAENERGY.addr) {
+        value = c->reg[VAENERGY.addr];
+        c->reg[VAENERGY.addr] = 0;
+    } else if (addr == RSTSTATUS.addr) {
+        value = c->reg[STATUS.addr];
+        c->reg[STATUS.addr] = 0;
+    } else if (addr == RSTIPEAK.addr) {
+        value = c->reg[IPEAK.addr];
+        c->reg[IPEAK.addr] = 0;
+    } else if (addr == RSTVPEAK.addr) {
+        value = c->reg[VPEAK.addr];
+        c->reg[VPEAK.addr] = 0;
+    } else if (addr == IRMS.addr) {
+        // IRMS^2 = IRMS0^2 + 32768*IRMSOS
+        rms = _current(c)*ADESIM_ICOUNTS;
+        rms = rms*rms + 32768.0*_signed(c->reg[IRMSOS.addr],12);
+        value = rms > 0 ? (uint32_t)sqrt(rms) : 0;
+    } else if (addr == VRMS.addr) {
+        rms = c->vrms*ADESIM_VCOUNTS + _signed(c->reg[VRMSOS.addr],12);
+        value = rms > 0 ? (uint32_t)rms : 0;
+    } else {
+        value = c->reg[addr];
+    }
+    value &= MASK(_nBits[addr]);
+
+    if (addr != CHKSUM.addr) {
+        c->reg[CHKSUM.addr] = __builtin_popcountl(value);
+    }
+    ADESIMstat.reads++;
+    return value;
+}
+
+/** Read only registers ignore writes. */
+static void _write(ADESIMchip *c, uint8_t addr, uint32_t value)
+{
+    static const uint8_t writable[] = {
+        MODE.addr, IRQEN.addr, CH1OS.addr, CH2OS.addr, GAIN.addr, PHCAL.addr,
+        APOS.addr, WGAIN.addr, WDIV.addr, CFNUM.addr, CFDEN.addr, IRMSOS.addr,
+        VRMSOS.addr, VAGAIN.addr, VADIV.addr, LINECYC.addr, ZXTOUT.addr,
+        SAGCYC.addr, SAGLVL.addr, IPKLVL.addr, VPKLVL.addr, TMODE.addr };
+
+    ADESIMstat.writes++;
+    for (uint8_t i=0; i < sizeof(writable); i++) {
+        if (writable[i] != addr) continue;
+        c->reg[addr] = value & MASK(_nBits[addr]);
+        if (addr == MODE.addr && (value & SWRST)) {
+            _powerOn(c);
+        } else if (addr == LINECYC.addr) {
+            c->lineCount = 0;
+        }
+        return;
+    }
+}
+
+/** Flips a random bit of a MISO byte either by request or at the bit error rate.*/
+static uint8_t _corrupt(ADESIMchip *c, uint8_t b)
+{
+    _rand ^= _rand << 13;
+    _rand ^= _rand >> 17;
+    _rand ^= _rand << 5;
+    float ber = c->bitErrorRate;
+    if (c->maxSck && _sck > c->maxSck) {
+        ber += ADESIM_OVERCLOCK_BER;
+    }
+    if (c->flips > 0 || (_rand & 0xFFFF) < ber*0x10000) {
+        if (c->flips > 0) c->flips--;
+        ADESIMstat.flips++;
+        b ^= 1 << ((_rand >> 16) & 0x07);
+    }
+    return b;
+}
+
+/**
+ * Resets all chips to their power on state with a 230V 50Hz line, no load
+ * and no communication errors.
+ * */
+void ADESIMinit()
+{
+    for (uint8_t i=0; i < regListSize/sizeof(regList[0]); i++) {
+        _nBits[regList[i]->addr] = regList[i]->nBits;
+    }
+    _nBits[RSTVPEAK.addr] = RSTVPEAK.nBits;
+    memset(&ADESIMstat,0,sizeof(ADESIMstat));
+    for (int8_t i=0; i < NCIRCUITS; i++) {
+        ADESIMchip *c = &_chips[i];
+        memset(c,0,sizeof(*c));
+        _powerOn(c);
+        c->present = true;
+        c->vrms = 230;
+        c->freq = 50;
+        c->t_us = micros();
+    }
+    _selected = DEVDISABLE;
+}
+
+/** An absent chip leaves MISO floating high. */
+void ADESIMsetPresent(int8_t chip, int8_t present)
+{
+    if (0 <= chip && chip < NCIRCUITS) {
+        _chips[chip].present = present;
+    }
+}
+
+/**
+ * Sets the line seen by a chip. The current lags the voltage by phaseDeg.
+ * A frequency or voltage of 0 removes the line so no zero crossings occur.
+ * */
+void ADESIMsetWaveform(int8_t chip, float vrms, float irms, float phaseDeg, float freqHz)
+{
+    if (!(0 <= chip && chip < NCIRCUITS)) return;
+    ADESIMchip *c = &_chips[chip];
+    _update(c,micros());
+    c->vrms = vrms;
+    c->irms = irms;
+    c->phase = phaseDeg*M_PI/180;
+    c->freq = freqHz;
+}
+
+/** Probability that any byte read from the chip has one bit flipped. */
+void ADESIMsetBitErrorRate(int8_t chip, float perByte)
+{
+    if (0 <= chip && chip < NCIRCUITS) {
+        _chips[chip].bitErrorRate = perByte;
+    }
+}
+
+/** Flips one bit in each of the next n bytes read from the chip. */
+void ADESIMinjectBitFlips(int8_t chip, uint16_t n)
+{
+    if (0 <= chip && chip < NCIRCUITS) {
+        _chips[chip].flips += n;
+    }
+}
+
+/** SCK faster than sckHz corrupts bytes read from the chip at ADESIM_OVERCLOCK_BER. */
+void ADESIMsetMaxClock(int8_t chip, uint32_t sckHz)
+{
+    if (0 <= chip && chip < NCIRCUITS) {
+        _chips[chip].maxSck = sckHz;
+    }
+}
+
+/** SCK frequency of the bytes that follow. */
+void ADESIMsetClock(uint32_t sckHz)
+{
+    _sck = sckHz;
+}
+
+/** When set, a chip only sees its load current while isOn(chip) is true. */
+void ADESIMsetSwitchHook(uint8_t (*isOn)(int8_t chip))
+{
+    _isOn = isOn;
+}
+
+/** @return true if the active low IRQ output of the chip is asserted. */
+uint8_t ADESIMirq(int8_t chip)
+{
+    if (!(0 <= chip && chip < NCIRCUITS) || !_chips[chip].present) {
+        return false;
+    }
+    ADESIMchip *c = &_chips[chip];
+    _update(c,micros());
+    return (c->reg[STATUS.addr] & c->reg[IRQEN.addr]) != 0;
+}
+
+/** A falling CS edge returns the serial interface to communications mode. */
+void ADESIMselect(int device)
+{
+    _selected = device;
+    if (0 <= device && device < NCIRCUITS) {
+        _chips[device].state = ADESIM_CMD;
+    }
+}
+
+/** Holding both CS lines of a daughterboard low resets its pair of chips. */
+void ADESIMreset(int device)
+{
+    device = (device/2)*2;
+    for (int i=device; i < device+2 && i < NCIRCUITS; i++) {
+        _update(&_chips[i],micros());
+        _powerOn(&_chips[i]);
+    }
+}
+
+/**
+ * Clocks one byte through the selected chip.
+ * The first byte of a transfer is the communications register
+ * (W/R bit 7, address bits 5-0), followed by the register bytes MSB first.
+ * */
+uint8_t ADESIMtransfer(uint8_t mosi)
+{
+    if (!(0 <= _selected && _selected < NCIRCUITS)) {
+        return 0xFF;
+    }
+    ADESIMchip *c = &_chips[_selected];
+    if (!c->present) {
+        return 0xFF;
+    }
+    ADESIMstat.bytes++;
+    _update(c,micros());
+
+    if (c->state == ADESIM_CMD) {
+        c->addr = mosi & 0x3F;
+        c->nBytes = _nBits[c->addr] ? (_nBits[c->addr]+7)/8 : 1;
+        c->byteIdx = 0;
+        if (mosi & 0x80) {
+            c->state = ADESIM_WRITE;
+            c->shift = 0;
+        } else {
+            c->state = ADESIM_READ;
+            c->shift = _read(c,c->addr) << (8*(4-c->nBytes));
+        }
+        return 0x00;
+    }
+
+    c->byteIdx++;
+    if (c->byteIdx >= c->nBytes) {
+        c->state = (c->state == ADESIM_WRITE) ? ADESIM_WRITE+1 : ADESIM_CMD;
+    }
+    if (c->state >= ADESIM_WRITE) {
+        c->shift = (c->shift << 8) | mosi;
+        if (c->state > ADESIM_WRITE) {
+            _write(c,c->addr,c->shift);
+            c->state = ADESIM_CMD;
+        }
+        return 0x00;
+    }
+    uint8_t miso = c->shift >> 24;
+    c->shift <<= 8;
+    return _corrupt(c,miso);
+}
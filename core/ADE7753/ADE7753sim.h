@@ -0,0 +1,70 @@
+#ifndef ADE7753SIM_H
+#define ADE7753SIM_H
+
+#include <stdint.h>
+
+/** @file ADE7753sim.h
+ *
+ *  Behavioural model of the ADE7753s on the daughterboards for host builds.
+ *
+ *  When the firmware is built with ADESIM defined, SPIClass::transfer and
+ *  CSselectDevice are routed here instead of to the SPI hardware so that
+ *  the unchanged Cmeasure, Cprogram and calibrateCircuit code can run
+ *  against NCIRCUITS simulated chips.
+ *
+ *  Each chip models
+ *  - the register file in regList with its read-and-reset registers,
+ *  - the CHKSUM popcount of the last read,
+ *  - ZX, LINECYC/CYCEND, SAG and ZXTO timing from a configurable line frequency,
+ *  - WSMP/WAVEFORM samples of the CH1, CH2 or active power signal,
+ *  - AENERGY/VAENERGY accumulation with half-full and overflow flags and
+ *    their LAENERGY/LVAENERGY line cycle latches,
+ *  - bit flips on MISO to provoke COMMERR, either at a fixed rate or when
+ *    SCK is faster than the modelled cable allows.
+ *
+ *  Time is taken from micros() so the model runs at whatever speed the host
+ *  clock runs, real time or faster.
+ *
+ *  GAIN, PHCAL, the CF output and the temperature sensor are not modelled.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Register counts per unit of the modelled analog front end.
+ *  The defaults are close to what the V6 daughterboards report. */
+#define ADESIM_VCOUNTS  2430.0   // VRMS counts per Volt
+#define ADESIM_ICOUNTS  400000.0 // IRMS counts per Amp
+#define ADESIM_ECOUNTS  48.0     // AENERGY/VAENERGY counts per Joule
+/** Probability of a flipped bit per byte when SCK exceeds a chip's maximum clock. */
+#define ADESIM_OVERCLOCK_BER 0.05
+
+typedef struct {
+    uint32_t bytes;         // SPI bytes clocked through a chip
+    uint32_t reads;         // Register reads
+    uint32_t writes;        // Register writes
+    uint32_t flips;         // Injected MISO bit flips
+} ADESIMstats;
+
+extern ADESIMstats ADESIMstat;
+
+void ADESIMinit();
+void ADESIMsetPresent(int8_t chip, int8_t present);
+void ADESIMsetWaveform(int8_t chip, float vrms, float irms, float phaseDeg, float freqHz);
+void ADESIMsetBitErrorRate(int8_t chip, float perByte);
+void ADESIMinjectBitFlips(int8_t chip, uint16_t n);
+void ADESIMsetMaxClock(int8_t chip, uint32_t sckHz);
+void ADESIMsetClock(uint32_t sckHz);
+void ADESIMsetSwitchHook(uint8_t (*isOn)(int8_t chip));
+uint8_t ADESIMirq(int8_t chip);
+
+/** Hooks for the SPI and Select modules. */
+void ADESIMselect(int device);
+void ADESIMreset(int device);
+uint8_t ADESIMtransfer(uint8_t mosi);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,4 +1,6 @@
 #include <string.h>
+#include <inttypes.h>
+#include <math.h>
 #include "arduino/WProgram.h"
 #include "Select/select.h"
 #include "circuit.h"
@@ -7,6 +9,7 @@
 #include "ADE7753/ADE7753.h"
 #include "Strings/strings.h"
 #include "Statistics/statistics.h"
+#include "Cmd/cmd.h"
 #include "cfg.h"
 
 #define waitTime 8000
@@ -107,6 +110,7 @@ void calibrateCircuit(Circuit *c)
 	cCal.chIos = cCal.chVos = cCal.IRMSoffset = cCal.VRMSoffset = 0;
 	cCal.VAoffset = cCal.Woffset = 0;
 	cCal.IRMSslope = cCal.VRMSslope = cCal.VAslope = cCal.Wslope = 1;
+	CLcalcQslopes(&cCal);
 
     RCreset();
 	Cprogram(&cCal);
@@ -201,6 +205,7 @@ void calibrateCircuit(Circuit *c)
 	cCal.IRMSslope = ((float)(IlowMeas-IhighMeas))/(IlowCkt-IhighCkt);
 	cCal.VRMSslope = ((float)(VlowMeas-VhighMeas))/(VlowCkt-VhighCkt);
 	cCal.VAslope  = cCal.Wslope = ((float)(VAlowMeas-VAhighMeas))/(VAlowCkt-VAhighCkt);
+	CLcalcQslopes(&cCal);
 
 	Cprint(&dbg,&cCal);
 	Cprogram(&cCal);
@@ -215,6 +220,38 @@ void calibrateCircuit(Circuit *c)
 }
 
 
+/**
+  Converts a slope into a Qslope. The mantissa of the float is kept whole so 
+  raw*slope in fixed point is within one LSB of the float multiply.
+  Slopes too small to matter become 0.
+  */
+Qslope CLtoQ(float slope)
+{
+	Qslope q = {0,0};
+	int ex;
+	float fr = frexp(slope,&ex);	//slope = fr*2^ex, 0.5 <= |fr| < 1
+	if (slope == 0 || isnan(slope) || isinf(slope) || 24-ex > 62 || 24-ex < -31) {
+		return q;
+	}
+	q.mant = (int32_t)ldexp(fr,24);
+	q.shift = 24-ex;
+	return q;
+}
+
+/**
+  Regenerates the fixed point slopes of c from its float slopes.
+  */
+void CLcalcQslopes(Circuit *c)
+{
+	c->IRMSq = CLtoQ(c->IRMSslope);
+	c->VRMSq = CLtoQ(c->VRMSslope);
+	c->VAq = CLtoQ(c->VAslope);
+	c->Wq = CLtoQ(c->Wslope);
+	//Wslope and VAslope are in J per count, 3.6 J is a mWh
+	c->VAhq = CLtoQ(c->VAslope/3.6);
+	c->Whq = CLtoQ(c->Wslope/3.6);
+}
+
 /**
   Enters a string into the buffer. Backspaces are supported and the string end is delimited by '\r'.
   '\r' is not included in buff. The string is null terminated so the maximum input string is bSize-1.
@@ -254,16 +291,14 @@ int8_t CLgetString(HardwareSerial *ser,char *buff, size_t bSize)
 int8_t CLgetFloat(HardwareSerial *ser,float *f)
 {
 	char buff[32] = {'\0'};
-    if (!CLgetString(ser,buff,sizeof(buff))) {
+	char *p = buff;
+    if (CLgetString(ser,buff,sizeof(buff))) {
         return FAILURE;
     }
     if (!strcmp(buff,"cancel")) {
         return CANCELED;
     }
-    if (sscanf(buff,"%f",f)) {
-        return SUCCESS;
-    }
-    return FAILURE;
+    return CMDparseFloat(&p,f) == SUCCESS ? SUCCESS : FAILURE;
 }
 /** 
 	Gets a long int from the user. Hex (e.g. 0xdeadbeef) is also permitted.
@@ -272,13 +307,12 @@ int8_t CLgetFloat(HardwareSerial *ser,float *f)
 int8_t CLgetInt(HardwareSerial *ser,int32_t *d)
 {
     char buff[32] = {'\0'};
+    char *p = buff;
     if (CLgetString(ser,buff,sizeof(buff))) {
         return FAILURE;
     }
-    if (buff[0] == '0' && (buff[1] == 'x' || buff[1] == 'X')){
-        if (sscanf(buff,"%lx",d)) return SUCCESS;
-    } else { 
-        if (sscanf(buff,"%ld",d)) return SUCCESS;
+    if (CMDparseInt(&p,d) == SUCCESS) {
+        return SUCCESS;
     }
     if (!strcmp(buff,"cancel")) {
         return CANCELED;
@@ -7,6 +7,8 @@ extern "C"
 #endif
 
 void calibrateCircuit(Circuit *c);
+Qslope CLtoQ(float slope);
+void CLcalcQslopes(Circuit *c);
 int8_t CLgetString(HardwareSerial *ser,char *buff, size_t bSize);
 int8_t CLgetFloat(HardwareSerial *ser,float *f);
 int8_t CLgetInt(HardwareSerial *ser,int32_t*i);
@@ -1,11 +1,16 @@
 #include <avr/eeprom.h>
+#include <avr/interrupt.h>
 
 #include "ReturnCode/returncode.h"
 #include "ADE7753/ADE7753.h"
+#include "SPI/SPI.h"
 #include "Select/select.h"
 #include "Switches/switches.h"
+#include "EELogger/EELogger.h"
 #include "circuit.h"
+#include "calibration.h"
 #include "arduino/HardwareSerial.h"
+#include "Format/Line.h"
 
 #define dbg Serial
 #define max(X,Y) ((X)>=(Y))?(X):(Y)
@@ -23,11 +28,42 @@
  *
  */
 
+static void _Cprogram(Circuit *c);
+static void _Cdrain(Circuit *c);
+
+/** Energy register counts drained since the last Cread, by circuitID. */
+static int32_t _CWcounts[NCIRCUITS];
+static int32_t _CVAcounts[NCIRCUITS];
+/** millis() of the last drain, by circuitID. */
+static uint32_t _CdrainTime[NCIRCUITS];
+/** 
+ * AENERGY and VAENERGY as of the last drain, by circuitID. _Cbased is false 
+ * until they are known, e.g. after the AVR was reset but the ADE was not.
+ * */
+static int32_t _CWlast[NCIRCUITS];
+static int32_t _CVAlast[NCIRCUITS];
+static uint8_t _Cbased[NCIRCUITS];
+/** Energy totals by circuitID, see CgetTotals. */
+static Cenergy _Ctotals[NCIRCUITS];
+/** millis() of the last CprobeAbsent. */
+static uint32_t _CprobeTime;
+/** Run while CmeasureAll waits. */
+static CIDLE *_Cidle = NULL;
+/** 
+ * Published snapshots by circuitID. Cpublish and CgetSnapshot both run in 
+ * the main loop, and Cpublish does not call the idle function, so one 
+ * buffer is always read whole.
+ * */
+static Csnapshot _Csnap[NCIRCUITS];
+/** Counts CmeasureAll calls, 0 is left for no snapshot. */
+static uint16_t _Csweep = 0;
+
 int8_t _shouldReturn(Circuit *c) 
 {
     ifnsuccess(_retCode) {            
         if (_retCode == COMMERR) {        
             c->status |= COMM;            
+            c->spiDivider = ADEgetClockDivider(c->circuitID);
             CSselectDevice(DEVDISABLE);    
             return true;                        
         } else if (_retCode == TIMEOUT) {
@@ -41,19 +77,43 @@ int8_t _shouldReturn(Circuit *c)
 }
 
 /**
- * If switch state is not already in the desired state, wait for a zero-crossing or 50ms and then switches.
+ * Gives the relay queue a fresh zero crossing of the circuit's line by waiting 
+ * for one, which takes at most half a line period. The selected device is restored.
+ * */
+static void _CsyncZeroCross(Circuit *c)
+{
+    int32_t regData;
+    int device = CSgetDevice();
+    int8_t durationms;
+
+    RCreset();
+    CSselectDevice(c->circuitID);
+    ADEgetRegister(PERIOD,&regData);
+    ifsuccess(_retCode) {
+        c->periodus = periodTous(regData);
+        durationms = c->periodus/1000;
+        if (durationms > 50|| durationms < 10) durationms = 50;
+        CwaitForZX10(durationms);
+        ifsuccess(_retCode) {
+            SWsetZeroCross(ADEeventTime(),c->periodus);
+        }
+    }
+    CSselectDevice(device);
+}
+
+/**
+ * Queues the switch and returns. The relay queue pulses the coil at a zero 
+ * crossing, which is synchronized here first if the last one is too old.
  * Leaves _retcode as is.
  * */
 void CsetOn(Circuit *c, int8_t on) 
 {
     int8_t code = _retCode;
-    int8_t durationms = c->periodus/1000;
-    if (durationms > 50|| durationms < 10) durationms = 50;
-    if (CisOn(c) != on) {
-        CwaitForZX10(durationms);
+    if (!SWhasZeroCross()) {
+        _CsyncZeroCross(c);
     }
     _retCode = code;
-    SWset(c->circuitID,on);
+    SWqueue(c->circuitID,on);
 }
 
 /**
@@ -137,43 +197,8 @@ void Cmeasure(Circuit *c)
     }
 
     if (!timeout) {
-        //Apparent power or Volt Amps
-        ADEgetRegister(LVAENERGY,&regData);             ERRCHECKRETURN(c);
-        c->VA = regData*c->VAslope;// TODO assuming 1 seconds/(c->cyclesSample*c->periodus/1000000);  //Watts
-
-        //Active power or watts
-        ADEgetRegister(LAENERGY,&regData);              ERRCHECKRETURN(c);
-        c->W = regData*c->Wslope;//TODO Assuming 1 seconds///(c->cyclesSample*c->periodus/1000000); //The denominator is the actual time in seconds
-
-        //IRMS
-        ADEgetRegister(IRMS,&regData);                  ERRCHECKRETURN(c);
-        c->IRMS = regData*c->IRMSslope;
-
-        //VRMS
-        ADEgetRegister(VRMS,&regData);                  ERRCHECKRETURN(c);
-        c->VRMS= regData*c->VRMSslope;
-
-        //Apparent energy accumulated since last query
-        ADEgetRegister(RVAENERGY,&regData);             ERRCHECKRETURN(c);
-        c->VAEnergy = regData*c->VAslope;
-
-        //Actve energy accumulated since last query
-        ADEgetRegister(RAENERGY,&regData);              ERRCHECKRETURN(c);
-        c->WEnergy = regData*c->Wslope;
-
-        //Current and Voltage Peaks TODO in whatever units
-        ADEgetRegister(RSTIPEAK,&regData);              ERRCHECKRETURN(c);
-        c->ipeak = regData;
-        ADEgetRegister(RSTVPEAK,&regData);              ERRCHECKRETURN(c);
-        c->vpeak = regData;
-
-        //Power Factor PF
-        if (c->VA != 0){ 
-            c->PF = (uint16_t)(65535*((float)c->W)/c->VA);
-        } else {
-            c->PF = 65535;
-        }
-    } //end if (!timeout)
+        Cread(c);
+    }
 
     CSselectDevice(DEVDISABLE);
 
@@ -183,22 +208,443 @@ void Cmeasure(Circuit *c)
     }
 }
 
+/**
+ * Clears the circuit interrupts and records the line period so that the 
+ * end of the current LINECYC window (CYCEND) can be detected later with 
+ * Cready without blocking.
+ * Comm errors are stored in c->status.
+ * */
+void Carm(Circuit *c)
+{
+    int32_t regData;
+    RCreset();
+    CSselectDevice(c->circuitID);                       ERRCHECKRETURN(c);
+    c->status = 0;
+    ADEgetRegister(RSTSTATUS,&regData);                 ERRCHECKRETURN(c);
+    ADEgetRegister(PERIOD,&regData);                    ERRCHECKRETURN(c);
+    c->periodus = periodTous(regData);
+    CSselectDevice(DEVDISABLE);
+}
+
+/**
+ * Checks once, without waiting, whether an armed circuit has finished its 
+ * LINECYC window. STATUS is used instead of RSTSTATUS so the flags are 
+ * kept for the next poll.
+ * If the circuit's IRQ line is routed there is no SPI traffic until the 
+ * line falls. RSTSTATUS is read then to release the line and its flags 
+ * are added to c->status.
+ * @return true if CYCEND is set. On false check _retCode for COMMERR.
+ * */
+int8_t Cready(Circuit *c)
+{
+    int32_t regData;
+    int8_t irq = (CSgetIrqPin(c->circuitID) != NOIRQPIN);
+    RCreset();
+    if (!ADEirqPending(c->circuitID)) return false;
+    CSselectDevice(c->circuitID);       if (_shouldReturn(c)) return false;
+    ADEgetRegister(irq ? RSTSTATUS : STATUS,&regData);
+                                        if (_shouldReturn(c)) return false;
+    CSselectDevice(DEVDISABLE);
+    if (irq || (regData & CYCEND)) {
+        c->status |= (0x0000FFFF&regData);
+    }
+    // The window ends at a zero crossing and the line fell right then
+    if (irq && (regData & CYCEND)) {
+        SWsetZeroCross(ADEirqTime(c->circuitID),c->periodus);
+    }
+    return (regData & CYCEND) != 0;
+}
+
+/**
+ * @return x*q truncated toward zero, which is what assigning the float 
+ * product x*slope to an integer did.
+ * */
+static int32_t _Cscale(int32_t x, Qslope q)
+{
+    int64_t p = (int64_t)x*q.mant;
+    if (q.shift < 0) {
+        return (int32_t)(p*((int64_t)1 << -q.shift));
+    } else if (p < 0) {
+        return -(int32_t)((-p) >> q.shift);
+    }
+    return (int32_t)(p >> q.shift);
+}
+
+/**
+ * Takes the whole units out of a carry with shift fraction bits.
+ * The fraction, with the sign of the carry, is left in *carry.
+ * */
+static int32_t _Cwhole(int64_t *carry, int8_t shift)
+{
+    int64_t whole;
+    if (shift <= 0) {
+        whole = *carry*((int64_t)1 << -shift);
+        *carry = 0;
+    } else {
+        whole = (*carry < 0) ? -((-*carry) >> shift) : (*carry >> shift);
+        *carry -= whole*((int64_t)1 << shift);
+    }
+    return (int32_t)whole;
+}
+
+/**
+ * @return 65535*W/VA rounded down, computed by long division in 32 bits 
+ * instead of a float division. 65535 if VA is 0. A power factor above 1, 
+ * which only a bad calibration gives, is held at 65535.
+ * */
+static uint16_t _CpowerFactor(int32_t W, int32_t VA)
+{
+    int8_t negative = (W < 0) != (VA < 0);
+    uint32_t w = (W < 0) ? -(uint32_t)W : W;
+    uint32_t va = (VA < 0) ? -(uint32_t)VA : VA;
+    uint32_t r = w;
+    uint16_t pf = 0;
+
+    if (va == 0) {
+        return 65535;
+    } else if (w >= va) {
+        pf = 65535;
+    } else {
+        //pf = 2^16*w/va and r the remainder, r < va < 2^31 so r<<1 fits
+        for (int8_t i=0; i < 16; i++) {
+            r <<= 1;
+            pf <<= 1;
+            if (r >= va) {
+                r -= va;
+                pf |= 1;
+            }
+        }
+        //65535*w = pf*va + r - w
+        if (r < w) {
+            pf--;
+        }
+    }
+    return negative ? -pf : pf;
+}
+
+/**
+ * Adds drained AENERGY and VAENERGY counts to the energy totals.
+ * */
+static void _Caccumulate(Circuit *c, int32_t WCounts, int32_t VACounts)
+{
+    Cenergy *e = &_Ctotals[c->circuitID];
+    int32_t whole;
+    int32_t VAwhole;
+    uint8_t oldSREG;
+
+    _CWcounts[c->circuitID] += WCounts;
+    _CVAcounts[c->circuitID] += VACounts;
+    _CdrainTime[c->circuitID] = millis();
+
+    e->WhCarry += (int64_t)WCounts*c->Whq.mant;
+    whole = _Cwhole(&e->WhCarry,c->Whq.shift);
+    e->VAhCarry += (int64_t)VACounts*c->VAhq.mant;
+    VAwhole = _Cwhole(&e->VAhCarry,c->VAhq.shift);
+
+    // The power fail ISR reads the totals, see PowerFail
+    oldSREG = SREG;
+    cli();
+    if (whole > 0) {
+        e->WhImport += whole;
+    } else {
+        e->WhExport += -whole;
+    }
+    if (VAwhole > 0) {
+        e->VAh += VAwhole;
+    }
+    SREG = oldSREG;
+}
+
+/**
+ * Reads a register which does not reset when read, up to CDRAINTRIES 
+ * times until it passes its checksum.
+ * */
+static void _CgetChecked(ADEReg reg, int32_t *regData)
+{
+    for (uint8_t i=0; i < CDRAINTRIES; i++) {
+        ADEgetRegister(reg,regData);
+        if (_retCode != COMMERR) return;
+    }
+}
+
+/**
+ * Drains the selected ADE's energy registers into the totals. 
+ * AENERGY and VAENERGY are read rather than RAENERGY and RVAENERGY, so a 
+ * read that fails its checksum loses nothing: the counts are the increase 
+ * since the last drain modulo 2^24 and the next drain picks them up.
+ * */
+static void _Cdrain(Circuit *c)
+{
+    int8_t id = c->circuitID;
+    int32_t WData;
+    int32_t VAData;
+    int32_t WCounts;
+
+    _CgetChecked(AENERGY,&WData);                       ERRCHECKRETURN(c);
+    _CgetChecked(VAENERGY,&VAData);                     ERRCHECKRETURN(c);
+    if (_Cbased[id]) {
+        // Sign extend the 24 bit difference of the two's complement register
+        WCounts = (int32_t)((uint32_t)(WData - _CWlast[id]) << 8) >> 8;
+        _Caccumulate(c,WCounts,(VAData - _CVAlast[id]) & 0x00FFFFFF);
+    } else {
+        _CdrainTime[id] = millis();
+    }
+    _CWlast[id] = WData;
+    _CVAlast[id] = VAData;
+    _Cbased[id] = true;
+}
+
+/** The circuit's ADE was reset and counts from 0. */
+static void _Crebase(int8_t id)
+{
+    _CWlast[id] = 0;
+    _CVAlast[id] = 0;
+    _Cbased[id] = true;
+}
+
+/**
+ * Moves the energy the ADE has integrated since the last drain into the 
+ * circuit's 64 bit totals.
+ * Comm errors are stored in c->status.
+ * */
+void Cdrain(Circuit *c)
+{
+    RCreset();
+    CSselectDevice(c->circuitID);                       ERRCHECKRETURN(c);
+    _Cdrain(c);                                         ERRCHECKRETURN(c);
+    CSselectDevice(DEVDISABLE);
+}
+
+/**
+ * Drains every connected circuit which has not been drained for CDRAINMS.
+ * Call it from the main loop so the totals do not depend on how often 
+ * the circuits are reported. Leaves _retCode as is.
+ * */
+void CdrainAll(Circuit cs[], int8_t n)
+{
+    int8_t code = _retCode;
+    if (n > NCIRCUITS) n = NCIRCUITS;
+    for (int8_t i=0; i < n; i++) {
+        int8_t id = cs[i].circuitID;
+        if (!(0 <= id && id < NCIRCUITS) || !cs[i].connected) continue;
+        if (millis() - _CdrainTime[id] >= CDRAINMS) {
+            Cdrain(&cs[i]);
+            if (_retCode == COMMERR) Cprobe(&cs[i]);
+        }
+    }
+    _retCode = code;
+}
+
+/** Registers read by Cread in the order they are read. */
+static const ADEReg *CREADREGS[] = {&LVAENERGY, &LAENERGY, &IRMS, &VRMS, 
+    &RSTIPEAK, &RSTVPEAK};
+#define CREADNREGS (sizeof(CREADREGS)/sizeof(CREADREGS[0]))
+
+/**
+ * Reads the line cycle registers of a circuit which has reached CYCEND 
+ * and converts them into engineering units.
+ * All registers are read in one SPI session and only the energy registers are 
+ * checksummed since they are what the energy totals are built from. The 
+ * totals are drained first, so they are up to date even if a later read fails.
+ * @warning A communications error may leave Circuit *c in an inconsisent state.
+ * */
+void Cread(Circuit *c)
+{
+    int32_t regData[CREADNREGS];
+    RCreset();
+    CSselectDevice(c->circuitID);                       ERRCHECKRETURN(c);
+
+    _Cdrain(c);                                         ERRCHECKRETURN(c);
+    ADEreadBlock(CREADREGS,regData,CREADNREGS,ADECHK_ENERGY);   ERRCHECKRETURN(c);
+
+    //Apparent power or Volt Amps
+    c->VA = _Cscale(regData[0],c->VAq);// TODO assuming 1 seconds/(c->cyclesSample*c->periodus/1000000);  //Watts
+
+    //Active power or watts
+    c->W = _Cscale(regData[1],c->Wq);//TODO Assuming 1 seconds///(c->cyclesSample*c->periodus/1000000); //The denominator is the actual time in seconds
+
+    //IRMS
+    c->IRMS = _Cscale(regData[2],c->IRMSq);
+
+    //VRMS
+    c->VRMS= _Cscale(regData[3],c->VRMSq);
+
+    //Energy accumulated since last query, including what CdrainAll took in between
+    c->VAEnergy = _Cscale(_CVAcounts[c->circuitID],c->VAq);
+    c->WEnergy = _Cscale(_CWcounts[c->circuitID],c->Wq);
+    _CVAcounts[c->circuitID] = 0;
+    _CWcounts[c->circuitID] = 0;
+
+    //Current and Voltage Peaks TODO in whatever units
+    c->ipeak = regData[4];
+    c->vpeak = regData[5];
+
+    //Power Factor PF
+    c->PF = _CpowerFactor(c->W,c->VA);
+
+    CSselectDevice(DEVDISABLE);
+}
+
+/**
+ * Meters n circuits concurrently. 
+ * All of the ADEs integrate in parallel, so every circuit is armed 
+ * once and then polled round-robin for CYCEND. Each circuit is read 
+ * as soon as it is ready and handed to onReady so a full sweep takes 
+ * about one LINECYC window instead of n.
+ *
+ * Every circuit read successfully is published with Cpublish.
+ * Circuits which are not connected are skipped. onReady is called exactly 
+ * once per connected circuit with _retCode set to SUCCESS, TIMEOUT if CYCEND 
+ * was not seen within CcalcWaitTime or COMMERR. A circuit which failed with 
+ * COMMERR is probed afterwards so an unplugged ADE drops out of later sweeps.
+ * */
+void CmeasureAll(Circuit cs[], int8_t n, CREADY *onReady)
+{
+    uint32_t armTime[NCIRCUITS];
+    uint16_t waitTime[NCIRCUITS];
+    int8_t armed[NCIRCUITS];
+    int8_t remaining = 0;
+    // Sleep between sweeps when no armed circuit has to be polled
+    int8_t irqOnly = true;
+
+    if (n > NCIRCUITS) n = NCIRCUITS;
+    if (++_Csweep == 0) _Csweep = 1;
+    for (int8_t i=0; i < n; i++) {
+        armed[i] = false;
+        if (!cs[i].connected) continue;
+        Carm(&cs[i]);
+        armed[i] = success(_retCode);
+        if (armed[i]) {
+            armTime[i] = millis();
+            waitTime[i] = CcalcWaitTime(&cs[i]);
+            remaining++;
+            if (CSgetIrqPin(cs[i].circuitID) == NOIRQPIN) irqOnly = false;
+        } else {
+            onReady(&cs[i]);
+            if (_retCode == COMMERR) Cprobe(&cs[i]);
+        }
+    }
+
+    while (remaining > 0) {
+        if (irqOnly) ADEidle();
+        if (_Cidle) _Cidle();
+        for (int8_t i=0; i < n; i++) {
+            if (!armed[i]) continue;
+            Circuit *c = &cs[i];
+            if (Cready(c)) {
+                Cread(c);
+                ifsuccess(_retCode) Cpublish(c);
+            } else if (success(_retCode)) {
+                if (millis() - armTime[i] <= waitTime[i]) continue;
+                c->status |= TIME;
+                _retCode = TIMEOUT;
+            }
+            armed[i] = false;
+            remaining--;
+            onReady(c);
+            if (_retCode == COMMERR) Cprobe(c);
+        }
+    }
+}
+
+void CsetIdle(CIDLE *idle)
+{
+    _Cidle = idle;
+}
+
+/**
+ * Copies the measurements of c into s, stamped with the time and the 
+ * current sweep.
+ * */
+void CtakeSnapshot(Circuit *c, Csnapshot *s)
+{
+    s->time = millis();
+    s->sweep = _Csweep;
+    s->circuitID = c->circuitID;
+    s->on = CisOn(c);
+    s->status = c->status;
+    s->IRMS = c->IRMS;
+    s->VRMS = c->VRMS;
+    s->periodus = c->periodus;
+    s->VA = c->VA;
+    s->W = c->W;
+    s->PF = c->PF;
+    s->VAEnergy = c->VAEnergy;
+    s->WEnergy = c->WEnergy;
+    s->ipeak = c->ipeak;
+    s->vpeak = c->vpeak;
+    s->WhImport = _Ctotals[c->circuitID].WhImport;
+    s->WhExport = _Ctotals[c->circuitID].WhExport;
+    s->VAh = _Ctotals[c->circuitID].VAh;
+}
+
+/**
+ * Makes the current measurements of c the snapshot CgetSnapshot returns.
+ * */
+void Cpublish(Circuit *c)
+{
+    int8_t id = c->circuitID;
+    if (id < 0 || NCIRCUITS <= id) return;
+    CtakeSnapshot(c,&_Csnap[id]);
+}
+
+/**
+ * Copies the latest published snapshot of a circuit into s.
+ * @return SUCCESS, FAILURE if none has been published yet or ARGVALUEERR 
+ *  for an invalid circuitID.
+ * */
+int8_t CgetSnapshot(int8_t circuitID, Csnapshot *s)
+{
+    if (circuitID < 0 || NCIRCUITS <= circuitID) return ARGVALUEERR;
+    *s = _Csnap[circuitID];
+    return (s->sweep == 0) ? FAILURE : SUCCESS;
+}
+
+/**
+ * The energy totals of a circuit. Interrupts have to be off to change
+ * them since the power fail ISR reads them.
+ * @return NULL if circuitID is invalid.
+ * */
+Cenergy *CgetTotals(int8_t circuitID)
+{
+    if (circuitID < 0 || NCIRCUITS <= circuitID) return NULL;
+    return &_Ctotals[circuitID];
+}
+
 /**
  * Configure ADE according to parameters specified in c.
+ * Programming is retried at slower SPI clocks for as long as it fails with 
+ * a communications error, which settles c->spiDivider for the wiring to the ADE.
  *
  * @return void
  * */
 void Cprogram(Circuit *c)
+{
+    uint8_t divider;
+    ADEsetClockDivider(c->circuitID,c->spiDivider);
+    do {
+        divider = ADEgetClockDivider(c->circuitID);
+        _Cprogram(c);
+        // The ADE module may already have slowed down during the attempt
+    } while (_retCode == COMMERR && 
+            (ADEgetClockDivider(c->circuitID) != divider || ADEslowDown(c->circuitID)));
+    c->spiDivider = ADEgetClockDivider(c->circuitID);
+}
+
+static void _Cprogram(Circuit *c)
 {
     int32_t regData;
 
     RCreset();
     CSselectDevice(c->circuitID);                       ERRCHECKRETURN(c);
 
+    //The reset clears the energy registers
+    _Cdrain(c);                                         ERRCHECKRETURN(c);
     ADEreset();
+    _Crebase(c->circuitID);
 
-    //Enable zero crossing Shouldn't matter
-    ADEsetIrqEnBit(ZX,true);
+    //Only CYCEND drives the IRQ line so a routed line wakes Cready once per window
+    ADEsetIrqEnBit(CYCEND,true);
 
     //If there is some non-zero sag duration cycle count set it
     if (c->sagDurationCycles > 0) { 
@@ -294,6 +740,8 @@ void CsetDefaults(Circuit *c, int8_t circuitID)
     c->vpeak = 123;
 
     c->status = 0;
+    c->spiDivider = SPI_CLOCK_DIV2;
+    CLcalcQslopes(c);
 }
 
 /**
@@ -302,94 +750,152 @@ void CsetDefaults(Circuit *c, int8_t circuitID)
  * */
 void Cprint(HardwareSerial *ser, Circuit *c) 
 {
-
-    ser->print("#CIRCUIT");
-    ser->print("circuitID:"); ser->print(c->circuitID);
-    ser->print("\tcyclesSample:"); ser->print(c->cyclesSample);
-    ser->print("\tphcal:"); ser->println(c->phcal);
-
-    ser->print("chIint:"); ser->print(c->chIint);
-    ser->print("\tchIOS:"); ser->print(c->chIos);
-    ser->print("\tchIgainExp:"); ser->println(c->chIgainExp);
-
-    ser->print("IRMSOS:"); ser->print(c->IRMSoffset);
-    ser->print("\tIRMS slope:"); ser->print(c->IRMSslope);
-    ser->print("\tchVOS:"); ser->println(c->chVos);
-
-    ser->print("chIgainExp:"); ser->print(c->chVgainExp);
-    ser->print("\tchVscale:"); ser->print(c->chVscale);
-    ser->print("\tVRMSOS:"); ser->println(c->VRMSoffset);
-
-    ser->print("VRMS slope:"); ser->print(c->VRMSslope);
-    ser->print("\tVAE slope:"); ser->print(c->VAslope);
-    ser->print("\tVA OS:"); ser->println(c->VAoffset);
-
-    ser->print("W OS:"); ser->print(c->VAoffset);
-    ser->print("\tW slope:"); ser->println(c->Wslope);
-
-    ser->print("IRMS:"); ser->print(c->IRMS);
-    ser->print("\tVRMS:"); ser->print(c->VRMS);
-    ser->print("\tPeriod:"); ser->println(c->periodus);
-    ser->print("VA:"); ser->print(c->VA);
-    ser->print("\tW:"); ser->print(c->W);
-    ser->print("\tPF:"); ser->println(c->PF);
-    ser->print("VA Energy:"); ser->print(c->VAEnergy);
-    ser->print("\tW Energy:"); ser->print(c->WEnergy);
-    ser->print("\tipeak:"); ser->println(c->ipeak);
-    ser->print("vpeak:"); ser->println(c->vpeak);
+    Line<CLINESIZE> out(ser);
+    Cenergy *e = CgetTotals(c->circuitID);
+
+    out.print("#CIRCUIT");
+    out.print("circuitID:"); out.print(c->circuitID);
+    out.print("\tconnected:"); out.print(c->connected);
+    out.print("\tcyclesSample:"); out.print(c->cyclesSample);
+    out.print("\tphcal:"); out.println(c->phcal);
+
+    out.print("chIint:"); out.print(c->chIint);
+    out.print("\tchIOS:"); out.print(c->chIos);
+    out.print("\tchIgainExp:"); out.println(c->chIgainExp);
+
+    out.print("IRMSOS:"); out.print(c->IRMSoffset);
+    out.print("\tIRMS slope:"); out.print(c->IRMSslope);
+    out.print("\tchVOS:"); out.println(c->chVos);
+
+    out.print("chIgainExp:"); out.print(c->chVgainExp);
+    out.print("\tchVscale:"); out.print(c->chVscale);
+    out.print("\tVRMSOS:"); out.println(c->VRMSoffset);
+
+    out.print("VRMS slope:"); out.print(c->VRMSslope);
+    out.print("\tVAE slope:"); out.print(c->VAslope);
+    out.print("\tVA OS:"); out.println(c->VAoffset);
+
+    out.print("W OS:"); out.print(c->VAoffset);
+    out.print("\tW slope:"); out.print(c->Wslope);
+    out.print("\tSPI divider:"); out.println((int)c->spiDivider);
+
+    out.print("IRMS:"); out.print(c->IRMS);
+    out.print("\tVRMS:"); out.print(c->VRMS);
+    out.print("\tPeriod:"); out.println(c->periodus);
+    out.print("VA:"); out.print(c->VA);
+    out.print("\tW:"); out.print(c->W);
+    out.print("\tPF:"); out.println(c->PF);
+    out.print("VA Energy:"); out.print(c->VAEnergy);
+    out.print("\tW Energy:"); out.print(c->WEnergy);
+    out.print("\tipeak:"); out.println(c->ipeak);
+    out.print("vpeak:"); out.println(c->vpeak);
+    if (e) {
+        out.print("Wh import:"); out.print(e->WhImport);
+        out.print("\tWh export:"); out.print(e->WhExport);
+        out.print("\tVAh:"); out.println(e->VAh);
+    }
 
     RCreset();
     CSselectDevice(c->circuitID);
-    ser->println("#ADE");
+    out.println("#ADE");
     for (const ADEReg** reg = &regList[0]; reg < &(regList[regListSize/sizeof(*reg)-1]);reg++) {
         int32_t regData = 0;
-        ser->print((**reg).name); ser->print("& "); 
+        out.print((**reg).name); out.print("& "); 
         ADEgetRegister(**reg,&regData);
         ifsuccess(_retCode) {
-            ser->print(":0x");
-            ser->print(regData,HEX);
-            ser->print(":");
-            ser->print(regData,DEC);
+            out.print(":0x");
+            out.print(regData,HEX);
+            out.print(":");
+            out.print(regData,DEC);
         } else {
-            ser->println("FAILURE");
+            out.println("FAILURE");
         }
-        ser->println();
+        out.println();
     }
     CSselectDevice(DEVDISABLE);
 }
 
 void CprintMeas(HardwareSerial *ser, Circuit *c)
+{
+    Line<CLINESIZE> out(ser);
+    Csnapshot s;
+    CtakeSnapshot(c,&s);
+    CprintSnapshot(&out,&s);
+}
+
+/**
+ * Prints a snapshot in the CprintMeas format.
+ * */
+void CprintSnapshot(Print *ser, const Csnapshot *s)
+{
+    CprintFields(ser,s,CFDEFAULT);
+}
+
+/**
+ * Prints the circuitID and the fields of a snapshot selected by CF flags,
+ * each as LABEL:value so the line says what it holds. Print to a Line to 
+ * have it sent in one write.
+ * */
+void CprintFields(Print *ser, const Csnapshot *s, uint16_t fields)
 {
     ser->print("CID:");
-    ser->print(c->circuitID,DEC);
-    ser->print(",SWON");
-    ser->print(CisOn(c),DEC);
-    ser->print(",VRMS:");
-    ser->print(c->VRMS,DEC);
-    ser->print(",IRMS:");
-    ser->print(c->IRMS,DEC);
-   // ser->print(",");
-   // ser->print(c->vpeak,DEC);
-   // ser->print(",");
-   // ser->print(c->ipeak,DEC);
-    ser->print(",PERIOD:");
-    ser->print(c->periodus,DEC);
-   // ser->print(",");
-   // ser->print(c->VA,DEC);
-    ser->print(",W:");
-    ser->print(c->W,DEC);
-  //  ser->print(",");
-  //  ser->print(c->VAEnergy,DEC);
-    ser->print(",WE:");
-    ser->print(c->WEnergy,DEC);
-  //  ser->print(",");
-  //  ser->print(c->PF,DEC);
-  //  ser->print(",");
-  //  // TODO VA ACCUM
-  //  ser->print(0);
-  //  ser->print(",");
-    // TODO W ACCUM
-  //  ser->print(0);
+    ser->print(s->circuitID,DEC);
+    if (fields & CFSW) {
+        ser->print(",SWON");
+        ser->print(s->on,DEC);
+    }
+    if (fields & CFVRMS) {
+        ser->print(",VRMS:");
+        ser->print(s->VRMS,DEC);
+    }
+    if (fields & CFIRMS) {
+        ser->print(",IRMS:");
+        ser->print(s->IRMS,DEC);
+    }
+    if (fields & CFVPEAK) {
+        ser->print(",VPEAK:");
+        ser->print(s->vpeak,DEC);
+    }
+    if (fields & CFIPEAK) {
+        ser->print(",IPEAK:");
+        ser->print(s->ipeak,DEC);
+    }
+    if (fields & CFPERIOD) {
+        ser->print(",PERIOD:");
+        ser->print(s->periodus,DEC);
+    }
+    if (fields & CFVA) {
+        ser->print(",VA:");
+        ser->print(s->VA,DEC);
+    }
+    if (fields & CFW) {
+        ser->print(",W:");
+        ser->print(s->W,DEC);
+    }
+    if (fields & CFVAE) {
+        ser->print(",VAE:");
+        ser->print(s->VAEnergy,DEC);
+    }
+    if (fields & CFWE) {
+        ser->print(",WE:");
+        ser->print(s->WEnergy,DEC);
+    }
+    if (fields & CFPF) {
+        ser->print(",PF:");
+        ser->print(s->PF,DEC);
+    }
+    if (fields & CFWH) {
+        ser->print(",WH:");
+        ser->print(s->WhImport,DEC);
+    }
+    if (fields & CFWHX) {
+        ser->print(",WHX:");
+        ser->print(s->WhExport,DEC);
+    }
+    if (fields & CFVAH) {
+        ser->print(",VAH:");
+        ser->print(s->VAh,DEC);
+    }
 }
 
 /** Strobe the CS pin on the current ADE.
@@ -447,6 +953,57 @@ int8_t CtestComms(Circuit *c)
     return regData && success(_retCode);
 }
 
+/**
+ * Checks whether the circuit's ADE answers and records it in c->connected.
+ * DIEREV is read at the slowest SPI clock so marginal wiring is not taken for 
+ * an empty socket, and the circuit's adaptive clock is left where it was.
+ * An ADE which was not connected is programmed as soon as it answers.
+ * @return c->connected
+ * */
+int8_t Cprobe(Circuit *c)
+{
+    int8_t wasConnected = c->connected;
+    uint8_t divider = ADEgetClockDivider(c->circuitID);
+
+    ADEsetClockDivider(c->circuitID,SPI_CLOCK_DIV128);
+    c->connected = CtestComms(c);
+    ADEsetClockDivider(c->circuitID,divider);
+    if (c->connected && !wasConnected) {
+        Cprogram(c);
+        c->connected = success(_retCode);
+    }
+    return c->connected;
+}
+
+/**
+ * Probes every circuit at boot. Each ADE that answers is programmed.
+ * */
+void CprobeAll(Circuit cs[], int8_t n)
+{
+    if (n > NCIRCUITS) n = NCIRCUITS;
+    for (int8_t i=0; i < n; i++) {
+        cs[i].connected = false;
+        Cprobe(&cs[i]);
+    }
+    _CprobeTime = millis();
+}
+
+/**
+ * Every CPROBEMS probes the circuits which are not connected so ADEs that 
+ * are plugged in later start being metered. Leaves _retCode as is.
+ * */
+void CprobeAbsent(Circuit cs[], int8_t n)
+{
+    int8_t code = _retCode;
+    if (millis() - _CprobeTime < CPROBEMS) return;
+    _CprobeTime = millis();
+    if (n > NCIRCUITS) n = NCIRCUITS;
+    for (int8_t i=0; i < n; i++) {
+        if (!cs[i].connected) Cprobe(&cs[i]);
+    }
+    _retCode = code;
+}
+
 /**
  *  Resets the ADEs on the daughterboard and erases all data on the Circuit.
  *  Usually you want to follow this up with a reprogram of floor(circuitID/2) 
@@ -454,7 +1011,12 @@ int8_t CtestComms(Circuit *c)
  */
 void Creset(Circuit *c) 
 {
+    int8_t id = (c->circuitID/2)*2;
     CSreset(c->circuitID);
+    if (0 <= id && id < NCIRCUITS) {
+        _Crebase(id);
+        if (id + 1 < NCIRCUITS) _Crebase(id + 1);
+    }
 }
 
 
@@ -563,16 +1125,33 @@ int32_t Cirms(void* c)
 
 /**
  *  Loads circuit data from the EEPROM into memory. This data can now be used to program the registers.
+ *  c->connected is kept since it describes the ADE that is plugged in now.
+ *  The energy totals are not in the Circuit, so they are not rolled back.
+ *  The SPI divider comes from its own byte, see Csave, and starts at the 
+ *  fastest rate if none was saved yet.
  * */
-void Cload(Circuit *c, Circuit* addrEEPROM)
+void Cload(Circuit *c, uint8_t *addrEEPROM, uint8_t *dividerEEPROM)
 {
-    eeprom_read_block(c,(uint8_t*)addrEEPROM,sizeof(Circuit));
+    int8_t connected = c->connected;
+    uint8_t divider;
+
+    eeprom_read_block(c,addrEEPROM,CSAVESIZE);
+    c->connected = connected;
+    divider = eeprom_read_byte(dividerEEPROM) - 1;
+    c->spiDivider = (divider <= 0x07) ? divider : SPI_CLOCK_DIV2;
+    CLcalcQslopes(c);
 }
 
 /**
  *  Save circuit data from the memory into EEPROM.
+ *  Goes through ELupdateBlock so the power fail ISR can write meanwhile.
+ *  The SPI divider is stored plus one, so an erased byte (0xFF) and a
+ *  zeroed one both read as not learned yet.
  * */
-void Csave(Circuit *c, Circuit* addrEEPROM) 
+void Csave(Circuit *c, uint8_t *addrEEPROM, uint8_t *dividerEEPROM) 
 {
-    eeprom_update_block(c,(uint8_t*)addrEEPROM,sizeof(Circuit));
+    uint8_t divider = c->spiDivider + 1;
+
+    ELupdateBlock(c,addrEEPROM,CSAVESIZE);
+    ELupdateBlock(&divider,dividerEEPROM,1);
 }
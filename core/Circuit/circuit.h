@@ -1,6 +1,7 @@
 #ifndef CIRCUIT_H
 #define CIRCUIT_H
 #include <stdint.h>
+#include <stddef.h>
 
 #include "arduino/HardwareSerial.h"
 
@@ -10,6 +11,25 @@
 static const uint32_t COMM	= 0x00010000;
 static const uint32_t TIME  = 0x00020000;
 
+/** How often CdrainAll moves the ADE energy registers into the totals. 
+ * This has to be well inside the time AENERGY and VAENERGY take to reach 
+ * half full at the highest load. */
+#define CDRAINMS 1000
+/** Reads of AENERGY and VAENERGY a drain makes before it gives up on a checksum. */
+#define CDRAINTRIES 3
+
+/** How often CprobeAbsent looks for ADEs that have been plugged in. */
+#define CPROBEMS 10000
+
+/**
+ * A calibration slope in fixed point, mant/2^shift. mant holds the 24 bit 
+ * mantissa of the float slope so applying it is exact integer math.
+ * */
+typedef struct {
+    int32_t mant;
+    int8_t shift;
+} Qslope;
+
 //MODEL
 typedef struct {
 
@@ -19,7 +39,8 @@ typedef struct {
 	  */
 	int8_t circuitID;
     /**
-     * Indicates whether or not this circuit is connected.
+     * Indicates whether or not this circuit's ADE answers. Set by Cprobe, 
+     * sweeps skip circuits which are not connected.
     */
     int8_t connected;
 
@@ -116,8 +137,98 @@ typedef struct {
 	*/
 	uint32_t status;
 
+    /**
+     * SPI clock divider (SPI_CLOCK_DIVx) the ADE is run at. Starts at the 
+     * fastest rate and is lowered by the ADE module when it sees 
+     * communication errors. Csave keeps it apart from the calibration, 
+     * see CSAVESIZE, so the saved layout of older firmware still loads.
+     * */
+    uint8_t spiDivider;
+
+    /**
+     * The float slopes as Qslopes, which is what Cread and the energy totals 
+     * use so there is no soft-float on the metering path. 
+     * CLcalcQslopes generates them and has to be called whenever a slope changes.
+     * They are not saved, see CSAVESIZE.
+     * */
+    Qslope IRMSq;
+    Qslope VRMSq;
+    Qslope VAq;
+    Qslope Wq;
+    Qslope VAhq;        // VAslope in mVAh per count
+    Qslope Whq;         // Wslope in mWh per count
+
 } Circuit;
 
+/**
+ * Bytes of a Circuit that Csave writes to the EEPROM as the calibration,
+ * those before spiDivider. New fields go after it.
+ * */
+#define CSAVESIZE offsetof(Circuit,spiDivider)
+
+/**
+ * Energy totals of a circuit, drained from AENERGY and VAENERGY by Cread 
+ * and CdrainAll so that nothing is lost between reports. They only grow.
+ * They are not part of the Circuit, which Cload overwrites, and only 
+ * PowerFail keeps them over a reset or a loss of power.
+ * */
+typedef struct {
+    uint64_t WhImport;  // Active energy consumed in mWh
+    uint64_t WhExport;  // Active energy returned in mWh
+    uint64_t VAh;       // Apparent energy in mVAh
+    int64_t WhCarry;    // Parts of a mWh not yet in the totals, in units of Whq
+    int64_t VAhCarry;   // Parts of a mVAh, in units of VAhq
+} Cenergy;
+
+/**
+ * The measurements of a circuit at the end of a LINECYC window. CmeasureAll
+ * publishes one for every circuit it reads successfully, so the latest can
+ * be answered at once without waiting for the ADE.
+ * */
+typedef struct {
+    uint32_t time;      // millis() when it was taken
+    uint16_t sweep;     // CmeasureAll call it was taken in, 0 for none
+    int8_t circuitID;
+    int8_t on;
+    uint32_t status;
+    int32_t IRMS;
+    int32_t VRMS;
+    int32_t periodus;
+    int32_t VA;
+    int32_t W;
+    uint16_t PF;
+    int32_t VAEnergy;
+    int32_t WEnergy;
+    int32_t ipeak;
+    int32_t vpeak;
+    uint64_t WhImport;
+    uint64_t WhExport;
+    uint64_t VAh;
+} Csnapshot;
+
+/**
+ * Fields of a snapshot for CprintFields, in the order they are printed.
+ * CFDEFAULT is what CprintSnapshot prints. CFSTATUS is not printed by 
+ * CprintFields, it is there for callers that append the status.
+ * */
+#define CFSW        0x0001
+#define CFVRMS      0x0002
+#define CFIRMS      0x0004
+#define CFVPEAK     0x0008
+#define CFIPEAK     0x0010
+#define CFPERIOD    0x0020
+#define CFVA        0x0040
+#define CFW         0x0080
+#define CFVAE       0x0100
+#define CFWE        0x0200
+#define CFPF        0x0400
+#define CFWH        0x0800
+#define CFWHX       0x1000
+#define CFVAH       0x2000
+#define CFSTATUS    0x4000
+#define CFALL       0x7FFF
+#define CFDEFAULT   (CFSW|CFVRMS|CFIRMS|CFPERIOD|CFW|CFWE|CFWH|CFWHX|CFVAH|CFSTATUS)
+
 //MODEL ACCESSORS
 void CsetOn(Circuit *c, int8_t on);
 int8_t CisOn(Circuit *c);
@@ -128,15 +239,40 @@ void Creset(Circuit *c);
 void Cprogram(Circuit *c);
 void Cclear(Circuit *c);
 void Cmeasure(Circuit *c);
+void Carm(Circuit *c);
+int8_t Cready(Circuit *c);
+void Cread(Circuit *c);
+void Cdrain(Circuit *c);
+void CdrainAll(Circuit cs[], int8_t n);
 int8_t Cstrobe(Circuit*);
 int8_t CrestoreCommunications(Circuit *c);
 int8_t CtestComms(Circuit *c);
+int8_t Cprobe(Circuit *c);
+void CprobeAll(Circuit cs[], int8_t n);
+void CprobeAbsent(Circuit cs[], int8_t n);
 int32_t Cvrms(void*);
 int32_t Cirms(void*);
 int32_t Cwaveform(void*);
 
-void Cload(Circuit *c, Circuit* addrEEPROM);
-void Csave(Circuit *c, Circuit* addrEEPROM);
+/** Called by CmeasureAll once a connected circuit has been read, timed out or failed. 
+ * _retCode holds the outcome for that circuit. */
+typedef void (CREADY)(Circuit *c);
+void CmeasureAll(Circuit cs[], int8_t n, CREADY *onReady);
+/** Called while CmeasureAll waits for the LINECYC windows to end, 
+ * e.g. to service a serial port. It must not start a measurement. */
+typedef void (CIDLE)(void);
+void CsetIdle(CIDLE *idle);
+void CtakeSnapshot(Circuit *c, Csnapshot *s);
+void Cpublish(Circuit *c);
+int8_t CgetSnapshot(int8_t circuitID, Csnapshot *s);
+Cenergy *CgetTotals(int8_t circuitID);
+/** Buffer of the Line Cprint and CprintMeas assemble their output in. */
+#define CLINESIZE 64
+void CprintSnapshot(Print *ser, const Csnapshot *s);
+void CprintFields(Print *ser, const Csnapshot *s, uint16_t fields);
+
+void Cload(Circuit *c, uint8_t *addrEEPROM, uint8_t *dividerEEPROM);
+void Csave(Circuit *c, uint8_t *addrEEPROM, uint8_t *dividerEEPROM);
 
 //CONTROLLER
 /** I'm in the process of creating a standard syntax 
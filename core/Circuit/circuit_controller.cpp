@@ -1,4 +1,5 @@
 #include "circuit.h"
+#include "calibration.h"
 #include "ADE7753/ADE7753.h"
 
 //For Serial
@@ -10,11 +11,13 @@ CSET* CSETS[3] = {CsetWslope,CsetVAslope,CsetSampleTime};
 void CsetWslope(Circuit *c, float Wslope) 
 {
     c->Wslope = Wslope;    
+    CLcalcQslopes(c);
 }
 
 void CsetVAslope(Circuit *c, float VAslope) 
 {
     c->VAslope = VAslope;    
+    CLcalcQslopes(c);
 }
 
 /**
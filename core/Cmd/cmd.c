@@ -0,0 +1,235 @@
+#include <string.h>
+#include "cmd.h"
+#include "ReturnCode/returncode.h"
+
+/**
+ * @file cmd.c
+ * The number parsers stand in for sscanf, which with float support is
+ * several KB of flash and takes a time that depends on the format.
+ * */
+
+/** Ends an argument. '\r' and '\n' are included for lines that were not trimmed. */
+static uint8_t _isEnd(char c)
+{
+    return c == '\0' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static char *_skipSpace(char *s)
+{
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+/** @return the value of a hex digit or 0xFF. */
+static uint8_t _digit(char c)
+{
+    if ('0' <= c && c <= '9') return c - '0';
+    if ('a' <= c && c <= 'f') return c - 'a' + 10;
+    if ('A' <= c && c <= 'F') return c - 'A' + 10;
+    return 0xFF;
+}
+
+/**
+ * Parses an integer at *p and advances *p past it. 0x prefixed hex may use
+ * all 32 bits, e.g. 0xdeadbeef, decimal has to fit an int32_t.
+ * @return SUCCESS or PARSEERR if *p does not start with an integer.
+ * */
+int8_t CMDparseInt(char **p, int32_t *v)
+{
+    char *s = _skipSpace(*p);
+    uint8_t neg = 0;
+    uint8_t base = 10;
+    uint8_t digits = 0;
+    uint32_t u = 0;
+    uint32_t limit;
+
+    if (*s == '-' || *s == '+') {
+        neg = (*s++ == '-');
+    }
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    }
+    for (uint8_t d; (d = _digit(*s)) < base; s++, digits++) {
+        if (u > (0xFFFFFFFFUL - d)/base) return PARSEERR;
+        u = u*base + d;
+    }
+    if (digits == 0 || !_isEnd(*s)) return PARSEERR;
+    limit = (base == 16) ? 0xFFFFFFFFUL : (neg ? 0x80000000UL : 0x7FFFFFFFUL);
+    if (u > limit) return PARSEERR;
+
+    *v = neg ? (int32_t)(0 - u) : (int32_t)u;
+    *p = s;
+    return SUCCESS;
+}
+
+/**
+ * Parses a decimal number such as 12, -0.5 or 3.6e3 at *p and advances
+ * *p past it.
+ * @return SUCCESS or PARSEERR if *p does not start with a number.
+ * */
+int8_t CMDparseFloat(char **p, float *f)
+{
+    char *s = _skipSpace(*p);
+    uint8_t neg = 0;
+    uint8_t digits = 0;
+    int16_t exp10 = 0;
+    float v = 0;
+    float scale = 1;
+
+    if (*s == '-' || *s == '+') {
+        neg = (*s++ == '-');
+    }
+    for (; '0' <= *s && *s <= '9'; s++, digits++) {
+        v = v*10 + (*s - '0');
+    }
+    if (*s == '.') {
+        for (s++; '0' <= *s && *s <= '9'; s++, digits++, exp10--) {
+            v = v*10 + (*s - '0');
+        }
+    }
+    if (digits == 0) return PARSEERR;
+    if (*s == 'e' || *s == 'E') {
+        int32_t e;
+        s++;
+        if (_isEnd(*s) || CMDparseInt(&s,&e) != SUCCESS) return PARSEERR;
+        // Beyond this the result is 0 or inf anyway
+        if (e > 90) e = 90;
+        if (e < -90) e = -90;
+        exp10 += e;
+    }
+    if (!_isEnd(*s)) return PARSEERR;
+
+    for (int16_t i = (exp10 < 0) ? -exp10 : exp10; i > 0; i--) {
+        scale *= 10;
+    }
+    v = (exp10 < 0) ? v/scale : v*scale;
+    *f = neg ? -v : v;
+    *p = s;
+    return SUCCESS;
+}
+
+/**
+ * Terminates the word at *p and advances *p past it.
+ * @return the word or NULL if the line has ended.
+ * */
+char *CMDparseWord(char **p)
+{
+    char *s = _skipSpace(*p);
+    char *word = s;
+
+    if (_isEnd(*s)) {
+        *p = s;
+        return NULL;
+    }
+    while (!_isEnd(*s)) s++;
+    if (*s != '\0') {
+        *s++ = '\0';
+    }
+    *p = s;
+    return word;
+}
+
+/**
+ * Parses the arguments in line according to schema, which is in RAM.
+ * line may be NULL if the schema is empty.
+ * @return SUCCESS, PARSEERR if an argument is missing or malformed, or
+ *  ARGVALUEERR for an unknown schema character.
+ * */
+int8_t CMDparseArgs(const char *schema, char *line, CmdArgs *args)
+{
+    static char none[1];
+    char *p = (line == NULL) ? none : line;
+
+    for (uint8_t i=0; i < CMDMAXARGS && schema[i] != '\0'; i++) {
+        switch (schema[i]) {
+            case CMDINT:
+                ifnsuccess(CMDparseInt(&p,&args->arg[i].i)) return PARSEERR;
+                break;
+            case CMDFLOAT:
+                ifnsuccess(CMDparseFloat(&p,&args->arg[i].f)) return PARSEERR;
+                break;
+            case CMDWORD:
+                if ((args->arg[i].s = CMDparseWord(&p)) == NULL) return PARSEERR;
+                break;
+            default:
+                return ARGVALUEERR;
+        }
+    }
+    args->rest = _skipSpace(p);
+    return SUCCESS;
+}
+
+/**
+ * @return the entry of table named name or NULL. The entry is in flash.
+ * */
+const CmdEntry *CMDfind(const CmdEntry *table, uint8_t n, const char *name)
+{
+    for (uint8_t i=0; i < n; i++) {
+        if (strncmp_P(name,table[i].name,CMDNAMESIZE) == 0) {
+            return &table[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Runs the command name with the arguments in line.
+ * @return SUCCESS once the handler has run, FAILURE if there is no such
+ *  command or the error of CMDparseArgs.
+ * */
+int8_t CMDexec(const CmdEntry *table, uint8_t n, const char *name, char *line, CmdArgs *args)
+{
+    const CmdEntry *entry = CMDfind(table,n,name);
+    char schema[CMDMAXARGS+1];
+    CmdHandler handler;
+    int8_t rc;
+
+    if (entry == NULL) return FAILURE;
+    args->name = name;
+    memcpy_P(schema,entry->schema,sizeof(schema));
+    memcpy_P(&handler,&entry->handler,sizeof(handler));
+    ifnsuccess(rc = CMDparseArgs(schema,line,args)) return rc;
+    handler(args);
+    return SUCCESS;
+}
+
+/**
+ * Runs the command line, a command name followed by its arguments.
+ * args->name and args->rest are left at the command name and its arguments 
+ * even when the command is unknown, args->name is NULL for an empty line.
+ * @return as CMDexec, FAILURE for an empty line.
+ * */
+int8_t CMDdispatch(const CmdEntry *table, uint8_t n, char *line, CmdArgs *args)
+{
+    char *name = CMDparseWord(&line);
+
+    args->name = name;
+    args->rest = line;
+    if (name == NULL) return FAILURE;
+    return CMDexec(table,n,name,line,args);
+}
+
+/**
+ * Copies the value of key from a string of &-delimited key=value pairs,
+ * truncated to size-1 characters.
+ * @return SUCCESS or FAILURE if there is no such key.
+ * */
+int8_t CMDgetValue(const char *s, const char *key, char *val, size_t size)
+{
+    size_t klen = strlen(key);
+
+    while (s != NULL) {
+        if (strncmp(s,key,klen) == 0 && s[klen] == '=') {
+            size_t i = 0;
+            for (s += klen+1; *s != '\0' && *s != '&' && *s != '\r' && *s != '\n'; s++) {
+                if (i+1 < size) val[i++] = *s;
+            }
+            val[i] = '\0';
+            return SUCCESS;
+        }
+        s = strchr(s,'&');
+        if (s != NULL) s++;
+    }
+    return FAILURE;
+}
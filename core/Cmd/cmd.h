@@ -0,0 +1,73 @@
+#ifndef CMD_H
+#define CMD_H
+#include <inttypes.h>
+#include <stddef.h>
+#include <avr/pgmspace.h>
+
+/** @file cmd.h
+ *  Command tables and the tokenizer shared by the command line front ends.
+ *
+ *  A command table is an array of CmdEntry in flash. Each entry names a
+ *  command, the arguments that follow the name and the handler to call.
+ *  The arguments are described by a schema string with one character per
+ *  argument:
+ *      CMDINT   'i'  decimal or 0x prefixed hex, fits an int32_t
+ *      CMDFLOAT 'f'  decimal with optional fraction and exponent
+ *      CMDWORD  'w'  anything up to the next space
+ *  Arguments are separated by spaces or tabs. Words are terminated in place,
+ *  so the line has to be writable. Nothing is allocated.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Longest command name including the terminating zero. */
+#define CMDNAMESIZE 12
+#define CMDMAXARGS 3
+
+#define CMDINT 'i'
+#define CMDFLOAT 'f'
+#define CMDWORD 'w'
+
+typedef union {
+    int32_t i;
+    float f;
+    char *s;
+} CmdArg;
+
+typedef struct {
+    /** Name of the command being run. */
+    const char *name;
+    /** Arguments in schema order. */
+    CmdArg arg[CMDMAXARGS];
+    /** What follows the arguments on the line. */
+    char *rest;
+} CmdArgs;
+
+typedef void (*CmdHandler)(CmdArgs *args);
+
+typedef struct {
+    char name[CMDNAMESIZE];
+    char schema[CMDMAXARGS+1];
+    CmdHandler handler;
+} CmdEntry;
+
+/** Number of entries in a command table. */
+#define CMDCOUNT(table) (sizeof(table)/sizeof(table[0]))
+
+int8_t CMDparseInt(char **p, int32_t *v);
+int8_t CMDparseFloat(char **p, float *f);
+char *CMDparseWord(char **p);
+int8_t CMDparseArgs(const char *schema, char *line, CmdArgs *args);
+
+const CmdEntry *CMDfind(const CmdEntry *table, uint8_t n, const char *name);
+int8_t CMDexec(const CmdEntry *table, uint8_t n, const char *name, char *line, CmdArgs *args);
+int8_t CMDdispatch(const CmdEntry *table, uint8_t n, char *line, CmdArgs *args);
+
+int8_t CMDgetValue(const char *s, const char *key, char *val, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1 +1,303 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
 
+#include "ReturnCode/returncode.h"
+#include "Frame/frame.h"
+#include "EELogger.h"
+#ifdef HOST
+#include "host/hal.h"
+#endif
+
+static uint8_t *_ELslot(const EELog *log, uint16_t slot)
+{
+    return log->start + (uint16_t)ELSLOT(log->size)*slot;
+}
+
+/** Slot after the newest record, the next one written. */
+static uint16_t _ELnext(const EELog *log)
+{
+    return (log->head + 1 == log->slots) ? 0 : log->head + 1;
+}
+
+/**
+ * Programs a byte in one of the EEPROM's split modes, mode is _BV(EEPM0) 
+ * to erase it and _BV(EEPM1) to write an erased one. Either takes half 
+ * as long as eeprom_write_byte.
+ * */
+static void _ELprogram(uint8_t *p, uint8_t value, uint8_t mode)
+{
+    uint8_t oldSREG;
+#ifdef HOST
+    HOSTeepromProgram(p,value,mode);
+    return;
+#endif
+    eeprom_busy_wait();
+    oldSREG = SREG;
+    cli();
+    EEAR = (uint16_t)(uintptr_t)p;
+    EEDR = value;
+    EECR = mode | _BV(EEMPE);
+    EECR |= _BV(EEPE);
+    SREG = oldSREG;
+}
+
+/**
+ * Turns the analog comparator's interrupt off. ACI is written 0, which
+ * leaves an edge that comes in the meantime pending.
+ * @return ACSR to give _ELrelease.
+ * */
+static uint8_t _ELhold(void)
+{
+    uint8_t acsr = ACSR & ~_BV(ACI);
+    ACSR = acsr & ~_BV(ACIE);
+    return acsr;
+}
+
+static void _ELrelease(uint8_t acsr)
+{
+    ACSR = acsr;
+}
+
+/**
+ * Updates a byte with the comparator's interrupt off, so the ISR cannot 
+ * come between eeprom_update_byte setting EEAR and EEPE.
+ * */
+static void _ELupdate(uint8_t *p, uint8_t value)
+{
+    uint8_t acsr;
+
+    eeprom_busy_wait();
+    acsr = _ELhold();
+    eeprom_update_byte(p,value);
+    _ELrelease(acsr);
+}
+
+/**
+ * Reads the sequence number of a slot, and its record if record is not NULL.
+ * @return true if the slot passes its CRC.
+ * */
+static uint8_t _ELcheck(const EELog *log, uint16_t slot, uint16_t *seq, uint8_t *record)
+{
+    uint8_t *p = _ELslot(log,slot);
+    uint8_t buf[2];
+    uint16_t crc;
+
+    eeprom_read_block(buf,p,2);
+    *seq = FRgetU16(buf);
+    crc = FRcrc16(0xFFFF,buf,2);
+    p += 2;
+    for (uint8_t i=0; i < log->size; i++, p++) {
+        buf[0] = eeprom_read_byte(p);
+        if (record) record[i] = buf[0];
+        crc = FRcrc16(crc,buf,1);
+    }
+    eeprom_read_block(buf,p,2);
+    return FRgetU16(buf) == crc;
+}
+
+/**
+ * Sets up a journal of records of size bytes in the bytes of EEPROM at
+ * start and finds its newest record.
+ * @return SUCCESS, FAILURE if the region does not hold two slots.
+ * */
+int8_t ELopen(EELog *log, uint8_t *start, uint16_t bytes, uint8_t size)
+{
+    uint16_t first;
+    uint16_t seq;
+    uint16_t lo;
+    uint16_t hi;
+
+    log->start = start;
+    log->size = size;
+    log->stop = NULL;
+    log->slots = bytes/ELSLOT(size);
+    if (log->slots < 2) {
+        log->slots = 0;
+        log->count = 0;
+        log->prepared = false;
+        return FAILURE;
+    }
+    // Empty, the first record goes to slot 0 with sequence number 0
+    log->head = log->slots - 1;
+    log->seq = 0xFFFF;
+    log->count = 0;
+    log->prepared = false;
+    if (!_ELcheck(log,0,&first,NULL)) {
+        // Either nothing was written or the write of slot 0 after a lap was torn
+        if (_ELcheck(log,log->slots - 1,&seq,NULL)) {
+            log->seq = seq;
+            log->count = log->slots - 1;
+        }
+        return SUCCESS;
+    }
+    // Slots up to lo are this lap's, those from hi on are not
+    lo = 0;
+    hi = log->slots;
+    while (hi - lo > 1) {
+        uint16_t mid = lo + (hi - lo)/2;
+        if (_ELcheck(log,mid,&seq,NULL) && (uint16_t)(seq - first) == mid) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    log->head = lo;
+    log->seq = first + lo;
+    log->count = lo + 1;
+    if (hi == log->slots) return SUCCESS;
+    // Slot hi is from the last lap, or was torn and the last lap goes on after it
+    if (_ELcheck(log,hi,&seq,NULL) && seq == (uint16_t)(log->seq + 1 - log->slots)) {
+        log->count = log->slots;
+    } else if (_ELcheck(log,(hi + 1 == log->slots) ? 0 : hi + 1,&seq,NULL)
+            && seq == (uint16_t)(log->seq + 2 - log->slots)) {
+        log->count = log->slots - 1;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Writes a record of log->size bytes over the oldest one. Gives up before
+ * the last byte, which leaves the slot failing its CRC, once log->stop is
+ * set.
+ * @return SUCCESS, FAILURE if the journal was not opened or it gave up.
+ * */
+int8_t ELappend(EELog *log, const void *record)
+{
+    const uint8_t *r = (const uint8_t *)record;
+    uint8_t buf[4];
+    uint16_t seq;
+    uint16_t crc;
+    uint8_t *p;
+    uint8_t acsr;
+
+    if (log->slots == 0) return FAILURE;
+    // The oldest record is gone as soon as its slot is written
+    if (log->count == log->slots) log->count--;
+    log->prepared = false;
+
+    p = _ELslot(log,_ELnext(log));
+    seq = log->seq + 1;
+    FRputU16(buf,seq);
+    crc = FRcrc16(0xFFFF,buf,2);
+    crc = FRcrc16(crc,r,log->size);
+    FRputU16(&buf[2],crc);
+    for (uint8_t i=0; i < 2; i++) _ELupdate(p++,buf[i]);
+    for (uint8_t i=0; i < log->size; i++) {
+        if (log->stop && *log->stop) return FAILURE;
+        _ELupdate(p++,r[i]);
+    }
+    _ELupdate(p++,buf[2]);
+
+    // The record is there with its last byte, the ISR sees it in log->seq
+    eeprom_busy_wait();
+    acsr = _ELhold();
+    if (log->stop && *log->stop) {
+        _ELrelease(acsr);
+        return FAILURE;
+    }
+    eeprom_update_byte(p,buf[3]);
+    log->head = _ELnext(log);
+    log->seq = seq;
+    log->count++;
+    _ELrelease(acsr);
+    return SUCCESS;
+}
+
+/**
+ * Erases the slot the next record goes to, which drops the oldest record
+ * if the journal is full. Bytes that are already erased are left alone.
+ * */
+void ELprepare(EELog *log)
+{
+    uint8_t *p;
+
+    if (log->slots == 0 || log->prepared) return;
+    if (log->count == log->slots) log->count--;
+    p = _ELslot(log,_ELnext(log));
+    for (uint8_t i=0; i < ELSLOT(log->size); i++, p++) {
+        if (eeprom_read_byte(p) != 0xFF) {
+            _ELprogram(p,0xFF,_BV(EEPM0));
+        }
+    }
+    log->prepared = true;
+}
+
+/**
+ * Writes a record to the slot erased by ELprepare, programming only the 
+ * bytes that are not 0xFF. Short enough to run in an ISR.
+ * @return SUCCESS, FAILURE if the slot has not been prepared.
+ * */
+int8_t ELappendPrepared(EELog *log, const void *record)
+{
+    const uint8_t *r = (const uint8_t *)record;
+    uint8_t buf[2];
+    uint16_t crc;
+    uint8_t *p;
+
+    if (!log->prepared) return FAILURE;
+    log->head = _ELnext(log);
+    log->seq++;
+    if (log->count < log->slots) log->count++;
+    log->prepared = false;
+
+    p = _ELslot(log,log->head);
+    FRputU16(buf,log->seq);
+    crc = FRcrc16(0xFFFF,buf,2);
+    crc = FRcrc16(crc,r,log->size);
+    for (uint8_t i=0; i < 2; i++, p++) {
+        if (buf[i] != 0xFF) _ELprogram(p,buf[i],_BV(EEPM1));
+    }
+    for (uint8_t i=0; i < log->size; i++, p++) {
+        if (r[i] != 0xFF) _ELprogram(p,r[i],_BV(EEPM1));
+    }
+    FRputU16(buf,crc);
+    for (uint8_t i=0; i < 2; i++, p++) {
+        if (buf[i] != 0xFF) _ELprogram(p,buf[i],_BV(EEPM1));
+    }
+    return SUCCESS;
+}
+
+/**
+ * Reads the record logged back records before the newest one.
+ * @return SUCCESS, FAILURE if there is no such record or it is damaged.
+ * */
+int8_t ELread(const EELog *log, uint16_t back, void *record)
+{
+    uint16_t slot;
+    uint16_t seq;
+
+    if (back >= log->count) return FAILURE;
+    slot = (back > log->head) ? log->head + log->slots - back : log->head - back;
+    if (!_ELcheck(log,slot,&seq,(uint8_t *)record) || seq != (uint16_t)(log->seq - back)) {
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/** Erases the region, which writes every slot once. */
+void ELclear(EELog *log)
+{
+    uint8_t *end = _ELslot(log,log->slots);
+    for (uint8_t *p = log->start; p < end; p++) {
+        _ELupdate(p,0xFF);
+    }
+    log->head = (log->slots) ? log->slots - 1 : 0;
+    log->seq = 0xFFFF;
+    log->count = 0;
+    log->prepared = false;
+}
+
+/**
+ * eeprom_update_block for writes outside the ISR, byte by byte with the
+ * comparator's interrupt off around each.
+ * */
+void ELupdateBlock(const void *src, void *dst, uint16_t n)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+
+    for (uint16_t i=0; i < n; i++) {
+        _ELupdate(d + i,s[i]);
+    }
+}
@@ -1,8 +1,65 @@
 #ifndef EELOGGER
 #define EELOGGER
-//Takes in the amount of EEPROM to use and start offset in memory. 
-//Uses EEPROM to log data
-//Take format string and prints data dump from log
-//Option to add time stamp and use circular buffer
+#include <inttypes.h>
 
+/** @file EELogger.h
+ *  Journal of fixed size records in a region of the EEPROM.
+ *
+ *  The region is divided into slots which are written in turn, wrapping
+ *  around at the end, so every cell is written once per lap and a record
+ *  can be saved often without wearing out the cells of a fixed address. A
+ *  slot holds a 16 bit sequence number, the record and a CRC-16 (see
+ *  Frame/frame.h) of both, all little endian. A slot that was erased or
+ *  whose write was cut short by a reset fails the CRC.
+ *
+ *  The sequence numbers go up by one from slot to slot up to the newest
+ *  record and are one lap lower after it, so ELopen finds the newest record
+ *  by binary search, reading about log2(slots) slots. Only the slot after
+ *  the newest is written next, so a torn write loses nothing but itself.
+ *
+ *  Timestamps, if wanted, are part of the record.
+ *
+ *  ELappend rewrites the slot byte by byte, about 3.4 ms for every byte
+ *  that changes. A record that has to be saved in a hurry, e.g. when the
+ *  supply fails, goes to a slot erased ahead of time by ELprepare with
+ *  ELappendPrepared, which only programs the bytes that are not 0xFF and
+ *  takes about 1.8 ms for each.
+ *
+ *  ELappendPrepared is meant for the analog comparator's ISR (see
+ *  PowerFail/powerfail.h). The other writes, and those of the rest of the
+ *  firmware through ELupdateBlock, turn its interrupt off from setting
+ *  EEAR to setting EEPE of every byte, so the ISR never comes in between.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Bytes of a slot holding a record of size bytes. */
+#define ELSLOT(size) ((size) + 4)
+/** Bytes of a region of n slots. */
+#define ELREGION(size,n) (ELSLOT(size)*(n))
+
+typedef struct {
+    uint8_t *start;     // region in EEPROM, an EEMEM address
+    uint16_t slots;
+    uint8_t size;       // of a record
+    uint16_t head;      // slot of the newest record
+    uint16_t seq;       // of the newest record
+    uint16_t count;     // records held
+    uint8_t prepared;   // the slot after head is erased
+    volatile uint8_t *stop; // ELappend gives up once it is set, NULL for never
+} EELog;
+
+int8_t ELopen(EELog *log, uint8_t *start, uint16_t bytes, uint8_t size);
+int8_t ELappend(EELog *log, const void *record);
+void ELprepare(EELog *log);
+int8_t ELappendPrepared(EELog *log, const void *record);
+int8_t ELread(const EELog *log, uint16_t back, void *record);
+void ELclear(EELog *log);
+void ELupdateBlock(const void *src, void *dst, uint16_t n);
+
+#ifdef __cplusplus
+}
+#endif
 #endif
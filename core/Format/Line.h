@@ -0,0 +1,69 @@
+#ifndef LINE_H
+#define LINE_H
+
+#include <inttypes.h>
+#include <string.h>
+#include "arduino/Print.h"
+
+/** @file Line.h
+ *  A Print that assembles what is printed to it in a buffer and hands the
+ *  buffer on in a single write, so a report costs one call into the UART
+ *  instead of one per character.
+ *
+ *  The buffer is handed on when it is full, on flush() and when the Line
+ *  goes out of scope. Put it on the stack around the code that prints:
+ *      Line<CLINESIZE> line(&cpu);
+ *      line.print(...);
+ */
+
+template <uint16_t N>
+class Line : public Print
+{
+  public:
+    Line(Print *out) : _out(out), _n(0) {}
+    ~Line() { flush(); }
+
+    virtual void write(uint8_t c)
+    {
+        if (_n == N) flush();
+        _buf[_n++] = c;
+    }
+
+    virtual void write(const char *str)
+    {
+        write((const uint8_t *)str,strlen(str));
+    }
+
+    virtual void write(const uint8_t *buffer, size_t size)
+    {
+        if (size <= (size_t)(N - _n)) {
+            memcpy(&_buf[_n],buffer,size);
+            _n += size;
+            return;
+        }
+        while (size > 0) {
+            if (_n == N) flush();
+            size_t n = (size < (size_t)(N - _n)) ? size : N - _n;
+            memcpy(&_buf[_n],buffer,n);
+            _n += n;
+            buffer += n;
+            size -= n;
+        }
+    }
+
+    /** Hands on what has been assembled so far. */
+    void flush()
+    {
+        if (_n > 0) {
+            _out->write(_buf,_n);
+            _n = 0;
+        }
+    }
+
+  private:
+    Print *const _out;
+    uint16_t _n;
+    uint8_t _buf[N];
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include <avr/pgmspace.h>
+#include "format.h"
+
+/**
+ * @file format.c
+ * Values are split into groups of four digits by multiplying with the
+ * reciprocal of 10000, the groups into pairs of digits the same way with 100,
+ * and the pairs are looked up. A 32 bit value takes at most two 32x32 bit
+ * multiplications.
+ * */
+
+/** "00" to "99", so two digits are found with one lookup. */
+static const char _FMpairs[] PROGMEM =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/** v/10000 for every uint32_t, by multiplying with 2^45/10000 rounded up. */
+static uint32_t _FMdiv10000(uint32_t v)
+{
+    return (uint32_t)(((uint64_t)v * 0xD1B71759UL) >> 45);
+}
+
+/**
+ * Writes the digits of v < 10000, four of them with pad.
+ * */
+static uint8_t _FMchunk(char *p, uint16_t v, uint8_t pad)
+{
+    // v/100, exact below 43699
+    uint8_t hi = ((uint32_t)v * 5243) >> 19;
+    uint8_t lo = v - hi*100;
+    uint8_t n = 0;
+
+    if (pad || v >= 1000) p[n++] = pgm_read_byte(&_FMpairs[2*hi]);
+    if (pad || v >= 100) p[n++] = pgm_read_byte(&_FMpairs[2*hi+1]);
+    if (pad || v >= 10) p[n++] = pgm_read_byte(&_FMpairs[2*lo]);
+    p[n++] = pgm_read_byte(&_FMpairs[2*lo+1]);
+    return n;
+}
+
+uint8_t FMu32(char *p, uint32_t v)
+{
+    uint32_t hi;
+    uint8_t n;
+
+    if (v < 10000) {
+        return _FMchunk(p,v,0);
+    }
+    hi = _FMdiv10000(v);
+    if (hi < 10000) {
+        n = _FMchunk(p,hi,0);
+    } else {
+        uint32_t top = _FMdiv10000(hi);
+        n = _FMchunk(p,top,0);
+        n += _FMchunk(&p[n],hi - top*10000,1);
+    }
+    return n + _FMchunk(&p[n],v - hi*10000,1);
+}
+
+/** Writes v < 10^9 as exactly 9 digits. */
+static uint8_t _FMpad9(char *p, uint32_t v)
+{
+    uint32_t hi = _FMdiv10000(v);
+    uint32_t top = _FMdiv10000(hi);
+    p[0] = '0' + top;
+    _FMchunk(&p[1],hi - top*10000,1);
+    _FMchunk(&p[5],v - hi*10000,1);
+    return 9;
+}
+
+uint8_t FMi32(char *p, int32_t v)
+{
+    if (v < 0) {
+        *p = '-';
+        return 1 + FMu32(p+1,0 - (uint32_t)v);
+    }
+    return FMu32(p,v);
+}
+
+/**
+ * Values beyond 32 bits take one 64 bit division by 10^9 per 9 digits,
+ * the digits themselves are found as for FMu32.
+ * */
+uint8_t FMu64(char *p, uint64_t v)
+{
+    uint64_t hi;
+    uint8_t n;
+
+    if ((v >> 32) == 0) {
+        return FMu32(p,(uint32_t)v);
+    }
+    hi = v / 1000000000UL;
+    n = FMu64(p,hi);
+    return n + _FMpad9(&p[n],(uint32_t)(v - hi*1000000000UL));
+}
+
+uint8_t FMi64(char *p, int64_t v)
+{
+    if (v < 0) {
+        *p = '-';
+        return 1 + FMu64(p+1,0 - (uint64_t)v);
+    }
+    return FMu64(p,v);
+}
+
+/** Upper case without leading zeros, like Print's HEX. */
+uint8_t FMhex32(char *p, uint32_t v)
+{
+    uint8_t n = 0;
+    int8_t shift = 28;
+
+    while (shift > 0 && (v >> shift) == 0) {
+        shift -= 4;
+    }
+    for (; shift >= 0; shift -= 4) {
+        uint8_t d = (v >> shift) & 0xF;
+        p[n++] = (d < 10) ? '0' + d : 'A' + d - 10;
+    }
+    return n;
+}
+
+/**
+ * Writes v/10^decimals with exactly decimals digits after the point,
+ * e.g. FMfixed(p,-5,3) is "-0.005". decimals is at most 9.
+ * */
+uint8_t FMfixed(char *p, int32_t v, uint8_t decimals)
+{
+    char digits[FMMAXU32];
+    uint8_t len;
+    uint8_t n = 0;
+
+    if (v < 0) {
+        p[n++] = '-';
+    }
+    len = FMu32(digits,(v < 0) ? 0 - (uint32_t)v : (uint32_t)v);
+    if (decimals == 0) {
+        for (uint8_t i = 0; i < len; i++) p[n++] = digits[i];
+        return n;
+    }
+    if (len <= decimals) {
+        p[n++] = '0';
+        p[n++] = '.';
+        for (uint8_t i = len; i < decimals; i++) p[n++] = '0';
+        for (uint8_t i = 0; i < len; i++) p[n++] = digits[i];
+        return n;
+    }
+    for (uint8_t i = 0; i < len; i++) {
+        if (i == len - decimals) p[n++] = '.';
+        p[n++] = digits[i];
+    }
+    return n;
+}
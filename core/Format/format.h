@@ -0,0 +1,39 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+#include <inttypes.h>
+
+/** @file format.h
+ *  Number to text conversion without division.
+ *
+ *  The AVR has no divide instruction and a 32 bit division takes several
+ *  hundred cycles, so the usual digit by digit n % 10, n /= 10 costs that
+ *  for every digit. Here the divisions by constants are multiplications by
+ *  their reciprocal and the digits come in pairs from a table.
+ *
+ *  The functions write into p without a terminating zero and return the
+ *  number of characters written. p has to hold the FMMAX size of the call.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FMMAXU32 10
+#define FMMAXI32 11
+#define FMMAXU64 20
+#define FMMAXI64 20
+#define FMMAXHEX32 8
+/** FMfixed, the sign, 10 digits and the point. */
+#define FMMAXFIXED 12
+
+uint8_t FMu32(char *p, uint32_t v);
+uint8_t FMi32(char *p, int32_t v);
+uint8_t FMu64(char *p, uint64_t v);
+uint8_t FMi64(char *p, int64_t v);
+uint8_t FMhex32(char *p, uint32_t v);
+uint8_t FMfixed(char *p, int32_t v, uint8_t decimals);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
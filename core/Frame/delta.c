@@ -0,0 +1,170 @@
+#include "delta.h"
+
+/**
+ * @file delta.c
+ * Varints hold 7 bits per byte, least significant first, with the top bit
+ * set on every byte but the last. Zigzag maps 0, -1, 1, -2, ... to 0, 1, 2,
+ * 3, ... so small differences of either sign stay short.
+ * */
+
+/**
+ * @param p has to hold 10 bytes.
+ * @return the number of bytes written.
+ * */
+uint8_t DLputVarint(uint8_t *p, uint64_t v)
+{
+    uint8_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/**
+ * Reads a varint from the n bytes at p.
+ * @return the number of bytes read or -1 if it does not end within n bytes.
+ * */
+int8_t DLgetVarint(const uint8_t *p, uint8_t n, uint64_t *v)
+{
+    uint64_t u = 0;
+    for (uint8_t i=0; i < n && i < 10; i++) {
+        u |= (uint64_t)(p[i] & 0x7F) << (7*i);
+        if (!(p[i] & 0x80)) {
+            *v = u;
+            return i+1;
+        }
+    }
+    return -1;
+}
+
+uint64_t DLzigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+int64_t DLunzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/** Makes the next report a keyframe. */
+void DLreset(DLencoder *e)
+{
+    e->reports = 0;
+}
+
+/**
+ * Encodes a report of the circuit e belongs to and remembers it.
+ * @param entry has to hold DLMAXENTRY bytes.
+ * @return the length of the entry.
+ * */
+uint8_t DLencode(DLencoder *e, const DLreport *r, uint8_t *entry)
+{
+    uint8_t key = (e->reports == 0 || e->reports >= DLKEYEVERY || e->fields != r->fields);
+    uint8_t n = 1;
+
+    entry[0] = (r->circuitID & DLIDMASK) | (r->on ? DLSWON : 0) | (key ? DLKEY : 0);
+    if (key) {
+        n += DLputVarint(&entry[n],r->fields);
+        n += DLputVarint(&entry[n],r->seq);
+        n += DLputVarint(&entry[n],r->time);
+        e->seqStep = 0;
+        e->timeStep = 0;
+        e->reports = 0;
+    } else {
+        int32_t seqStep = r->seq - e->seq;
+        int32_t timeStep = r->time - e->time;
+        n += DLputVarint(&entry[n],DLzigzag((int32_t)((uint32_t)seqStep - e->seqStep)));
+        n += DLputVarint(&entry[n],DLzigzag((int32_t)((uint32_t)timeStep - e->timeStep)));
+        e->seqStep = seqStep;
+        e->timeStep = timeStep;
+    }
+    for (uint8_t i=0; i < DLNFIELDS; i++) {
+        if (!(r->fields & DLFIELD(i))) continue;
+        int32_t v = (int32_t)r->v[i];
+        if (key) {
+            n += DLputVarint(&entry[n],DLzigzag(r->v[i]));
+        } else {
+            // Differences wrap like the low 32 bits of the energy totals do
+            n += DLputVarint(&entry[n],DLzigzag((int32_t)((uint32_t)v - e->v[i])));
+        }
+        e->v[i] = v;
+    }
+    e->fields = r->fields;
+    e->seq = r->seq;
+    e->time = r->time;
+    e->reports++;
+    return n;
+}
+
+/**
+ * Decodes an entry of the circuit d belongs to, which is entry[0] & DLIDMASK.
+ * r is only filled if d->state is DLVALID afterwards, otherwise the entry
+ * followed a lost one and is skipped.
+ * @return the length of the entry or -1 if it cannot be parsed, in which
+ *  case nothing after it can be either.
+ * */
+int16_t DLdecode(DLdecoder *d, const uint8_t *entry, uint8_t n, DLreport *r)
+{
+    DLreport next;
+    uint64_t u;
+    int8_t len;
+    uint8_t in = 1;
+    uint8_t key;
+
+    if (n < 1) return -1;
+    key = (entry[0] & DLKEY) != 0;
+    if (!key && d->state == DLNONE) return -1;
+
+    next = d->last;
+    next.circuitID = entry[0] & DLIDMASK;
+    next.on = (entry[0] & DLSWON) != 0;
+    if (key) {
+        uint64_t seq, time;
+        if ((len = DLgetVarint(&entry[in],n-in,&u)) < 0) return -1;
+        in += len;
+        if ((len = DLgetVarint(&entry[in],n-in,&seq)) < 0) return -1;
+        in += len;
+        if ((len = DLgetVarint(&entry[in],n-in,&time)) < 0) return -1;
+        in += len;
+        next.fields = u;
+        next.seq = seq;
+        next.time = time;
+        d->seqStep = 0;
+        d->timeStep = 0;
+    } else {
+        int32_t seqStep, timeStep;
+        if ((len = DLgetVarint(&entry[in],n-in,&u)) < 0) return -1;
+        in += len;
+        seqStep = (uint32_t)d->seqStep + (uint32_t)DLunzigzag(u);
+        if ((len = DLgetVarint(&entry[in],n-in,&u)) < 0) return -1;
+        in += len;
+        timeStep = (uint32_t)d->timeStep + (uint32_t)DLunzigzag(u);
+        next.seq += seqStep;
+        next.time += timeStep;
+        d->seqStep = seqStep;
+        d->timeStep = timeStep;
+    }
+    for (uint8_t i=0; i < DLNFIELDS; i++) {
+        if (!(next.fields & DLFIELD(i))) continue;
+        if ((len = DLgetVarint(&entry[in],n-in,&u)) < 0) return -1;
+        in += len;
+        if (key) {
+            next.v[i] = DLunzigzag(u);
+        } else if (i >= DLENERGY && i < DLENERGY+3) {
+            next.v[i] += (int32_t)DLunzigzag(u);
+        } else {
+            next.v[i] = (int32_t)((uint32_t)next.v[i] + (uint32_t)DLunzigzag(u));
+        }
+    }
+    d->last = next;
+    if (key) {
+        d->state = DLVALID;
+    }
+    if (d->state == DLVALID) {
+        *r = next;
+    }
+    return in;
+}
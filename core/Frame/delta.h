@@ -0,0 +1,91 @@
+#ifndef DELTA_H
+#define DELTA_H
+#include <inttypes.h>
+
+/** @file delta.h
+ *  Delta coding of meter reports. A report is sent as the difference of each
+ *  field to the previous report of the same circuit, as a zigzag varint, so
+ *  the usual small changes take one or two bytes. Every DLKEYEVERY reports of
+ *  a circuit, and whenever its fields change, the report is a keyframe with
+ *  absolute values instead.
+ *
+ *  An entry is
+ *      0 circuitID in bits 0-4, DLSWON, DLKEY
+ *      keyframe: fields (CF flags, varint), seq (varint), millis() (varint),
+ *          then each field that is set as a zigzag varint
+ *      delta: seq and millis() as zigzag varints of how much their step
+ *          differs from the previous step, then each field that is set as
+ *          the zigzag varint of its difference
+ *  Fields are in CF order (Circuit/circuit.h) and CFSW is carried by DLSWON.
+ *  The 64 bit energy totals are sent whole in keyframes and by the
+ *  difference of their low 32 bits otherwise.
+ *
+ *  The entries depend on the previous ones, so whatever carries them has to
+ *  tell the decoder when some were lost, e.g. by counting frames. The
+ *  decoder then waits for the next keyframe of each circuit.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Fields with a value, VRMS to STATUS. Field i has the CF flag DLFIELD(i). */
+#define DLNFIELDS 14
+#define DLFIELD(i) ((uint16_t)1 << ((i)+1))
+/** Index of the first of the three 64 bit energy totals, WH, WHX and VAH. */
+#define DLENERGY 10
+
+#define DLSWON  0x20
+#define DLKEY   0x40
+#define DLIDMASK 0x1F
+
+#define DLKEYEVERY 32
+/** Largest entry, a keyframe with every field at its largest. */
+#define DLMAXENTRY (1 + 3 + 5 + 5 + (DLNFIELDS-3)*5 + 3*10)
+
+/** A report, the values of the fields that are not set are ignored. */
+typedef struct {
+    int8_t circuitID;
+    uint8_t on;
+    uint16_t fields;
+    uint32_t seq;
+    uint32_t time;
+    int64_t v[DLNFIELDS];
+} DLreport;
+
+/** What the encoder remembers of the last report of a circuit. */
+typedef struct {
+    uint8_t reports;    // since the last keyframe, 0 to force one
+    uint16_t fields;
+    uint32_t seq;
+    uint32_t time;
+    int32_t seqStep;
+    int32_t timeStep;
+    int32_t v[DLNFIELDS];
+} DLencoder;
+
+#define DLNONE  0   // nothing is known, the entries cannot even be parsed
+#define DLSTALE 1   // entries were lost, waiting for a keyframe
+#define DLVALID 2
+
+/** What the decoder knows of a circuit. */
+typedef struct {
+    uint8_t state;
+    int32_t seqStep;
+    int32_t timeStep;
+    DLreport last;
+} DLdecoder;
+
+uint8_t DLputVarint(uint8_t *p, uint64_t v);
+int8_t DLgetVarint(const uint8_t *p, uint8_t n, uint64_t *v);
+uint64_t DLzigzag(int64_t v);
+int64_t DLunzigzag(uint64_t v);
+
+void DLreset(DLencoder *e);
+uint8_t DLencode(DLencoder *e, const DLreport *r, uint8_t *entry);
+int16_t DLdecode(DLdecoder *d, const uint8_t *entry, uint8_t n, DLreport *r);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
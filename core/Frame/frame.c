@@ -0,0 +1,108 @@
+#include "frame.h"
+
+/**
+ * @file frame.c
+ * COBS (Consistent Overhead Byte Stuffing) replaces every zero in the data by 
+ * the distance to the next zero, so zero can only appear as the frame delimiter.
+ * */
+
+/**
+ * CRC-16/CCITT-FALSE, poly 0x1021. Start with crc = 0xFFFF.
+ * */
+uint16_t FRcrc16(uint16_t crc, const uint8_t *data, uint8_t n)
+{
+    for (uint8_t i=0; i < n; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t b=0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * Frames a record of n <= FRMAXRECORD bytes.
+ * @param frame has to hold FRSIZE(n) bytes.
+ * @return the number of bytes in frame including the terminating zero.
+ * */
+uint8_t FRencode(const uint8_t *record, uint8_t n, uint8_t *frame)
+{
+    uint8_t crc[2];
+    uint8_t code = 0;   // index of the current code byte
+    uint8_t out = 1;
+
+    FRputU16(crc,FRcrc16(0xFFFF,record,n));
+    for (uint8_t i=0; i < n+2; i++) {
+        uint8_t b = (i < n) ? record[i] : crc[i-n];
+        if (b == 0) {
+            frame[code] = out - code;
+            code = out++;
+        } else {
+            frame[out++] = b;
+        }
+    }
+    frame[code] = out - code;
+    frame[out++] = 0;
+    return out;
+}
+
+/**
+ * Decodes a frame of n bytes, without its terminating zero, and checks its CRC.
+ * @param record has to hold n bytes.
+ * @return the length of the record or -1 if the frame is malformed or the CRC does not match.
+ * */
+int16_t FRdecode(const uint8_t *frame, uint8_t n, uint8_t *record)
+{
+    uint8_t in = 0;
+    uint8_t len = 0;
+
+    while (in < n) {
+        uint8_t code = frame[in++];
+        if (code == 0 || in + code - 1 > n) return -1;
+        for (uint8_t i=1; i < code; i++) {
+            if (frame[in] == 0) return -1;
+            record[len++] = frame[in++];
+        }
+        if (code < 0xFF && in < n) {
+            record[len++] = 0;
+        }
+    }
+    if (len < 2) return -1;
+    len -= 2;
+    if (FRcrc16(0xFFFF,record,len) != FRgetU16(&record[len])) return -1;
+    return len;
+}
+
+/** Little endian stores and loads, independent of the byte order of the machine. */
+void FRputU16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+void FRputU32(uint8_t *p, uint32_t v)
+{
+    FRputU16(p,v);
+    FRputU16(p+2,v >> 16);
+}
+
+void FRputU64(uint8_t *p, uint64_t v)
+{
+    FRputU32(p,v);
+    FRputU32(p+4,v >> 32);
+}
+
+uint16_t FRgetU16(const uint8_t *p)
+{
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+uint32_t FRgetU32(const uint8_t *p)
+{
+    return FRgetU16(p) | (uint32_t)FRgetU16(p+2) << 16;
+}
+
+uint64_t FRgetU64(const uint8_t *p)
+{
+    return FRgetU32(p) | (uint64_t)FRgetU32(p+4) << 32;
+}
@@ -0,0 +1,36 @@
+#ifndef FRAME_H
+#define FRAME_H
+#include <inttypes.h>
+
+/** @file frame.h
+ *  Framing for binary records on a serial line.
+ *
+ *  A frame is the record followed by its CRC-16/CCITT-FALSE (little endian), 
+ *  COBS encoded so that it contains no zero bytes, and terminated by a zero.
+ *  A receiver that starts in the middle of a frame resynchronizes at the next zero.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Largest record. Up to 253 bytes COBS only adds a single code byte. */
+#define FRMAXRECORD 128
+/** Encoded size of a record of n bytes with its CRC, COBS code byte and terminating zero. */
+#define FRSIZE(n) ((n) + 4)
+
+uint16_t FRcrc16(uint16_t crc, const uint8_t *data, uint8_t n);
+uint8_t FRencode(const uint8_t *record, uint8_t n, uint8_t *frame);
+int16_t FRdecode(const uint8_t *frame, uint8_t n, uint8_t *record);
+
+void FRputU16(uint8_t *p, uint16_t v);
+void FRputU32(uint8_t *p, uint32_t v);
+void FRputU64(uint8_t *p, uint64_t v);
+uint16_t FRgetU16(const uint8_t *p);
+uint32_t FRgetU32(const uint8_t *p);
+uint64_t FRgetU64(const uint8_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,57 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+/** @file records.h
+ *  Layout of the binary meter mode records. Every field is little endian 
+ *  and every record starts with its type. See frame.h for the framing.
+ *
+ *  RECMEAS, one per circuit and report:
+ *      0 type, 1 circuitID (int8), 2 flags (RECSWON, RECCOMM, RECTIME),
+ *      3 sequence number (uint16, low bits of the ASCII one), 5 millis() (uint32),
+ *      9 VRMS, 13 IRMS, 17 W (int32, same units as the ASCII report),
+ *      21 period in us (uint16), 23 ADE status flags (uint16)
+ *  RECENERGY, the 64 bit energy totals of a circuit every RECENERGYEVERY reports:
+ *      0 type, 1 circuitID, 2 sequence number of its RECMEAS (uint16),
+ *      4 Wh import, 12 Wh export, 20 VAh (uint64, mWh and mVAh)
+ *  RECRESULT, the reply to a command:
+ *      0 type, 1 command character, 2 circuitID (int8), 3 argument (int32),
+ *      7 tag of the command (uint16, RECNOTAG if it had none)
+ *  RECFIELDS, replaces RECMEAS and RECENERGY for a circuit that is subscribed
+ *  to other fields than CFDEFAULT (Circuit/circuit.h):
+ *      0 type, 1 circuitID, 2 flags, 3 sequence number, 5 millis() (uint32),
+ *      9 CF field flags (uint16), 11 the fields that are set in CF order:
+ *      PERIOD, PF and STATUS as uint16, WH, WHX and VAH as uint64, 
+ *      the others as int32. CFSW is carried by RECSWON.
+ *  RECDELTA, the reports of a sweep in mode METERDELTAMODE:
+ *      0 type, 1 frame counter (uint8, one more than the previous RECDELTA),
+ *      2 entries, see Frame/delta.h. A gap in the counter means entries
+ *      were lost.
+ *  RECSECTOR, starts every 512 byte sector of the SD card log, see SDLog/sdlog.h:
+ *      0 type, 1 generation of the log (uint16), 3 sector number in the 
+ *      log file (uint32), 7 SLclock() when the sector was started (uint32)
+ */
+
+#define RECMEAS     1
+#define RECENERGY   2
+#define RECRESULT   3
+#define RECFIELDS   4
+#define RECDELTA    5
+#define RECSECTOR   6
+
+#define RECMEASSIZE     25
+#define RECENERGYSIZE   28
+#define RECRESULTSIZE   9
+/** RECFIELDS without fields and with all of them. */
+#define RECFIELDSMIN    11
+#define RECFIELDSMAX    73
+#define RECDELTAMIN     2
+#define RECSECTORSIZE   11
+
+#define RECSWON 0x01
+#define RECCOMM 0x02
+#define RECTIME 0x04
+
+#define RECENERGYEVERY 10
+#define RECNOTAG 0xFFFF
+
+#endif
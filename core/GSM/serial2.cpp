@@ -1,35 +1,28 @@
 //serial 1280
 #include "serial.h"
+#include "Ring/Ring.h"
 
 #define RX_BUFFER_SIZE 128 //***watch buffer overflow!!!
-struct ring_buffer {
-  unsigned char buffer[RX_BUFFER_SIZE];
-  int head;
-  int tail;
-};
+struct ring_buffer : public Ring<unsigned char, RX_BUFFER_SIZE> {};
 
 #ifdef SERIAL0
-ring_buffer rx_buffer = { { 0 }, 0, 0 };
+ring_buffer rx_buffer;
 #endif
 #ifdef SERIAL1
-ring_buffer rx_buffer1 = { { 0 }, 0, 0 };
+ring_buffer rx_buffer1;
 #endif
 #ifdef SERIAL2
-ring_buffer rx_buffer2 = { { 0 }, 0, 0 };
+ring_buffer rx_buffer2;
 #endif
 #ifdef SERIAL3
-ring_buffer rx_buffer3 = { { 0 }, 0, 0 };
+ring_buffer rx_buffer3;
 #endif
 
 
 inline void store_char(unsigned char c, ring_buffer *rx_buffer)
 {
-	int i = (rx_buffer->head + 1) % RX_BUFFER_SIZE;
- 	if (i != rx_buffer->tail) {			//check if they equal if so buffer overflow
- 		rx_buffer->buffer[rx_buffer->head] = c;
- 		rx_buffer->head = i;
- 	}
- }
+	rx_buffer->push(c);		//dropped if the buffer overflows
+}
 
 #ifdef SERIAL0
 //serial 0 interupts
@@ -122,25 +115,23 @@ unsigned char* message;
  
 char SerialPort::read()
 {
-// if the head isn't ahead of the tail, we don't have any characters
-	if (rx_buffer->head == rx_buffer->tail) {
+	unsigned char c;
+	// if the head isn't ahead of the tail, we don't have any characters
+	if (!rx_buffer->pop(c)) {
 		return -1;
-	} else {
-	char c = rx_buffer->buffer[rx_buffer->tail];
-	rx_buffer->tail = (rx_buffer->tail + 1) % RX_BUFFER_SIZE;
+	}
 	return c;
 }
-}
 
 uint8_t SerialPort::available()
 {
-  return (RX_BUFFER_SIZE + rx_buffer->head - rx_buffer->tail) % RX_BUFFER_SIZE;
+  return rx_buffer->count();
 }
 
 void SerialPort::flush()
 {
- rx_buffer->head = rx_buffer->tail;
- }
+ rx_buffer->clear();
+}
  
 
 
@@ -0,0 +1,261 @@
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+
+#include "arduino/wiring.h"
+#include "ReturnCode/returncode.h"
+#include "Select/select.h"
+#include "Frame/frame.h"
+#include "EELogger/EELogger.h"
+#include "powerfail.h"
+
+#if PFCHECKPOINTS < NCIRCUITS + 2
+#error "The checkpoint journal cannot hold the newest record of every circuit"
+#endif
+#if PFCHECKPOINTSTEP >= 200*PFSAVEUNIT
+#error "An increase may not fit the byte of a save"
+#endif
+
+static uint8_t EEMEM _PFcheckpointRegion[ELREGION(PFCHECKPOINTSIZE,PFCHECKPOINTS)];
+static uint8_t EEMEM _PFsaveRegion[ELREGION(PFSAVESIZE,PFSAVES)];
+
+static EELog _PFcheckpoints;
+static EELog _PFsaves;
+/** Circuits whose totals are kept, 0 until PFinit. */
+static int8_t _PFn;
+/**
+ * Low 32 bits of the totals of each circuit's newest checkpoint, what the
+ * ISR saves against, and the journal's sequence number they are as of.
+ * */
+static uint32_t _PFbase[NCIRCUITS][3];
+static uint16_t _PFbaseSeq;
+/** Sequence number of each circuit's newest checkpoint, if it has one. */
+static uint16_t _PFat[NCIRCUITS];
+static uint8_t _PFhas[NCIRCUITS];
+static uint32_t _PFcheckpointAt[NCIRCUITS];
+/**
+ * Circuit whose checkpoint is being written, -1 for none, and its base
+ * once the journal's sequence number has moved past _PFbaseSeq.
+ * */
+static volatile int8_t _PFwriting = -1;
+static uint32_t _PFnext[3];
+/** The ISR has run since the supply last fell, ELappend gives up then. */
+static volatile uint8_t _PFsaved;
+
+static uint64_t *_PFtotal(int8_t circuitID, uint8_t k)
+{
+    Cenergy *e = CgetTotals(circuitID);
+    switch (k) {
+        case 0: return &e->WhImport;
+        case 1: return &e->WhExport;
+        default: return &e->VAh;
+    }
+}
+
+/** Increase of a total since the circuit's checkpoint. */
+static uint32_t _PFincrease(int8_t circuitID, uint8_t k)
+{
+    uint32_t base = _PFbase[circuitID][k];
+
+    if (circuitID == _PFwriting && _PFcheckpoints.seq != _PFbaseSeq) {
+        base = _PFnext[k];
+    }
+    return (uint32_t)*_PFtotal(circuitID,k) - base;
+}
+
+/** Writes a checkpoint of a circuit's totals. */
+static void _PFcheckpoint(int8_t circuitID)
+{
+    uint8_t rec[PFCHECKPOINTSIZE];
+    uint64_t total;
+    uint8_t oldSREG;
+    int8_t ret;
+
+    rec[0] = circuitID;
+    oldSREG = SREG;
+    cli();
+    for (uint8_t k=0; k < 3; k++) {
+        total = *_PFtotal(circuitID,k);
+        FRputU32(&rec[1+5*k],(uint32_t)total);
+        rec[5+5*k] = total >> 32;
+        _PFnext[k] = (uint32_t)total;
+    }
+    _PFwriting = circuitID;
+    SREG = oldSREG;
+
+    ret = ELappend(&_PFcheckpoints,rec);
+
+    oldSREG = SREG;
+    cli();
+    if (ret == SUCCESS) {
+        memcpy(_PFbase[circuitID],_PFnext,sizeof(_PFnext));
+        _PFbaseSeq = _PFcheckpoints.seq;
+        _PFat[circuitID] = _PFcheckpoints.seq;
+        _PFhas[circuitID] = true;
+    }
+    _PFwriting = -1;
+    SREG = oldSREG;
+    if (ret == SUCCESS) _PFcheckpointAt[circuitID] = millis();
+}
+
+/** @return the circuit to checkpoint next, -1 for none. */
+static int8_t _PFdue(void)
+{
+    int8_t oldest = -1;
+    uint16_t oldestAge = 0;
+    uint32_t increase;
+
+    // The next record overwrites the oldest in the journal, which has to
+    // be nobody's newest even if that write is torn
+    for (int8_t i=0; i < _PFn; i++) {
+        uint16_t age = _PFcheckpoints.seq - _PFat[i];
+        if (_PFhas[i] && age >= oldestAge) {
+            oldest = i;
+            oldestAge = age;
+        }
+    }
+    if (oldest >= 0 && oldestAge >= PFCHECKPOINTS - 2) return oldest;
+
+    for (int8_t i=0; i < _PFn; i++) {
+        increase = 0;
+        for (uint8_t k=0; k < 3; k++) {
+            uint32_t d = _PFincrease(i,k);
+            if (d > increase) increase = d;
+        }
+        if (increase >= PFCHECKPOINTSTEP
+                || (increase > 0 && millis() - _PFcheckpointAt[i] >= PFCHECKPOINTMS)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** Increase of a total since the circuit's checkpoint in PFSAVEUNITs, up to 255. */
+static uint8_t _PFsaveUnits(int8_t circuitID, uint8_t k)
+{
+    uint32_t d = _PFincrease(circuitID,k)/PFSAVEUNIT;
+    return (d > 0xFF) ? 0xFF : d;
+}
+
+/**
+ * The supply is falling. Saves the increases of the circuits with the 
+ * largest increase of VAh, as many as PFSAVEBYTES allow, to the erased 
+ * slot, once until PFpoll sees the supply back, or nothing if the slot is 
+ * not erased.
+ * */
+ISR(ANALOG_COMP_vect)
+{
+    uint8_t rec[PFSAVESIZE];
+    uint8_t units[NCIRCUITS][3];
+    uint8_t cost[NCIRCUITS];
+    uint8_t budget = PFSAVEBYTES;
+    int8_t best;
+
+    if (_PFn == 0 || _PFsaved) return;
+    _PFsaved = true;
+
+    memset(rec,0xFF,sizeof(rec));
+    FRputU16(rec,_PFcheckpoints.seq);
+    for (int8_t i=0; i < _PFn; i++) {
+        cost[i] = 0;
+        for (uint8_t k=0; k < 3; k++) {
+            units[i][k] = _PFsaveUnits(i,k);
+            if (units[i][k]) cost[i]++;
+        }
+    }
+    // Largest first, skipping those whose bytes no longer fit
+    for (;;) {
+        best = -1;
+        for (int8_t i=0; i < _PFn; i++) {
+            if (cost[i] && (best < 0 || units[i][2] > units[best][2])) best = i;
+        }
+        if (best < 0) break;
+        if (cost[best] <= budget) {
+            for (uint8_t k=0; k < 3; k++) {
+                rec[2+3*best+k] = ~units[best][k];
+            }
+            budget -= cost[best];
+        }
+        cost[best] = 0;
+    }
+    ELappendPrepared(&_PFsaves,rec);
+}
+
+/**
+ * Restores the totals of circuits 0 to n-1 from their newest checkpoints
+ * and the save made against them, if any, erases the slot of the next save
+ * and enables the comparator's interrupt.
+ * @return true if a save made when the supply failed was restored.
+ * */
+uint8_t PFinit(int8_t n)
+{
+    uint8_t rec[PFCHECKPOINTSIZE > PFSAVESIZE ? PFCHECKPOINTSIZE : PFSAVESIZE];
+    uint8_t restored = false;
+
+    _PFn = 0;
+    if (n > NCIRCUITS) n = NCIRCUITS;
+    ELopen(&_PFcheckpoints,_PFcheckpointRegion,sizeof(_PFcheckpointRegion),PFCHECKPOINTSIZE);
+    ELopen(&_PFsaves,_PFsaveRegion,sizeof(_PFsaveRegion),PFSAVESIZE);
+    _PFcheckpoints.stop = &_PFsaved;
+
+    for (int8_t i=0; i < n; i++) {
+        _PFhas[i] = false;
+    }
+    // Newest first, the first record of a circuit is its newest
+    for (uint16_t back=0; back < _PFcheckpoints.count; back++) {
+        ifnsuccess(ELread(&_PFcheckpoints,back,rec)) continue;
+        if ((int8_t)rec[0] < 0 || n <= (int8_t)rec[0] || _PFhas[rec[0]]) continue;
+        for (uint8_t k=0; k < 3; k++) {
+            *_PFtotal(rec[0],k) = FRgetU32(&rec[1+5*k])
+                | ((uint64_t)rec[5+5*k] << 32);
+        }
+        _PFat[rec[0]] = _PFcheckpoints.seq - back;
+        _PFhas[rec[0]] = true;
+    }
+    for (int8_t i=0; i < n; i++) {
+        for (uint8_t k=0; k < 3; k++) {
+            _PFbase[i][k] = (uint32_t)*_PFtotal(i,k);
+        }
+        _PFcheckpointAt[i] = millis();
+    }
+    _PFbaseSeq = _PFcheckpoints.seq;
+
+    if (ELread(&_PFsaves,0,rec) == SUCCESS && FRgetU16(rec) == _PFcheckpoints.seq) {
+        for (int8_t i=0; i < n; i++) {
+            for (uint8_t k=0; k < 3; k++) {
+                *_PFtotal(i,k) += (uint8_t)~rec[2+3*i+k]*PFSAVEUNIT;
+            }
+        }
+        restored = true;
+    }
+    _PFwriting = -1;
+    _PFn = n;
+    ELprepare(&_PFsaves);
+    _PFsaved = false;
+
+    // Interrupt on the rising edge of ACO, AIN1 falling below the bandgap
+    DIDR1 |= _BV(AIN1D);
+    ACSR = _BV(ACBG) | _BV(ACI) | _BV(ACIS1) | _BV(ACIS0);
+    ACSR = _BV(ACBG) | _BV(ACIE) | _BV(ACIS1) | _BV(ACIS0);
+    return restored;
+}
+
+/**
+ * Writes the checkpoint of at most one circuit that is due, and erases the
+ * slot of the next save once the supply is back after one. Does nothing
+ * while it is falling.
+ * */
+void PFpoll(void)
+{
+    int8_t circuitID;
+
+    if (_PFn == 0 || (ACSR & _BV(ACO))) return;
+    if (_PFsaved) {
+        ELprepare(&_PFsaves);
+        _PFsaved = false;
+        return;
+    }
+    circuitID = _PFdue();
+    if (circuitID >= 0) _PFcheckpoint(circuitID);
+}
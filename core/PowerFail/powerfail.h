@@ -0,0 +1,81 @@
+#ifndef POWERFAIL_H
+#define POWERFAIL_H
+#include <inttypes.h>
+#include "Circuit/circuit.h"
+#include "EELogger/EELogger.h"
+
+/** @file powerfail.h
+ *  Keeps the energy totals of the circuits over a loss of power.
+ *
+ *  The totals of each circuit are checkpointed on their own, a record of
+ *  16 bytes in a journal (EELogger/EELogger.h) shared by all circuits.
+ *  PFpoll writes at most one per call: that of a circuit whose totals grew
+ *  by PFCHECKPOINTSTEP, or grew at all in PFCHECKPOINTMS, and before that
+ *  the oldest circuit's again if the next record would otherwise overwrite
+ *  it, so the journal always holds the newest record of every circuit.
+ *
+ *  What the circuits have drained since their checkpoints is saved by the
+ *  analog comparator's ISR when the supply starts to fall, to a slot of a
+ *  second journal which was erased ahead of time. The slot has a byte for
+ *  each total, its increase in Wh inverted, so the totals which grew by
+ *  less than a Wh are left 0xFF and are not programmed at all. The ISR
+ *  programs those of the circuits that grew most, as many as fit in
+ *  PFSAVEBYTES, and with the sequence number and CRC a save is at most 26
+ *  bytes at about 1.8 ms, so about 47 ms. That is at least 7 circuits, 11
+ *  if they export nothing. If the slot is not erased when the supply
+ *  falls, the save is dropped.
+ *  PFinit adds the save to the checkpoints if none was written after it.
+ *
+ *  A saved circuit loses less than a Wh of each total. The circuits the
+ *  save leaves out, which grew less than each one it holds, lose what they
+ *  drained since their checkpoints, less than PFCHECKPOINTSTEP and at most
+ *  PFCHECKPOINTMS of it. So does every circuit when there was no time to
+ *  save at all.
+ *
+ *  Endurance: an EEPROM cell takes 100000 writes and every slot of the
+ *  checkpoint journal is written once a lap, so over 10 years (87600 h)
+ *  the journal takes 100000*PFCHECKPOINTS/87600 records an hour, 41 with
+ *  the 36 slots of 20 circuits. The circuits write one record for every
+ *  100 Wh, 10 an hour for each kW metered on average, and one every 3 h
+ *  for each circuit that is used at all, 7 an hour for 20 circuits: up to
+ *  3.4 kW on average. An idle circuit is rewritten once every lap the
+ *  others write, which at worst, one circuit busy and 19 idle, multiplies
+ *  its records by 2.3, so up to 1.8 kW on average on a single circuit.
+ *  The step is also what keeps an increase within the byte of a save.
+ *
+ *  The comparator compares the 1.1 V bandgap with AIN1 (PE3), which needs
+ *  the unregulated supply divided down so that it drops below 1.1 V while
+ *  the regulator still holds up the board for longer than the save takes.
+ *  Energy the ADEs hold since the last CdrainAll, up to CDRAINMS, is lost.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Interval in which a circuit that grew at all is checkpointed, 3 h. */
+#define PFCHECKPOINTMS 10800000UL
+/** Increase of a total in mWh or mVAh which makes it due, 100 Wh. */
+#define PFCHECKPOINTSTEP 100000UL
+/** Slots of the checkpoint journal, at least NCIRCUITS + 2, see Endurance. */
+#define PFCHECKPOINTS (2 + NCIRCUITS*17/10)
+/** Bytes of increases a save programs at most. */
+#define PFSAVEBYTES 22
+/** mWh or mVAh of a saved increase. */
+#define PFSAVEUNIT 1000UL
+#define PFSAVES 2
+
+/** circuitID, then WhImport, WhExport and VAh as 40 bits. */
+#define PFCHECKPOINTSIZE 16
+/** Sequence number of the newest checkpoint and 3 increases of every circuit. */
+#define PFSAVESIZE (2 + 3*NCIRCUITS)
+/** EEPROM the journals take. */
+#define PFEEPROMSIZE (ELREGION(PFCHECKPOINTSIZE,PFCHECKPOINTS) + ELREGION(PFSAVESIZE,PFSAVES))
+
+uint8_t PFinit(int8_t n);
+void PFpoll(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,149 @@
+#ifndef RING_H
+#define RING_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/** @file Ring.h
+ *  Single producer, single consumer ring buffers for passing data between an
+ *  interrupt and the main loop without disabling interrupts.
+ *
+ *  The size is a power of two so indices wrap with a mask instead of a modulo.
+ *  One slot is kept free to tell a full ring from an empty one, so a ring of N
+ *  holds N-1 elements. Up to N = 256 the indices are 8 bit and are read and
+ *  written atomically. Larger rings use 16 bit indices, which are accessed with
+ *  interrupts disabled.
+ *
+ *  Only the producer may call push and only the consumer pop, peek and clear.
+ *  The producer publishes an element by storing head after the element, the
+ *  consumer frees a slot by storing tail after reading it.
+ *
+ *  Ring<T,N> holds its storage. RingBase<T,I> is what the operations work on,
+ *  so rings of different sizes can be used through the same pointer type.
+ */
+
+/** Keeps the compiler from moving memory accesses across it. */
+#define RINGBARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+/** Index type for a ring of N elements. */
+template <bool Small> struct RingIndex { typedef uint16_t type; };
+template <> struct RingIndex<true> { typedef uint8_t type; };
+
+template <typename T, typename I>
+class RingBase
+{
+  public:
+    /** Uses buf as the storage. N has to be a power of two that I can index. */
+    template <size_t N>
+    RingBase(T (&buf)[N]) : _buf(buf), _mask(N-1), _head(0), _tail(0)
+    {
+        typedef char sizeIsPowerOfTwo[(N >= 2 && (N & (N-1)) == 0) ? 1 : -1];
+        typedef char indexFits[(N-1 <= (I)~0) ? 1 : -1];
+        (void)sizeof(sizeIsPowerOfTwo);
+        (void)sizeof(indexFits);
+    }
+
+    /** Producer. @return false if the ring is full. */
+    uint8_t push(const T &v)
+    {
+        I head = _load(_head);
+        I next = (head + 1) & _mask;
+        if (next == _load(_tail)) return false;
+        _buf[head] = v;
+        RINGBARRIER();
+        _store(_head,next);
+        return true;
+    }
+
+    /** Consumer. @return false if the ring is empty. */
+    uint8_t pop(T &v)
+    {
+        I tail = _load(_tail);
+        if (tail == _load(_head)) return false;
+        v = _buf[tail];
+        RINGBARRIER();
+        _store(_tail,(I)((tail + 1) & _mask));
+        return true;
+    }
+
+    /** Consumer. Reads the oldest element without removing it. */
+    uint8_t peek(T &v) const
+    {
+        I tail = _load(_tail);
+        if (tail == _load(_head)) return false;
+        RINGBARRIER();
+        v = _buf[tail];
+        return true;
+    }
+
+    /** Consumer. Discards everything in the ring. */
+    void clear()
+    {
+        _store(_tail,_load(_head));
+    }
+
+    /** @return the number of elements in the ring. */
+    I count() const
+    {
+        return (_load(_head) - _load(_tail)) & _mask;
+    }
+
+    /** @return the number of elements that can still be pushed. */
+    I space() const
+    {
+        return _mask - count();
+    }
+
+    uint8_t empty() const
+    {
+        return _load(_head) == _load(_tail);
+    }
+
+    I capacity() const
+    {
+        return _mask;
+    }
+
+  private:
+    static I _load(const volatile I &i)
+    {
+        if (sizeof(I) == 1) return i;
+        uint8_t oldSREG = SREG;
+        cli();
+        I v = i;
+        SREG = oldSREG;
+        return v;
+    }
+
+    static void _store(volatile I &i, I v)
+    {
+        if (sizeof(I) == 1) {
+            i = v;
+            return;
+        }
+        uint8_t oldSREG = SREG;
+        cli();
+        i = v;
+        SREG = oldSREG;
+    }
+
+    T *const _buf;
+    const I _mask;
+    volatile I _head;
+    volatile I _tail;
+};
+
+/** A ring with room for N-1 elements of T. */
+template <typename T, uint16_t N>
+class Ring : public RingBase<T, typename RingIndex<(N <= 256)>::type>
+{
+  public:
+    Ring() : RingBase<T, typename RingIndex<(N <= 256)>::type>(_data) {}
+
+  private:
+    T _data[N];
+};
+
+#endif
@@ -0,0 +1,554 @@
+#include <string.h>
+#include "arduino/wiring.h"
+#include "ReturnCode/returncode.h"
+#include "Frame/frame.h"
+#include "Frame/records.h"
+#include "sd-reader/sd_raw.h"
+#include "sd-reader/partition.h"
+#include "sd-reader/fat.h"
+#include "sdlog.h"
+
+/**
+ * @file sdlog.c
+ * The file position of _SLfd runs ahead of the log: it is the end of the
+ * extent mapped last, _SLoffset and _SLextent are what is left of that
+ * extent on the card. The sector being filled is always the one at _SLoffset,
+ * or the one after it while the other buffer waits to be written.
+ * */
+
+/** Size of the framed RECSECTOR record at the start of every sector. */
+#define SLHEADER FRSIZE(RECSECTORSIZE)
+
+SLstats SLstat;
+
+static struct partition_struct *_SLpartition;
+static struct fat_fs_struct *_SLfs;
+static struct fat_file_struct *_SLfd;
+/** Second handle of the file for reading, so the position of _SLfd stays where the writing is. */
+static struct fat_file_struct *_SLrd;
+
+static uint8_t _SLbuf[2][SLSECTOR];
+/** Buffer being filled and the bytes used in it. */
+static uint8_t _SLcur;
+static uint16_t _SLfill;
+/** The other buffer is full and waits for SLpoll. */
+static uint8_t _SLpending;
+/** Sector of the file being filled and sectors in the file. */
+static uint32_t _SLsector;
+static uint32_t _SLsectors;
+static uint16_t _SLgen;
+/** Where the next sector goes on the card and how many follow it contiguously. */
+static offset_t _SLoffset;
+static uint32_t _SLextent;
+/** When SLpoll syncs, and the records and time since the last sync. */
+static uint16_t _SLsyncRecords = SLSYNCRECORDS;
+static uint16_t _SLsyncMs = SLSYNCMS;
+static uint16_t _SLunsynced;
+static uint32_t _SLsyncedAt;
+/** SLclock(0), so the log's clock goes on where it was before a reset. */
+static uint32_t _SLepoch;
+/**
+ * Replay: sectors left including the one being read, where it is on the
+ * card and how many follow it there, and where its next frame starts.
+ * */
+static uint32_t _SLrLeft;
+static uint32_t _SLrSector;
+static offset_t _SLrOffset;
+static uint32_t _SLrExtent;
+static uint16_t _SLrPos;
+
+/** Starts filling sector in the current buffer with its RECSECTOR record. */
+static void _SLstart(uint32_t sector)
+{
+    uint8_t rec[RECSECTORSIZE];
+    uint8_t *buf = _SLbuf[_SLcur];
+
+    memset(buf,0,SLSECTOR);
+    rec[0] = RECSECTOR;
+    FRputU16(&rec[1],_SLgen);
+    FRputU32(&rec[3],sector);
+    FRputU32(&rec[7],SLclock(millis()));
+    _SLfill = FRencode(rec,RECSECTORSIZE,buf);
+    _SLsector = sector;
+}
+
+/**
+ * Decodes the RECSECTOR record framed at the start of a sector.
+ * @return false if it is not the one of sector.
+ * */
+static uint8_t _SLdecodeHeader(const uint8_t *frame, uint32_t sector, uint16_t *gen, uint32_t *time)
+{
+    uint8_t rec[SLHEADER];
+
+    if (frame[SLHEADER-1] != 0 || FRdecode(frame,SLHEADER-1,rec) != RECSECTORSIZE
+            || rec[0] != RECSECTOR || FRgetU32(&rec[3]) != sector) {
+        return false;
+    }
+    *gen = FRgetU16(&rec[1]);
+    *time = FRgetU32(&rec[7]);
+    return true;
+}
+
+/**
+ * Reads the RECSECTOR record of a sector of the file.
+ * @return false if the sector does not start with a valid one.
+ * */
+static uint8_t _SLreadHeader(uint32_t sector, uint16_t *gen, uint32_t *time)
+{
+    uint8_t frame[SLHEADER];
+    int32_t pos = sector*SLSECTOR;
+
+    if (!fat_seek_file(_SLrd,&pos,FAT_SEEK_SET)
+            || fat_read_file(_SLrd,frame,SLHEADER) != SLHEADER) {
+        return false;
+    }
+    return _SLdecodeHeader(frame,sector,gen,time);
+}
+
+/**
+ * Continues filling sector from what the card holds, so a synced sector
+ * is not overwritten by an empty one.
+ * */
+static uint8_t _SLreload(uint32_t sector)
+{
+    int32_t pos = sector*SLSECTOR;
+    uint8_t *buf = _SLbuf[_SLcur];
+
+    if (!fat_seek_file(_SLrd,&pos,FAT_SEEK_SET)
+            || fat_read_file(_SLrd,buf,SLSECTOR) != SLSECTOR) {
+        return false;
+    }
+    // Frames hold no zeros, so the last frame ends after the last non zero byte
+    _SLfill = SLSECTOR;
+    while (_SLfill > SLHEADER && buf[_SLfill-1] == 0) _SLfill--;
+    if (SLHEADER < _SLfill && _SLfill < SLSECTOR) _SLfill++;
+    _SLsector = sector;
+    return true;
+}
+
+/** Maps the next extent of the file, the first one again after the last. */
+static uint8_t _SLmap(void)
+{
+    uint32_t length = (uint32_t)SLEXTENT*SLSECTOR;
+
+    if (!fat_next_extent(_SLfd,&_SLoffset,&length)) {
+        int32_t pos = 0;
+        length = (uint32_t)SLEXTENT*SLSECTOR;
+        if (!fat_seek_file(_SLfd,&pos,FAT_SEEK_SET)
+                || !fat_next_extent(_SLfd,&_SLoffset,&length)) {
+            return false;
+        }
+    }
+    _SLextent = length/SLSECTOR;
+    return _SLextent > 0;
+}
+
+/** Sends buf as the sector at _SLoffset, in the open multiple block write if there is one. */
+static uint8_t _SLwrite(const uint8_t *buf)
+{
+    if (_SLextent == 0) {
+        if (!sd_raw_write_stop()) return false;
+        if (!_SLmap()) return false;
+    }
+    // A replay read, or a sync, stops the write, so it is reopened where the log is
+    if (sd_raw_write_position() != _SLoffset) {
+        if (!sd_raw_write_start(_SLoffset,_SLextent)) return false;
+    }
+    return sd_raw_write_next(buf);
+}
+
+/** Releases the file, filesystem and partition, whichever are open. */
+static void _SLrelease(void)
+{
+    if (_SLrd) fat_close_file(_SLrd);
+    if (_SLfd) fat_close_file(_SLfd);
+    if (_SLfs) fat_close(_SLfs);
+    if (_SLpartition) partition_close(_SLpartition);
+    _SLfd = NULL;
+    _SLrd = NULL;
+    _SLfs = NULL;
+    _SLpartition = NULL;
+    _SLrLeft = 0;
+}
+
+/**
+ * Opens the FAT filesystem of the first partition or of a card without
+ * partition table, and keeps its FAT in sd_raw's cache.
+ * */
+static uint8_t _SLopenFs(void)
+{
+    int8_t index;
+    offset_t offset;
+    uint32_t length;
+
+    for (index = 0; index >= -1; index--) {
+        _SLpartition = partition_open(sd_raw_read,sd_raw_read_interval,
+                sd_raw_write,sd_raw_write_interval,index);
+        if (_SLpartition == NULL) continue;
+        _SLfs = fat_open(_SLpartition);
+        if (_SLfs) {
+            offset = fat_get_fat_area(_SLfs,&length);
+            sd_raw_pin(offset,length);
+            return true;
+        }
+        partition_close(_SLpartition);
+        _SLpartition = NULL;
+    }
+    return false;
+}
+
+/** Opens SLFILENAME in the root directory, creating it at SLFILESIZE if needed. */
+static uint8_t _SLopenFile(uint8_t *created)
+{
+    struct fat_dir_entry_struct entry;
+    struct fat_dir_struct *dd;
+
+    *created = !fat_get_dir_entry_of_path(_SLfs,"/" SLFILENAME,&entry);
+    if (*created) {
+        if (!fat_get_dir_entry_of_path(_SLfs,"/",&entry)) return false;
+        dd = fat_open_dir(_SLfs,&entry);
+        if (dd == NULL) return false;
+        *created = fat_create_file(dd,SLFILENAME,&entry);
+        fat_close_dir(dd);
+        if (!*created) return false;
+    }
+    _SLfd = fat_open_file(_SLfs,&entry);
+    if (_SLfd == NULL) return false;
+    if (entry.file_size != SLFILESIZE) {
+        // The entry is out of date for the second handle once the file is resized
+        if (!fat_resize_file(_SLfd,SLFILESIZE)
+                || !fat_get_dir_entry_of_path(_SLfs,"/" SLFILENAME,&entry)) {
+            return false;
+        }
+    }
+    _SLrd = fat_open_file(_SLfs,&entry);
+    if (_SLrd == NULL) return false;
+    _SLsectors = SLFILESIZE/SLSECTOR;
+    return true;
+}
+
+/** Closes the log after the card failed. */
+static void _SLfail(void)
+{
+    SLstat.errors++;
+    _SLpending = false;
+    _SLrelease();
+}
+
+/**
+ * Opens the log and finds its end, see sdlog.h. A new log starts with a
+ * generation above the one the card held at its place, so sectors left
+ * over from before do not count.
+ * @return SUCCESS, COMMERR if there is no card or it does not answer, or
+ *  FAILURE if there is no FAT partition or the file cannot be opened.
+ * */
+int8_t SLopen(void)
+{
+    uint8_t created;
+    uint8_t valid;
+    uint16_t gen0;
+    uint16_t gen;
+    uint32_t time;
+    uint32_t lo, hi;
+    int32_t pos;
+
+    if (_SLfd) return SUCCESS;
+    if (!sd_raw_init()) return COMMERR;
+    if (!_SLopenFs() || !_SLopenFile(&created)) {
+        _SLrelease();
+        return FAILURE;
+    }
+
+    _SLcur = 0;
+    _SLpending = false;
+    _SLextent = 0;
+    valid = _SLreadHeader(0,&gen0,&time);
+    if (created || !valid) {
+        _SLgen = valid ? gen0 + 1 : 1;
+        _SLepoch = 0;
+        _SLstart(0);
+    } else {
+        // Sector lo has the generation of sector 0, sector hi does not
+        _SLgen = gen0;
+        lo = 0;
+        hi = _SLsectors;
+        while (hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo)/2;
+            if (_SLreadHeader(mid,&gen,&time) && gen == gen0) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        if (!_SLreadHeader(lo,&gen,&time) || !_SLreload(lo)) {
+            _SLrelease();
+            return FAILURE;
+        }
+        // Go on from where the last sector was started
+        _SLepoch = time - millis();
+    }
+    pos = _SLsector*SLSECTOR;
+    if (!fat_seek_file(_SLfd,&pos,FAT_SEEK_SET)) {
+        _SLrelease();
+        return FAILURE;
+    }
+    // Mark the new generation on the card right away
+    if (created || !valid) return SLsync();
+    // The file may have been resized
+    if (!sd_raw_sync()) {
+        _SLfail();
+        return COMMERR;
+    }
+    _SLunsynced = 0;
+    _SLsyncedAt = millis();
+    return SUCCESS;
+}
+
+uint8_t SLisOpen(void)
+{
+    return _SLfd != NULL;
+}
+
+/** @return the sector of the log file being filled or -1 if the log is closed. */
+int32_t SLhead(void)
+{
+    return _SLfd ? (int32_t)_SLsector : -1;
+}
+
+/**
+ * The log's clock, which goes on across resets. It is millis() while the
+ * log was not reopened since it was created.
+ * @return the log time of a millis() value.
+ * */
+uint32_t SLclock(uint32_t ms)
+{
+    return ms + _SLepoch;
+}
+
+/**
+ * @return whether sector k in order of age, 0 being the one after the head,
+ *  was started window_ms or more before now or does not belong to the log.
+ * */
+static uint8_t _SLolder(uint32_t k, uint32_t now, uint32_t window_ms)
+{
+    uint32_t sector = (_SLsector + 1 + k) % _SLsectors;
+    uint16_t gen;
+    uint32_t time;
+
+    if (!_SLreadHeader(sector,&gen,&time)
+            || gen != ((sector <= _SLsector) ? _SLgen : (uint16_t)(_SLgen - 1))) {
+        return true;
+    }
+    return now - time >= window_ms;
+}
+
+/**
+ * Starts a replay of the records logged in the last window_ms of the log's
+ * clock, see SLclock. The sector headers are the index: a binary search
+ * finds the last sector started before the window, so it takes about
+ * log2(SLFILESIZE/SLSECTOR) header reads however long the log is. Records
+ * logged after this call are not replayed. The records of the first sector
+ * may be older than the window, the caller checks their times.
+ * @return the sector the replay starts at, or -1 if the log is closed or the
+ *  card failed.
+ * */
+int32_t SLreplay(uint32_t window_ms)
+{
+    uint32_t now;
+    uint32_t lo, hi;
+
+    if (_SLfd == NULL || SLsync() != SUCCESS) return -1;
+    now = SLclock(millis());
+    // Sectors in order of age are older up to lo, not from hi on
+    lo = 0;
+    hi = _SLsectors;
+    if (!_SLolder(0,now,window_ms)) {
+        hi = 0;
+    } else {
+        while (hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo)/2;
+            if (_SLolder(mid,now,window_ms)) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+    }
+    // Start at the last sector before the window, or at the first in it
+    // if that one is not part of the log
+    if (hi > 0 && !_SLolder(hi - 1,now,0xFFFFFFFF)) hi--;
+    _SLrSector = (_SLsector + 1 + hi) % _SLsectors;
+    _SLrLeft = _SLsectors - hi;
+    _SLrExtent = 0;
+    _SLrPos = 0;
+    return _SLrSector;
+}
+
+/** Maps the part of the file from the sector being replayed that is contiguous on the card. */
+static uint8_t _SLrMap(void)
+{
+    int32_t pos = _SLrSector*SLSECTOR;
+    uint32_t length = (uint32_t)SLEXTENT*SLSECTOR;
+
+    if (!fat_seek_file(_SLrd,&pos,FAT_SEEK_SET)
+            || !fat_next_extent(_SLrd,&_SLrOffset,&length)) {
+        return false;
+    }
+    _SLrExtent = length/SLSECTOR;
+    return _SLrExtent > 0;
+}
+
+/**
+ * Reads the next record of the replay started by SLreplay.
+ * @param record holds FRMAXRECORD bytes.
+ * @return its length, 0 once the replay is done.
+ * */
+uint8_t SLreplayNext(uint8_t *record)
+{
+    uint8_t frame[FRSIZE(FRMAXRECORD)];
+    uint16_t gen;
+    uint32_t time;
+    uint16_t n, z;
+    int16_t len;
+
+    while (_SLfd && _SLrLeft > 0) {
+        if (_SLrPos == 0) {
+            if (_SLrExtent == 0 && !_SLrMap()) {
+                _SLrLeft = 0;
+                return 0;
+            }
+            if (sd_raw_read(_SLrOffset,frame,SLHEADER)
+                    && _SLdecodeHeader(frame,_SLrSector,&gen,&time)) {
+                _SLrPos = SLHEADER;
+            } else {
+                _SLrPos = SLSECTOR;
+            }
+        }
+        n = SLSECTOR - _SLrPos;
+        if (n > sizeof(frame)) n = sizeof(frame);
+        if (n > 0 && sd_raw_read(_SLrOffset + _SLrPos,frame,n)) {
+            // Frames end with their only zero, zeros fill the rest of the sector
+            for (z = 0; z < n && frame[z] != 0; z++);
+            if (z > 0 && z < n) {
+                _SLrPos += z + 1;
+                len = FRdecode(frame,z,record);
+                if (len > 0) return len;
+                continue;
+            }
+        }
+        // On to the next sector
+        _SLrPos = 0;
+        _SLrLeft--;
+        _SLrOffset += SLSECTOR;
+        _SLrExtent--;
+        if (++_SLrSector == _SLsectors) {
+            _SLrSector = 0;
+            _SLrExtent = 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Adds a record to the log, framed. The record is dropped if its sector is
+ * full and the previous one has not been written yet.
+ * */
+void SLappend(const uint8_t *record, uint8_t n)
+{
+    if (_SLfd == NULL) return;
+    if (_SLfill + FRSIZE(n) > SLSECTOR) {
+        if (_SLpending) {
+            SLstat.dropped++;
+            return;
+        }
+        _SLpending = true;
+        _SLcur = !_SLcur;
+        if (_SLsector + 1 == _SLsectors) {
+            _SLgen++;
+            _SLstart(0);
+        } else {
+            _SLstart(_SLsector + 1);
+        }
+        SLstat.sectors++;
+    }
+    _SLfill += FRencode(record,n,&_SLbuf[_SLcur][_SLfill]);
+    SLstat.records++;
+    if (_SLunsynced < 0xFFFF) _SLunsynced++;
+}
+
+/**
+ * Writes the full sector if there is one and the card is ready for it,
+ * which takes about the time to send 512 bytes. Otherwise syncs if the
+ * policy set with SLsetSync says so, which waits for the card.
+ * */
+void SLpoll(void)
+{
+    uint32_t start;
+    uint32_t took;
+
+    if (_SLfd == NULL) return;
+    if (!_SLpending && (_SLunsynced == 0
+            || !((_SLsyncRecords && _SLunsynced >= _SLsyncRecords)
+                || (_SLsyncMs && millis() - _SLsyncedAt >= _SLsyncMs)))) {
+        return;
+    }
+    // The card is still programming the previous sector
+    if (sd_raw_write_position() != (offset_t)-1 && sd_raw_busy()) return;
+    if (!_SLpending) {
+        SLsync();
+        return;
+    }
+    start = micros();
+    if (!_SLwrite(_SLbuf[!_SLcur])) {
+        _SLfail();
+        return;
+    }
+    _SLoffset += SLSECTOR;
+    _SLextent--;
+    _SLpending = false;
+    took = micros() - start;
+    if (took > SLstat.maxFlush_us) {
+        SLstat.maxFlush_us = (took > 0xFFFF) ? 0xFFFF : took;
+    }
+}
+
+/**
+ * Writes everything logged so far to the card, and what sd_raw caches,
+ * and waits until it is programmed. The sector being filled is written as
+ * it is and again once it is full.
+ * @return SUCCESS, FAILURE if the log is closed or COMMERR if the card failed.
+ * */
+int8_t SLsync(void)
+{
+    if (_SLfd == NULL) return FAILURE;
+    while (_SLfd && _SLpending) {
+        SLpoll();
+    }
+    if (_SLfd == NULL || !_SLwrite(_SLbuf[_SLcur]) || !sd_raw_write_stop()
+            || !sd_raw_sync()) {
+        if (_SLfd) _SLfail();
+        return COMMERR;
+    }
+    _SLunsynced = 0;
+    _SLsyncedAt = millis();
+    return SUCCESS;
+}
+
+/**
+ * Sets when SLpoll syncs: once records have been logged since the last
+ * sync, or ms have passed since it and a record was logged. 1 record syncs
+ * after every record, 0 turns either off.
+ * */
+void SLsetSync(uint16_t records, uint16_t ms)
+{
+    _SLsyncRecords = records;
+    _SLsyncMs = ms;
+}
+
+/** Syncs and closes the log. */
+void SLclose(void)
+{
+    if (_SLfd == NULL) return;
+    SLsync();
+    _SLrelease();
+}
@@ -0,0 +1,80 @@
+#ifndef SDLOG_H
+#define SDLOG_H
+#include <inttypes.h>
+
+/** @file sdlog.h
+ *  Measurement log on the SD card.
+ *
+ *  The log is the file SLFILENAME in the root directory of the card's FAT 
+ *  partition. It is allocated at SLFILESIZE when it is opened, so the FAT is 
+ *  not touched while logging, and written as a ring of 512 byte sectors. 
+ *  Every sector starts with a framed RECSECTOR record (Frame/records.h) 
+ *  followed by framed records which never cross into the next sector, the 
+ *  rest is zeros. The generation in RECSECTOR goes up by one whenever the 
+ *  log wraps around or the file is created, so after a reset the end of the 
+ *  log is the last sector with the generation of the first one, found by 
+ *  binary search.
+ *
+ *  Records are assembled in one of two sector buffers. When it is full the 
+ *  other one takes the records while SLpoll sends the full one as the next 
+ *  block of a multiple block write over the part of the file that is 
+ *  contiguous on the card, see fat_next_extent. SLpoll sends at most one 
+ *  sector and returns right away while the card is still programming the 
+ *  previous one, so it can run while a sweep waits for the ADEs. If records 
+ *  come faster than the card takes them, the ones that find both buffers 
+ *  full are dropped and counted.
+ *
+ *  The sector being filled reaches the card with SLsync, which SLpoll also 
+ *  calls once SLsetSync's number of records or milliseconds have passed 
+ *  since the last one. A reset loses the records logged since. SLsync also 
+ *  writes back what sd_raw holds in its cache, e.g. the FAT after the file 
+ *  was created.
+ *
+ *  Sectors are stamped with the log's own clock, SLclock, which goes on 
+ *  from the last sector's stamp when the log is reopened, so the stamps 
+ *  grow along the ring across resets. They are the log's index: SLreplay 
+ *  finds where the records of the last so many ms begin by binary search 
+ *  over them, and SLreplayNext reads the records from there on while 
+ *  logging goes on.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLFILENAME "METER.LOG"
+/** Creating the file writes its FAT chain a cluster at a time, which takes a while. */
+#define SLFILESIZE (8UL*1024*1024)
+#define SLSECTOR 512
+/** Most sectors sent in one multiple block write. Mapping the next ones reads the FAT. */
+#define SLEXTENT 64
+/** Sync policy until SLsetSync sets another. */
+#define SLSYNCRECORDS 0
+#define SLSYNCMS 10000
+
+typedef struct {
+    uint32_t sectors;       // filled since SLopen
+    uint32_t records;
+    uint16_t dropped;       // found both buffers full
+    uint16_t errors;        // the card failed and the log was closed
+    uint16_t maxFlush_us;   // longest SLpoll that wrote a sector
+} SLstats;
+
+extern SLstats SLstat;
+
+int8_t SLopen(void);
+uint8_t SLisOpen(void);
+int32_t SLhead(void);
+uint32_t SLclock(uint32_t ms);
+int32_t SLreplay(uint32_t window_ms);
+uint8_t SLreplayNext(uint8_t *record);
+void SLappend(const uint8_t *record, uint8_t n);
+void SLpoll(void);
+int8_t SLsync(void);
+void SLsetSync(uint16_t records, uint16_t ms);
+void SLclose(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
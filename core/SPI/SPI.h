@@ -14,6 +14,9 @@
 #include <stdio.h>
 #include "arduino/WProgram.h"
 #include <avr/pgmspace.h>
+#ifdef HOST
+#include "host/hal.h"
+#endif
 
 #define SPI_CLOCK_DIV4 0x00
 #define SPI_CLOCK_DIV16 0x01
@@ -53,6 +56,9 @@ public:
 extern SPIClass SPI;
 
 byte SPIClass::transfer(byte _data) {
+#ifdef HOST
+  return HOSTspiTransfer(_data);
+#endif
   SPDR = _data;
   while (!(SPSR & _BV(SPIF)))
     ;
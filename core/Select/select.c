@@ -8,6 +8,9 @@
 #include "select.h"
 #include "Switches/switches.h"
 #include "ReturnCode/returncode.h"
+#ifdef ADESIM
+#include "ADE7753/ADE7753sim.h"
+#endif
 
 
 static int _device = DEVDISABLE;
@@ -24,6 +27,30 @@ static const int8_t mapCtoPinCS[] = {
     42,21,//CH16,17
     47,46 //CH18,19
 };
+/** 
+ * Maps the Circuit number to the pin (with a pin change interrupt) its ADE IRQ 
+ * line is routed to. The line is open drain so circuits may share a pin (wired-OR).
+ * The current daughterboards do not route IRQ, so the ADE module polls them. 
+ * The simulated board routes both circuits to PB6.
+ */
+#ifdef ADESIM
+static const int8_t mapCtoPinIRQ[] = {
+    12,12
+};
+#else
+static const int8_t mapCtoPinIRQ[] = {
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN,
+    NOIRQPIN,NOIRQPIN
+};
+#endif
 /*static const int8_t mapCtoPinCS[] = {
     62,57, //CH0,1
     24,23, //CH4,5
@@ -37,6 +64,8 @@ static const int8_t mapCtoPinCS[] = {
  * */
 void CSpinActive(int8_t active,int8_t device) 
 {
+    // _device is DEVDISABLE when nothing was selected
+    if (!(0 <= device && device < NCIRCUITS)) return;
     if (active) {
         // Instead of setting the pins as low impedenece high outputs, let's set them as High-Z
         // In this setup adding another Port A causes communications to fail. In the other configurations it is Port B
@@ -77,14 +106,18 @@ void initSelect()
 *	Note: ALL other devices should be held HIGH
 *	and the device desired should be driven LOW
 *
-*	@note resets the _retCode return value
+*	@note sets _retCode to ARGVALUEERR for an invalid device and otherwise 
+*	leaves it as is, so a pending error survives deselecting after it.
 */
 void CSselectDevice(int newDevice) 
 {
     if (_device == newDevice) return;
+    int8_t retCode = _retCode;
+    RCreset();
     _CSselectDevice(newDevice);
     ifsuccess(_retCode) {
         _device = newDevice;
+        _retCode = retCode;
     }
 }
 
@@ -107,6 +140,9 @@ void _CSselectDevice(int newDevice) {
     } else { //error
         _retCode = ARGVALUEERR;
     }
+#ifdef ADESIM
+    ADESIMselect(newDevice);
+#endif
 }
 
 /**
@@ -122,6 +158,9 @@ void CSreset(int device)
     device = (device/2)*2;
     CSpinActive(true,device);
     CSpinActive(true,device+1);
+#ifdef ADESIM
+    ADESIMreset(device);
+#endif
 
     delay(10);
     CSpinActive(false,device);
@@ -134,3 +173,12 @@ int CSgetDevice()
 {
     return _device;
 }
+
+/**
+ * @return the pin the IRQ line of the device is routed to or NOIRQPIN.
+ * */
+int8_t CSgetIrqPin(int8_t device)
+{
+    if (!(0 <= device && device < NCIRCUITS)) return NOIRQPIN;
+    return mapCtoPinIRQ[device];
+}
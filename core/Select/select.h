@@ -2,6 +2,8 @@
 #ifndef SELECT_H
 #define SELECT_H
 
+#include <inttypes.h>
+
 #ifdef __cplusplus
 extern "C"{
 #endif
@@ -18,12 +20,15 @@ extern "C"{
 *	@warning Ensure SDCCARD is not within the range of [-1,NCIRCUITS].
 */
 #define SDCARD 24 //24 works as there are less than 22 circuits
+/** Pin of a circuit whose ADE IRQ line is not routed to the MCU. */
+#define NOIRQPIN -1
 
 void initSelect();
 void CSselectDevice(int device);
 int CSgetDevice();
 void _CSselectDevice(int device);
 void CSreset(int device);
+int8_t CSgetIrqPin(int8_t device);
 
 #ifdef __cplusplus
 }
@@ -1,9 +1,17 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
 #include "switches.h"
 #include "ReturnCode/returncode.h"
 
 /**
  * @file Switches.cpp
  *
+ * Switching is done by a relay queue. SWqueue records the requested state and 
+ * returns, the Timer5 compare interrupt then pulses the coils one at a time, 
+ * each at a zero crossing of the line and at least the stagger time after the 
+ * previous one, and ends the pulses. The timer only runs while the queue is busy.
+ *
  * TODO: Since the relays are latching relays, switch to High-Z.
  * */
 
@@ -51,39 +59,127 @@ static const int8_t mapSWtoPinOFF[] = {
     70,71,//CH16,17
 };*/
 
+/** Requests waiting for their coil pulse and the state they ask for. */
+static volatile int8_t _SWpending[NSWITCHES];
+static volatile int8_t _SWtarget[NSWITCHES];
+/** Switch whose coil is being pulsed, -1 if none. */
+static volatile int8_t _SWpulsing = -1;
+static volatile uint32_t _SWpulseStart_us;
+static volatile uint8_t _SWrunning = false;
+static volatile uint16_t _SWstagger_ms = SWSTAGGERMS;
+/** Next switch to be served, so that no switch starves the others. */
+static int8_t _SWnext = 0;
+
+/** 
+ * The zero crossing the reference was taken at and half the line period. 
+ * _SWzx_us is the last crossing before now, which _SWstart and the ticks 
+ * step forward so the ISR only ever adds half a period.
+ * */
+static volatile uint32_t _SWzxRef_us;
+static volatile uint32_t _SWzx_us;
+static volatile uint32_t _SWhalf_us = 0;
+
 /**
-  The workhorse of the Switches library. This function along with 
-  _SWsetSwitches(), SWinit, and _enabledC is used to implement the actual switching.
+  Energizes the coil that puts switch sw into state on.
+  The pulse is ended by _SWtick after SWPULSEMS.
 */
-void _SWset(int8_t sw, int8_t on) 
+static void _SWfire(int8_t sw, int8_t on, uint32_t now) 
 {
     _enabledC[sw] = on;
-    int8_t pinOn = mapSWtoPinON[sw];
-    int8_t pinOff = mapSWtoPinOFF[sw];
     if (on) {
-        digitalWrite(pinOn,HIGH);
+        digitalWrite(mapSWtoPinON[sw],HIGH);
     } else {
-        digitalWrite(pinOff,HIGH);
+        digitalWrite(mapSWtoPinOFF[sw],HIGH);
+    }
+    _SWpulsing = sw;
+    _SWpulseStart_us = now;
+}
+
+/** Moves _SWzx_us to the last zero crossing before now. Interrupts are off. */
+static void _SWstepZeroCross(uint32_t now)
+{
+    while ((int32_t)(now - _SWzx_us) >= (int32_t)_SWhalf_us) {
+        _SWzx_us += _SWhalf_us;
+    }
+}
+
+/** @return true if now is within a tick after a zero crossing, or if 
+ *  there is no zero crossing reference to align with. */
+static uint8_t _SWatZeroCross(uint32_t now)
+{
+    if (!SWhasZeroCross()) return true;
+    // A tick is much shorter than half a period so this steps at most once
+    _SWstepZeroCross(now);
+    return now - _SWzx_us < SWTICKUS;
+}
+
+static void _SWstart()
+{
+    uint8_t oldSREG = SREG;
+    cli();
+    if (SWhasZeroCross()) {
+        _SWstepZeroCross(micros());
     }
-    // Relays need 10ms
-	delay(10);
-    digitalWrite(pinOn,LOW);
-    digitalWrite(pinOff,LOW);
+    if (!_SWrunning) {
+        _SWrunning = true;
+        // CTC mode at one count per microsecond
+        TCCR5A = 0;
+        TCNT5 = 0;
+        OCR5A = SWTICKUS*(F_CPU/8/1000000UL) - 1;
+        TCCR5B = _BV(WGM52) | _BV(CS51);
+        TIMSK5 |= _BV(OCIE5A);
+    }
+    SREG = oldSREG;
+}
+
+static void _SWstop()
+{
+    TIMSK5 &= ~_BV(OCIE5A);
+    TCCR5B = 0;
+    _SWrunning = false;
 }
 
 /**
-  Normally, this function can just call _SWset. 
-  If the switch is controlled by shift registers, that might not be
-  optimal.
+  Runs the relay queue, called every SWTICKUS while it is busy.
+  A pulse that has lasted SWPULSEMS is ended first. Then the next pending 
+  switch is fired once the stagger time has passed and the line is at a zero crossing.
 */
-void _SWsetSwitches() 
+static void _SWtick()
 {
+    uint32_t now = micros();
+    int8_t sw = -1;
+
+    if (_SWpulsing >= 0) {
+        if (now - _SWpulseStart_us < SWPULSEMS*1000UL) return;
+        digitalWrite(mapSWtoPinON[_SWpulsing],LOW);
+        digitalWrite(mapSWtoPinOFF[_SWpulsing],LOW);
+        _SWpulsing = -1;
+    }
     for (int8_t i=0; i < NSWITCHES; i++) {
-        _SWset(i,_enabledC[i]);
+        int8_t j = (_SWnext + i)%NSWITCHES;
+        if (_SWpending[j]) {
+            sw = j;
+            break;
+        }
     }
+    if (sw < 0) {
+        _SWstop();
+        return;
+    }
+    if (now - _SWpulseStart_us < _SWstagger_ms*1000UL) return;
+    if (!_SWatZeroCross(now)) return;
+
+    _SWpending[sw] = false;
+    _SWnext = (sw + 1)%NSWITCHES;
+    _SWfire(sw,_SWtarget[sw],now);
 }
 
-/** Configures appropriate pins and sets pins to match _enabledC[].
+ISR(TIMER5_COMPA_vect)
+{
+    _SWtick();
+}
+
+/** Configures appropriate pins and queues pulses that set the relays to match _enabledC[].
 */
 void SWinit() 
 {
@@ -94,7 +190,7 @@ void SWinit()
         pinMode(pinOff,OUTPUT);
         digitalWrite(pinOn,LOW);
         digitalWrite(pinOff,LOW);
-        _SWset(i,_enabledC[i]);
+        SWqueue(i,_enabledC[i]);
     }
 }
 
@@ -102,27 +198,101 @@ void SWinit()
 /**
     There are NSWITCHES switches in the circuit.
     if enabledC[i] == 1 then the circuit is on and off if it is 0.
+    Returns once all of the relays have been switched.
 */
 void SWsetSwitches(int8_t enabledC[NSWITCHES]) 
 {
     int8_t i = 0;
     for (i =0; i < NSWITCHES; i++) {
-        _enabledC[i] = enabledC[i];
+        SWqueue(i,enabledC[i]);
     }
-    _SWsetSwitches();
+    SWwait();
 }
 
 /**
+  Queues a coil pulse that puts the switch in state on and returns immediately. 
+  A later request for the same switch replaces one that has not been fired yet.
   For any non-zero value of on the switch is turned on. 
   0 <= sw < NSWITCHES
   */
-void SWset(int8_t sw, int8_t on) 
+void SWqueue(int8_t sw, int8_t on) 
 {
-    if (0 <= sw && sw < NSWITCHES) {
-        _SWset(sw, on);
-    } else {
+    if (!(0 <= sw && sw < NSWITCHES)) {
         _retCode = ARGVALUEERR;
+        return;
     }
+    _SWtarget[sw] = on;
+    _SWpending[sw] = true;
+    _SWstart();
+}
+
+/** @return true while there are queued requests or a coil is being pulsed. */
+uint8_t SWbusy()
+{
+    return _SWrunning;
+}
+
+/** Waits for the relay queue to be done. */
+void SWwait()
+{
+    while (SWbusy()) {
+        delay(1);
+    }
+}
+
+/**
+  Like SWqueue but returns after the relay has been switched.
+  For any non-zero value of on the switch is turned on. 
+  0 <= sw < NSWITCHES
+  */
+void SWset(int8_t sw, int8_t on) 
+{
+    SWqueue(sw,on);
+    SWwait();
+}
+
+/** Sets the minimum time between the starts of two coil pulses. */
+void SWsetStagger(uint16_t ms)
+{
+    uint8_t oldSREG = SREG;
+    cli();
+    _SWstagger_ms = ms;
+    SREG = oldSREG;
+}
+
+uint16_t SWgetStagger()
+{
+    return _SWstagger_ms;
+}
+
+/**
+  Gives the relay queue a zero crossing to align coil pulses with. 
+  zxTime_us is the micros() of the crossing itself, not of when it was 
+  noticed. Zero crossings are expected every period_us/2 after it for 
+  SWZXMAXAGEMS. All switches are assumed to be on the same phase.
+  */
+void SWsetZeroCross(uint32_t zxTime_us, uint32_t period_us)
+{
+    uint8_t oldSREG = SREG;
+    cli();
+    _SWzxRef_us = zxTime_us;
+    _SWzx_us = zxTime_us;
+    _SWhalf_us = period_us/2;
+    if (SWhasZeroCross()) {
+        _SWstepZeroCross(micros());
+    }
+    SREG = oldSREG;
+}
+
+/** @return true if there is a zero crossing reference recent enough to align pulses with. */
+uint8_t SWhasZeroCross()
+{
+    uint8_t oldSREG = SREG;
+    uint8_t recent;
+    cli();
+    recent = _SWhalf_us != 0 && micros() - _SWzxRef_us <= SWZXMAXAGEMS*1000UL;
+    SREG = oldSREG;
+    return recent;
 }
 
 /** 
@@ -132,8 +302,9 @@ void SWallOff()
 {
     int8_t i = 0;
     for (i = 0; i < NSWITCHES; i++) {
-		_SWset(i,false);
+		SWqueue(i,false);
     }
+    SWwait();
 }
 
 /** 
@@ -143,8 +314,9 @@ void SWallOn()
 {
     int8_t i;
     for (i = 0; i < NSWITCHES; i++) {
-		_SWset(i,true);
+		SWqueue(i,true);
     }
+    SWwait();
 }
 
 /**
@@ -12,12 +12,30 @@ extern "C" {
 /**Must be the same value as NCIRCUITS in Select.h*/
 #define NSWITCHES 2
 
+/** Length of a coil pulse. Latching relays need 10ms. */
+#define SWPULSEMS 10
+/** Period of the Timer5 interrupt that runs the relay queue while it is busy. */
+#define SWTICKUS 500
+/** Default time between the starts of two coil pulses, which spreads the 
+ *  inrush currents of loads switched on together. */
+#define SWSTAGGERMS 20
+/** A zero crossing reference older than this is too far off to align pulses 
+ *  with, the line frequency drifts from the period it was taken with. */
+#define SWZXMAXAGEMS 500
+
 static int8_t _enabledC[NSWITCHES] = {0};
 
 void SWinit();    
 void SWsetSwitches(int8_t enabledC[NSWITCHES]); 
 
 void SWset(int8_t sw, int8_t on);
+void SWqueue(int8_t sw, int8_t on);
+uint8_t SWbusy();
+void SWwait();
+void SWsetStagger(uint16_t ms);
+uint16_t SWgetStagger();
+void SWsetZeroCross(uint32_t zxTime_us, uint32_t period_us);
+uint8_t SWhasZeroCross();
 void SWallOff();                
 void SWallOn();                  
 const int8_t* SWgetSwitchState();
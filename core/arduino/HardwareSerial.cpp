@@ -27,39 +27,39 @@
 #include "wiring_private.h"
 
 #include "HardwareSerial.h"
+#include "Ring/Ring.h"
 
-// Define constants and variables for buffering incoming serial data.  We're
-// using a ring buffer (I think), in which rx_buffer_head is the index of the
-// location to which to write the next incoming character and rx_buffer_tail
-// is the index of the location from which to read.
+// Received bytes are pushed by the RX interrupt and popped by read(). Bytes 
+// to send are pushed by write() and popped by the UDRE interrupt.
 #define RX_BUFFER_SIZE 128
 
-struct ring_buffer {
-  unsigned char buffer[RX_BUFFER_SIZE];
-  int head;
-  int tail;
+struct ring_buffer : public Ring<unsigned char, RX_BUFFER_SIZE> {};
+
+struct tx_ring : public RingBase<unsigned char, uint8_t> {
+  template <size_t N>
+  tx_ring(unsigned char (&buf)[N]) : RingBase<unsigned char, uint8_t>(buf) {}
 };
 
-ring_buffer rx_buffer = { { 0 }, 0, 0 };
+ring_buffer rx_buffer;
+static unsigned char tx_data[SERIAL_TX_SIZE0];
+tx_ring tx_buffer(tx_data);
 
 #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
-ring_buffer rx_buffer1 = { { 0 }, 0, 0 };
-ring_buffer rx_buffer2 = { { 0 }, 0, 0 };
-ring_buffer rx_buffer3 = { { 0 }, 0, 0 };
+ring_buffer rx_buffer1;
+ring_buffer rx_buffer2;
+ring_buffer rx_buffer3;
+static unsigned char tx_data1[SERIAL_TX_SIZE1];
+static unsigned char tx_data2[SERIAL_TX_SIZE2];
+static unsigned char tx_data3[SERIAL_TX_SIZE3];
+tx_ring tx_buffer1(tx_data1);
+tx_ring tx_buffer2(tx_data2);
+tx_ring tx_buffer3(tx_data3);
 #endif
 
+// A byte that arrives while the ring is full is dropped.
 inline void store_char(unsigned char c, ring_buffer *rx_buffer)
 {
-  int i = (rx_buffer->head + 1) % RX_BUFFER_SIZE;
-
-  // if we should be storing the received character into the location
-  // just before the tail (meaning that the head would advance to the
-  // current location of the tail), we're about to overflow the buffer
-  // and so we don't write the character or advance the head.
-  if (i != rx_buffer->tail) {
-    rx_buffer->buffer[rx_buffer->head] = c;
-    rx_buffer->head = i;
-  }
+  rx_buffer->push(c);
 }
 
 #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
@@ -88,6 +88,26 @@ SIGNAL(SIG_USART3_RECV)
   store_char(c, &rx_buffer3);
 }
 
+SIGNAL(SIG_USART0_DATA)
+{
+  Serial._txInterrupt();
+}
+
+SIGNAL(SIG_USART1_DATA)
+{
+  Serial1._txInterrupt();
+}
+
+SIGNAL(SIG_USART2_DATA)
+{
+  Serial2._txInterrupt();
+}
+
+SIGNAL(SIG_USART3_DATA)
+{
+  Serial3._txInterrupt();
+}
+
 #else
 
 #if defined(__AVR_ATmega8__)
@@ -104,17 +124,28 @@ SIGNAL(USART_RX_vect)
   store_char(c, &rx_buffer);
 }
 
+#if defined(__AVR_ATmega8__)
+SIGNAL(SIG_UART_DATA)
+#else
+SIGNAL(USART_UDRE_vect)
+#endif
+{
+  Serial._txInterrupt();
+}
+
 #endif
 
 // Constructors ////////////////////////////////////////////////////////////////
 
-HardwareSerial::HardwareSerial(ring_buffer *rx_buffer,
+HardwareSerial::HardwareSerial(ring_buffer *rx_buffer, tx_ring *tx_buffer,
   volatile uint8_t *ubrrh, volatile uint8_t *ubrrl,
   volatile uint8_t *ucsra, volatile uint8_t *ucsrb,
   volatile uint8_t *udr,
-  uint8_t rxen, uint8_t txen, uint8_t rxcie, uint8_t udre, uint8_t u2x)
+  uint8_t rxen, uint8_t txen, uint8_t rxcie, uint8_t udre, uint8_t u2x,
+  uint8_t udrie)
 {
   _rx_buffer = rx_buffer;
+  _tx_buffer = tx_buffer;
   _ubrrh = ubrrh;
   _ubrrl = ubrrl;
   _ucsra = ucsra;
@@ -125,6 +156,9 @@ HardwareSerial::HardwareSerial(ring_buffer *rx_buffer,
   _rxcie = rxcie;
   _udre = udre;
   _u2x = u2x;
+  _udrie = udrie;
+  _txBlocking = true;
+  _txDropped = 0;
 }
 
 // Public Methods //////////////////////////////////////////////////////////////
@@ -168,6 +202,7 @@ void HardwareSerial::begin(long baud)
 
 void HardwareSerial::end()
 {
+  flushTx();
   cbi(*_ucsrb, _rxen);
   cbi(*_ucsrb, _txen);
   cbi(*_ucsrb, _rxcie);  
@@ -175,62 +210,122 @@ void HardwareSerial::end()
 
 int HardwareSerial::available(void)
 {
-  return (RX_BUFFER_SIZE + _rx_buffer->head - _rx_buffer->tail) % RX_BUFFER_SIZE;
+  return _rx_buffer->count();
 }
 
 int HardwareSerial::peek(void)
 {
-  if (_rx_buffer->head == _rx_buffer->tail) {
+  unsigned char c;
+  if (!_rx_buffer->peek(c)) {
     return -1;
-  } else {
-    return _rx_buffer->buffer[_rx_buffer->tail];
   }
+  return c;
 }
 
 int HardwareSerial::read(void)
 {
-  // if the head isn't ahead of the tail, we don't have any characters
-  if (_rx_buffer->head == _rx_buffer->tail) {
+  unsigned char c;
+  if (!_rx_buffer->pop(c)) {
     return -1;
-  } else {
-    unsigned char c = _rx_buffer->buffer[_rx_buffer->tail];
-    _rx_buffer->tail = (_rx_buffer->tail + 1) % RX_BUFFER_SIZE;
-    return c;
   }
+  return c;
 }
 
 void HardwareSerial::flush()
 {
-  // don't reverse this or there may be problems if the RX interrupt
-  // occurs after reading the value of rx_buffer_head but before writing
-  // the value to rx_buffer_tail; the previous value of rx_buffer_head
-  // may be written to rx_buffer_tail, making it appear as if the buffer
-  // don't reverse this or there may be problems if the RX interrupt
-  // occurs after reading the value of rx_buffer_head but before writing
-  // the value to rx_buffer_tail; the previous value of rx_buffer_head
-  // may be written to rx_buffer_tail, making it appear as if the buffer
-  // were full, not empty.
-  _rx_buffer->head = _rx_buffer->tail;
+  _rx_buffer->clear();
 }
 
+/**
+ * Queues c for the UDRE interrupt. When the queue is full a blocking port 
+ * waits for space and a non-blocking one drops c and counts it in txDropped().
+ */
 void HardwareSerial::write(uint8_t c)
 {
-  while (!((*_ucsra) & (1 << _udre)))
-    ;
+  // Nothing queued and the data register is free, no need for the interrupt
+  if (_tx_buffer->empty() && ((*_ucsra) & (1 << _udre))) {
+    *_udr = c;
+    return;
+  }
+  while (!_tx_buffer->push(c)) {
+    if (!_txBlocking) {
+      _txDropped++;
+      return;
+    }
+    // The queue is full, it only drains while the interrupt is enabled
+    sbi(*_ucsrb, _udrie);
+    // The interrupt cannot run when called with interrupts disabled
+    if (!(SREG & (1 << SREG_I)) && ((*_ucsra) & (1 << _udre))) {
+      _txInterrupt();
+    }
+  }
+  sbi(*_ucsrb, _udrie);
+}
+
+/**
+ * Queues a buffer with a single call. Bytes that do not fit are handled as
+ * by write(uint8_t).
+ */
+void HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  if (size > 0 && _tx_buffer->empty() && ((*_ucsra) & (1 << _udre))) {
+    *_udr = *buffer++;
+    size--;
+  }
+  for (; size > 0; size--, buffer++) {
+    if (!_tx_buffer->push(*buffer)) {
+      write(*buffer);
+    }
+  }
+  if (!_tx_buffer->empty()) {
+    sbi(*_ucsrb, _udrie);
+  }
+}
+
+/** Sends the next queued byte. Called by the UDRE interrupt. */
+void HardwareSerial::_txInterrupt(void)
+{
+  unsigned char c;
+  if (_tx_buffer->pop(c)) {
+    *_udr = c;
+  }
+  if (_tx_buffer->empty()) {
+    cbi(*_ucsrb, _udrie);
+  }
+}
 
-  *_udr = c;
+/** Waits until every queued byte has been handed to the USART. */
+void HardwareSerial::flushTx(void)
+{
+  while (!_tx_buffer->empty()) {
+    if (!(SREG & (1 << SREG_I)) && ((*_ucsra) & (1 << _udre))) {
+      _txInterrupt();
+    }
+  }
+}
+
+/** Whether write() waits for space (the default) or drops bytes when the queue is full. */
+void HardwareSerial::setTxBlocking(uint8_t blocking)
+{
+  _txBlocking = blocking;
+}
+
+/** @return the number of bytes dropped by a non-blocking port. */
+uint16_t HardwareSerial::txDropped(void)
+{
+  return _txDropped;
 }
 
 // Preinstantiate Objects //////////////////////////////////////////////////////
 
 #if defined(__AVR_ATmega8__)
-HardwareSerial Serial(&rx_buffer, &UBRRH, &UBRRL, &UCSRA, &UCSRB, &UDR, RXEN, TXEN, RXCIE, UDRE, U2X);
+HardwareSerial Serial(&rx_buffer, &tx_buffer, &UBRRH, &UBRRL, &UCSRA, &UCSRB, &UDR, RXEN, TXEN, RXCIE, UDRE, U2X, UDRIE);
 #else
-HardwareSerial Serial(&rx_buffer, &UBRR0H, &UBRR0L, &UCSR0A, &UCSR0B, &UDR0, RXEN0, TXEN0, RXCIE0, UDRE0, U2X0);
+HardwareSerial Serial(&rx_buffer, &tx_buffer, &UBRR0H, &UBRR0L, &UCSR0A, &UCSR0B, &UDR0, RXEN0, TXEN0, RXCIE0, UDRE0, U2X0, UDRIE0);
 #endif
 
 #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
-HardwareSerial Serial1(&rx_buffer1, &UBRR1H, &UBRR1L, &UCSR1A, &UCSR1B, &UDR1, RXEN1, TXEN1, RXCIE1, UDRE1, U2X1);
-HardwareSerial Serial2(&rx_buffer2, &UBRR2H, &UBRR2L, &UCSR2A, &UCSR2B, &UDR2, RXEN2, TXEN2, RXCIE2, UDRE2, U2X2);
-HardwareSerial Serial3(&rx_buffer3, &UBRR3H, &UBRR3L, &UCSR3A, &UCSR3B, &UDR3, RXEN3, TXEN3, RXCIE3, UDRE3, U2X3);
+HardwareSerial Serial1(&rx_buffer1, &tx_buffer1, &UBRR1H, &UBRR1L, &UCSR1A, &UCSR1B, &UDR1, RXEN1, TXEN1, RXCIE1, UDRE1, U2X1, UDRIE1);
+HardwareSerial Serial2(&rx_buffer2, &tx_buffer2, &UBRR2H, &UBRR2L, &UCSR2A, &UCSR2B, &UDR2, RXEN2, TXEN2, RXCIE2, UDRE2, U2X2, UDRIE2);
+HardwareSerial Serial3(&rx_buffer3, &tx_buffer3, &UBRR3H, &UBRR3L, &UCSR3A, &UCSR3B, &UDR3, RXEN3, TXEN3, RXCIE3, UDRE3, U2X3, UDRIE3);
 #endif
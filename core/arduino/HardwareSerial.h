@@ -24,12 +24,29 @@
 
 #include "Stream.h"
 
+/** Transmit buffer size of each port, a power of two from 2 to 256 bytes. 
+ *  Writes return as soon as the byte is queued and the UDRE interrupt sends it. */
+#ifndef SERIAL_TX_SIZE0
+#define SERIAL_TX_SIZE0 256
+#endif
+#ifndef SERIAL_TX_SIZE1
+#define SERIAL_TX_SIZE1 32
+#endif
+#ifndef SERIAL_TX_SIZE2
+#define SERIAL_TX_SIZE2 32
+#endif
+#ifndef SERIAL_TX_SIZE3
+#define SERIAL_TX_SIZE3 64
+#endif
+
 struct ring_buffer;
+struct tx_ring;
 
 class HardwareSerial : public Stream
 {
   private:
     ring_buffer *_rx_buffer;
+    tx_ring *_tx_buffer;
     volatile uint8_t *_ubrrh;
     volatile uint8_t *_ubrrl;
     volatile uint8_t *_ucsra;
@@ -40,20 +57,29 @@ class HardwareSerial : public Stream
     uint8_t _rxcie;
     uint8_t _udre;
     uint8_t _u2x;
+    uint8_t _udrie;
+    uint8_t _txBlocking;
+    uint16_t _txDropped;
   public:
-    HardwareSerial(ring_buffer *rx_buffer,
+    HardwareSerial(ring_buffer *rx_buffer, tx_ring *tx_buffer,
       volatile uint8_t *ubrrh, volatile uint8_t *ubrrl,
       volatile uint8_t *ucsra, volatile uint8_t *ucsrb,
       volatile uint8_t *udr,
-      uint8_t rxen, uint8_t txen, uint8_t rxcie, uint8_t udre, uint8_t u2x);
+      uint8_t rxen, uint8_t txen, uint8_t rxcie, uint8_t udre, uint8_t u2x,
+      uint8_t udrie);
     void begin(long);
     void end();
+    void flushTx(void);
+    void setTxBlocking(uint8_t blocking);
+    uint16_t txDropped(void);
+    void _txInterrupt(void);
     virtual int available(void);
     virtual int peek(void);
     virtual int read(void);
     virtual void flush(void);
     virtual void write(uint8_t);
-    using Print::write; // pull in write(str) and write(buf, size) from Print
+    virtual void write(const uint8_t *buffer, size_t size);
+    using Print::write; // pull in write(str) from Print
 };
 
 extern HardwareSerial Serial;
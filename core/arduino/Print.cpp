@@ -26,6 +26,7 @@
 #include "wiring.h"
 
 #include "Print.h"
+#include "Format/format.h"
 
 // Public Methods //////////////////////////////////////////////////////////////
 
@@ -73,11 +74,12 @@ void Print::print(long n, int base)
   if (base == 0) {
     write(n);
   } else if (base == 10) {
-    if (n < 0) {
-      print('-');
-      n = -n;
+    if (n != (int32_t) n) {
+      print((long long) n, base);
+      return;
     }
-    printNumber(n, 10);
+    char buf[FMMAXI32];
+    write((const uint8_t *)buf, FMi32(buf, n));
   } else {
     printNumber(n, base);
   }
@@ -89,6 +91,24 @@ void Print::print(unsigned long n, int base)
   else printNumber(n, base);
 }
 
+void Print::print(long long n, int base)
+{
+  if (base == 0) {
+    write(n);
+  } else if (base == 10) {
+    char buf[FMMAXI64];
+    write((const uint8_t *)buf, FMi64(buf, n));
+  } else {
+    printNumber64((unsigned long long) n, base);
+  }
+}
+
+void Print::print(unsigned long long n, int base)
+{
+  if (base == 0) write(n);
+  else printNumber64(n, base);
+}
+
 void Print::print(double n, int digits)
 {
   printFloat(n, digits);
@@ -96,8 +116,7 @@ void Print::print(double n, int digits)
 
 void Print::println(void)
 {
-  print('\r');
-  print('\n');  
+  write((const uint8_t *)"\r\n", 2);
 }
 
 void Print::println(const char c[])
@@ -142,6 +161,18 @@ void Print::println(unsigned long n, int base)
   println();
 }
 
+void Print::println(long long n, int base)
+{
+  print(n, base);
+  println();
+}
+
+void Print::println(unsigned long long n, int base)
+{
+  print(n, base);
+  println();
+}
+
 void Print::println(double n, int digits)
 {
   print(n, digits);
@@ -150,25 +181,55 @@ void Print::println(double n, int digits)
 
 // Private Methods /////////////////////////////////////////////////////////////
 
+// Numbers are formatted into a buffer and written at once, decimal and hex
+// without division, see Format/format.h
 void Print::printNumber(unsigned long n, uint8_t base)
 {
-  unsigned char buf[8 * sizeof(long)]; // Assumes 8-bit chars. 
-  unsigned long i = 0;
+  char buf[8 * sizeof(long)]; // Assumes 8-bit chars. 
+  uint8_t i = sizeof(buf);
 
-  if (n == 0) {
-    print('0');
+  if (n != (uint32_t) n) {
+    // long is 64 bits on the host
+    printNumber64(n, base);
     return;
-  } 
+  }
+  if (base == 10) {
+    write((const uint8_t *)buf, FMu32(buf, n));
+    return;
+  }
+  if (base == 16) {
+    write((const uint8_t *)buf, FMhex32(buf, n));
+    return;
+  }
+  do {
+    uint8_t d = n % base;
+    buf[--i] = d < 10 ? '0' + d : 'A' + d - 10;
+    n /= base;
+  } while (n > 0);
+  write((const uint8_t *)&buf[i], sizeof(buf) - i);
+}
 
+void Print::printNumber64(unsigned long long n, uint8_t base)
+{
+  // 64 bit division is slow on the AVR so only use it when the value needs it
+  if (n == (uint32_t) n) {
+    printNumber((unsigned long) n, base);
+    return;
+  }
+  if (base == 10) {
+    char buf[FMMAXU64];
+    write((const uint8_t *)buf, FMu64(buf, n));
+    return;
+  }
+
+  char buf[8 * sizeof(long long)];
+  uint8_t i = sizeof(buf);
   while (n > 0) {
-    buf[i++] = n % base;
+    uint8_t d = n % base;
+    buf[--i] = d < 10 ? '0' + d : 'A' + d - 10;
     n /= base;
   }
-
-  for (; i > 0; i--)
-    print((char) (buf[i - 1] < 10 ?
-      '0' + buf[i - 1] :
-      'A' + buf[i - 1] - 10));
+  write((const uint8_t *)&buf[i], sizeof(buf) - i);
 }
 
 void Print::printFloat(double number, uint8_t digits) 
@@ -180,6 +241,18 @@ void Print::printFloat(double number, uint8_t digits)
      number = -number;
   }
 
+  // Up to 9 digits of anything that fits a long is printed as a fixed point number
+  if (digits <= 9) {
+    double scaled = number;
+    for (uint8_t i=0; i<digits; ++i)
+      scaled *= 10.0;
+    if (scaled + 0.5 < 2147483647.0) {
+      char buf[FMMAXFIXED];
+      write((const uint8_t *)buf, FMfixed(buf, (long)(scaled + 0.5), digits));
+      return;
+    }
+  }
+
   // Round correctly so that print(1.999, 2) prints as "2.00"
   double rounding = 0.5;
   for (uint8_t i=0; i<digits; ++i)
@@ -33,6 +33,7 @@ class Print
 {
   private:
     void printNumber(unsigned long, uint8_t);
+    void printNumber64(unsigned long long, uint8_t);
     void printFloat(double, uint8_t);
   public:
     virtual void write(uint8_t) = 0;
@@ -46,6 +47,8 @@ class Print
     void print(unsigned int, int = DEC);
     void print(long, int = DEC);
     void print(unsigned long, int = DEC);
+    void print(long long, int = DEC);
+    void print(unsigned long long, int = DEC);
     void print(double, int = 2);
 
     void println(const char[]);
@@ -55,6 +58,8 @@ class Print
     void println(unsigned int, int = DEC);
     void println(long, int = DEC);
     void println(unsigned long, int = DEC);
+    void println(long long, int = DEC);
+    void println(unsigned long long, int = DEC);
     void println(double, int = 2);
     void println(void);
 };
@@ -31,6 +31,7 @@
 
 #include "wiring.h"
 #include "wiring_private.h"
+#include "pins_arduino.h"
 
 volatile static voidFuncPtr intFunc[EXTERNAL_NUM_INTERRUPTS];
 // volatile static voidFuncPtr twiIntFunc;
@@ -144,6 +145,124 @@ void detachInterrupt(uint8_t interruptNum) {
   }
 }
 
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+// Pin change interrupts. Group 0 is PB0-7, group 1 is PE0 and PJ0-6 and 
+// group 2 is PK0-7. The handler of a pin is called on both edges.
+#define PCINT_NUM_GROUPS 3
+
+volatile static voidFuncPtr pcintFunc[PCINT_NUM_GROUPS][8];
+static uint8_t pcintLast[PCINT_NUM_GROUPS];
+
+static uint8_t pcintState(uint8_t group) {
+  switch (group) {
+  case 0:
+    return PINB;
+  case 1:
+    return (PINE & 0x01) | (PINJ << 1);
+  default:
+    return PINK;
+  }
+}
+
+// Returns the group of the pin and its bit in the group's PCMSK register, 
+// or -1 if the pin has no pin change interrupt.
+static int8_t pcintGroup(uint8_t pin, uint8_t *bit) {
+  volatile uint8_t *in;
+  uint8_t mask;
+  if (digitalPinToPort(pin) == NOT_A_PIN) return -1;
+  in = portInputRegister(digitalPinToPort(pin));
+  mask = digitalPinToBitMask(pin);
+  if (in == &PINB) {
+    *bit = mask;
+    return 0;
+  } else if (in == &PINE && mask == 0x01) {
+    *bit = mask;
+    return 1;
+  } else if (in == &PINJ && mask != 0x80) {
+    *bit = mask << 1;
+    return 1;
+  } else if (in == &PINK) {
+    *bit = mask;
+    return 2;
+  }
+  return -1;
+}
+
+static volatile uint8_t *pcintMask(uint8_t group) {
+  switch (group) {
+  case 0:
+    return &PCMSK0;
+  case 1:
+    return &PCMSK1;
+  default:
+    return &PCMSK2;
+  }
+}
+
+void attachPinChangeInterrupt(uint8_t pin, void (*userFunc)(void)) {
+  uint8_t bit, i;
+  int8_t group = pcintGroup(pin,&bit);
+  if (group < 0) return;
+  for (i = 0; !(bit & (1 << i)); i++);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  pcintFunc[group][i] = userFunc;
+  pcintLast[group] = pcintState(group);
+  *pcintMask(group) |= bit;
+  PCICR |= (1 << (PCIE0 + group));
+  SREG = oldSREG;
+}
+
+void detachPinChangeInterrupt(uint8_t pin) {
+  uint8_t bit, i;
+  int8_t group = pcintGroup(pin,&bit);
+  if (group < 0) return;
+  for (i = 0; !(bit & (1 << i)); i++);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  *pcintMask(group) &= ~bit;
+  if (*pcintMask(group) == 0) {
+    PCICR &= ~(1 << (PCIE0 + group));
+  }
+  pcintFunc[group][i] = 0;
+  SREG = oldSREG;
+}
+
+static void pcintDispatch(uint8_t group) {
+  uint8_t state = pcintState(group);
+  uint8_t changed = (state ^ pcintLast[group]) & *pcintMask(group);
+  uint8_t i;
+  pcintLast[group] = state;
+  for (i = 0; changed; i++, changed >>= 1) {
+    if ((changed & 0x01) && pcintFunc[group][i])
+      pcintFunc[group][i]();
+  }
+}
+
+SIGNAL(PCINT0_vect) {
+  pcintDispatch(0);
+}
+
+SIGNAL(PCINT1_vect) {
+  pcintDispatch(1);
+}
+
+SIGNAL(PCINT2_vect) {
+  pcintDispatch(2);
+}
+
+#else
+
+void attachPinChangeInterrupt(uint8_t pin, void (*userFunc)(void)) {
+}
+
+void detachPinChangeInterrupt(uint8_t pin) {
+}
+
+#endif
+
 /*
 void attachInterruptTwi(void (*userFunc)(void) ) {
   twiIntFunc = userFunc;
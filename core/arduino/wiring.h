@@ -118,6 +118,8 @@ void delayMicroseconds(unsigned int us);
 
 void attachInterrupt(uint8_t, void (*)(void), int mode);
 void detachInterrupt(uint8_t);
+void attachPinChangeInterrupt(uint8_t pin, void (*)(void));
+void detachPinChangeInterrupt(uint8_t pin);
 
 void setup(void);
 void loop(void);
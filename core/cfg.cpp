@@ -1,13 +1,21 @@
 #include <stdint.h>
+#include <avr/io.h>
 #include "cfg.h"
+#include "PowerFail/powerfail.h"
 
 int16_t reportInterval=10;     /** How often to report in seconds */
 int8_t mode = INTERACTIVEMODE;  /** 0 emergency, 1 interactive, 2 meter */
 
 // In memory and in EEPROM storage for circuit configuration
 Circuit ckts[NCIRCUITS];
-Circuit EEMEM cktsSave[NCIRCUITS];
+uint8_t EEMEM cktsSave[NCIRCUITS][CSAVESIZE];
+uint8_t EEMEM cktsDividerSave[NCIRCUITS];
 
 
-int32_t EEMEM RARAASave[RARAASIZE][2] = {0}; //Used for a hacked up long running test
-int32_t EEMEM nRARAASave = 0; //Total number of saved entries in RARAASave
+//Journal of the hacked up long running test, opened at power up
+uint8_t EEMEM testLogSave[ELREGION(TESTLOGRECORD,TESTLOGSLOTS)];
+EELog testLog;
+
+// avr-ld does not check that EEMEM fits the EEPROM, what is past it wraps onto cktsSave
+typedef char eepromFits[(sizeof(cktsSave) + sizeof(cktsDividerSave) + sizeof(testLogSave)
+        + PFEEPROMSIZE <= E2END + 1) ? 1 : -1];
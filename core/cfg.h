@@ -3,6 +3,7 @@
 
 #include <avr/eeprom.h>
 #include "Circuit/circuit.h"
+#include "EELogger/EELogger.h"
 
 /** select.h contains lower level hardware configuration information 
  * like how many circuits there are*/
@@ -21,21 +22,29 @@
 #define MDM_BAUD_RATE 9600
 
 //HACKED UP TEST REMOVE
-#define RARAASIZE 225
+/** Results kept by the long-run test, see interactive.cpp. A result is two int32_t. */
+#define TESTLOGSLOTS 100
+#define TESTLOGRECORD 8
 
 #define MAINS 0
 extern int16_t reportInterval;  /** How often to report in seconds */
-extern int8_t mode;             /** 0 emergency, 1 interactive, 2 meter, 3 test */
+extern int8_t mode;             /** 0 emergency, 1 interactive, 2 meter, 3 test, 4 binary meter, 5 delta meter */
 #define EMERGENCYMODE 0
 #define INTERACTIVEMODE 1
 #define METERMODE 2
 #define TESTMODE 3
+/** Meter mode with binary reports, see Frame/records.h */
+#define METERBINMODE 4
+/** Binary meter mode with delta coded reports, see Frame/delta.h */
+#define METERDELTAMODE 5
 
 extern Circuit ckts[NCIRCUITS];
 //EEPROM DATA
-extern Circuit EEMEM cktsSave[NCIRCUITS];
+extern uint8_t EEMEM cktsSave[NCIRCUITS][CSAVESIZE];
+/** SPI divider of each circuit, see Csave. */
+extern uint8_t EEMEM cktsDividerSave[NCIRCUITS];
 //HACKED UP TEST REMOVE \/
-extern int32_t EEMEM RARAASave[RARAASIZE][2];
-extern int32_t EEMEM nRARAASave;
+extern uint8_t EEMEM testLogSave[ELREGION(TESTLOGRECORD,TESTLOGSLOTS)];
+extern EELog testLog;
             
 #endif
@@ -0,0 +1,238 @@
+/** @file HostSerial.cpp
+ *  HardwareSerial for the host build. Replaces HardwareSerial.cpp.
+ *
+ *  Serial reads stdin and writes stdout. Serial1-3 are connected to a pty
+ *  each when TELDUINO_PTY is set and to /dev/null otherwise.
+ *  On the virtual clock the transmit queue of the real UART is modelled: a
+ *  byte is output right away but leaves the queue only after its time on the
+ *  wire, and a write to a full queue either waits or drops the byte.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "arduino/wiring.h"
+#include "arduino/HardwareSerial.h"
+#include "hal.h"
+#include "Ring/Ring.h"
+
+#define RX_BUFFER_SIZE 128
+
+/** Host state of a port, stored where the AVR version keeps its RX ring.*/
+struct ring_buffer {
+    const char *name;
+    int in;
+    int out;
+    FILE *stream;
+    long baud;
+    Ring<unsigned char, RX_BUFFER_SIZE> rx;
+};
+
+ring_buffer rx_buffer  =  { "Serial", -1, -1 };
+ring_buffer rx_buffer1 =  { "Serial1", -1, -1 };
+ring_buffer rx_buffer2 =  { "Serial2", -1, -1 };
+ring_buffer rx_buffer3 =  { "Serial3", -1, -1 };
+
+/** Model of a transmit queue. */
+struct tx_ring {
+    uint16_t size;
+    /** When the UART will have sent everything written so far. */
+    uint64_t idleNs;
+};
+
+tx_ring tx_buffer  = { SERIAL_TX_SIZE0 };
+tx_ring tx_buffer1 = { SERIAL_TX_SIZE1 };
+tx_ring tx_buffer2 = { SERIAL_TX_SIZE2 };
+tx_ring tx_buffer3 = { SERIAL_TX_SIZE3 };
+
+/** Opens the file descriptors of a port the first time it is used. */
+static void _open(ring_buffer *rx)
+{
+    if (rx->in >= 0) return;
+
+    if (rx == &rx_buffer) {
+        rx->in = STDIN_FILENO;
+        rx->out = STDOUT_FILENO;
+        rx->stream = stdout;
+        return;
+    }
+    if (getenv("TELDUINO_PTY") != NULL) {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd >= 0 && grantpt(fd) == 0 && unlockpt(fd) == 0) {
+            struct termios t;
+            if (tcgetattr(fd,&t) == 0) {
+                cfmakeraw(&t);
+                tcsetattr(fd,TCSANOW,&t);
+            }
+            fprintf(stderr,"%s on %s\n",rx->name,ptsname(fd));
+            rx->in = rx->out = fd;
+            rx->stream = fdopen(dup(fd),"w");
+            return;
+        }
+        perror(rx->name);
+    }
+    rx->in = open("/dev/null",O_RDONLY);
+    rx->out = open("/dev/null",O_WRONLY);
+    rx->stream = fdopen(rx->out,"w");
+}
+
+/** Moves whatever input is pending into the ring without blocking. */
+static void _poll(ring_buffer *rx)
+{
+    struct pollfd p = {rx->in, POLLIN, 0};
+    unsigned char buffer[RX_BUFFER_SIZE];
+
+    HOSTmicros();
+    if (rx->stream) {
+        fflush(rx->stream);
+    }
+    if (rx->in < 0 || poll(&p,1,0) <= 0) {
+        return;
+    }
+    if (rx->rx.space() == 0) {
+        return;
+    }
+    // A pty reports POLLHUP with nothing to read while its slave is closed.
+    if (!(p.revents & POLLIN)) {
+        return;
+    }
+    ssize_t n = ::read(rx->in,buffer,rx->rx.space());
+    for (ssize_t i=0; i < n; i++) {
+        rx->rx.push(buffer[i]);
+    }
+    if (n == 0 && rx == &rx_buffer && getenv("TELDUINO_RUN_MS") == NULL) {
+        HOSTexit(0);
+    }
+}
+
+HardwareSerial::HardwareSerial(ring_buffer *rx_buffer, tx_ring *tx_buffer,
+  volatile uint8_t *ubrrh, volatile uint8_t *ubrrl,
+  volatile uint8_t *ucsra, volatile uint8_t *ucsrb,
+  volatile uint8_t *udr,
+  uint8_t rxen, uint8_t txen, uint8_t rxcie, uint8_t udre, uint8_t u2x,
+  uint8_t udrie)
+{
+  _rx_buffer = rx_buffer;
+  _tx_buffer = tx_buffer;
+  _ubrrh = ubrrh;
+  _ubrrl = ubrrl;
+  _ucsra = ucsra;
+  _ucsrb = ucsrb;
+  _udr = udr;
+  _rxen = rxen;
+  _txen = txen;
+  _rxcie = rxcie;
+  _udre = udre;
+  _u2x = u2x;
+  _udrie = udrie;
+  _txBlocking = true;
+  _txDropped = 0;
+}
+
+void HardwareSerial::begin(long baud)
+{
+  _open(_rx_buffer);
+  _rx_buffer->baud = baud;
+}
+
+void HardwareSerial::end()
+{
+  flushTx();
+  if (_rx_buffer->stream) {
+    fflush(_rx_buffer->stream);
+  }
+}
+
+int HardwareSerial::available(void)
+{
+  _open(_rx_buffer);
+  _poll(_rx_buffer);
+  return _rx_buffer->rx.count();
+}
+
+int HardwareSerial::peek(void)
+{
+  unsigned char c;
+  if (!available() || !_rx_buffer->rx.peek(c)) {
+    return -1;
+  }
+  return c;
+}
+
+int HardwareSerial::read(void)
+{
+  unsigned char c;
+  if (!available() || !_rx_buffer->rx.pop(c)) {
+    return -1;
+  }
+  return c;
+}
+
+void HardwareSerial::flush()
+{
+  _rx_buffer->rx.clear();
+}
+
+void HardwareSerial::write(uint8_t c)
+{
+  tx_ring *tx = _tx_buffer;
+  _open(_rx_buffer);
+  if (_rx_buffer->baud > 0) {
+    // 10 bits per byte with the start and stop bits
+    uint64_t byteNs = 10000000000ULL/_rx_buffer->baud;
+    uint64_t now = HOSTmicros()*1000;
+    // The ring holds size-1 bytes, plus the byte in the data register
+    uint64_t fullNs = tx->size*byteNs;
+    if (tx->idleNs < now) {
+      tx->idleNs = now;
+    }
+    if (tx->idleNs - now >= fullNs) {
+      if (!_txBlocking) {
+        _txDropped++;
+        return;
+      }
+      HOSTadvance((tx->idleNs - now - fullNs + byteNs + 999)/1000);
+    }
+    tx->idleNs += byteNs;
+  }
+  putc_unlocked(c,_rx_buffer->stream);
+}
+
+/** The time on the wire is modelled per byte, so this is write(uint8_t) for each. */
+void HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  while (size--) {
+    write(*buffer++);
+  }
+}
+
+void HardwareSerial::_txInterrupt(void)
+{
+}
+
+void HardwareSerial::flushTx(void)
+{
+  uint64_t now = HOSTmicros()*1000;
+  if (_tx_buffer->idleNs > now) {
+    HOSTadvance((_tx_buffer->idleNs - now + 999)/1000);
+  }
+}
+
+void HardwareSerial::setTxBlocking(uint8_t blocking)
+{
+  _txBlocking = blocking;
+}
+
+uint16_t HardwareSerial::txDropped(void)
+{
+  return _txDropped;
+}
+
+HardwareSerial Serial(&rx_buffer, &tx_buffer, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+HardwareSerial Serial1(&rx_buffer1, &tx_buffer1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+HardwareSerial Serial2(&rx_buffer2, &tx_buffer2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+HardwareSerial Serial3(&rx_buffer3, &tx_buffer3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
@@ -0,0 +1,13 @@
+#ifndef HOST_AVR_DELAY_H
+#define HOST_AVR_DELAY_H
+
+/** @file delay.h
+ *  Host stand-in for avr/delay.h.
+ */
+
+#include "arduino/wiring.h"
+
+#define _delay_ms(ms) delay(ms)
+#define _delay_us(us) delayMicroseconds(us)
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+/** @file interrupt.h
+ *  Host stand-in for avr/interrupt.h.
+ *  Interrupts are always enabled on the host, sei() and cli() only track SREG_I.
+ */
+
+#include "avr/io.h"
+
+#define sei() (SREG |= _BV(SREG_I))
+#define cli() (SREG &= ~_BV(SREG_I))
+
+#ifdef __cplusplus
+#define ISR(vector) extern "C" void vector(void); void vector(void)
+#else
+#define ISR(vector) void vector(void); void vector(void)
+#endif
+
+#endif
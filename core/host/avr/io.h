@@ -0,0 +1,121 @@
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+/** @file io.h
+ *  Host stand-in for avr/io.h.
+ *  The I/O registers the firmware touches directly are plain variables
+ *  defined in host/hal.c so register level code compiles and runs unchanged.
+ */
+
+#include <stdint.h>
+#include "avr/sfr_defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile uint8_t SREG, MCUSR, CLKPR;
+extern volatile uint8_t SPCR, SPSR, SPDR;
+extern volatile uint8_t DDRB, PORTB, PINB;
+extern volatile uint8_t DDRH, PORTH, PINH;
+extern volatile uint8_t DDRL, PORTL, PINL;
+extern volatile uint8_t TCCR5A, TCCR5B, TIMSK5;
+extern volatile uint16_t TCNT5, OCR5A;
+extern volatile uint8_t ACSR, DIDR1;
+extern volatile uint8_t EECR, EEDR;
+extern volatile uint16_t EEAR;
+
+#ifdef __cplusplus
+}
+#endif
+
+// Last EEPROM address of the ATmega1280
+#define E2END 0x0FFF
+
+// SREG
+#define SREG_I 7
+
+// CLKPR
+#define CLKPCE 7
+#define CLKPS3 3
+#define CLKPS2 2
+#define CLKPS1 1
+#define CLKPS0 0
+
+// SPCR
+#define SPIE 7
+#define SPE 6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+
+// SPSR
+#define SPIF 7
+#define WCOL 6
+#define SPI2X 0
+
+#define DDB7 7
+#define DDB6 6
+#define DDB5 5
+#define DDB4 4
+#define DDB3 3
+#define DDB2 2
+#define DDB1 1
+#define DDB0 0
+#define PORTB7 7
+#define PORTB6 6
+#define PORTB5 5
+#define PORTB4 4
+#define PORTB3 3
+#define PORTB2 2
+#define PORTB1 1
+#define PORTB0 0
+#define PB7 7
+#define PB6 6
+#define PB5 5
+#define PB4 4
+#define PB3 3
+#define PB2 2
+#define PB1 1
+#define PB0 0
+
+#define DDH4 4
+#define DDH3 3
+#define PINH4 4
+#define PINH3 3
+
+#define DDL2 2
+#define PORTL2 2
+
+// Timer5
+#define WGM53 4
+#define WGM52 3
+#define CS52 2
+#define CS51 1
+#define CS50 0
+#define OCIE5A 1
+
+// Analog comparator
+#define ACD 7
+#define ACBG 6
+#define ACO 5
+#define ACI 4
+#define ACIE 3
+#define ACIC 2
+#define ACIS1 1
+#define ACIS0 0
+#define AIN1D 1
+#define AIN0D 0
+
+// EECR
+#define EEPM1 5
+#define EEPM0 4
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
+
+#endif
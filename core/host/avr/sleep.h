@@ -0,0 +1,20 @@
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+/** @file sleep.h
+ *  Host stand-in for avr/sleep.h. Sleeping lasts until the next check for
+ *  pin change interrupts.
+ */
+
+#include "hal.h"
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN 2
+
+#define set_sleep_mode(mode) do {} while (0)
+#define sleep_enable() do {} while (0)
+#define sleep_disable() do {} while (0)
+#define sleep_cpu() HOSTsleep()
+#define sleep_mode() HOSTsleep()
+
+#endif
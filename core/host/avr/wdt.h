@@ -0,0 +1,26 @@
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+/** @file wdt.h
+ *  Host stand-in for avr/wdt.h.
+ *  An expired watchdog restarts the host executable, see HOSTwdt().
+ */
+
+#include "host/hal.h"
+
+#define WDTO_15MS 0
+#define WDTO_30MS 1
+#define WDTO_60MS 2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+#define WDTO_4S 8
+#define WDTO_8S 9
+
+#define wdt_enable(value) HOSTwdt(15UL << (value))
+#define wdt_reset() HOSTwdtReset()
+#define wdt_disable() HOSTwdt(0)
+
+#endif
@@ -0,0 +1,153 @@
+/** @file eeprom.c
+ *  File backed EEPROM for the host build.
+ *
+ *  The EEMEM section is the EEPROM. At start up it is loaded from the image
+ *  file, or the file is created from the EEMEM initializers the same way the
+ *  .eep file programs a fresh board. Every write goes through to the file.
+ *  Only HOSTeepromProgram takes the time the EEPROM does.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "avr/io.h"
+#include "avr/eeprom.h"
+#include "arduino/wiring.h"
+#include "hal.h"
+
+/** Keeps the section in the image even when nothing else is in EEMEM. */
+static uint8_t _eepromStart EEMEM;
+
+extern uint8_t __start_telduino_eeprom[];
+extern uint8_t __stop_telduino_eeprom[];
+
+static int _fd = -1;
+
+void HOSTeepromInit(void)
+{
+    const char *path = getenv("TELDUINO_EEPROM");
+    size_t size = __stop_telduino_eeprom - __start_telduino_eeprom;
+    struct stat st;
+
+    (void)_eepromStart;
+    if (path == NULL) {
+        path = "telduino.eeprom";
+    }
+    _fd = open(path,O_RDWR | O_CREAT,0644);
+    if (_fd < 0) {
+        perror(path);
+        return;
+    }
+    if (fstat(_fd,&st) == 0 && (size_t)st.st_size == size
+            && pread(_fd,__start_telduino_eeprom,size,0) == (ssize_t)size) {
+        return;
+    }
+    if (st.st_size != 0) {
+        fprintf(stderr,"%s does not match this build's EEPROM layout, reprogramming\n",path);
+    }
+    if (ftruncate(_fd,0) != 0 || pwrite(_fd,__start_telduino_eeprom,size,0) != (ssize_t)size) {
+        perror(path);
+    }
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst,src,n);
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+    return *addr;
+}
+
+uint16_t eeprom_read_word(const uint16_t *addr)
+{
+    uint16_t v;
+    eeprom_read_block(&v,addr,sizeof(v));
+    return v;
+}
+
+uint32_t eeprom_read_dword(const uint32_t *addr)
+{
+    uint32_t v;
+    eeprom_read_block(&v,addr,sizeof(v));
+    return v;
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+    uint8_t *p = (uint8_t *)dst;
+    if (p < __start_telduino_eeprom || p + n > __stop_telduino_eeprom) {
+        fprintf(stderr,"EEPROM write outside of EEMEM\n");
+        return;
+    }
+    memmove(p,src,n);
+    if (_fd >= 0 && pwrite(_fd,src,n,p - __start_telduino_eeprom) != (ssize_t)n) {
+        perror("EEPROM");
+    }
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+    eeprom_write_block(&value,addr,sizeof(value));
+}
+
+void eeprom_write_word(uint16_t *addr, uint16_t value)
+{
+    eeprom_write_block(&value,addr,sizeof(value));
+}
+
+void eeprom_write_dword(uint32_t *addr, uint32_t value)
+{
+    eeprom_write_block(&value,addr,sizeof(value));
+}
+
+/** Only writes the bytes that differ, as avr-libc does to save EEPROM wear. */
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    for (size_t i=0; i < n; i++) {
+        if (d[i] != s[i]) {
+            eeprom_write_block(&s[i],&d[i],1);
+        }
+    }
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    eeprom_update_block(&value,addr,sizeof(value));
+}
+
+void eeprom_update_word(uint16_t *addr, uint16_t value)
+{
+    eeprom_update_block(&value,addr,sizeof(value));
+}
+
+void eeprom_update_dword(uint32_t *addr, uint32_t value)
+{
+    eeprom_update_block(&value,addr,sizeof(value));
+}
+
+/**
+ * What setting EEPE does with EEAR and EEDR in the programming mode of
+ * EECR's EEPM bits: erase only sets the byte to 0xFF, write only can just
+ * clear bits and both together write it. The byte changes once the time 
+ * the EEPROM takes has passed, so a power loss before then leaves it as it was.
+ * */
+void HOSTeepromProgram(uint8_t *addr, uint8_t value, uint8_t mode)
+{
+    uint8_t pm = mode & (_BV(EEPM1) | _BV(EEPM0));
+
+    delayMicroseconds(pm ? HOSTEESPLITUS : HOSTEEATOMICUS);
+    if (pm == _BV(EEPM0)) {
+        value = 0xFF;
+    } else if (pm == _BV(EEPM1)) {
+        value &= *addr;
+    }
+    eeprom_write_block(&value,addr,1);
+}
@@ -0,0 +1,503 @@
+/** @file hal.c
+ *  Host implementation of the Arduino core: clock, pins, interrupts, Timer5
+ *  and the watchdog. Replaces wiring.c, wiring_digital.c, wiring_analog.c,
+ *  WInterrupts.c and pins_arduino.c in the host build.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "arduino/wiring.h"
+#include "hal.h"
+#ifdef ADESIM
+#include "ADE7753/ADE7753sim.h"
+#include "Switches/switches.h"
+#include "Select/select.h"
+#endif
+
+volatile uint8_t SREG = _BV(SREG_I), MCUSR, CLKPR;
+volatile uint8_t SPCR, SPSR = _BV(SPIF), SPDR;
+volatile uint8_t DDRB, PORTB, PINB;
+// Card detect and write protect are active low, HOSTinit inserts the card.
+volatile uint8_t DDRH, PORTH, PINH = 0xFF;
+volatile uint8_t DDRL, PORTL, PINL;
+volatile uint8_t TCCR5A, TCCR5B, TIMSK5;
+volatile uint16_t TCNT5, OCR5A;
+volatile uint8_t ACSR, DIDR1;
+volatile uint8_t EECR, EEDR;
+volatile uint16_t EEAR;
+
+/** Defined by the firmware with ISR(). */
+extern void TIMER5_COMPA_vect(void) __attribute__((weak));
+extern void ANALOG_COMP_vect(void) __attribute__((weak));
+
+void (*HOSTpinHook)(uint8_t pin, uint8_t val) = 0;
+uint8_t (*HOSTpinReadHook)(uint8_t pin) = 0;
+uint8_t (*HOSTspiHook)(uint8_t mosi) = 0;
+
+static uint8_t _mode[HOSTNPINS];
+static uint8_t _level[HOSTNPINS];
+static void (*_isr[8])(void);
+static void (*_pcint[HOSTNPINS])(void);
+static uint8_t _pcintLevel[HOSTNPINS];
+static uint8_t _pcintAttached = 0;
+static uint8_t _inIsr = false;
+static uint64_t _pcintPollUs = 0;
+static uint64_t _timer5Us = 0;
+static uint8_t _timer5Running = false;
+
+static uint8_t _virtual = false;
+static uint64_t _virtualUs = 0;
+static uint32_t _spiNs = 0;
+static struct timespec _start;
+static uint64_t _runLimitUs = 0;
+static uint64_t _wdtTimeoutUs = 0;
+static uint64_t _wdtDeadlineUs = 0;
+/** When the supply starts to fall and when the board stops, 0 for never. */
+static uint64_t _powerFailUs = 0;
+static uint64_t _powerOffUs = 0;
+/**
+ * ACI as the chip keeps it. Writing 1 to ACI clears it there and writing 0
+ * leaves it alone, which a plain variable cannot tell apart, so the edge
+ * is latched here and ACSR's ACI only mirrors it.
+ * */
+static uint8_t _acPending = 0;
+
+static uint8_t _termSaved = false;
+static struct termios _term;
+
+static void _restoreTerminal(void)
+{
+    if (_termSaved) {
+        tcsetattr(STDIN_FILENO,TCSANOW,&_term);
+    }
+}
+
+/**
+ * Makes a terminal on stdin behave like the serial terminal on the real port:
+ * no line buffering, no local echo and Enter sends '\r'.
+ * */
+static void _rawTerminal(void)
+{
+    struct termios raw;
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO,&_term) != 0) {
+        return;
+    }
+    _termSaved = true;
+    atexit(_restoreTerminal);
+    raw = _term;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_iflag &= ~(ICRNL | INLCR);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO,TCSANOW,&raw);
+}
+
+#ifdef ADESIM
+/** The IRQ outputs of the simulated ADEs are open drain and wired-OR on shared pins. */
+static uint8_t _simPinRead(uint8_t pin)
+{
+    for (int8_t i=0; i < NCIRCUITS; i++) {
+        if (CSgetIrqPin(i) == pin && ADESIMirq(i)) {
+            return LOW;
+        }
+    }
+    return HIGH;
+}
+#endif
+
+void HOSTinit(void)
+{
+    const char *env;
+
+    clock_gettime(CLOCK_MONOTONIC,&_start);
+    env = getenv("TELDUINO_CLOCK");
+    _virtual = (env != NULL && strcmp(env,"virtual") == 0);
+    env = getenv("TELDUINO_RUN_MS");
+    if (env != NULL) {
+        _runLimitUs = strtoull(env,NULL,10)*1000ULL;
+    }
+    setvbuf(stdout,NULL,isatty(STDOUT_FILENO) ? _IONBF : _IOFBF,0);
+    _rawTerminal();
+    HOSTeepromInit();
+    env = getenv("TELDUINO_POWER_FAIL");
+    if (env != NULL) {
+        unsigned long at = 0, holdup = HOSTHOLDUPMS;
+        sscanf(env,"%lu,%lu",&at,&holdup);
+        _powerFailUs = at*1000ULL;
+        _powerOffUs = _powerFailUs + holdup*1000ULL;
+    }
+    env = getenv("TELDUINO_SD");
+    if (env != NULL) {
+        const char *mb = getenv("TELDUINO_SD_MB");
+        if (HOSTsdInit(env,mb ? strtoul(mb,NULL,10) : 256)) {
+            PINH &= ~_BV(3);
+        }
+    }
+
+#ifdef ADESIM
+    ADESIMinit();
+    ADESIMsetSwitchHook(SWisOn);
+    HOSTspiHook = ADESIMtransfer;
+    HOSTpinReadHook = _simPinRead;
+    env = getenv("TELDUINO_LINE");
+    if (env != NULL) {
+        float vrms = 230, irms = 0, phase = 0, freq = 50;
+        sscanf(env,"%f,%f,%f,%f",&vrms,&irms,&phase,&freq);
+        for (int8_t i=0; i < NCIRCUITS; i++) {
+            ADESIMsetWaveform(i,vrms,irms,phase,freq);
+        }
+    }
+    env = getenv("TELDUINO_ABSENT");
+    while (env != NULL && *env != '\0') {
+        char *end;
+        long chip = strtol(env,&end,10);
+        if (end == env) break;
+        ADESIMsetPresent(chip,false);
+        env = (*end == ',') ? end+1 : end;
+    }
+    env = getenv("TELDUINO_SCK_MAX");
+    if (env != NULL) {
+        for (int8_t i=0; i < NCIRCUITS; i++) {
+            ADESIMsetMaxClock(i,strtoul(env,NULL,10));
+        }
+    }
+#endif
+}
+
+uint8_t HOSTisVirtual(void)
+{
+    return _virtual;
+}
+
+/**
+ * Runs the pin change ISR of every attached pin whose level changed.
+ * Like the hardware ISRs they neither nest nor run while interrupts are disabled.
+ * */
+static void _pollPinChanges(void)
+{
+    if (_inIsr || !(SREG & _BV(SREG_I))) return;
+    _inIsr = true;
+    for (uint8_t pin=0; pin < HOSTNPINS; pin++) {
+        if (_pcint[pin] == NULL) continue;
+        uint8_t level = digitalRead(pin);
+        if (level != _pcintLevel[pin]) {
+            _pcintLevel[pin] = level;
+            _pcint[pin]();
+        }
+    }
+    _inIsr = false;
+}
+
+/**
+ * Runs the Timer5 compare A ISR when Timer5 is in CTC mode and OCR5A has 
+ * been reached. Interrupts that were missed while the ISR could not run 
+ * are merged into one like the interrupt flag does.
+ * */
+static void _pollTimer5(uint64_t now)
+{
+    static const uint16_t prescalers[] = {0, 1, 8, 64, 256, 1024, 0, 0};
+    uint16_t prescaler = prescalers[TCCR5B & 0x07];
+    uint64_t periodUs;
+
+    if (!prescaler || !(TCCR5B & _BV(WGM52)) || !(TIMSK5 & _BV(OCIE5A))) {
+        _timer5Running = false;
+        return;
+    }
+    if (!_timer5Running) {
+        _timer5Running = true;
+        _timer5Us = now;
+    }
+    periodUs = (OCR5A + 1ULL)*prescaler*1000000ULL/F_CPU;
+    if (periodUs == 0) periodUs = 1;
+    if (now - _timer5Us < periodUs || _inIsr || !(SREG & _BV(SREG_I))) return;
+    _timer5Us += (now - _timer5Us)/periodUs*periodUs;
+    if (TIMER5_COMPA_vect) {
+        _inIsr = true;
+        TIMER5_COMPA_vect();
+        _inIsr = false;
+    }
+}
+
+/**
+ * Raises the analog comparator output once the supply starts to fall, 
+ * which runs its ISR on the rising edge if it is enabled, and stops the 
+ * board when the supply is gone. What the firmware has not written to the 
+ * EEPROM by then is lost.
+ * */
+static void _pollPower(uint64_t now)
+{
+    if (!_powerFailUs || now < _powerFailUs) return;
+    if (now >= _powerOffUs) {
+        _powerFailUs = 0;
+        fprintf(stderr,"power lost\n");
+        HOSTexit(0);
+    }
+    if (!(ACSR & _BV(ACO))) {
+        ACSR |= _BV(ACO);
+        if ((ACSR & (_BV(ACIS1) | _BV(ACIS0))) != _BV(ACIS1)) {
+            _acPending = 1;
+        }
+    }
+    if (_acPending) ACSR |= _BV(ACI);
+    if (!_acPending || !(ACSR & _BV(ACIE)) || (ACSR & _BV(ACD))
+            || _inIsr || !(SREG & _BV(SREG_I))) {
+        return;
+    }
+    _acPending = 0;
+    ACSR &= ~_BV(ACI);
+    if (ANALOG_COMP_vect) {
+        _inIsr = true;
+        ANALOG_COMP_vect();
+        _inIsr = false;
+    }
+}
+
+/**
+ * @return microseconds since HOSTinit.
+ * Also where the run time limit and the watchdog are enforced.
+ * */
+uint64_t HOSTmicros(void)
+{
+    uint64_t now;
+    if (_virtual) {
+        now = ++_virtualUs;
+    } else {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC,&t);
+        now = (t.tv_sec - _start.tv_sec)*1000000ULL;
+        now += t.tv_nsec/1000 - _start.tv_nsec/1000;
+    }
+    if (_runLimitUs && now >= _runLimitUs) {
+        HOSTexit(0);
+    }
+    if (_wdtDeadlineUs && now >= _wdtDeadlineUs) {
+        fprintf(stderr,"watchdog reset\n");
+        HOSTreset();
+    }
+    if (_pcintAttached && now - _pcintPollUs >= HOSTPCINTUS) {
+        _pcintPollUs = now;
+        _pollPinChanges();
+    }
+    _pollTimer5(now);
+    _pollPower(now);
+    return now;
+}
+
+/** Advances the virtual clock. Has no effect on the real clock. */
+void HOSTadvance(uint32_t us)
+{
+    if (_virtual) {
+        _virtualUs += us;
+        HOSTmicros();
+    }
+}
+
+void HOSTexit(int status)
+{
+    fflush(NULL);
+    exit(status);
+}
+
+/**
+ *  Restarts the executable with the same arguments and environment,
+ *  the equivalent of a watchdog reset.
+ * */
+void HOSTreset(void)
+{
+    char cmdline[4096];
+    char *argv[64];
+    int argc = 0;
+    ssize_t n = 0;
+    int fd = open("/proc/self/cmdline",O_RDONLY);
+
+    if (fd >= 0) {
+        n = read(fd,cmdline,sizeof(cmdline)-1);
+        close(fd);
+    }
+    for (ssize_t i=0; i < n && argc < 63; i += strlen(&cmdline[i])+1) {
+        argv[argc++] = &cmdline[i];
+    }
+    argv[argc] = NULL;
+
+    fflush(NULL);
+    _restoreTerminal();
+    execv("/proc/self/exe",argv);
+    perror("reset");
+    exit(1);
+}
+
+void HOSTwdt(uint32_t timeoutms)
+{
+    _wdtTimeoutUs = timeoutms*1000ULL;
+    _wdtDeadlineUs = 0;
+    if (_wdtTimeoutUs) {
+        _wdtDeadlineUs = HOSTmicros() + _wdtTimeoutUs;
+    }
+}
+
+void HOSTwdtReset(void)
+{
+    if (_wdtTimeoutUs) {
+        _wdtDeadlineUs = HOSTmicros() + _wdtTimeoutUs;
+    }
+}
+
+/**
+ * Waits for an interrupt. Pin changes are only noticed every HOSTPCINTUS so 
+ * that is how long the virtual clock sleeps.
+ * */
+void HOSTsleep(void)
+{
+    if (_virtual) {
+        HOSTadvance(HOSTPCINTUS);
+    } else {
+        struct timespec t = {0, HOSTPCINTUS*1000L};
+        nanosleep(&t,NULL);
+        HOSTmicros();
+    }
+}
+
+/**
+ * Clocks a byte out on the SPI bus, charging the virtual clock for the
+ * 8 SCK periods at the divider currently set in SPCR/SPSR.
+ * */
+uint8_t HOSTspiTransfer(uint8_t mosi)
+{
+    static const uint8_t dividers[] = {4, 16, 64, 128};
+    uint32_t divider = dividers[SPCR & 0x03];
+    if (SPSR & _BV(SPI2X)) {
+        divider /= 2;
+    }
+    _spiNs += 8*divider*(1000000000UL/F_CPU);
+#ifdef ADESIM
+    ADESIMsetClock(F_CPU/divider);
+#endif
+    HOSTadvance(_spiNs/1000);
+    _spiNs %= 1000;
+
+    if (!(SPCR & _BV(SPE))) {
+        return 0xFF;
+    }
+    if (HOSTsdSelected()) {
+        return HOSTsdTransfer(mosi);
+    }
+    if (HOSTspiHook == NULL) {
+        return 0xFF;
+    }
+    return HOSTspiHook(mosi);
+}
+
+void init()
+{
+    HOSTinit();
+}
+
+unsigned long millis()
+{
+    return (uint32_t)(HOSTmicros()/1000);
+}
+
+unsigned long micros()
+{
+    return (uint32_t)HOSTmicros();
+}
+
+void delay(unsigned long ms)
+{
+    if (_virtual) {
+        HOSTadvance(ms*1000);
+    } else {
+        struct timespec t = {ms/1000, (ms%1000)*1000000L};
+        nanosleep(&t,NULL);
+        HOSTmicros();
+    }
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    if (_virtual) {
+        HOSTadvance(us);
+    } else {
+        struct timespec t = {0, us*1000L};
+        nanosleep(&t,NULL);
+        HOSTmicros();
+    }
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin < HOSTNPINS) {
+        _mode[pin] = mode;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin >= HOSTNPINS) return;
+    _level[pin] = val ? HIGH : LOW;
+    if (pin == HOSTSDSS) {
+        HOSTsdSelect(_level[pin] == LOW);
+    }
+    if (HOSTpinHook) {
+        HOSTpinHook(pin,_level[pin]);
+    }
+}
+
+int digitalRead(uint8_t pin)
+{
+    if (pin >= HOSTNPINS) return LOW;
+    if (_mode[pin] == INPUT && HOSTpinReadHook) {
+        return HOSTpinReadHook(pin);
+    }
+    return _level[pin];
+}
+
+int analogRead(uint8_t pin)
+{
+    return 0;
+}
+
+void analogReference(uint8_t mode)
+{
+}
+
+void analogWrite(uint8_t pin, int val)
+{
+    digitalWrite(pin,val >= 128);
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode)
+{
+    if (interruptNum < 8) {
+        _isr[interruptNum] = userFunc;
+    }
+}
+
+void detachInterrupt(uint8_t interruptNum)
+{
+    if (interruptNum < 8) {
+        _isr[interruptNum] = 0;
+    }
+}
+
+void attachPinChangeInterrupt(uint8_t pin, void (*userFunc)(void))
+{
+    if (pin < HOSTNPINS) {
+        _pcintLevel[pin] = digitalRead(pin);
+        _pcint[pin] = userFunc;
+        _pcintAttached = true;
+    }
+}
+
+void detachPinChangeInterrupt(uint8_t pin)
+{
+    if (pin < HOSTNPINS) {
+        _pcint[pin] = 0;
+    }
+}
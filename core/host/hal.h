@@ -0,0 +1,94 @@
+#ifndef HAL_H
+#define HAL_H
+
+/** @file hal.h
+ *  Hardware abstraction for running the firmware as a Linux executable.
+ *
+ *  `make host` compiles app/ and core/ against the headers in core/host
+ *  instead of avr-libc and links them with the host implementations of the
+ *  Arduino core (hal.c, eeprom.c, HostSerial.cpp). The hooks below are
+ *  the extension points for attaching models of the board's peripherals.
+ *
+ *  The executable is configured with environment variables:
+ *  - TELDUINO_CLOCK=virtual  time only advances with delay(), SPI and UART
+ *                            traffic, and 1us per clock read. Default is real time.
+ *  - TELDUINO_RUN_MS=n       exit after n ms of (virtual or real) time.
+ *                            Without it the executable exits when stdin closes.
+ *  - TELDUINO_EEPROM=path    EEPROM image file, default telduino.eeprom.
+ *  - TELDUINO_PTY=1          open a pty for each of Serial1-3 and print its name
+ *                            on stderr. Otherwise they are connected to /dev/null.
+ *  - TELDUINO_LINE=V,A,deg,Hz  line seen by every simulated ADE7753,
+ *                            default 230,0,0,50.
+ *  - TELDUINO_SCK_MAX=hz     SPI clock above which the simulated ADE7753s see
+ *                            bit errors, default no limit.
+ *  - TELDUINO_ABSENT=i,j,... simulated ADE7753s that are not plugged in.
+ *  - TELDUINO_SD=path        SD card image, see sdcard.c. Without it the slot
+ *                            is empty. A missing image is created with a FAT16
+ *                            partition of TELDUINO_SD_MB MiB, default 256.
+ *  - TELDUINO_SD_STATS=1     print the SD card's command and block counts on
+ *                            stderr at exit.
+ *  - TELDUINO_POWER_FAIL=ms[,holdup]  the supply starts to fall at ms, which
+ *                            raises the analog comparator output, and the board
+ *                            stops holdup ms later, default HOSTHOLDUPMS.
+ *
+ *  Serial is connected to stdin/stdout.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOSTNPINS 70
+/** Interval at which pin change interrupts are checked for. */
+#define HOSTPCINTUS 50
+/** SDSS of Select/select.h, the SD card's chip select. */
+#define HOSTSDSS 8
+/** Time the board runs on once the supply starts to fall. */
+#define HOSTHOLDUPMS 50
+/** Time the EEPROM takes to erase or to write a byte, and to do both. */
+#define HOSTEESPLITUS 1800
+#define HOSTEEATOMICUS 3400
+
+/** What the SD card model has been asked to do. */
+typedef struct {
+    uint32_t commands;
+    uint32_t blocksRead;
+    uint32_t blocksWritten;
+    uint32_t singleWrites;
+    uint32_t multiWrites;
+    uint32_t busyUs;
+} HOSTsdStats;
+
+extern HOSTsdStats HOSTsdStat;
+
+void HOSTinit(void);
+uint64_t HOSTmicros(void);
+void HOSTadvance(uint32_t us);
+uint8_t HOSTisVirtual(void);
+void HOSTexit(int status);
+void HOSTreset(void);
+void HOSTwdt(uint32_t timeoutms);
+void HOSTwdtReset(void);
+void HOSTsleep(void);
+uint8_t HOSTspiTransfer(uint8_t mosi);
+void HOSTeepromInit(void);
+void HOSTeepromProgram(uint8_t *addr, uint8_t value, uint8_t mode);
+uint8_t HOSTsdInit(const char *path, uint32_t mb);
+uint8_t HOSTsdSelected(void);
+void HOSTsdSelect(uint8_t selected);
+uint8_t HOSTsdTransfer(uint8_t mosi);
+
+/** Called after every digitalWrite. */
+extern void (*HOSTpinHook)(uint8_t pin, uint8_t val);
+/** Supplies digitalRead of pins configured as inputs. 
+ *  Also sampled for attachPinChangeInterrupt. */
+extern uint8_t (*HOSTpinReadHook)(uint8_t pin);
+/** Device on the far end of the SPI bus. Returns MISO for a MOSI byte. */
+extern uint8_t (*HOSTspiHook)(uint8_t mosi);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
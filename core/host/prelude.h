@@ -0,0 +1,20 @@
+#ifndef HOST_PRELUDE_H
+#define HOST_PRELUDE_H
+
+/** @file prelude.h
+ *  Included ahead of every file in the host build.
+ *  wiring.h defines min, max and abs as macros, which breaks the C++ headers
+ *  glibc pulls in from math.h and stdlib.h unless they are already included.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __cplusplus
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#endif
+
+#endif
@@ -0,0 +1,390 @@
+/** @file sdcard.c
+ *  SD card on the SPI bus of the host build, backed by an image file.
+ *
+ *  The card is an SDHC card, addressed in blocks, and answers the SPI mode
+ *  commands sd_raw uses: GO_IDLE_STATE, SEND_IF_COND, APP_CMD,
+ *  SD_SEND_OP_COND, READ_OCR, SET_BLOCKLEN, SEND_CSD, SEND_CID, SEND_STATUS,
+ *  READ_SINGLE_BLOCK, WRITE_SINGLE_BLOCK, WRITE_MULTIPLE_BLOCK with its stop
+ *  token and SET_WR_BLK_ERASE_COUNT. After a block is written the card holds
+ *  MISO low for a programming time measured with micros(), so waiting for it
+ *  costs what it does on a card.
+ *
+ *  A missing image is created with an MBR and a FAT16 partition, its
+ *  clusters as large as needed to stay below 32768 of them.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hal.h"
+
+#define SDBLOCK 512
+/** Programming times of a single block write, of each block of a multiple
+ *  block write and after its stop token, in us. */
+#define SDSINGLEUS 1500
+#define SDMULTIUS 300
+#define SDSTOPUS 500
+/** Partition start, aligned to 1 MiB like mkfs does. */
+#define SDPARTSTART 2048
+
+/** What the card does with the next byte clocked in. */
+enum {SDIDLE, SDCMD, SDOUT, SDWAITDATA, SDDATA, SDWAITMULTI};
+
+HOSTsdStats HOSTsdStat;
+
+static int _fd = -1;
+static uint32_t _blocks;
+static uint8_t _selected;
+static uint8_t _state = SDIDLE;
+static uint8_t _cmd[6];
+static uint8_t _cmdLen;
+/** Response, data token and block being sent, then _next. */
+static uint8_t _out[SDBLOCK + 8];
+static uint16_t _outLen;
+static uint16_t _outPos;
+static uint8_t _next;
+/** Data block being received with its CRC. */
+static uint8_t _data[SDBLOCK + 2];
+static uint16_t _dataLen;
+static uint32_t _block;
+static uint8_t _multi;
+static uint8_t _app;
+static uint8_t _idle = 1;
+static uint64_t _busyUntil;
+
+static void _put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void _put32(uint8_t *p, uint32_t v)
+{
+    _put16(p,v);
+    _put16(p+2,v >> 16);
+}
+
+/** Writes an MBR with one FAT16 partition over the whole image. */
+static int _format(uint32_t blocks)
+{
+    uint8_t b[SDBLOCK];
+    uint32_t sectors = blocks - SDPARTSTART;
+    uint8_t perCluster = 1;
+    uint32_t fatSectors;
+
+    while (sectors/perCluster > 32768) {
+        perCluster *= 2;
+    }
+    fatSectors = ((sectors/perCluster + 2)*2 + SDBLOCK - 1)/SDBLOCK;
+
+    memset(b,0,sizeof(b));
+    b[0x1BE + 4] = 0x06;
+    _put32(&b[0x1BE + 8],SDPARTSTART);
+    _put32(&b[0x1BE + 12],sectors);
+    b[510] = 0x55;
+    b[511] = 0xAA;
+    if (pwrite(_fd,b,SDBLOCK,0) != SDBLOCK) return -1;
+
+    memset(b,0,sizeof(b));
+    memcpy(b,"\xEB\x3C\x90TELDUINO",11);
+    _put16(&b[11],SDBLOCK);
+    b[13] = perCluster;
+    _put16(&b[14],1);                       // reserved sectors
+    b[16] = 2;                              // FATs
+    _put16(&b[17],512);                     // root directory entries
+    if (sectors < 0x10000) {
+        _put16(&b[19],sectors);
+    } else {
+        _put32(&b[32],sectors);
+    }
+    b[21] = 0xF8;
+    _put16(&b[22],fatSectors);
+    _put16(&b[24],63);
+    _put16(&b[26],255);
+    _put32(&b[28],SDPARTSTART);
+    b[36] = 0x80;
+    b[38] = 0x29;
+    memcpy(&b[43],"NO NAME    FAT16   ",19);
+    b[510] = 0x55;
+    b[511] = 0xAA;
+    if (pwrite(_fd,b,SDBLOCK,SDPARTSTART*(off_t)SDBLOCK) != SDBLOCK) return -1;
+
+    memset(b,0,sizeof(b));
+    memcpy(b,"\xF8\xFF\xFF\xFF",4);
+    for (int i = 0; i < 2; i++) {
+        off_t fat = (SDPARTSTART + 1 + i*(off_t)fatSectors)*SDBLOCK;
+        if (pwrite(_fd,b,SDBLOCK,fat) != SDBLOCK) return -1;
+    }
+    return 0;
+}
+
+static void _printStats(void)
+{
+    fprintf(stderr,"sd: %u commands, %u blocks read, %u blocks written in %u single "
+            "and %u multiple block writes, busy %u ms\n",HOSTsdStat.commands,
+            HOSTsdStat.blocksRead,HOSTsdStat.blocksWritten,HOSTsdStat.singleWrites,
+            HOSTsdStat.multiWrites,HOSTsdStat.busyUs/1000);
+}
+
+/**
+ * Inserts the card, creating a FAT16 image of mb MiB if path does not exist.
+ * @return false if there is no card.
+ * */
+uint8_t HOSTsdInit(const char *path, uint32_t mb)
+{
+    struct stat st;
+
+    _fd = open(path,O_RDWR | O_CREAT,0644);
+    if (_fd < 0 || fstat(_fd,&st) != 0) {
+        perror(path);
+        _fd = -1;
+        return 0;
+    }
+    if (st.st_size == 0) {
+        if (mb < 8) mb = 8;
+        _blocks = mb*2048;
+        if (ftruncate(_fd,(off_t)_blocks*SDBLOCK) != 0 || _format(_blocks) != 0) {
+            perror(path);
+            close(_fd);
+            _fd = -1;
+            return 0;
+        }
+    }
+    _blocks = st.st_size ? st.st_size/SDBLOCK : _blocks;
+    if (getenv("TELDUINO_SD_STATS") != NULL) {
+        atexit(_printStats);
+    }
+    return 1;
+}
+
+/** @return true if the card is inserted and selected, so it owns the bus. */
+uint8_t HOSTsdSelected(void)
+{
+    return _fd >= 0 && _selected;
+}
+
+/**
+ * Chip select. Deselecting abandons a command or a block in progress, but 
+ * not a multiple block write.
+ * */
+void HOSTsdSelect(uint8_t selected)
+{
+    _selected = selected;
+    if (!selected) {
+        _state = _multi ? SDWAITMULTI : SDIDLE;
+    }
+}
+
+static uint8_t _busy(void)
+{
+    return HOSTmicros() < _busyUntil;
+}
+
+static void _program(uint32_t us)
+{
+    _busyUntil = HOSTmicros() + us;
+    HOSTsdStat.busyUs += us;
+}
+
+/** Queues the NCR byte and an R1 response, then the card goes to state next. */
+static void _respond(uint8_t r1, uint8_t next)
+{
+    _out[0] = 0xFF;
+    _out[1] = r1;
+    _outLen = 2;
+    _outPos = 0;
+    _next = next;
+    _state = SDOUT;
+}
+
+/** Appends a data token, n bytes and a dummy CRC to the response. */
+static void _respondData(const uint8_t *data, uint16_t n)
+{
+    _out[_outLen++] = 0xFE;
+    memcpy(&_out[_outLen],data,n);
+    _outLen += n;
+    _out[_outLen++] = 0xFF;
+    _out[_outLen++] = 0xFF;
+}
+
+static void _command(void)
+{
+    uint8_t cmd = _cmd[0] & 0x3F;
+    uint32_t arg = ((uint32_t)_cmd[1] << 24) | ((uint32_t)_cmd[2] << 16)
+        | ((uint32_t)_cmd[3] << 8) | _cmd[4];
+    uint8_t app = _app;
+    uint8_t reg[16];
+
+    HOSTsdStat.commands++;
+    _app = 0;
+    switch (cmd) {
+        case 0:
+            _idle = 1;
+            _multi = 0;
+            _respond(0x01,SDIDLE);
+            break;
+        case 8:
+            _respond(_idle,SDIDLE);
+            _out[_outLen++] = 0x00;
+            _out[_outLen++] = 0x00;
+            _out[_outLen++] = (arg >> 8) & 0x0F;
+            _out[_outLen++] = arg;
+            break;
+        case 55:
+            _app = 1;
+            _respond(_idle,SDIDLE);
+            break;
+        case 1:
+        case 41:
+            _idle = 0;
+            _respond(0x00,SDIDLE);
+            break;
+        case 58:
+            _respond(_idle,SDIDLE);
+            memcpy(&_out[_outLen],"\xC0\xFF\x80\x00",4);
+            _outLen += 4;
+            break;
+        case 9:
+            // CSD version 2.0, C_SIZE is the capacity in 512 KiB less one
+            memset(reg,0,sizeof(reg));
+            reg[0] = 0x40;
+            reg[5] = 0x59;
+            reg[7] = ((_blocks/1024 - 1) >> 16) & 0x3F;
+            reg[8] = (_blocks/1024 - 1) >> 8;
+            reg[9] = _blocks/1024 - 1;
+            _respond(0x00,SDIDLE);
+            _respondData(reg,sizeof(reg));
+            break;
+        case 10:
+            memcpy(reg,"\x00TDHOSTC\x10\x00\x00\x00\x01\x00\xB1\x00",sizeof(reg));
+            _respond(0x00,SDIDLE);
+            _respondData(reg,sizeof(reg));
+            break;
+        case 13:
+            _respond(0x00,SDIDLE);
+            _out[_outLen++] = 0x00;
+            break;
+        case 16:
+        case 12:
+            _respond(0x00,SDIDLE);
+            break;
+        case 17:
+            if (arg >= _blocks) {
+                _respond(0x20,SDIDLE);
+                break;
+            }
+            _respond(0x00,SDIDLE);
+            _out[_outLen++] = 0xFE;
+            if (pread(_fd,&_out[_outLen],SDBLOCK,(off_t)arg*SDBLOCK) != SDBLOCK) {
+                memset(&_out[_outLen],0,SDBLOCK);
+            }
+            _outLen += SDBLOCK;
+            _out[_outLen++] = 0xFF;
+            _out[_outLen++] = 0xFF;
+            HOSTsdStat.blocksRead++;
+            break;
+        case 23:
+            // ACMD23 pre-erase, nothing to do for an image
+            _respond(app ? 0x00 : 0x04,SDIDLE);
+            break;
+        case 24:
+        case 25:
+            if (arg >= _blocks) {
+                _respond(0x20,SDIDLE);
+                break;
+            }
+            _block = arg;
+            _multi = (cmd == 25);
+            if (_multi) {
+                HOSTsdStat.multiWrites++;
+            } else {
+                HOSTsdStat.singleWrites++;
+            }
+            _respond(0x00,_multi ? SDWAITMULTI : SDWAITDATA);
+            break;
+        default:
+            _respond(0x04 | _idle,SDIDLE);
+            break;
+    }
+}
+
+/** Takes a received block and queues the data response. */
+static void _blockReceived(void)
+{
+    uint8_t response = 0x05;
+    if (_block >= _blocks || pwrite(_fd,_data,SDBLOCK,(off_t)_block*SDBLOCK) != SDBLOCK) {
+        response = 0x0D;
+    } else {
+        HOSTsdStat.blocksWritten++;
+    }
+    _block++;
+    _program(_multi ? SDMULTIUS : SDSINGLEUS);
+    _out[0] = response;
+    _outLen = 1;
+    _outPos = 0;
+    _next = _multi ? SDWAITMULTI : SDIDLE;
+    _state = SDOUT;
+}
+
+/** Clocks one byte through the card. @return MISO. */
+uint8_t HOSTsdTransfer(uint8_t mosi)
+{
+    uint8_t miso;
+
+    if (_fd < 0 || !_selected) {
+        return 0xFF;
+    }
+    switch (_state) {
+        case SDCMD:
+            _cmd[_cmdLen++] = mosi;
+            if (_cmdLen == sizeof(_cmd)) {
+                _command();
+            }
+            return 0xFF;
+        case SDOUT:
+            miso = _out[_outPos++];
+            if (_outPos >= _outLen) {
+                _state = _next;
+            }
+            return miso;
+        case SDWAITDATA:
+            if (mosi == 0xFE) {
+                _dataLen = 0;
+                _state = SDDATA;
+            }
+            return 0xFF;
+        case SDDATA:
+            _data[_dataLen++] = mosi;
+            if (_dataLen == sizeof(_data)) {
+                _blockReceived();
+            }
+            return 0xFF;
+        case SDWAITMULTI:
+            if (_busy()) {
+                return 0x00;
+            }
+            if (mosi == 0xFC) {
+                _dataLen = 0;
+                _state = SDDATA;
+            } else if (mosi == 0xFD) {
+                _multi = 0;
+                _program(SDSTOPUS);
+                _state = SDIDLE;
+            }
+            return 0xFF;
+        default:
+            if (_busy()) {
+                return 0x00;
+            }
+            if ((mosi & 0xC0) == 0x40) {
+                _cmd[0] = mosi;
+                _cmdLen = 1;
+                _state = SDCMD;
+            }
+            return 0xFF;
+    }
+}
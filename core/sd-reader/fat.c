@@ -485,6 +485,9 @@ cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster
  *
  * Set cluster_num to zero to create a completely new one.
  *
+ * The new clusters are chained in ascending order, so a chain allocated
+ * from free space in one go is contiguous on the device.
+ *
  * \param[in] fs The file system on which to operate.
  * \param[in] cluster_num The cluster to which to append the new chain.
  * \param[in] count The number of clusters to allocate.
@@ -500,7 +503,9 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
     offset_t fat_offset = fs->header.fat_offset;
     cluster_t count_left = count;
     cluster_t cluster_current = fs->cluster_free;
-    cluster_t cluster_next = 0;
+    /* first cluster of the new chain and the last one, whose entry is not yet written */
+    cluster_t cluster_first = 0;
+    cluster_t cluster_last = 0;
     cluster_t cluster_count;
     uint16_t fat_entry16;
 #if FAT_FAT32_SUPPORT
@@ -549,13 +554,10 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
                 break;
             }
 
-            /* allocate cluster */
-            if(cluster_next == 0)
-                fat_entry32 = HTOL32(FAT32_CLUSTER_LAST_MAX);
-            else
-                fat_entry32 = htol32(cluster_next);
-
-            if(!device_write(fat_offset + cluster_current * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
+            /* allocate cluster by linking the previous one to it */
+            fat_entry32 = htol32(cluster_current);
+            if(cluster_last &&
+               !device_write(fat_offset + cluster_last * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
                 break;
         }
         else
@@ -575,20 +577,38 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
                 break;
             }
 
-            /* allocate cluster */
-            if(cluster_next == 0)
-                fat_entry16 = HTOL16(FAT16_CLUSTER_LAST_MAX);
-            else
-                fat_entry16 = htol16((uint16_t) cluster_next);
-
-            if(!device_write(fat_offset + cluster_current * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
+            /* allocate cluster by linking the previous one to it */
+            fat_entry16 = htol16((uint16_t) cluster_current);
+            if(cluster_last &&
+               !device_write(fat_offset + cluster_last * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
                 break;
         }
 
-        cluster_next = cluster_current;
+        if(!cluster_first)
+            cluster_first = cluster_current;
+        cluster_last = cluster_current;
         --count_left;
     }
 
+    /* terminate the new chain */
+    if(cluster_last)
+    {
+#if FAT_FAT32_SUPPORT
+        if(is_fat32)
+        {
+            fat_entry32 = HTOL32(FAT32_CLUSTER_LAST_MAX);
+            if(!device_write(fat_offset + cluster_last * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
+                count_left = 1;
+        }
+        else
+#endif
+        {
+            fat_entry16 = HTOL16(FAT16_CLUSTER_LAST_MAX);
+            if(!device_write(fat_offset + cluster_last * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
+                count_left = 1;
+        }
+    }
+
     do
     {
         if(count_left > 0)
@@ -602,7 +622,7 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
 #if FAT_FAT32_SUPPORT
             if(is_fat32)
             {
-                fat_entry32 = htol32(cluster_next);
+                fat_entry32 = htol32(cluster_first);
 
                 if(!device_write(fat_offset + cluster_num * sizeof(fat_entry32), (uint8_t*) &fat_entry32, sizeof(fat_entry32)))
                     break;
@@ -610,21 +630,21 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
             else
 #endif
             {
-                fat_entry16 = htol16((uint16_t) cluster_next);
+                fat_entry16 = htol16((uint16_t) cluster_first);
 
                 if(!device_write(fat_offset + cluster_num * sizeof(fat_entry16), (uint8_t*) &fat_entry16, sizeof(fat_entry16)))
                     break;
             }
         }
 
-        return cluster_next;
+        return cluster_first;
 
     } while(0);
 
     /* No space left on device or writing error.
      * Free up all clusters already allocated.
      */
-    fat_free_clusters(fs, cluster_next);
+    fat_free_clusters(fs, cluster_first);
 
     return 0;
 }
@@ -1264,6 +1284,75 @@ uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whenc
     return 1;
 }
 
+/**
+ * \ingroup fat_file
+ * Maps the part of a file at the file position which is contiguous on the device.
+ *
+ * Finds where the data at the current file position lies on the device and
+ * how much of what follows is in clusters following each other, then moves
+ * the file position past it. The data can then be read or written with the
+ * device functions directly, without going through the FAT for every cluster.
+ * A file allocated in one go, e.g. with fat_resize_file() on an empty
+ * filesystem, is usually a single run.
+ *
+ * \param[in] fd The file handle of the file to map.
+ * \param[out] offset The device offset of the data at the file position.
+ * \param[in,out] length The number of bytes to map at most, on return the number mapped.
+ * \returns 0 on failure or at the end of the file, 1 on success.
+ * \see fat_seek_file
+ */
+uint8_t fat_next_extent(struct fat_file_struct* fd, offset_t* offset, uint32_t* length)
+{
+    if(!fd || !offset || !length || *length == 0 || fd->pos >= fd->dir_entry.file_size)
+        return 0;
+
+    uint16_t cluster_size = fd->fs->header.cluster_size;
+    uint16_t first_cluster_offset = (uint16_t) (fd->pos & (cluster_size - 1));
+    cluster_t cluster_num = fd->pos_cluster;
+
+    /* find cluster of the file position */
+    if(!cluster_num)
+    {
+        cluster_num = fd->dir_entry.cluster;
+        uint32_t pos = fd->pos;
+        while(cluster_num && pos >= cluster_size)
+        {
+            pos -= cluster_size;
+            cluster_num = fat_get_next_cluster(fd->fs, cluster_num);
+        }
+        if(!cluster_num)
+            return 0;
+    }
+    *offset = fat_cluster_offset(fd->fs, cluster_num) + first_cluster_offset;
+
+    /* extend over the clusters following on the device */
+    if(*length > fd->dir_entry.file_size - fd->pos)
+        *length = fd->dir_entry.file_size - fd->pos;
+    uint32_t extent = cluster_size - first_cluster_offset;
+    cluster_t cluster_next = 0;
+    while(extent < *length)
+    {
+        cluster_next = fat_get_next_cluster(fd->fs, cluster_num);
+        if(cluster_next != cluster_num + 1)
+            break;
+        cluster_num = cluster_next;
+        cluster_next = 0;
+        extent += cluster_size;
+    }
+    if(extent > *length)
+        extent = *length;
+    *length = extent;
+
+    /* remember the cluster of the new file position */
+    fd->pos += extent;
+    if(((first_cluster_offset + extent) & (cluster_size - 1)) == 0)
+        fd->pos_cluster = cluster_next ? cluster_next : fat_get_next_cluster(fd->fs, cluster_num);
+    else
+        fd->pos_cluster = cluster_num;
+
+    return 1;
+}
+
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_file
@@ -2359,6 +2448,23 @@ offset_t fat_get_fs_size(const struct fat_fs_struct* fs)
         return (offset_t) (fs->header.fat_size / 2 - 2) * fs->header.cluster_size;
 }
 
+/**
+ * \ingroup fat_fs
+ * Returns where on the device the allocation table in use lies.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[out] length The length of the table in bytes.
+ * \returns 0 on failure, the offset of the table otherwise.
+ */
+offset_t fat_get_fat_area(const struct fat_fs_struct* fs, uint32_t* length)
+{
+    if(!fs || !length)
+        return 0;
+
+    *length = fs->header.fat_size;
+    return fs->header.fat_offset;
+}
+
 /**
  * \ingroup fat_fs
  * Returns the amount of free storage capacity on the filesystem in bytes.
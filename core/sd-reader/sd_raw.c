@@ -11,6 +11,9 @@
 #include <string.h>
 #include <avr/io.h>
 #include "sd_raw.h"
+#ifdef HOST
+#include "host/hal.h"
+#endif
 
 /**
  * \addtogroup sd_raw MMC/SD/SDHC card raw access
@@ -86,6 +89,8 @@
 #define CMD_UNTAG_ERASE_GROUP 0x25
 /* CMD38: arg0[31:0]: stuff bits, response R1b */
 #define CMD_ERASE 0x26
+/* ACMD23: arg0[22:0]: number of blocks to pre-erase, response R1 */
+#define CMD_SET_WR_BLK_ERASE_COUNT 0x17
 /* ACMD41: arg0[31:0]: OCR contents, response R1 */
 #define CMD_SD_SEND_OP_COND 0x29
 /* CMD42: arg0[31:0]: stuff bits, response R1b */
@@ -138,6 +143,9 @@
 #define DR_STATUS_ACCEPTED 0x05
 #define DR_STATUS_CRC_ERR 0x0a
 #define DR_STATUS_WRITE_ERR 0x0c
+/* Data tokens of a multiple block write */
+#define TOKEN_WRITE_MULTIPLE 0xfc
+#define TOKEN_STOP_TRAN 0xfd
 
 /* status bits for card types */
 #define SD_RAW_SPEC_1 0
@@ -145,18 +153,37 @@
 #define SD_RAW_SPEC_SDHC 2
 
 #if !SD_RAW_SAVE_RAM
-/* static data buffer for acceleration */
-static uint8_t raw_block[512];
-/* offset where the data within raw_block lies on the card */
-static offset_t raw_block_address;
+/* static data buffers for acceleration */
+static uint8_t raw_cache[SD_RAW_CACHE_BLOCKS][512];
+/* offsets where the data within raw_cache lies on the card, -1 if unused */
+static offset_t raw_cache_address[SD_RAW_CACHE_BLOCKS];
+/* indices of raw_cache, the one used most recently first */
+static uint8_t raw_cache_order[SD_RAW_CACHE_BLOCKS];
 #if SD_RAW_WRITE_BUFFERING
-/* flag to remember if raw_block was written to the card */
-static uint8_t raw_block_written;
+/* bit i is set while raw_cache[i] was not written to the card */
+static uint8_t raw_cache_dirty;
+#endif
+/* range whose blocks are kept cached, see sd_raw_pin() */
+static offset_t raw_pin_offset;
+static offset_t raw_pin_length;
 #endif
+
+#if SD_RAW_WRITE_SUPPORT
+/* offset the open multiple block write continues at, -1 if there is none */
+static offset_t raw_stream_address = (offset_t) -1;
 #endif
 
+/* SPI settings of the card, the ADE7753s on the same bus set their own */
+static uint8_t raw_spcr;
+static uint8_t raw_spsr;
+
 void configure_pin_ss(){ initSelect(); }
-void select_card(){CSselectDevice(  SDCARD  );}
+void select_card()
+{
+    SPCR = raw_spcr;
+    SPSR = (SPSR & ~(1 << SPI2X)) | raw_spsr;
+    CSselectDevice(SDCARD);
+}
 void unselect_card(){CSselectDevice(DEVDISABLE);}
 
 
@@ -167,6 +194,16 @@ static uint8_t sd_raw_card_type;
 static void sd_raw_send_byte(uint8_t b);
 static uint8_t sd_raw_rec_byte();
 static uint8_t sd_raw_send_command(uint8_t command, uint32_t arg);
+#if !SD_RAW_SAVE_RAM
+static uint8_t sd_raw_read_block(offset_t block_address, uint8_t* buffer);
+static uint8_t sd_raw_cache_block(offset_t block_address, uint8_t fill);
+#endif
+#if SD_RAW_WRITE_SUPPORT
+static uint8_t sd_raw_write_block(offset_t block_address, const uint8_t* buffer);
+#endif
+#if SD_RAW_WRITE_BUFFERING
+static uint8_t sd_raw_cache_flush(uint8_t i);
+#endif
 
 /**
  * \ingroup sd_raw
@@ -198,6 +235,8 @@ uint8_t sd_raw_init()
            (1 << SPR1) | /* Clock Frequency: f_OSC / 128 */
            (1 << SPR0);
     SPSR &= ~(1 << SPI2X); /* No doubled clock frequency */
+    raw_spcr = SPCR;
+    raw_spsr = 0;
 
     /* initialization procedure */
     sd_raw_card_type = 0;
@@ -321,14 +360,23 @@ uint8_t sd_raw_init()
     /* switch to highest SPI frequency possible */
     SPCR &= ~((1 << SPR1) | (1 << SPR0)); /* Clock Frequency: f_OSC / 4 */
     SPSR |= (1 << SPI2X); /* Doubled Clock Frequency: f_OSC / 2 */
+    raw_spcr = SPCR;
+    raw_spsr = (1 << SPI2X);
 
 #if !SD_RAW_SAVE_RAM
-    /* the first block is likely to be accessed first, so precache it here */
-    raw_block_address = (offset_t) -1;
+    /* forget what was cached of the card that was here before */
+    for(uint8_t i = 0; i < SD_RAW_CACHE_BLOCKS; ++i)
+    {
+        raw_cache_address[i] = (offset_t) -1;
+        raw_cache_order[i] = i;
+    }
 #if SD_RAW_WRITE_BUFFERING
-    raw_block_written = 1;
+    raw_cache_dirty = 0;
 #endif
-    if(!sd_raw_read(0, raw_block, sizeof(raw_block)))
+    raw_pin_length = 0;
+
+    /* the first block is likely to be accessed first, so precache it here */
+    if(sd_raw_cache_block(0, 1) == SD_RAW_CACHE_BLOCKS)
         return 0;
 #endif
 
@@ -366,6 +414,10 @@ uint8_t sd_raw_locked()
  */
 void sd_raw_send_byte(uint8_t b)
 {
+#ifdef HOST
+    HOSTspiTransfer(b);
+    return;
+#endif
     SPDR = b;
     /* wait for byte to be shifted out */
     while(!(SPSR & (1 << SPIF)));
@@ -382,6 +434,9 @@ void sd_raw_send_byte(uint8_t b)
 uint8_t sd_raw_rec_byte()
 {
     /* send dummy data for receiving some */
+#ifdef HOST
+    return HOSTspiTransfer(0xff);
+#endif
     SPDR = 0xff;
     while(!(SPSR & (1 << SPIF)));
     SPSR &= ~(1 << SPIF);
@@ -458,16 +513,8 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
         if(read_length > length)
             read_length = length;
         
-#if !SD_RAW_SAVE_RAM
-        /* check if the requested data is cached */
-        if(block_address != raw_block_address)
-#endif
+#if SD_RAW_SAVE_RAM
         {
-#if SD_RAW_WRITE_BUFFERING
-            if(!sd_raw_sync())
-                return 0;
-#endif
-
             /* address card */
             select_card();
 
@@ -485,7 +532,6 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
             /* wait for data block (start byte 0xfe) */
             while(sd_raw_rec_byte() != 0xfe);
 
-#if SD_RAW_SAVE_RAM
             /* read byte block */
             uint16_t read_to = block_offset + read_length;
             for(uint16_t i = 0; i < 512; ++i)
@@ -494,16 +540,6 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
                 if(i >= block_offset && i < read_to)
                     *buffer++ = b;
             }
-#else
-            /* read byte block */
-            uint8_t* cache = raw_block;
-            for(uint16_t i = 0; i < 512; ++i)
-                *cache++ = sd_raw_rec_byte();
-            raw_block_address = block_address;
-
-            memcpy(buffer, raw_block + block_offset, read_length);
-            buffer += read_length;
-#endif
             
             /* read crc16 */
             sd_raw_rec_byte();
@@ -515,11 +551,14 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
             /* let card some time to finish */
             sd_raw_rec_byte();
         }
-#if !SD_RAW_SAVE_RAM
-        else
+#else
         {
-            /* use cached data */
-            memcpy(buffer, raw_block + block_offset, read_length);
+            /* use cached data, loading the block if it is not cached */
+            uint8_t i = sd_raw_cache_block(block_address, 1);
+            if(i == SD_RAW_CACHE_BLOCKS)
+                return 0;
+
+            memcpy(buffer, raw_cache[i] + block_offset, read_length);
             buffer += read_length;
         }
 #endif
@@ -531,6 +570,169 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
     return 1;
 }
 
+#if DOXYGEN || !SD_RAW_SAVE_RAM
+/**
+ * \ingroup sd_raw
+ * Reads a block from the card, bypassing the cache.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \param[out] buffer The buffer of 512 bytes into which to read the block.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_read_block(offset_t block_address, uint8_t* buffer)
+{
+#if SD_RAW_WRITE_SUPPORT
+    if(!sd_raw_write_stop())
+        return 0;
+#endif
+
+    /* address card */
+    select_card();
+
+    /* send single block request */
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+#else
+    if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, block_address))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* wait for data block (start byte 0xfe) */
+    while(sd_raw_rec_byte() != 0xfe);
+
+    /* read byte block */
+    for(uint16_t i = 0; i < 512; ++i)
+        *buffer++ = sd_raw_rec_byte();
+
+    /* read crc16 */
+    sd_raw_rec_byte();
+    sd_raw_rec_byte();
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Moves a cache block to the front of the least recently used order.
+ */
+static void sd_raw_cache_touch(uint8_t i)
+{
+    uint8_t j = 0;
+    while(raw_cache_order[j] != i)
+        ++j;
+    for(; j > 0; --j)
+        raw_cache_order[j] = raw_cache_order[j - 1];
+    raw_cache_order[0] = i;
+}
+
+/**
+ * \ingroup sd_raw
+ * Checks whether a block lies in the range given to sd_raw_pin().
+ */
+static uint8_t sd_raw_cache_pinned(offset_t block_address)
+{
+    return block_address != (offset_t) -1 && block_address - raw_pin_offset < raw_pin_length;
+}
+
+/**
+ * \ingroup sd_raw
+ * Picks the cache block to be reused for a block which is not cached.
+ *
+ * An unused cache block is taken first. Otherwise the least recently
+ * used pinned block is taken if pinned blocks would hold more than
+ * SD_RAW_CACHE_PINNED cache blocks, else the least recently used other one.
+ *
+ * \param[in] block_address The offset of the block to be cached.
+ * \returns The index into raw_cache.
+ */
+static uint8_t sd_raw_cache_victim(offset_t block_address)
+{
+    uint8_t pinned = sd_raw_cache_pinned(block_address);
+    for(uint8_t i = 0; i < SD_RAW_CACHE_BLOCKS; ++i)
+    {
+        if(raw_cache_address[i] == (offset_t) -1)
+            return i;
+        pinned += sd_raw_cache_pinned(raw_cache_address[i]);
+    }
+
+    uint8_t evict_pinned = (pinned > SD_RAW_CACHE_PINNED);
+    for(uint8_t j = SD_RAW_CACHE_BLOCKS; j-- > 0; )
+    {
+        uint8_t i = raw_cache_order[j];
+        if(sd_raw_cache_pinned(raw_cache_address[i]) == evict_pinned)
+            return i;
+    }
+    return raw_cache_order[SD_RAW_CACHE_BLOCKS - 1];
+}
+
+/**
+ * \ingroup sd_raw
+ * Finds the cache block holding a block, caching the block if needed.
+ *
+ * The cache block it replaces is written to the card first if it was
+ * changed.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \param[in] fill Whether to read the block from the card if it is not
+ *                 cached. If not, the caller overwrites all of it.
+ * \returns The index into raw_cache, or SD_RAW_CACHE_BLOCKS on failure.
+ */
+uint8_t sd_raw_cache_block(offset_t block_address, uint8_t fill)
+{
+    uint8_t i;
+    for(i = 0; i < SD_RAW_CACHE_BLOCKS; ++i)
+    {
+        if(raw_cache_address[i] == block_address)
+        {
+            sd_raw_cache_touch(i);
+            return i;
+        }
+    }
+
+    i = sd_raw_cache_victim(block_address);
+#if SD_RAW_WRITE_BUFFERING
+    if(!sd_raw_cache_flush(i))
+        return SD_RAW_CACHE_BLOCKS;
+#endif
+    raw_cache_address[i] = (offset_t) -1;
+    if(fill && !sd_raw_read_block(block_address, raw_cache[i]))
+        return SD_RAW_CACHE_BLOCKS;
+    raw_cache_address[i] = block_address;
+    sd_raw_cache_touch(i);
+
+    return i;
+}
+#endif
+
+/**
+ * \ingroup sd_raw
+ * Keeps the blocks of a range cached in preference to other blocks.
+ *
+ * Meant for the FAT, whose blocks are looked up over and over while a
+ * file is appended to, where data blocks are done with once they are
+ * full. How many cache blocks the range may hold is set by
+ * SD_RAW_CACHE_PINNED. sd_raw_init() forgets the range.
+ *
+ * \param[in] offset The offset of the range.
+ * \param[in] length The length of the range in bytes, 0 to pin nothing.
+ */
+void sd_raw_pin(offset_t offset, offset_t length)
+{
+#if !SD_RAW_SAVE_RAM
+    raw_pin_offset = offset;
+    raw_pin_length = length;
+#endif
+}
+
 /**
  * \ingroup sd_raw
  * Continuously reads units of \c interval bytes and calls a callback function.
@@ -688,74 +890,73 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
         /* Merge the data to write with the content of the block.
          * Use the cached block if available.
          */
-        if(block_address != raw_block_address)
-        {
-#if SD_RAW_WRITE_BUFFERING
-            if(!sd_raw_sync())
-                return 0;
-#endif
+        uint8_t i = sd_raw_cache_block(block_address, block_offset || write_length < 512);
+        if(i == SD_RAW_CACHE_BLOCKS)
+            return 0;
+        memcpy(raw_cache[i] + block_offset, buffer, write_length);
 
-            if(block_offset || write_length < 512)
-            {
-                if(!sd_raw_read(block_address, raw_block, sizeof(raw_block)))
-                    return 0;
-            }
-            raw_block_address = block_address;
+#if SD_RAW_WRITE_BUFFERING
+        raw_cache_dirty |= (1 << i);
+#else
+        if(!sd_raw_write_block(block_address, raw_cache[i]))
+        {
+            raw_cache_address[i] = (offset_t) -1;
+            return 0;
         }
+#endif
 
-        if(buffer != raw_block)
-        {
-            memcpy(raw_block + block_offset, buffer, write_length);
+        buffer += write_length;
+        offset += write_length;
+        length -= write_length;
+    }
 
-#if SD_RAW_WRITE_BUFFERING
-            raw_block_written = 0;
+    return 1;
+}
 
-            if(length == write_length)
-                return 1;
-#endif
-        }
+/**
+ * \ingroup sd_raw
+ * Writes a block to the card, bypassing the cache.
+ *
+ * \param[in] block_address The offset of the block, a multiple of 512.
+ * \param[in] buffer The 512 bytes of the block.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_write_block(offset_t block_address, const uint8_t* buffer)
+{
+    if(!sd_raw_write_stop())
+        return 0;
 
-        /* address card */
-        select_card();
+    /* address card */
+    select_card();
 
-        /* send single block request */
+    /* send single block request */
 #if SD_RAW_SDHC
-        if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+    if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
 #else
-        if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, block_address))
+    if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, block_address))
 #endif
-        {
-            unselect_card();
-            return 0;
-        }
-
-        /* send start byte */
-        sd_raw_send_byte(0xfe);
+    {
+        unselect_card();
+        return 0;
+    }
 
-        /* write byte block */
-        uint8_t* cache = raw_block;
-        for(uint16_t i = 0; i < 512; ++i)
-            sd_raw_send_byte(*cache++);
+    /* send start byte */
+    sd_raw_send_byte(0xfe);
 
-        /* write dummy crc16 */
-        sd_raw_send_byte(0xff);
-        sd_raw_send_byte(0xff);
+    /* write byte block */
+    for(uint16_t i = 0; i < 512; ++i)
+        sd_raw_send_byte(*buffer++);
 
-        /* wait while card is busy */
-        while(sd_raw_rec_byte() != 0xff);
-        sd_raw_rec_byte();
+    /* write dummy crc16 */
+    sd_raw_send_byte(0xff);
+    sd_raw_send_byte(0xff);
 
-        /* deaddress card */
-        unselect_card();
-
-        buffer += write_length;
-        offset += write_length;
-        length -= write_length;
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+    sd_raw_rec_byte();
 
-#if SD_RAW_WRITE_BUFFERING
-        raw_block_written = 1;
-#endif
-    }
+    /* deaddress card */
+    unselect_card();
 
     return 1;
 }
@@ -828,16 +1029,204 @@ uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length
 uint8_t sd_raw_sync()
 {
 #if SD_RAW_WRITE_BUFFERING
-    if(raw_block_written)
+    for(uint8_t i = 0; i < SD_RAW_CACHE_BLOCKS; ++i)
+    {
+        if(!sd_raw_cache_flush(i))
+            return 0;
+    }
+#endif
+    return 1;
+}
+#endif
+
+#if DOXYGEN || SD_RAW_WRITE_BUFFERING
+/**
+ * \ingroup sd_raw
+ * Writes a cache block to the card if it was changed since.
+ *
+ * \param[in] i The index into raw_cache.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_cache_flush(uint8_t i)
+{
+    if(!(raw_cache_dirty & (1 << i)))
         return 1;
-    if(!sd_raw_write(raw_block_address, raw_block, sizeof(raw_block)))
+    if(!sd_raw_write_block(raw_cache_address[i], raw_cache[i]))
+        return 0;
+    raw_cache_dirty &= ~(1 << i);
+
+    return 1;
+}
+#endif
+
+#if DOXYGEN || SD_RAW_WRITE_SUPPORT
+/**
+ * \ingroup sd_raw
+ * Opens a multiple block write of the card.
+ *
+ * The blocks are then sent one at a time with sd_raw_write_next(), which
+ * leaves the card programming in the background, and the write is finished
+ * by sd_raw_write_stop(). Unlike sd_raw_write() a block costs no command and
+ * the card may erase and program several blocks at once. In between the card
+ * is deselected, so other devices on the bus may be used. Any other access
+ * of the card which is not served by the cache stops the write first.
+ *
+ * \param[in] offset The offset of the first block, a multiple of 512.
+ * \param[in] count The number of blocks the card may pre-erase, 0 if unknown.
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_write_next, sd_raw_write_stop
+ */
+uint8_t sd_raw_write_start(offset_t offset, uint32_t count)
+{
+    if(sd_raw_locked() || (offset & 0x01ff) || !sd_raw_write_stop())
+        return 0;
+
+    select_card();
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* pre-erasing is optional, MMC cards do not know it */
+    if(count && (sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2))))
+    {
+        sd_raw_send_command(CMD_APP, 0);
+        sd_raw_send_command(CMD_SET_WR_BLK_ERASE_COUNT, count & 0x7fffff);
+    }
+
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_WRITE_MULTIPLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? offset / 512 : offset)))
+#else
+    if(sd_raw_send_command(CMD_WRITE_MULTIPLE_BLOCK, offset))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    unselect_card();
+    raw_stream_address = offset;
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Sends the next block of a multiple block write.
+ *
+ * Waits while the card is still programming the previous block, see
+ * sd_raw_busy(), but not for this one.
+ *
+ * \param[in] buffer The 512 bytes of the block.
+ * \returns 0 on failure, 1 on success. The write is stopped on failure.
+ * \see sd_raw_write_start
+ */
+uint8_t sd_raw_write_next(const uint8_t* buffer)
+{
+    if(raw_stream_address == (offset_t) -1)
         return 0;
-    raw_block_written = 1;
+
+    /* a cached copy of the block would be out of date */
+    for(uint8_t i = 0; i < SD_RAW_CACHE_BLOCKS; ++i)
+    {
+        if(raw_cache_address[i] != raw_stream_address)
+            continue;
+        raw_cache_address[i] = (offset_t) -1;
+#if SD_RAW_WRITE_BUFFERING
+        raw_cache_dirty &= ~(1 << i);
 #endif
+    }
+
+    select_card();
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    sd_raw_send_byte(TOKEN_WRITE_MULTIPLE);
+    for(uint16_t i = 0; i < 512; ++i)
+        sd_raw_send_byte(buffer[i]);
+
+    /* write dummy crc16 */
+    sd_raw_send_byte(0xff);
+    sd_raw_send_byte(0xff);
+
+    uint8_t response = sd_raw_rec_byte();
+
+    unselect_card();
+    sd_raw_rec_byte();
+
+    if((response & DR_STATUS_MASK) != (DR_STATUS_ACCEPTED & DR_STATUS_MASK))
+    {
+        sd_raw_write_stop();
+        return 0;
+    }
+    raw_stream_address += 512;
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Tells where the next block of the open multiple block write goes.
+ *
+ * A read the cache does not serve stops the write, so a caller asks this
+ * instead of remembering that it started one.
+ *
+ * \returns The offset of the next block, (offset_t) -1 if no write is open.
+ * \see sd_raw_write_start
+ */
+offset_t sd_raw_write_position()
+{
+    return raw_stream_address;
+}
+
+/**
+ * \ingroup sd_raw
+ * Finishes a multiple block write, if one is open.
+ *
+ * Waits until the card has programmed every block.
+ *
+ * \returns 0 on failure, 1 on success.
+ * \see sd_raw_write_start
+ */
+uint8_t sd_raw_write_stop()
+{
+    if(raw_stream_address == (offset_t) -1)
+        return 1;
+    raw_stream_address = (offset_t) -1;
+
+    select_card();
+
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+
+    sd_raw_send_byte(TOKEN_STOP_TRAN);
+
+    /* the card starts to signal busy one byte later */
+    sd_raw_rec_byte();
+    while(sd_raw_rec_byte() != 0xff);
+
+    unselect_card();
+    sd_raw_rec_byte();
+
     return 1;
 }
 #endif
 
+/**
+ * \ingroup sd_raw
+ * Checks whether the card is still programming a block.
+ *
+ * \returns 1 if the card is busy, 0 if it accepts the next command or block.
+ */
+uint8_t sd_raw_busy()
+{
+    select_card();
+    uint8_t busy = (sd_raw_rec_byte() != 0xff);
+    unselect_card();
+
+    return busy;
+}
+
 /**
  * \ingroup sd_raw
  * Reads informational data from the card.
@@ -858,6 +1247,11 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
     if(!info || !sd_raw_available())
         return 0;
 
+#if SD_RAW_WRITE_SUPPORT
+    if(!sd_raw_write_stop())
+        return 0;
+#endif
+
     memset(info, 0, sizeof(*info));
 
     select_card();
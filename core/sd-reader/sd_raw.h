@@ -139,6 +139,12 @@ uint8_t sd_raw_read_interval(offset_t offset, uint8_t* buffer, uintptr_t interva
 uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length);
 uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length, sd_raw_write_interval_handler_t callback, void* p);
 uint8_t sd_raw_sync();
+void sd_raw_pin(offset_t offset, offset_t length);
+uint8_t sd_raw_write_start(offset_t offset, uint32_t count);
+uint8_t sd_raw_write_next(const uint8_t* buffer);
+uint8_t sd_raw_write_stop();
+offset_t sd_raw_write_position();
+uint8_t sd_raw_busy();
 
 uint8_t sd_raw_get_info(struct sd_raw_info* info);
 
@@ -44,7 +44,34 @@ extern "C"
  *
  * \note This option has no effect when SD_RAW_WRITE_SUPPORT is 0.
  */
-#define SD_RAW_WRITE_BUFFERING 0
+#ifndef SD_RAW_WRITE_BUFFERING
+#define SD_RAW_WRITE_BUFFERING 1
+#endif
+
+/**
+ * \ingroup sd_raw_config
+ * Number of blocks held in the block cache.
+ *
+ * Appending to a file touches its data block, its directory entry and
+ * now and then its FAT block, so three blocks keep all of them cached.
+ * Each block costs 512 bytes of static RAM.
+ *
+ * \note This option has no effect when SD_RAW_SAVE_RAM is 1.
+ */
+#ifndef SD_RAW_CACHE_BLOCKS
+#define SD_RAW_CACHE_BLOCKS 3
+#endif
+
+/**
+ * \ingroup sd_raw_config
+ * Number of cached blocks kept for the range given to sd_raw_pin().
+ *
+ * Blocks of that range are evicted before other blocks only when they
+ * would hold more than this many cache blocks.
+ */
+#ifndef SD_RAW_CACHE_PINNED
+#define SD_RAW_CACHE_PINNED 1
+#endif
 
 /**
  * \ingroup sd_raw_config
@@ -138,6 +165,9 @@ extern "C"
 #undef SD_RAW_WRITE_BUFFERING
 #define SD_RAW_WRITE_BUFFERING 0
 #endif
+#if SD_RAW_CACHE_BLOCKS < 1 || SD_RAW_CACHE_BLOCKS > 8
+#error "SD_RAW_CACHE_BLOCKS must be 1 to 8"
+#endif
 
 #ifdef __cplusplus
 }
@@ -37,6 +37,7 @@
 #include "Circuit/circuit.h"
 #include "Circuit/calibration.h"
 
+#include "Cmd/cmd.h"
 #include "Strings/strings.h"
 
 #define verbose 1
@@ -52,120 +53,132 @@ void setupDefaultMode(int icid);
 void jobReadLVA(int icid);
 void jobReadRVA(int icid);
 void parseColumbia();
-String getValueForKey(String key, String commandString);
-void get_val(char *s, char *key, char *val);
-void meter(String commandString);
+void meter(char *commandString);
 void meter_test(char *s);
-void modem(String commandString);
+void modem(char *commandString);
 void readSheevaPort();
 void readTelitPort();
-void chooseDestination(String destination, String commandString);
+void chooseDestination(const char *destination, char *commandString);
 void turnOnTelit();
 
-/* Parses &-delimited 'key=val' pairs and stores
- * the value for 'key' in 'val'
+/** 
+ * @return the value of the integer key in the &-delimited 'key=val' pairs 
+ * of a job, or def if it is missing.
  */
-void get_val(char *s, char *key, char *val)
+static int32_t getIntValue(char *s, const char *key, int32_t def)
 {
-    char *substr, *eq, *p, c;
-    int i;
-
-    substr = strstr(s, key);
-    if (substr != NULL) {
-        eq = strchr(substr, '=');
-        if (eq != NULL) {
-            p = eq;
-            p++; // skip separator
-            i = 0;
-            c = *p;
-            while ((c != NULL) && (c != '\0') && (c != '&') && \
-                    (c != '\n') && (c != '\r')) {
-                val[i++] = *p++;
-                c = *p;
-            }
-            val[i] = '\0';
-        }
+    char val[12];
+    char *p = val;
+    int32_t v;
+    ifnsuccess(CMDgetValue(s,key,val,sizeof(val))) return def;
+    ifnsuccess(CMDparseInt(&p,&v)) return def;
+    return v;
+}
+
+static void printSwitch(int8_t cid)
+{
+    debugPort.print("switch ");
+    debugPort.print(cid, DEC);
+    if (SWisOn(cid)) {
+        debugPort.println(" is on");
+    } else {
+        debugPort.println(" is off");
     }
 }
 
-void meter_test(char *s)
+static void jobOn(CmdArgs *args)
+{
+    int8_t cid = getIntValue(args->rest,"cid",-1);
+    debugPort.println("execute con job");
+    SWset(cid,1);
+    printSwitch(cid);
+}
+
+static void jobOff(CmdArgs *args)
+{
+    int8_t cid = getIntValue(args->rest,"cid",-1);
+    debugPort.println("execute coff job");
+    SWset(cid,0);
+    printSwitch(cid);
+}
+
+static void jobReadRVACmd(CmdArgs *args)
+{
+    jobReadRVA(getIntValue(args->rest,"cid",-1));
+}
+
+static void jobReadLVACmd(CmdArgs *args)
+{
+    jobReadLVA(getIntValue(args->rest,"cid",-1));
+}
+
+static void jobModeRVA(CmdArgs *args)
+{
+    setupRVAMode(getIntValue(args->rest,"cid",-1));
+}
+
+static void jobModeLVA(CmdArgs *args)
 {
-    char job[8], s_cid[8];
-    int8_t cid;
+    setupLVAMode(getIntValue(args->rest,"cid",-1),getIntValue(args->rest,"linecyc",1000));
+}
 
-    // get job
-    get_val(s, "job", job);
-    // get cid
-    get_val(s, "cid", s_cid);
-    cid = atoi(s_cid); // could use strtod
+static void jobModeDefault(CmdArgs *args)
+{
+    setupDefaultMode(getIntValue(args->rest,"cid",-1));
+}
 
+static void jobChannel(CmdArgs *args)
+{
+    _testChannel = getIntValue(args->rest,"cid",-1);
+    displayChannelInfo();
+}
+
+static void jobTest(CmdArgs *args)
+{
+    testHardware();
+}
+
+static void jobReset(CmdArgs *args)
+{
+    wdt_enable((WDTO_4S));
+    debugPort.println("resetting in 4s.");
+}
+
+/** Jobs of cmp=mtr messages. The handlers get the whole message in args->rest. */
+static const CmdEntry meterJobs[] PROGMEM = {
+    {"con", "", jobOn},
+    {"coff", "", jobOff},
+    {"readRVA", "", jobReadRVACmd},
+    {"readLVA", "", jobReadLVACmd},
+    {"modeRVA", "", jobModeRVA},
+    {"modeLVA", "", jobModeLVA},
+    {"modeDefault", "", jobModeDefault},
+    {"c", "", jobChannel},
+    {"T", "", jobTest},
+    {"R", "", jobReset},
+};
+
+void meter_test(char *s)
+{
+    char job[CMDNAMESIZE] = "";
+    CmdArgs args;
+
+    CMDgetValue(s, "job", job, sizeof(job));
     if (verbose > 0) {
         debugPort.println();
         debugPort.println("entered void meter()");
         debugPort.print("executing job type:");
         debugPort.print(job);
         debugPort.print(", on circuit id:");
-        debugPort.println(cid);
+        debugPort.println(getIntValue(s,"cid",-1));
         debugPort.println();
     }
-
-    if (!strncmp(job, "con", 3)) {
-        debugPort.println("execute con job");
-        SWset(cid,1);
-        debugPort.print("switch ");
-        debugPort.print(cid, DEC);
-        if (SWisOn(cid)) {
-            debugPort.println(" is on");
-        } else {
-            debugPort.println(" is off");
-        }
-    }
-    else if (!strncmp(job, "coff", 4)) {
-        debugPort.println("execute coff job");
-        SWset(cid,0);
-        debugPort.print("switch ");
-        debugPort.print(cid, DEC);
-        if (SWisOn(cid)) {
-            debugPort.println(" is on");
-        } else {
-            debugPort.println(" is off");
-        }
-    }
-    else if (!strncmp(job, "readRVA", 7)) {
-        jobReadRVA(cid);
-    }
-    else if (!strncmp(job, "readLVA", 7)) {
-        jobReadLVA(cid);
-    }
-    else if (!strncmp(job, "modeRVA", 7)) {
-        setupRVAMode(cid);
-    }
-    else if (!strncmp(job, "modeLVA", 7)) {
-        int32_t line_cycle = 1000;
-        char s_line_cycle[8];
-        get_val(s, "linecyc", s_line_cycle);
-        line_cycle = atoi(s_line_cycle); // could use strtod
-        setupLVAMode(cid, line_cycle);
-    }
-    else if (!strncmp(job, "modeDefault", 11)) {
-        setupDefaultMode(cid);
-    }
-    else if (!strncmp(job, "c", 1)) {
-        _testChannel = cid;
-        displayChannelInfo();		
-    }
-    else if (!strncmp(job, "T", 1)) {
-        testHardware();
-    }
-    else if (!strncmp(job, "R", 1)) {
-        wdt_enable((WDTO_4S));
-        debugPort.println("resetting in 4s.");
-    }
+    CMDexec(meterJobs, CMDCOUNT(meterJobs), job, s, &args);
 }
 
 /**
  *	this function reads the telitPort (Serial3) for incoming commands
- *	and returns them as String objects.
+ *	and forwards them to the debug and sheeva ports.
  */
 void readTelitPort() {
     uint32_t startTime = millis();
@@ -182,17 +195,17 @@ void readTelitPort() {
     }
 }
 
-void chooseDestination(String destination, String commandString) {
+void chooseDestination(const char *destination, char *commandString) {
     /**
      *	based on the value for the cmp key, this calls the function
      *	meter if cmp=mtr
      *	and
      *  modem if cmp=mdm
      */
-    if (destination == "mtr") {
+    if (!strcmp(destination, "mtr")) {
         meter(commandString);
     }
-    else if (destination == "mdm") {
+    else if (!strcmp(destination, "mdm")) {
         modem(commandString);
     }
 }
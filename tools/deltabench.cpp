@@ -0,0 +1,277 @@
+/** @file deltabench.cpp
+ *  Compares the sizes of the meter mode report encodings on recorded logs.
+ *
+ *  Usage: deltabench log...
+ *
+ *  A log holds one report per line, either as meter mode text reports
+ *      ts,seq,CID:id,SWONs,LABEL:value,...,status
+ *  or as in testResults/repeatability.csv
+ *      ts,seq,id,s,LABEL,value,...,status
+ *  Other lines are skipped. Every report is encoded as
+ *      ascii    the text report of the same fields with "\r\n"
+ *      fields   a framed RECFIELDS record (M 0 4)
+ *      delta    a framed RECDELTA record per report (M 0 5, one circuit a sweep)
+ *      batched  RECDELTA records filled up to FRMAXRECORD, e.g. several
+ *               circuits a sweep or reports collected for an upload
+ *  and the delta records are decoded again to check they give the reports back.
+ *
+ *  Build with `make tools`.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "Frame/frame.h"
+#include "Frame/records.h"
+#include "Frame/delta.h"
+
+#define CFSW 0x0001
+
+static const char *const labels[DLNFIELDS] = {
+    "VRMS", "IRMS", "VPEAK", "IPEAK", "PERIOD", "VA", "W", "VAE", "WE", "PF",
+    "WH", "WHX", "VAH", NULL
+};
+static const uint8_t fieldSizes[DLNFIELDS] = {4, 4, 4, 4, 2, 4, 4, 4, 4, 2, 8, 8, 8, 2};
+
+struct Totals {
+    unsigned long reports;
+    unsigned long ascii;
+    unsigned long fields;
+    unsigned long delta;
+    unsigned long batched;
+    unsigned long mismatches;
+};
+
+/** The encoder and decoder state of a log, by circuitID. */
+struct Codec {
+    DLencoder enc[DLIDMASK+1];
+    DLdecoder dec[DLIDMASK+1];
+    uint8_t frames;
+    uint8_t batch[FRMAXRECORD];
+    uint8_t batchLen;
+    DLreport pending[FRMAXRECORD];
+    uint8_t npending;
+};
+
+/** @return the field index of label or -1. */
+static int fieldIndex(const char *label)
+{
+    for (int i = 0; i < DLNFIELDS; i++) {
+        if (labels[i] != NULL && strcmp(label,labels[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static int isNumber(const char *s)
+{
+    char *end;
+    strtoll(s,&end,10);
+    return *s != '\0' && *end == '\0';
+}
+
+/** @return false if line is not a report. */
+static int parseReport(char *line, DLreport *r)
+{
+    char *tok[64];
+    int n = 0;
+    int i;
+
+    line[strcspn(line,"\r\n")] = '\0';
+    for (char *t = strtok(line,","); t != NULL && n < 64; t = strtok(NULL,",")) {
+        tok[n++] = t;
+    }
+    if (n < 4 || !isNumber(tok[0]) || !isNumber(tok[1])) return 0;
+    memset(r,0,sizeof(*r));
+    r->time = strtoul(tok[0],NULL,10);
+    r->seq = strtoul(tok[1],NULL,10);
+
+    if (strncmp(tok[2],"CID:",4) == 0) {
+        r->circuitID = atoi(tok[2]+4);
+        for (i = 3; i < n; i++) {
+            char *colon = strchr(tok[i],':');
+            if (strncmp(tok[i],"SWON",4) == 0) {
+                r->fields |= CFSW;
+                r->on = atoi(tok[i]+4) != 0;
+            } else if (colon != NULL) {
+                int f;
+                *colon = '\0';
+                if ((f = fieldIndex(tok[i])) < 0) return 0;
+                r->fields |= DLFIELD(f);
+                r->v[f] = strtoll(colon+1,NULL,10);
+            } else if (i == n-1) {
+                r->fields |= DLFIELD(DLNFIELDS-1);
+                r->v[DLNFIELDS-1] = strtoll(tok[i],NULL,16);
+            } else {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    if (!isNumber(tok[2]) || !isNumber(tok[3])) return 0;
+    r->circuitID = atoi(tok[2]);
+    r->on = atoi(tok[3]) != 0;
+    r->fields = CFSW;
+    for (i = 4; i+1 < n; i += 2) {
+        int f = fieldIndex(tok[i]);
+        if (f < 0) return 0;
+        r->fields |= DLFIELD(f);
+        r->v[f] = strtoll(tok[i+1],NULL,10);
+    }
+    if (i == n-1) {
+        r->fields |= DLFIELD(DLNFIELDS-1);
+        r->v[DLNFIELDS-1] = strtoll(tok[i],NULL,16);
+    }
+    return 1;
+}
+
+/** @return the length of the text report of r with its line ending. */
+static int asciiSize(const DLreport *r)
+{
+    char line[512];
+    int n = snprintf(line,sizeof(line),"%" PRIu32 ",%" PRIu32 ",CID:%d",r->time,r->seq,r->circuitID);
+    if (r->fields & CFSW) {
+        n += snprintf(&line[n],sizeof(line)-n,",SWON%d",r->on);
+    }
+    for (int i = 0; i < DLNFIELDS; i++) {
+        if (!(r->fields & DLFIELD(i))) continue;
+        if (labels[i] == NULL) {
+            n += snprintf(&line[n],sizeof(line)-n,",%" PRIX64,(uint64_t)r->v[i]);
+        } else {
+            n += snprintf(&line[n],sizeof(line)-n,",%s:%" PRId64,labels[i],r->v[i]);
+        }
+    }
+    return n + 2;
+}
+
+static int fieldsSize(const DLreport *r)
+{
+    int n = RECFIELDSMIN;
+    for (int i = 0; i < DLNFIELDS; i++) {
+        if (r->fields & DLFIELD(i)) n += fieldSizes[i];
+    }
+    return FRSIZE(n);
+}
+
+static int sameReport(const DLreport *a, const DLreport *b)
+{
+    if (a->circuitID != b->circuitID || a->fields != b->fields || a->seq != b->seq
+            || a->time != b->time || ((a->fields & CFSW) && a->on != b->on)) {
+        return 0;
+    }
+    for (int i = 0; i < DLNFIELDS; i++) {
+        if ((a->fields & DLFIELD(i)) && a->v[i] != b->v[i]) return 0;
+    }
+    return 1;
+}
+
+/** Frames the batch, decodes it again and compares it to the reports that went in. */
+static void flushBatch(Codec *c, Totals *t)
+{
+    uint8_t frame[FRSIZE(FRMAXRECORD)];
+    uint8_t rec[FRSIZE(FRMAXRECORD)];
+    uint8_t n;
+    int16_t len, in;
+
+    if (c->batchLen == 0) return;
+    n = FRencode(c->batch,c->batchLen,frame);
+    t->batched += n;
+    len = FRdecode(frame,n-1,rec);
+    for (in = RECDELTAMIN, c->npending = 0; len > 0 && in < len; c->npending++) {
+        DLdecoder *d = &c->dec[rec[in] & DLIDMASK];
+        DLreport r;
+        int16_t elen = DLdecode(d,&rec[in],len - in,&r);
+        if (elen < 0 || d->state != DLVALID || !sameReport(&r,&c->pending[c->npending])) {
+            t->mismatches++;
+            if (elen < 0) break;
+        }
+        in += elen;
+    }
+    c->batchLen = 0;
+    c->npending = 0;
+}
+
+static void bench(FILE *in, Totals *t)
+{
+    static Codec batched, single;
+    char line[1024];
+    DLreport r;
+
+    memset(&batched,0,sizeof(batched));
+    memset(&single,0,sizeof(single));
+    while (fgets(line,sizeof(line),in) != NULL) {
+        uint8_t entry[DLMAXENTRY];
+        uint8_t rec[RECDELTAMIN + DLMAXENTRY];
+        uint8_t n;
+
+        if (!parseReport(line,&r)) continue;
+        r.circuitID &= DLIDMASK;
+        t->reports++;
+        t->ascii += asciiSize(&r);
+        t->fields += fieldsSize(&r);
+
+        n = DLencode(&single.enc[r.circuitID],&r,entry);
+        rec[0] = RECDELTA;
+        rec[1] = single.frames++;
+        memcpy(&rec[RECDELTAMIN],entry,n);
+        t->delta += FRSIZE(RECDELTAMIN + n);
+
+        n = DLencode(&batched.enc[r.circuitID],&r,entry);
+        if (batched.batchLen + n > FRMAXRECORD) {
+            flushBatch(&batched,t);
+        }
+        if (batched.batchLen == 0) {
+            batched.batch[0] = RECDELTA;
+            batched.batch[1] = batched.frames++;
+            batched.batchLen = RECDELTAMIN;
+        }
+        memcpy(&batched.batch[batched.batchLen],entry,n);
+        batched.batchLen += n;
+        batched.pending[batched.npending++] = r;
+    }
+    flushBatch(&batched,t);
+}
+
+static void printTotals(const char *name, const Totals *t)
+{
+    printf("%-40s %7lu %9lu %9lu %9lu %9lu %6.1fx %6.1fx %s\n", name, t->reports,
+            t->ascii, t->fields, t->delta, t->batched,
+            t->delta ? (double)t->ascii/t->delta : 0.0,
+            t->batched ? (double)t->ascii/t->batched : 0.0,
+            t->mismatches ? "MISMATCH" : "ok");
+}
+
+int main(int argc, char *argv[])
+{
+    Totals all;
+    memset(&all,0,sizeof(all));
+
+    if (argc < 2) {
+        fprintf(stderr,"usage: %s log...\n",argv[0]);
+        return 2;
+    }
+    printf("%-40s %7s %9s %9s %9s %9s %7s %7s\n", "log", "reports", "ascii",
+            "fields", "delta", "batched", "delta", "batched");
+    for (int i = 1; i < argc; i++) {
+        Totals t;
+        FILE *in = fopen(argv[i],"r");
+        if (in == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        memset(&t,0,sizeof(t));
+        bench(in,&t);
+        fclose(in);
+        printTotals(argv[i],&t);
+        all.reports += t.reports;
+        all.ascii += t.ascii;
+        all.fields += t.fields;
+        all.delta += t.delta;
+        all.batched += t.batched;
+        all.mismatches += t.mismatches;
+    }
+    printTotals("total",&all);
+    return all.mismatches ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+/** @file formatbench.cpp
+ *  Times the text report path on the host: a meter mode report line printed
+ *  with the Print code as it was before Format/format.h, three calls and one
+ *  division per digit, against the current Print into a Line.
+ *
+ *  Usage: formatbench [lines]
+ *
+ *  Both print to a sink that queues every byte in a ring like the UART does,
+ *  and their output is compared. Besides the time per line it counts the
+ *  divisions and the writes into the sink per line. The host divides in a
+ *  few cycles where the AVR takes several hundred, so the time printed here
+ *  is mostly the calls and the AVR gains far more than the host.
+ *
+ *  Build with `make tools`.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arduino/Print.h"
+#include "Format/Line.h"
+#include "Format/format.h"
+
+/** Queues bytes in a ring like HardwareSerial and keeps a copy to compare. */
+class Sink : public Print
+{
+  public:
+    Sink() : head(0), n(0), calls(0) {}
+    virtual void write(uint8_t c)
+    {
+        calls++;
+        ring[head++ & 0xFF] = c;
+        if (n < sizeof(copy)) copy[n++] = c;
+    }
+    virtual void write(const uint8_t *buffer, size_t size)
+    {
+        calls++;
+        for (size_t i = 0; i < size; i++) {
+            ring[head++ & 0xFF] = buffer[i];
+        }
+        if (n + size <= sizeof(copy)) {
+            memcpy(&copy[n],buffer,size);
+            n += size;
+        }
+    }
+    void reset() { n = 0; }
+
+    volatile uint8_t ring[256];
+    uint32_t head;
+    char copy[4096];
+    size_t n;
+    uint32_t calls;
+};
+
+#define OLD __attribute__((noinline))
+
+/**
+ * Print as it was, kept here as the reference. The calls stay out of line as
+ * they are when Print.cpp is its own translation unit.
+ * */
+class OldPrint
+{
+  public:
+    OldPrint(Print *out) : divisions(0), _out(out) {}
+
+    OLD void write(uint8_t c) { _out->write(c); }
+    OLD void write(const char *str) { while (*str) write(*str++); }
+    OLD void print(const char str[]) { write(str); }
+    OLD void print(char c, int base = 0) { print((long)c,base); }
+    OLD void print(long n, int base = 10)
+    {
+        if (base == 0) {
+            write(n);
+        } else if (base == 10) {
+            if (n < 0) {
+                print('-');
+                n = -n;
+            }
+            printNumber(n,10);
+        } else {
+            printNumber(n,base);
+        }
+    }
+    OLD void print(unsigned long n, int base = 10)
+    {
+        if (base == 0) write(n);
+        else printNumber(n,base);
+    }
+    OLD void print(unsigned long long n, int base = 10)
+    {
+        if (base == 0) write(n);
+        else printNumber64(n,base);
+    }
+    OLD void println() { print('\r'); print('\n'); }
+
+    uint32_t divisions;
+
+  private:
+    OLD void printNumber(unsigned long n, uint8_t base)
+    {
+        unsigned char buf[8 * sizeof(long)];
+        unsigned long i = 0;
+        if (n == 0) {
+            print('0');
+            return;
+        }
+        while (n > 0) {
+            buf[i++] = n % base;
+            n /= base;
+            divisions++;
+        }
+        for (; i > 0; i--) {
+            print((char)(buf[i-1] < 10 ? '0' + buf[i-1] : 'A' + buf[i-1] - 10));
+        }
+    }
+    OLD void printNumber64(unsigned long long n, uint8_t base)
+    {
+        if (n == (uint32_t)n) {
+            printNumber((unsigned long)n,base);
+            return;
+        }
+        unsigned char buf[8 * sizeof(long long)];
+        unsigned long i = 0;
+        while (n > 0) {
+            buf[i++] = n % base;
+            n /= base;
+            divisions++;
+        }
+        for (; i > 0; i--) {
+            print((char)(buf[i-1] < 10 ? '0' + buf[i-1] : 'A' + buf[i-1] - 10));
+        }
+    }
+
+    Print *_out;
+};
+
+struct Report {
+    unsigned long time, seq;
+    long id, on, VRMS, IRMS, periodus, W, WE;
+    unsigned long long Wh, Whx, VAh;
+    unsigned long status;
+};
+
+/** The print calls of printSnapshot and CprintFields for CFDEFAULT. */
+template <class P>
+static void printReport(P &out, const Report &r)
+{
+    out.print(r.time); out.print(",");
+    out.print(r.seq); out.print(",");
+    out.print("CID:"); out.print(r.id);
+    out.print(",SWON"); out.print(r.on);
+    out.print(",VRMS:"); out.print(r.VRMS);
+    out.print(",IRMS:"); out.print(r.IRMS);
+    out.print(",PERIOD:"); out.print(r.periodus);
+    out.print(",W:"); out.print(r.W);
+    out.print(",WE:"); out.print(r.WE);
+    out.print(",WH:"); out.print(r.Wh);
+    out.print(",WHX:"); out.print(r.Whx);
+    out.print(",VAH:"); out.print(r.VAh);
+    out.print(","); out.print(r.status,16);
+    out.println();
+}
+
+static void makeReport(Report *r, uint32_t i)
+{
+    static uint32_t lcg = 12345;
+    lcg = lcg*1103515245 + 12345;
+    r->time = 1000*i + (lcg >> 28);
+    r->seq = i;
+    r->id = i & 1;
+    r->on = (lcg >> 8) & 1;
+    r->VRMS = 558400 + (lcg >> 22);
+    r->IRMS = (lcg >> 10) & 0x1FFFFF;
+    r->periodus = 19990 + ((lcg >> 4) & 0xF);
+    r->W = (long)((lcg >> 12) & 0x3FFF) - 200;
+    r->WE = r->W;
+    r->Wh = 1750ULL*i;
+    r->Whx = (i & 7) ? 0 : 5000000000ULL + i;
+    r->VAh = 2020ULL*i;
+    r->status = (lcg & 0x30) | 0x14;
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t lines = (argc > 1) ? strtoul(argv[1],NULL,10) : 200000;
+    Sink oldSink, newSink;
+    OldPrint oldOut(&oldSink);
+    Report r;
+    double t0, tOld, tNew;
+    uint32_t mismatches = 0;
+    uint32_t newDivisions = 0;
+    uint32_t divOld, callsOld, callsNew;
+
+    // Same output
+    for (uint32_t i = 0; i < 1000; i++) {
+        makeReport(&r,i);
+        oldSink.reset();
+        newSink.reset();
+        printReport(oldOut,r);
+        {
+            Line<128> line(&newSink);
+            printReport(line,r);
+        }
+        // FMu64 divides once by 10^9 above 32 bits
+        newDivisions += (r.Wh >> 32 != 0) + (r.Whx >> 32 != 0) + (r.VAh >> 32 != 0);
+        if (oldSink.n != newSink.n || memcmp(oldSink.copy,newSink.copy,oldSink.n) != 0) {
+            if (mismatches++ == 0) {
+                fprintf(stderr,"old: %.*snew: %.*s",(int)oldSink.n,oldSink.copy,
+                        (int)newSink.n,newSink.copy);
+            }
+        }
+    }
+
+    divOld = oldOut.divisions;
+    callsOld = oldSink.calls;
+    callsNew = newSink.calls;
+
+    t0 = now();
+    for (uint32_t i = 0; i < lines; i++) {
+        makeReport(&r,i);
+        oldSink.reset();
+        printReport(oldOut,r);
+    }
+    tOld = now() - t0;
+
+    t0 = now();
+    for (uint32_t i = 0; i < lines; i++) {
+        makeReport(&r,i);
+        newSink.reset();
+        Line<128> line(&newSink);
+        printReport(line,r);
+    }
+    tNew = now() - t0;
+
+    printf("%lu report lines of %lu bytes\n",(unsigned long)lines,(unsigned long)newSink.n);
+    printf("old Print           %8.1f ns/line %5.1f divisions %5.1f writes\n",
+            tOld*1e9/lines,divOld/1000.0,callsOld/1000.0);
+    printf("Print into a Line   %8.1f ns/line %5.1f divisions %5.1f writes\n",
+            tNew*1e9/lines,newDivisions/1000.0,callsNew/1000.0);
+    printf("speedup             %8.1fx\n",tOld/tNew);
+    printf("output %s\n",mismatches ? "DIFFERS" : "identical");
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+/** @file meterdecode.cpp
+ *  Decodes the binary meter mode reports (M 0 4) into text.
+ *
+ *  Usage: meterdecode [file]    reads the serial stream from file or stdin.
+ *
+ *  The SD card log METER.LOG (SDLog/sdlog.h) decodes the same way, the
+ *  start of each sector is printed as ts,SECTOR:sector,GEN:generation.
+ *
+ *  Measurements are printed in the order of the text reports,
+ *      ts,seq,CID:id,SWONs,VRMS:v,IRMS:i,PERIOD:p,W:w,StatusCode
+ *  energy totals as
+ *      seq,CID:id,WH:wh,WHX:whx,VAH:vah
+ *  and command results as "action circuit argument [tag]". Subscribed fields
+ *  and delta coded reports (M 0 5) are printed like the text reports, 
+ *  LABEL:value for each field that was sent.
+ *  Text between frames, e.g. from before the mode switch, is skipped and the
+ *  number of chunks that were not valid records is printed on stderr at the end.
+ *
+ *  Build with `make tools`.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "Frame/frame.h"
+#include "Frame/records.h"
+#include "Frame/delta.h"
+
+/** Longest frame that is attempted, anything longer is not one of ours. */
+#define MAXFRAME FRSIZE(FRMAXRECORD)
+
+static unsigned long bad = 0;
+
+/** Labels and RECFIELDS sizes of the fields of a DLreport, see Circuit/circuit.h. */
+static const struct {
+    const char *label;
+    uint8_t size;
+} fieldLayout[DLNFIELDS] = {
+    {"VRMS", 4}, {"IRMS", 4}, {"VPEAK", 4}, {"IPEAK", 4}, {"PERIOD", 2},
+    {"VA", 4}, {"W", 4}, {"VAE", 4}, {"WE", 4}, {"PF", 2},
+    {"WH", 8}, {"WHX", 8}, {"VAH", 8}, {NULL, 2},
+};
+#define CFSW 0x0001
+
+/** Decoders of the delta coded reports by circuitID, and the last RECDELTA counter. */
+static DLdecoder decoders[DLIDMASK+1];
+static int lastDeltaFrame = -1;
+
+/** Prints a report like the text reports. */
+static void printReport(const DLreport *r)
+{
+    printf("%" PRIu32 ",%" PRIu32 ",CID:%d", r->time, r->seq, r->circuitID);
+    if (r->fields & CFSW) {
+        printf(",SWON%d", r->on);
+    }
+    for (int i = 0; i < DLNFIELDS; i++) {
+        if (!(r->fields & DLFIELD(i))) continue;
+        if (fieldLayout[i].label == NULL) {
+            printf(",%" PRIX64, (uint64_t)r->v[i]);
+        } else {
+            printf(",%s:%" PRId64, fieldLayout[i].label, r->v[i]);
+        }
+    }
+    printf("\n");
+}
+
+/** @return false if the fields of the RECFIELDS record do not add up to n bytes. */
+static int printFields(const uint8_t *rec, int16_t n)
+{
+    DLreport r;
+    int16_t size = RECFIELDSMIN;
+
+    r.circuitID = (int8_t)rec[1];
+    r.on = (rec[2] & RECSWON) != 0;
+    r.seq = FRgetU16(&rec[3]);
+    r.time = FRgetU32(&rec[5]);
+    r.fields = FRgetU16(&rec[9]);
+    for (int i = 0; i < DLNFIELDS; i++) {
+        if (r.fields & DLFIELD(i)) size += fieldLayout[i].size;
+    }
+    if (size != n) return 0;
+
+    size = RECFIELDSMIN;
+    for (int i = 0; i < DLNFIELDS; i++) {
+        const uint8_t *p = &rec[size];
+        if (!(r.fields & DLFIELD(i))) continue;
+        size += fieldLayout[i].size;
+        if (fieldLayout[i].size == 2) {
+            r.v[i] = FRgetU16(p);
+        } else if (fieldLayout[i].size == 4) {
+            r.v[i] = (int32_t)FRgetU32(p);
+        } else {
+            r.v[i] = FRgetU64(p);
+        }
+    }
+    if (r.fields & DLFIELD(DLNFIELDS-1)) {
+        if (rec[2] & RECCOMM) r.v[DLNFIELDS-1] |= 0x10000;
+        if (rec[2] & RECTIME) r.v[DLNFIELDS-1] |= 0x20000;
+    }
+    printReport(&r);
+    return 1;
+}
+
+/** 
+ * Prints the reports of a RECDELTA record. After a gap in the frame counter
+ * the reports of each circuit are skipped until its next keyframe.
+ * @return false if the record could not be parsed to its end.
+ * */
+static int printDeltas(const uint8_t *rec, int16_t n)
+{
+    int16_t in = RECDELTAMIN;
+
+    if (lastDeltaFrame >= 0 && rec[1] != (uint8_t)(lastDeltaFrame + 1)) {
+        for (int id = 0; id <= DLIDMASK; id++) {
+            if (decoders[id].state == DLVALID) decoders[id].state = DLSTALE;
+        }
+    }
+    lastDeltaFrame = rec[1];
+    while (in < n) {
+        DLdecoder *d = &decoders[rec[in] & DLIDMASK];
+        DLreport r;
+        int16_t len = DLdecode(d,&rec[in],n - in,&r);
+        if (len < 0) return 0;
+        if (d->state == DLVALID) printReport(&r);
+        in += len;
+    }
+    return 1;
+}
+
+static void printRecord(const uint8_t *rec, int16_t n)
+{
+    if (n == RECMEASSIZE && rec[0] == RECMEAS) {
+        uint32_t status = FRgetU16(&rec[23]);
+        if (rec[2] & RECCOMM) status |= 0x10000;
+        if (rec[2] & RECTIME) status |= 0x20000;
+        printf("%" PRIu32 ",%u,CID:%d,SWON%d,VRMS:%" PRId32 ",IRMS:%" PRId32
+                ",PERIOD:%u,W:%" PRId32 ",%" PRIX32 "\n",
+                FRgetU32(&rec[5]), FRgetU16(&rec[3]), (int8_t)rec[1],
+                (rec[2] & RECSWON) != 0, (int32_t)FRgetU32(&rec[9]),
+                (int32_t)FRgetU32(&rec[13]), FRgetU16(&rec[21]),
+                (int32_t)FRgetU32(&rec[17]), status);
+    } else if (n == RECENERGYSIZE && rec[0] == RECENERGY) {
+        printf("%u,CID:%d,WH:%" PRIu64 ",WHX:%" PRIu64 ",VAH:%" PRIu64 "\n",
+                FRgetU16(&rec[2]), (int8_t)rec[1], FRgetU64(&rec[4]),
+                FRgetU64(&rec[12]), FRgetU64(&rec[20]));
+    } else if (n == RECRESULTSIZE && rec[0] == RECRESULT) {
+        printf("%c %d %" PRId32, rec[1], (int8_t)rec[2], (int32_t)FRgetU32(&rec[3]));
+        if (FRgetU16(&rec[7]) != RECNOTAG) {
+            printf(" %u", FRgetU16(&rec[7]));
+        }
+        printf("\n");
+    } else if (n >= RECFIELDSMIN && rec[0] == RECFIELDS) {
+        if (!printFields(rec,n)) bad++;
+    } else if (n >= RECDELTAMIN && rec[0] == RECDELTA) {
+        if (!printDeltas(rec,n)) bad++;
+    } else if (n == RECSECTORSIZE && rec[0] == RECSECTOR) {
+        printf("%" PRIu32 ",SECTOR:%" PRIu32 ",GEN:%u\n", FRgetU32(&rec[7]),
+                FRgetU32(&rec[3]), FRgetU16(&rec[1]));
+    } else {
+        bad++;
+    }
+}
+
+/**
+ * Decodes what was received between two zeros. When that fails the frame may
+ * be preceded by text, so the decode is retried from each later offset.
+ * */
+static void decodeChunk(const uint8_t *chunk, size_t n)
+{
+    uint8_t rec[MAXFRAME];
+    size_t start = (n > MAXFRAME) ? n - MAXFRAME : 0;
+
+    for (; start < n; start++) {
+        int16_t len = FRdecode(&chunk[start],n - start,rec);
+        if (len >= 0) {
+            printRecord(rec,len);
+            return;
+        }
+    }
+    bad++;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t chunk[4096];
+    size_t n = 0;
+    int c;
+    FILE *in = stdin;
+
+    if (argc > 1 && (in = fopen(argv[1],"rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    while ((c = getc(in)) != EOF) {
+        if (c != 0) {
+            // Only the end of an oversized chunk can be a frame
+            if (n == sizeof(chunk)) {
+                memmove(chunk,&chunk[n - MAXFRAME],MAXFRAME);
+                n = MAXFRAME;
+            }
+            chunk[n++] = c;
+            continue;
+        }
+        if (n > 0) {
+            decodeChunk(chunk,n);
+        }
+        n = 0;
+        fflush(stdout);
+    }
+    if (bad) {
+        fprintf(stderr,"%lu chunks were not valid records\n",bad);
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+/** @file sdbench.cpp
+ *  Counts the SD card transactions per logged record on the host's SD card
+ *  model (core/host/sdcard.c), for records appended to a file with
+ *  fat_write_file and for records appended to the log with SLappend, each
+ *  with several sync policies.
+ *
+ *  Usage: sdbench [records] [image]
+ *
+ *  The image, by default /tmp/sdbench.img, is created anew. A transaction is
+ *  a command or a block sent within a multiple block write. Time is virtual
+ *  and advances RECORDMS between records, so syncing by time counts records
+ *  at the meter's pace.
+ *
+ *  `make tools` builds it twice: sdbench with sd_raw as configured in
+ *  sd_raw_config.h and sdbench_nocache with a single block written through,
+ *  as sd_raw was before its cache.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arduino/wiring.h"
+#include "ReturnCode/returncode.h"
+#include "host/hal.h"
+#include "sd-reader/sd_raw.h"
+#include "sd-reader/partition.h"
+#include "sd-reader/fat.h"
+#include "SDLog/sdlog.h"
+
+/** Framed like a binary report of the default fields. */
+#define RECORD 48
+#define RECORDMS 500
+
+static HOSTsdStats _before;
+
+static void begin()
+{
+    _before = HOSTsdStat;
+}
+
+static void report(const char *what, uint32_t records)
+{
+    uint32_t commands = HOSTsdStat.commands - _before.commands;
+    uint32_t read = HOSTsdStat.blocksRead - _before.blocksRead;
+    uint32_t written = HOSTsdStat.blocksWritten - _before.blocksWritten;
+    uint32_t single = HOSTsdStat.singleWrites - _before.singleWrites;
+    double n = records;
+
+    printf("%-36s %8.3f %8.3f %8.3f %8.3f\n",what,(commands + written - single)/n,
+            commands/n,read/n,written/n);
+}
+
+static void makeRecord(uint8_t *rec, uint32_t i)
+{
+    for (uint8_t j = 0; j < RECORD; j++) {
+        rec[j] = 1 + (uint8_t)(i*7 + j) % 250;
+    }
+}
+
+/** Appends records to a new file, syncing every `every` records and at the end. */
+static void fatAppend(struct fat_fs_struct *fs, const char *name, uint16_t every, uint32_t records)
+{
+    struct fat_dir_entry_struct entry;
+    struct fat_dir_struct *dd;
+    struct fat_file_struct *fd;
+    uint8_t rec[RECORD];
+    char what[40];
+
+    fat_get_dir_entry_of_path(fs,"/",&entry);
+    dd = fat_open_dir(fs,&entry);
+    if (dd == NULL || !fat_create_file(dd,name,&entry)) {
+        fprintf(stderr,"cannot create %s\n",name);
+        exit(1);
+    }
+    fat_close_dir(dd);
+    fd = fat_open_file(fs,&entry);
+
+    begin();
+    for (uint32_t i = 0; i < records; i++) {
+        makeRecord(rec,i);
+        if (fat_write_file(fd,rec,RECORD) != RECORD) {
+            fprintf(stderr,"write failed at record %lu\n",(unsigned long)i);
+            exit(1);
+        }
+        if (every && (i+1) % every == 0) {
+            sd_raw_sync();
+        }
+        HOSTadvance(RECORDMS*1000UL);
+    }
+    sd_raw_sync();
+    if (every) {
+        snprintf(what,sizeof(what),"fat_write_file, sync every %u",every);
+    } else {
+        snprintf(what,sizeof(what),"fat_write_file, sync at the end");
+    }
+    report(what,records);
+    fat_close_file(fd);
+}
+
+/** Appends records to the log with a sync policy, see SLsetSync. */
+static void logAppend(uint16_t syncRecords, uint16_t syncMs, uint32_t records)
+{
+    uint8_t rec[RECORD];
+    char what[40];
+
+    SLsetSync(syncRecords,syncMs);
+    if (SLopen() != SUCCESS) {
+        fprintf(stderr,"cannot open the log\n");
+        exit(1);
+    }
+    begin();
+    for (uint32_t i = 0; i < records; i++) {
+        makeRecord(rec,i);
+        SLappend(rec,RECORD - 4);
+        for (uint8_t j = 0; j < 10; j++) {
+            SLpoll();
+            HOSTadvance(RECORDMS*100UL);
+        }
+    }
+    SLclose();
+    if (syncRecords) {
+        snprintf(what,sizeof(what),"SLappend, sync every %u",syncRecords);
+    } else if (syncMs) {
+        snprintf(what,sizeof(what),"SLappend, sync every %u ms",syncMs);
+    } else {
+        snprintf(what,sizeof(what),"SLappend, sync at the end");
+    }
+    report(what,records);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t records = (argc > 1) ? strtoul(argv[1],NULL,10) : 2000;
+    const char *image = (argc > 2) ? argv[2] : "/tmp/sdbench.img";
+    struct partition_struct *partition;
+    struct fat_fs_struct *fs;
+    offset_t offset;
+    uint32_t length;
+
+    unlink(image);
+    setenv("TELDUINO_CLOCK","virtual",1);
+    setenv("TELDUINO_SD",image,1);
+    HOSTinit();
+
+    printf("sd_raw cache of %u blocks, %s, %lu records of %u bytes\n",SD_RAW_CACHE_BLOCKS,
+            SD_RAW_WRITE_BUFFERING ? "write back" : "write through",(unsigned long)records,RECORD);
+    printf("%-36s %8s %8s %8s %8s\n","per record","transact","commands","read","written");
+
+    if (!sd_raw_init()
+            || (partition = partition_open(sd_raw_read,sd_raw_read_interval,
+                    sd_raw_write,sd_raw_write_interval,0)) == NULL
+            || (fs = fat_open(partition)) == NULL) {
+        fprintf(stderr,"cannot open %s\n",image);
+        return 1;
+    }
+    offset = fat_get_fat_area(fs,&length);
+    sd_raw_pin(offset,length);
+
+    fatAppend(fs,"SYNC1.LOG",1,records);
+    fatAppend(fs,"SYNC16.LOG",16,records);
+    fatAppend(fs,"SYNCEND.LOG",0,records);
+    fat_close(fs);
+    partition_close(partition);
+
+    begin();
+    if (SLopen() != SUCCESS) {
+        fprintf(stderr,"cannot create the log\n");
+        return 1;
+    }
+    SLclose();
+    report("create " SLFILENAME " (per file)",1);
+
+    logAppend(1,0,records);
+    logAppend(16,0,records);
+    logAppend(0,10000,records);
+    logAppend(0,0,records);
+    return 0;
+}